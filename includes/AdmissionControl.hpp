@@ -0,0 +1,87 @@
+#ifndef ADMISSIONCONTROL_HPP
+#define ADMISSIONCONTROL_HPP
+
+#include <string>
+#include <vector>
+
+class Config;
+
+#define ADMISSION_MIN_SLOTS         1024        // initial table size, power of two
+#define ADMISSION_MAX_SLOTS         1048576     // hosts tracked at most: half of it
+#define ADMISSION_ACCEPT_BATCH      64          // connections accepted per poll() turn
+#define ADMISSION_CLONES_DEFAULT    10          // live connections per host
+#define ADMISSION_CONNECTS_DEFAULT  10          // connections per host and period
+#define ADMISSION_PERIOD_DEFAULT    60          // seconds
+#define ADMISSION_EXEMPT_DEFAULT    "127.0.0.0/8"
+
+// Verdicts of AdmissionControl::admit()
+#define ADMISSION_OK                0
+#define ADMISSION_CLONES            1           // too many live connections from the host
+#define ADMISSION_RATE              2           // the host connects too fast
+
+/*
+** Per-host accounting of accepted connections, decided right after
+** accept4() so that a refused connection costs one lookup and a close().
+** Hosts (IPv4, host byte order) live in an open-addressing table with
+** linear probing, hashed with a random seed. Each slot holds the number of
+** live connections and the connect rate as a single time: a token bucket
+** of `connects` per `period` kept as the theoretical arrival time of the
+** next connection (GCRA). A slot whose host has no connection left and
+** whose bucket is full again is dropped when the table is rebuilt.
+*/
+class AdmissionControl
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Slot
+	{
+	    unsigned int    address;    // 0 = empty
+	    unsigned int    live;
+	    long            nextMs;     // the bucket is full again at this time
+	};
+
+	struct Range
+	{
+	    unsigned int    address;
+	    unsigned int    mask;
+	};
+
+	std::vector<Slot>       _slots;     // power of two
+	size_t                  _used;
+	unsigned int            _seed;
+	std::vector<Range>      _exempt;
+
+	long                    _clones;        // 0 = no limit
+	long                    _intervalMs;    // period / connects, 0 = no limit
+	long                    _toleranceMs;   // period - interval: the burst
+	unsigned long           _refused;       // since the last report
+	long                    _reportMs;
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	AdmissionControl(const AdmissionControl& other);
+	AdmissionControl& operator=(const AdmissionControl& other);
+
+	size_t                  slotOf(unsigned int address) const;
+	Slot*                   find(unsigned int address);
+	Slot*                   insert(unsigned int address, long nowMs);
+	void                    rebuild(long nowMs);
+	bool                    isExempt(unsigned int address) const;
+
+public:
+	AdmissionControl();
+	~AdmissionControl();
+
+	void                    configure(const Config& config);
+	int                     admit(unsigned int address, long nowMs);
+	void                    track(unsigned int address);
+	void                    release(unsigned int address);
+	bool                    takeReport(long nowMs, unsigned long& refused);
+
+	static bool             parseNetwork(const std::string& text, unsigned int& address, unsigned int& mask);
+};
+
+#endif
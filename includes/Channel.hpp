@@ -3,8 +3,34 @@
 
 #include <string>
 #include <set>
+#include <vector>
+#include "ChannelHistory.hpp"
+#include "MaskList.hpp"
+
+// Per-membership flag bits
+#define MEMBER_FLAG_OP      0x01    // channel operator (@)
+#define MEMBER_FLAG_VOICE   0x02    // voiced (+)
+
+// What a channel does when its +f message budget runs out
+#define FLOOD_ACTION_DROP       'd'     // drop the extra messages
+#define FLOOD_ACTION_MODERATE   'm'     // set +m
+#define FLOOD_ACTION_JOINS      'j'     // also refuse joins for one interval
 
 class Client;
+class ChannelRegistry;
+class Serializer;
+struct ChannelSnapshot;
+
+// One entry of the flat member array: the client, its flag bits and the
+// cached result of the ban check (see Channel::isBanned).
+struct Membership
+{
+    Client*         client;
+    unsigned char   flags;
+    bool            banned;
+    unsigned long   banCheckVersion;    // state version of the check, 0 = never
+};
+
 class Channel
 {
 private:
@@ -13,6 +39,7 @@ private:
 	/* ================================================================== */
 	// Identification
 	std::string         _name;
+	time_t              _creationTime;
 	
 	// Topic
 	std::string         _topic;
@@ -24,20 +51,65 @@ private:
 	bool                _topicRestricted;
 	std::string         _key;
 	size_t              _userLimit;
+	bool                _moderated;
+
+	// Flood protection (+f): token bucket of _floodMessages tokens,
+	// refilled over _floodSeconds (0 = disabled)
+	size_t              _floodMessages;
+	size_t              _floodSeconds;
+	char                _floodAction;
+	double              _floodTokens;
+	long                _floodRefillMs;     // time of the last refill
+	long                _joinLockUntilMs;
 	
-	// Member and operator lists
-	std::set<Client*>   _members;
-	std::set<Client*>   _operators;
+	// Members stored contiguously, with an open-addressing back-index
+	// (client -> position in _members) for O(1) lookup and removal.
+	// Operators are kept at the front: _members[0, _operatorCount).
+	std::vector<Membership> _members;
+	std::vector<int>        _memberIndex;
+	size_t                  _operatorCount;
+	size_t                  _localMemberCount;  // members with a socket here
+
+	// Auditorium (+u): above this member count, membership changes of
+	// non-operators are only shown to operators (0 = disabled)
+	size_t                  _auditoriumThreshold;
 	
 	// Invitations
 	std::set<std::string> _invitedUsers;
 
+	// nick!user@host (lowercased) of operators saved before a restart,
+	// given operator status back when they join (see StateStore)
+	std::set<std::string> _restoredOperators;
+
+	// Recent messages for CHATHISTORY
+	ChannelHistory      _history;
+
+	// Ban (+b), ban exception (+e) and invite exception (+I) masks
+	MaskList            _bans;
+	MaskList            _banExceptions;
+	MaskList            _inviteExceptions;
+	unsigned long       _maskVersion;       // state version of the last list change
+
+	// State version (see Snapshot.hpp) and the last snapshot taken
+	unsigned long           _version;
+	const ChannelSnapshot*  _snapshot;
+
+	// Registry whose secondary indexes follow the member count, creation and topic time
+	ChannelRegistry*        _registry;
+	bool                    _changeQueued;  // in the registry's list of changed channels
+
 	/* ================================================================== */
 	/*                CONSTRUCTORS FORBIDDEN                             */
 	/* ================================================================== */
 	Channel();
 	Channel(const Channel& other);
 	Channel& operator=(const Channel& other);
+
+	int                         findMemberSlot(Client* client) const;
+	void                        insertMemberSlot(Client* client, int position);
+	void                        eraseMemberSlot(size_t slot);
+	void                        growMemberIndex();
+	void                        swapMembers(size_t a, size_t b);
     
 public:
     Channel(const std::string& name);
@@ -51,8 +123,11 @@ public:
     bool                        isMember(Client* client) const;
     bool                        hasMember(const std::string& nickname) const;
     Client*                     getMemberByNickname(const std::string& nickname) const;
-    const std::set<Client*>&    getMembers() const;
+    const std::vector<Membership>& getMembers() const;
+    unsigned char               getMemberFlags(Client* client) const;
+    void                        setMemberFlag(Client* client, unsigned char flag, bool enabled);
     size_t                      getMemberCount() const;
+    size_t                      getLocalMemberCount() const;
     bool                        isEmpty() const;
 
     /* ========================================================================== */
@@ -62,6 +137,9 @@ public:
     void                        removeOperator(Client* client);
     bool                        isOperator(Client* client) const;
     bool                        isOperator(const std::string& nickname) const;
+    bool                        isVoiced(Client* client) const;
+    size_t                      getOperatorCount() const;
+    size_t                      getMemberPosition(Client* client) const;
 
     /* ========================================================================== */
     /*                    MODE MANAGEMENT                                       */
@@ -79,13 +157,28 @@ public:
     size_t                      getUserLimit() const;
     bool                        hasUserLimit() const;
     bool                        isFull() const;
+    void                        setAuditoriumThreshold(size_t threshold);
+    size_t                      getAuditoriumThreshold() const;
+    bool                        isAuditorium() const;
+    void                        setModerated(bool enabled);
+    bool                        isModerated() const;
+    bool                        setFloodLimit(const std::string& spec);
+    void                        clearFloodLimit();
+    bool                        hasFloodLimit() const;
+    std::string                 getFloodLimit() const;
+    char                        getFloodAction() const;
+    size_t                      getFloodSeconds() const;
+    bool                        consumeMessageToken(long nowMs);
+    void                        lockJoins(long untilMs);
+    bool                        areJoinsLocked(long nowMs) const;
     std::string                 getModeString() const;
     std::string                 getModeStringWithParams() const;
 
     /* ========================================================================== */
     /*                    TOPIC MANAGEMENT                                        */
     /* ========================================================================== */
-    void                        setTopic(const std::string& topic, const std::string& setterNick);
+    void                        setTopic(const std::string& topic, const std::string& setterNick,
+                                         time_t setAt = 0);
     const std::string&          getTopic() const;
     const std::string&          getTopicSetter() const;
     time_t                      getTopicTime() const;
@@ -97,11 +190,43 @@ public:
     void                        removeInvite(const std::string& nickname);
     bool                        isInvited(const std::string& nickname) const;
 
+    /* ========================================================================== */
+    /*                    BAN / EXCEPTION LISTS                                 */
+    /* ========================================================================== */
+    MaskList*                   getMaskList(char mode);
+    bool                        addMask(char mode, const std::string& mask, const std::string& setter);
+    bool                        removeMask(char mode, const std::string& mask);
+    bool                        isBanned(Client* client);
+    bool                        isInviteExempt(Client* client) const;
+
     /* ========================================================================== */
     /*                         GETTERS                                         */
     /* ========================================================================== */
     const std::string&          getName() const;
+    time_t                      getCreationTime() const;
+    void                        setCreationTime(time_t ts);
     std::string                 getNamesList() const;
+    std::string                 getMemberName(size_t position) const;
+    ChannelHistory&             getHistory();
+
+    /* ========================================================================== */
+    /*                         SNAPSHOT                                        */
+    /* ========================================================================== */
+    void                        touch();
+    unsigned long               getVersion() const;
+    void                        setChangeQueued(bool queued);
+    bool                        isChangeQueued() const;
+    const ChannelSnapshot*      snapshot();
+
+    /* ========================================================================== */
+    /*                         SAVED STATE                                     */
+    /* ========================================================================== */
+    void                        save(Serializer& out) const;
+    void                        load(Serializer& in);
+    void                        addRestoredOperator(const std::string& prefix);
+    std::vector<std::string>    getOperatorMasks() const;
+
+    void                        setRegistry(ChannelRegistry* registry);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#ifndef CHANNELHISTORY_HPP
+#define CHANNELHISTORY_HPP
+
+#include <string>
+#include <vector>
+
+/*
+** Bounded ring of the recent messages of a channel.
+** Lines are copied into a fixed byte arena (allocated on first use) and
+** indexed by a ring of fixed-size records, so appending is O(1) and the
+** memory of a channel never exceeds its byte and line limits. Message ids
+** and timestamps only grow, which makes BEFORE/AFTER lookups a binary search.
+*/
+class ChannelHistory
+{
+public:
+	struct Entry
+	{
+	    unsigned long   msgid;
+	    long            timeMs;
+	    std::string     line;
+	};
+
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Record
+	{
+	    unsigned long   msgid;
+	    long            timeMs;
+	    size_t          offset;     // position of the line in _arena
+	    size_t          length;
+	};
+
+	size_t              _maxLines;
+	size_t              _maxBytes;
+
+	std::vector<char>   _arena;
+	size_t              _writePos;
+
+	std::vector<Record> _records;   // ring of _maxLines records
+	size_t              _first;     // oldest record
+	size_t              _count;
+
+	static size_t       _totalBytes;    // memory used by every history
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	ChannelHistory();
+	ChannelHistory(const ChannelHistory& other);
+	ChannelHistory& operator=(const ChannelHistory& other);
+
+	const Record&               at(size_t i) const;
+	void                        dropOldest();
+	Entry                       toEntry(const Record& record) const;
+	size_t                      lowerBound(unsigned long msgid, long timeMs, bool byTime) const;
+
+public:
+	ChannelHistory(size_t maxLines, size_t maxBytes);
+	~ChannelHistory();
+
+	/* ================================================================== */
+	/*                    APPEND / QUERIES                                */
+	/* ================================================================== */
+	void                        append(const std::string& line, unsigned long msgid, long timeMs);
+	std::vector<Entry>          latest(size_t limit) const;
+	std::vector<Entry>          before(unsigned long msgid, long timeMs, bool byTime, size_t limit) const;
+	std::vector<Entry>          after(unsigned long msgid, long timeMs, bool byTime, size_t limit) const;
+
+	/* ================================================================== */
+	/*                         GETTERS                                    */
+	/* ================================================================== */
+	size_t                      size() const;
+	size_t                      memoryUsage() const;
+	static size_t               totalMemoryUsage();
+};
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef CHANNELLOG_HPP
+#define CHANNELLOG_HPP
+
+#include <string>
+#include <pthread.h>
+
+// Logged channel events
+#define LOG_EVENT_PRIVMSG   1
+#define LOG_EVENT_NOTICE    2
+#define LOG_EVENT_TOPIC     3
+#define LOG_EVENT_KICK      4
+#define LOG_EVENT_MODE      5
+
+// Behaviour when the ring is full (the writer is behind, e.g. slow disk)
+#define LOG_POLICY_DROP     0   // drop the record immediately
+#define LOG_POLICY_BLOCK    1   // wait up to log.block_timeout_ms, then drop
+
+#define LOG_RING_SIZE       4096    // records in flight (power of two)
+#define LOG_RECORD_DATA     1024    // channel + nick + text bytes per record
+
+#define LOG_SEGMENT_MAGIC   "FTIRCLOG"
+#define LOG_SEGMENT_VERSION 1
+
+/*
+** On-disk format. A segment starts with a LogSegmentHeader and is followed
+** by records, each a LogRecordHeader then channel, nick and text bytes,
+** padded to 8 bytes. Everything is fixed-size and aligned, so a segment
+** can be memory-mapped and walked using `length` (see SearchIndex).
+*/
+struct LogSegmentHeader
+{
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    reserved;
+};
+
+struct LogRecordHeader
+{
+    unsigned int    length;     // total size of the record, padding included
+    unsigned int    checksum;   // FNV-1a of the payload bytes
+    long            timeMs;
+    unsigned long   seq;
+    unsigned char   type;       // LOG_EVENT_*
+    unsigned char   reserved;
+    unsigned short  channelLength;
+    unsigned short  nickLength;
+    unsigned short  textLength;
+};
+
+class Config;
+
+/*
+** Asynchronous append-only log of channel events.
+** The event loop pushes records into a single-producer/single-consumer
+** lock-free ring (a memcpy, no allocation, no syscall). A writer thread
+** drains it in batches into segment files and calls fdatasync() once per
+** batch (group commit), rolling to a new segment past log.segment_size.
+*/
+class ChannelLog
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Slot
+	{
+	    long            timeMs;
+	    unsigned long   seq;
+	    unsigned char   type;
+	    unsigned short  channelLength;
+	    unsigned short  nickLength;
+	    unsigned short  textLength;
+	    char            data[LOG_RECORD_DATA];
+	};
+
+	// Ring (producer: event loop, consumer: writer thread)
+	Slot*               _ring;
+	size_t              _head;          // next slot to write, owned by the producer
+	size_t              _tail;          // next slot to read, owned by the consumer
+	unsigned long       _seq;
+	unsigned long       _dropped;       // bumped by both threads, atomically
+
+	// Configuration
+	std::string         _directory;
+	int                 _policy;
+	long                _blockTimeoutMs;
+	long                _commitIntervalMs;
+	size_t              _segmentSize;
+
+	// Writer thread
+	pthread_t           _thread;
+	pthread_mutex_t     _mutex;
+	pthread_cond_t      _wakeup;
+	bool                _running;
+	bool                _stopping;
+
+	// Current segment (writer thread only)
+	int                 _segmentFd;
+	unsigned long       _segmentNumber;
+	size_t              _segmentBytes;
+	bool                _segmentFailed; // the last open failed, already reported
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	ChannelLog();
+	ChannelLog(const ChannelLog& other);
+	ChannelLog& operator=(const ChannelLog& other);
+
+	static void*                writerMain(void* arg);
+	void                        writerLoop();
+	size_t                      drain(std::string& batch);
+	bool                        openSegment();
+	void                        wakeWriter();
+
+public:
+	ChannelLog(const Config& config);
+	~ChannelLog();
+
+	bool                        start();
+	void                        stop();
+	void                        append(int type, const std::string& channel,
+	                                   const std::string& nick, const std::string& text);
+
+	/* ================================================================== */
+	/*                         GETTERS                                    */
+	/* ================================================================== */
+	const std::string&          getDirectory() const;
+	unsigned long               getDroppedCount() const;
+	unsigned long               getCurrentSegment() const;
+
+	static std::string          segmentPath(const std::string& directory, unsigned long number);
+	static unsigned int         checksum(const char* data, size_t length);
+};
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef CHANNELREGISTRY_HPP
+#define CHANNELREGISTRY_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <ctime>
+
+class Channel;
+
+// Range conditions of an ELIST query, bounds included.
+struct ChannelFilter
+{
+	size_t      minUsers;
+	size_t      maxUsers;
+	time_t      createdFrom;
+	time_t      createdTo;
+	time_t      topicFrom;      // channels without a topic never match a topic range
+	time_t      topicTo;
+	bool        bySize;
+	bool        byCreation;
+	bool        byTopic;
+
+	ChannelFilter();
+	bool        matches(const Channel* channel) const;
+};
+
+/*
+** Open-addressing hash table of channels keyed by their casefolded name.
+** Lookups hash the name in place (no lowered copy), channels are heap
+** allocated so pointers stay valid across rehash, and entries are kept in a
+** dense insertion-ordered array so LIST/NAMES iterate in a stable order.
+**
+** Ordered secondary indexes on member count, creation time and topic time
+** are kept up to date by the channels themselves (see Channel::setRegistry),
+** so an ELIST query only walks the channels inside its ranges.
+*/
+class ChannelRegistry
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Entry
+	{
+	    Channel*        channel;    // NULL once removed (compacted later)
+	    unsigned int    hash;
+	};
+
+	struct Slot
+	{
+	    unsigned int    hash;
+	    int             index;      // index in _entries, -1 when empty
+	};
+
+	typedef std::set<std::pair<size_t, Channel*> >  SizeIndex;
+	typedef std::set<std::pair<time_t, Channel*> >  TimeIndex;
+
+	std::vector<Entry>  _entries;   // insertion order
+	std::vector<Slot>   _slots;     // power of two, linear probing
+	size_t              _count;
+	size_t              _maxChannels;
+
+	SizeIndex           _bySize;
+	TimeIndex           _byCreation;
+	TimeIndex           _byTopic;
+
+	std::vector<Channel*> _changed; // touched since the last takeChanged()
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	ChannelRegistry(const ChannelRegistry& other);
+	ChannelRegistry& operator=(const ChannelRegistry& other);
+
+	int                         findSlot(const std::string& name, unsigned int hash) const;
+	void                        eraseSlot(size_t slot);
+	void                        rebuild(size_t slotCount);
+
+public:
+	/* ================================================================== */
+	/*                    ITERATION (insertion order)                     */
+	/* ================================================================== */
+	class iterator
+	{
+	private:
+	    const std::vector<Entry>*   _entries;
+	    size_t                      _pos;
+	    void                        skipRemoved();
+	public:
+	    iterator(const std::vector<Entry>* entries, size_t pos);
+	    Channel*                    operator*() const;
+	    iterator&                   operator++();
+	    bool                        operator==(const iterator& other) const;
+	    bool                        operator!=(const iterator& other) const;
+	};
+
+	ChannelRegistry(size_t maxChannels);
+	~ChannelRegistry();
+
+	/* ================================================================== */
+	/*                    LOOKUP / INSERTION                              */
+	/* ================================================================== */
+	Channel*                    find(const std::string& name) const;
+	bool                        insert(Channel* channel);
+	Channel*                    remove(const std::string& name);
+	void                        deleteAll();
+
+	/* ================================================================== */
+	/*                    SECONDARY INDEXES                               */
+	/* ================================================================== */
+	void                        memberCountChanged(Channel* channel, size_t oldCount);
+	void                        topicTimeChanged(Channel* channel, time_t oldTime);
+	void                        creationTimeChanged(Channel* channel, time_t oldTime);
+	void                        select(const ChannelFilter& filter, std::vector<Channel*>& out) const;
+
+	/* ================================================================== */
+	/*                    CHANGED CHANNELS                                */
+	/* ================================================================== */
+	void                        channelChanged(Channel* channel);
+	void                        takeChanged(std::vector<Channel*>& out);
+
+	/* ================================================================== */
+	/*                         GETTERS                                    */
+	/* ================================================================== */
+	size_t                      size() const;
+	bool                        isFull() const;
+	iterator                    begin() const;
+	iterator                    end() const;
+};
+
+#endif
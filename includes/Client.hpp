@@ -4,6 +4,17 @@
 # include <string>
 # include <vector>
 # include <set>
+# include <deque>
+
+struct ClientSnapshot;
+class ReplyCursor;
+class SpillFile;
+
+// Output classes, sent in this order (see Client::nextOutput)
+# define OUTPUT_CONTROL      0       // PONG, ERROR, KILL
+# define OUTPUT_INTERACTIVE  1       // messages and command replies
+# define OUTPUT_BULK         2       // listings and history replays
+# define OUTPUT_CLASSES      3
 
 class Client
 {
@@ -14,24 +25,73 @@ private:
 	
 	// Socket file descriptor
 	int         _fd;
+	unsigned long _id;              // never reused, unlike fds (async replies)
 	
 	// Identification information
 	std::string _nickname;
 	std::string _username;
 	std::string _realname;
 	std::string _hostname;
+	unsigned int _address;          // IPv4 counted by AdmissionControl, 0 if none
 	
 	// Status
 	bool        _passwordProvided;
 	bool        _registered;
 	bool        _shouldDisconnect;
     bool        _markedForDisconnection;
+	bool        _serverOperator;     // granted by OPER
+	time_t      _nickTs;             // when the nickname was taken, settles collisions
+	std::string _quitReason;
+
+	// Detachable session (see Server::detachSession)
+	std::string _sessionToken;       // RESUME token, empty unless the client can resume
+	time_t      _detachedAt;         // 0 while a socket is attached
+	bool        _connectionLost;     // the socket died, as opposed to QUIT or KILL
+
+	// Server-to-server (see Network.hpp). A link is the connection to a
+	// peer server; a remote user has no socket and is reached via its uplink.
+	int         _linkState;          // LINK_* (LINK_NONE for users)
+	std::string _serverName;         // links: the peer; remote users: their server
+	Client*     _uplink;             // remote users: the link towards them
+	bool        _introduced;         // the other servers know this user
+
+	// IRCv3 capabilities (CAP_* bits) and negotiation state
+	unsigned int _capabilities;
+	bool        _capNegotiating;
+	std::string _activeBatch;       // reference of the open BATCH, tags outgoing replies
+	unsigned int _batchCounter;
 	
 	// Channels
 	std::set<std::string> _channels;
+
+	// Last fan-out pass that reached this client (see Server::broadcastToNeighbours)
+	unsigned long _fanoutEpoch;
 	
 	std::string _inputBuffer;
-	std::string _outputBuffer;
+	bool        _commandQueued;     // waiting in Server::_runQueue
+	std::string _outputBuffer;      // OUTPUT_INTERACTIVE, the one that spills
+	std::string _controlBuffer;
+	std::string _bulkBuffer;
+	int         _outputClass;       // where queued lines go now
+	int         _sendingClass;      // the class nextOutput() handed out
+	int         _partialClass;      // class whose front line was cut by send(), -1 if none
+
+	// Send queue limits (see Server::applySendq). Spilling clients keep
+	// _spillMemory bytes in RAM and the rest in a file; others are
+	// dropped past _sendqMax (0: no limit).
+	size_t      _sendqMax;
+	std::string _spillDir;          // empty unless the client spills
+	size_t      _spillMemory;
+	size_t      _spillMax;
+	SpillFile*  _spill;             // created by the first overflow
+
+	// Long replies produced lazily, front one first (see ReplyCursor.hpp)
+	std::deque<ReplyCursor*> _replyCursors;
+	bool        _cursorInFlight;     // the front cursor is on the worker pool
+
+	// State version (see Snapshot.hpp) and the last snapshot taken
+	unsigned long           _version;
+	const ClientSnapshot*   _snapshot;
 
 	/* ================================================================== */
 	/*                CONSTRUCTORS FORBIDDEN                           */
@@ -58,6 +118,8 @@ public:
     void                            setRealname(const std::string& realname);
     const std::string&              getRealname() const;
     const std::string&              getHostname() const;
+    void                            setAddress(unsigned int address);
+    unsigned int                    getAddress() const;
     std::string                     getPrefix() const;
 
     /* ========================================================================== */
@@ -67,6 +129,50 @@ public:
     bool                            hasPasswordProvided() const;
     void                            setRegistered(bool registered);
     bool                            isRegistered() const;
+    void                            setServerOperator(bool oper);
+    bool                            isServerOperator() const;
+    void                            setNickTs(time_t ts);
+    time_t                          getNickTs() const;
+    void                            setQuitReason(const std::string& reason);
+    const std::string&              getQuitReason() const;
+
+    /* ========================================================================== */
+    /*                   DETACHABLE SESSION                                     */
+    /* ========================================================================== */
+    void                            setSessionToken(const std::string& token);
+    const std::string&              getSessionToken() const;
+    void                            markConnectionLost();
+    bool                            isConnectionLost() const;
+    void                            detach(int key, time_t now, bool keepOutput);
+    void                            attach(int fd);
+    bool                            isDetached() const;
+    time_t                          getDetachedAt() const;
+
+    /* ========================================================================== */
+    /*                   SERVER LINKS                                           */
+    /* ========================================================================== */
+    void                            setLinkState(int state);
+    int                             getLinkState() const;
+    bool                            isServerLink() const;
+    void                            setServerName(const std::string& name);
+    const std::string&              getServerName() const;
+    void                            setUplink(Client* link);
+    Client*                         getUplink() const;
+    bool                            isRemote() const;
+    void                            setIntroduced(bool introduced);
+    bool                            isIntroduced() const;
+
+    /* ========================================================================== */
+    /*                   CAPABILITIES                                           */
+    /* ========================================================================== */
+    void                            setCapability(unsigned int cap, bool enabled);
+    bool                            hasCapability(unsigned int cap) const;
+    unsigned int                    getCapabilities() const;
+    void                            setCapNegotiating(bool negotiating);
+    bool                            isCapNegotiating() const;
+    std::string                     nextBatchRef();
+    void                            setActiveBatch(const std::string& ref);
+    const std::string&              getActiveBatch() const;
 
     /* ========================================================================== */
     /*                    CHANNEL MANAGEMENT                                    */
@@ -75,6 +181,8 @@ public:
     void                            leaveChannel(const std::string& channelName);
     bool                            isInChannel(const std::string& channelName) const;
     const std::set<std::string>&    getChannels() const;
+    void                            setFanoutEpoch(unsigned long epoch) { _fanoutEpoch = epoch; }
+    unsigned long                   getFanoutEpoch() const { return _fanoutEpoch; }
 
     /* ========================================================================== */
     /*                    BUFFER MANAGEMENT                                     */
@@ -84,16 +192,41 @@ public:
     void                            appendToOutputBuffer(const std::string& data);
     std::string&                    getOutputBuffer();
     void                            clearInputBuffer();
+    void                            setCommandQueued(bool queued);
+    bool                            isCommandQueued() const;
+    void                            appendToOutput(int outputClass, const std::string& data);
+    void                            setOutputClass(int outputClass);
+    int                             getOutputClass() const;
+    bool                            nextOutput(const char*& data, size_t& size);
     void                            trimOutputBuffer(size_t bytes);
     bool                            hasDataToSend() const;
+    size_t                          getOutputSize(int outputClass) const;
+    std::string                     getPendingOutput() const;
+    size_t                          getSendqSize() const;
+    void                            setSendqMax(size_t max);
+    void                            setSpill(const std::string& dir, size_t memory, size_t max);
+    bool                            isSpilling() const;
+    void                            addReplyCursor(ReplyCursor* cursor);
+    ReplyCursor*                    getReplyCursor() const;
+    void                            popReplyCursor();
+    void                            setCursorInFlight(bool inFlight);
+    bool                            isCursorInFlight() const;
 
     /* ========================================================================== */
     /*                         GETTERS                                         */
     /* ========================================================================== */
     int                             getFd() const;
+    unsigned long                   getId() const;
     void                            markForDisconnection();
     bool                            isMarkedForDisconnection() const { return _markedForDisconnection; }
     bool                            shouldDisconnect() const;
+
+    /* ========================================================================== */
+    /*                         SNAPSHOT                                        */
+    /* ========================================================================== */
+    void                            touch();
+    unsigned long                   getVersion() const;
+    const ClientSnapshot*           snapshot();
 };
 
 #endif
\ No newline at end of file
@@ -8,9 +8,12 @@
 class Client;
 class Server;
 class Channel;
+struct SearchResult;
+struct AsyncReply;
 
 struct ParsedCommand
 {
+    std::string tags;       // raw IRCv3 tags, without the leading '@'
     std::string prefix;
     std::string command;
     std::vector<std::string> params;
@@ -22,6 +25,7 @@ class CommandHandler
         Server& _server;
         void handlePass(Client* client, const ParsedCommand& cmd);
         void sendWhoReply(Client* client, Channel* channel, Client* targetClient);
+        void sendWhoList(Client* client, const std::string& target, bool isChannel);
     
 
     public:
@@ -36,18 +40,28 @@ class CommandHandler
         void handleNick(Client* client, const ParsedCommand& cmd);
         void checkRegistration(Client* client);
         void handleUser(Client* client, const ParsedCommand& cmd);
+        void handleCap(Client* client, const ParsedCommand& cmd);
 
 /* ========================================================================== */
 /*                         BASICS COMMANDS                                   */
 /* ========================================================================== */
         void handlePing(Client* client, const ParsedCommand& cmd);
         void handleQuit(Client* client, const ParsedCommand& cmd);
+        void handleResume(Client* client, const ParsedCommand& cmd);
         void handleJoin(Client* client, const ParsedCommand& cmd);
         void joinSingleChannel(Client* client, const std::string& channelName,
                              const std::string& key);
         void handlePart(Client* client, const ParsedCommand& cmd);
         void handlePrivmsg(Client* client, const ParsedCommand& cmd);
         void handleNotice(Client* client, const ParsedCommand& cmd);
+        std::string recordChannelMessage(Channel* channel, const std::string& line,
+                                         const std::string& clientTags);
+        bool filterMessage(Client* client, const std::string& command, const std::string& target,
+                           const std::string& text, std::string& tags);
+        bool checkChannelFlood(Client* client, Channel* channel, const std::string& command);
+        void handleChathistory(Client* client, const ParsedCommand& cmd);
+        void sendFail(Client* client, const std::string& command, const std::string& code,
+                      const std::string& context, const std::string& message);
 
 /* ========================================================================== */
 /*                         OPERATOR COMMANDS                                  */
@@ -60,11 +74,54 @@ class CommandHandler
         void applyModeChanges(Client* client, Channel* channel,
                               const std::string& modeString,
                               const std::vector<std::string>& modeParams);
+        void sendMaskList(Client* client, Channel* channel, char mode);
         void handleWho(Client* client, const ParsedCommand& cmd);
         void handleNames(Client* client, const ParsedCommand& cmd);
+        void sendNamesReply(Client* client, Channel* channel, size_t offset, size_t count);
         void handleList(Client* client, const ParsedCommand& cmd);
         void handleBot(Client* client, const ParsedCommand& cmd);
 
+/* ========================================================================== */
+/*                         SERVER OPERATOR COMMANDS                           */
+/* ========================================================================== */
+
+        void handleOper(Client* client, const ParsedCommand& cmd);
+        void handleSearch(Client* client, const ParsedCommand& cmd);
+        void handleRehash(Client* client, const ParsedCommand& cmd);
+        void handleUpgrade(Client* client, const ParsedCommand& cmd);
+        void sendSearchResult(Client* client, const SearchResult& result);
+        void handleConnect(Client* client, const ParsedCommand& cmd);
+        void handleSquit(Client* client, const ParsedCommand& cmd);
+        void handleLinks(Client* client, const ParsedCommand& cmd);
+
+/* ========================================================================== */
+/*                         SERVER LINKS                                       */
+/* ========================================================================== */
+
+        void handleServer(Client* client, const ParsedCommand& cmd);
+        void handleCapab(Client* client, const ParsedCommand& cmd);
+        void handleLinkMessage(Client* link, const ParsedCommand& cmd);
+        void linkServer(Client* link, const ParsedCommand& cmd);
+        void linkNick(Client* link, const ParsedCommand& cmd);
+        void linkQuit(Client* link, const ParsedCommand& cmd);
+        void linkKill(Client* link, const ParsedCommand& cmd);
+        void linkSquit(Client* link, const ParsedCommand& cmd);
+        void linkSjoin(Client* link, const ParsedCommand& cmd);
+        void linkBmask(Client* link, const ParsedCommand& cmd);
+        void linkPart(Client* link, const ParsedCommand& cmd);
+        void linkKick(Client* link, const ParsedCommand& cmd);
+        void linkTmode(Client* link, const ParsedCommand& cmd);
+        void linkTopic(Client* link, const ParsedCommand& cmd);
+        void linkMessage(Client* link, const ParsedCommand& cmd);
+        void linkInvite(Client* link, const ParsedCommand& cmd);
+        void linkRsub(Client* link, const ParsedCommand& cmd);
+        void linkRunsub(Client* link, const ParsedCommand& cmd);
+        void killUser(Client* victim, const std::string& source, const std::string& reason,
+                      Client* fromLink);
+        std::string applyLinkModes(Channel* channel, const std::vector<std::string>& args,
+                                   size_t first, size_t end, const std::string& setter);
+        std::string resetChannelModes(Channel* channel);
+
 /* ========================================================================== */
 /*                         UTILS                                              */
 /* ========================================================================== */
@@ -75,6 +132,9 @@ class CommandHandler
         void sendReply(Client* client, const std::string& replyCode,
                      const std::string& params, const std::string& message);
         void sendWelcome(Client* client);
+        bool startBatch(Client* client, const std::string& type, const std::string& params);
+        void endBatch(Client* client);
+        void sendCursorWindow(Client* client, const AsyncReply& reply);
 
 };
 
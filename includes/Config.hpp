@@ -0,0 +1,38 @@
+#ifndef CONFIG_HPP
+#define CONFIG_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+
+/*
+** Optional server configuration: "key = value" lines, '#' starts a comment.
+** Loaded from the third command line argument; every key has a default so
+** the server runs the same without a file.
+*/
+class Config
+{
+private:
+	std::map<std::string, std::string>  _values;
+	std::string                         _path;
+
+public:
+	Config();
+	~Config();
+
+	bool                        load(const std::string& path);
+	bool                        reload();
+
+	/* ================================================================== */
+	/*                         GETTERS                                    */
+	/* ================================================================== */
+	bool                        has(const std::string& key) const;
+	std::string                 getString(const std::string& key, const std::string& defaultValue) const;
+	long                        getLong(const std::string& key, long defaultValue) const;
+	bool                        getBool(const std::string& key, bool defaultValue) const;
+	std::vector<std::string>    getList(const std::string& key) const;
+	std::vector<std::string>    getKeysWithPrefix(const std::string& prefix) const;
+	const std::string&          getPath() const;
+};
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef FANOUTPOOL_HPP
+#define FANOUTPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#define FANOUT_THREADS_DEFAULT      3       // sender threads besides the event loop
+#define FANOUT_THREADS_MAX          31
+#define FANOUT_MIN_MEMBERS_DEFAULT  1000    // smaller channels are written by the loop alone
+
+class Client;
+struct Membership;
+
+// What the threads are doing
+#define FANOUT_TASK_QUEUE           0       // append a line to the members' buffers
+#define FANOUT_TASK_FLUSH           1       // write the buffers to the sockets
+
+/*
+** Sender threads for the broadcasts of very large channels. Work is cut
+** into as many contiguous slices as there are threads, plus one for the
+** event loop, and each thread only touches the clients of its slice.
+** broadcast() appends the shared line to every member's output buffer;
+** once per loop turn flush() writes the buffers that broadcasts filled,
+** one send() per client however many lines it got. Both return when every
+** slice is done: the threads only touch clients while the event loop
+** waits for them, and each client's lines stay in the order they were
+** queued, whoever queued them.
+*/
+class FanoutPool
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Sender
+	{
+	    FanoutPool*             pool;
+	    size_t                  index;          // slice index, 0 is the event loop's
+	    pthread_t               thread;
+	    std::vector<int>        dirty;          // fds whose buffer it filled from empty
+	    std::vector<Client*>    blocked;        // clients left with output after a flush
+	};
+
+	std::vector<Sender*>        _senders;       // _senders[0] is the event loop
+	size_t                      _minMembers;
+
+	pthread_mutex_t             _mutex;
+	pthread_cond_t              _startCond;
+	pthread_cond_t              _doneCond;
+	unsigned long               _generation;    // bumped for each task
+	size_t                      _busy;          // threads still running the task
+	bool                        _stopping;
+
+	// The task being run, read-only while _busy > 0
+	int                         _task;
+	const std::vector<Membership>* _members;
+	const std::string*          _line;
+	const std::string*          _taggedLine;
+	int                         _excludeFd;
+	const std::vector<Client*>* _clients;
+	bool                        _hasDirty;
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	FanoutPool();
+	FanoutPool(const FanoutPool& other);
+	FanoutPool& operator=(const FanoutPool& other);
+
+	static void*                senderMain(void* arg);
+	void                        senderLoop(Sender& sender);
+	void                        runTask(int task);
+	void                        queueSlice(Sender& sender);
+	void                        flushSlice(Sender& sender);
+
+public:
+	FanoutPool(size_t threads, size_t minMembers);
+	~FanoutPool();
+
+	bool                        start();
+	void                        stop();
+
+	bool                        accepts(size_t memberCount) const;
+	void                        broadcast(const std::vector<Membership>& members, const std::string& line,
+	                                      const std::string& taggedLine, int excludeFd);
+	bool                        hasDirty() const;
+	void                        takeDirty(std::vector<int>& fds);
+	void                        flush(const std::vector<Client*>& clients, std::vector<Client*>& blocked);
+	size_t                      size() const;
+};
+
+#endif
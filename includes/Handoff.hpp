@@ -0,0 +1,61 @@
+#ifndef HANDOFF_HPP
+#define HANDOFF_HPP
+
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+#define HANDOFF_ENV             "IRCSERV_HANDOFF_FD"    // set for the new binary: its end of the socket
+#define HANDOFF_VERSION         3       // bumped when the state layout changes
+#define HANDOFF_FDS_PER_MSG     200     // descriptors per SCM_RIGHTS message
+#define HANDOFF_CHUNK           65536   // state bytes per message
+#define HANDOFF_TIMEOUT_MS      10000   // how long the old process waits for the new one
+
+/*
+** Compact binary encoding of server state, used by UPGRADE and the state
+** file (see StateStore.hpp): numbers are zigzag varints (7 bits per byte,
+** small values of either sign take one byte), strings a varint length and
+** their bytes. A reader that meets something unexpected stays failed, so
+** callers only check ok() once at the end.
+*/
+class Serializer
+{
+private:
+	std::string         _data;
+	size_t              _pos;
+	bool                _ok;
+
+public:
+	Serializer();
+	Serializer(const std::string& data);
+
+	void                putNumber(long value);
+	void                putString(const std::string& value);
+	long                getNumber();
+	std::string         getString();
+
+	const std::string&  getData() const;
+	bool                ok() const;
+};
+
+/*
+** Live upgrade transport. The old process execs the new binary with one
+** end of a Unix socket pair, then passes it the listening socket and every
+** client socket (SCM_RIGHTS) followed by the serialized state. The new
+** process answers once it has taken everything over; until then the old
+** one keeps its own copies and can carry on if anything fails.
+*/
+class Handoff
+{
+private:
+	Handoff();
+
+public:
+	static bool         spawn(const std::vector<std::string>& commandLine, int& sock, pid_t& pid);
+	static bool         send(int sock, const std::vector<int>& fds, const std::string& state);
+	static bool         receive(int sock, std::vector<int>& fds, std::string& state);
+	static bool         waitReady(int sock, int timeoutMs);
+	static void         ready(int sock);
+};
+
+#endif
@@ -22,6 +22,7 @@
 # include <cstring>     // memset, strlen (C++ versions of string.h)
 # include <cerrno>      // errno for system error codes
 # include <ctime>       // time() for timestamps
+# include <cstdio>      // snprintf, sscanf
 
 /* ========================================================================== */
 /*                        BIBLIOTHÈQUES SYSTÈME (POSIX)                       */
@@ -38,6 +39,7 @@
 # include <unistd.h>        // close(), read(), write()
 # include <fcntl.h>         // fcntl() for non-blocking mode
 # include <sys/stat.h>      // fstat() for file information
+# include <sys/time.h>      // gettimeofday() for millisecond timestamps
 
 // Multiplexage I/O
 # include <poll.h>          // poll() or alternative (select, epoll, kqueue)
@@ -45,6 +47,12 @@
 // Signaux
 # include <signal.h>        // signal(), sigaction() for handling Ctrl+C, etc.
 
+// Processes (UPGRADE)
+# include <sys/wait.h>      // waitpid() for a new binary that failed to take over
+
+// Threads (channel log writer)
+# include <pthread.h>       // pthread_create(), mutexes, condition variables
+
 /* ========================================================================== */
 /*                           PROJECT CONSTANTS                                */
 /* ========================================================================== */
@@ -54,10 +62,38 @@
 # define SERVER_VERSION     "1.0"                   // Server version
 # define MAX_CLIENTS        100                     // Maximum number of simultaneous clients
 # define MAX_CHANNELS       50                      // Maximum number of channels
+# define MAX_CHANNELS_PER_USER 20                   // Maximum number of channels a client can join
 # define BUFFER_SIZE        512                     // Reception buffer size (RFC 2812)
 # define MAX_NICK_LENGTH    9                       // Maximum length of a nickname
 # define MAX_CHANNEL_LENGTH 50                      // Maximum length of a channel name
 # define MAX_TOPIC_LENGTH   390                     // Maximum length of a topic
+# define NAMES_LINE_LENGTH  400                     // Maximum length of the names in one RPL_NAMREPLY
+# define NAMES_PAGE_SIZE    200                     // Members per page for NAMES <channel> <offset>
+# define AUDITORIUM_NAMES_MAX 50                    // Members shown to someone joining an auditorium (+u)
+# define HISTORY_MAX_LINES  500                     // Messages kept per channel for CHATHISTORY
+# define HISTORY_MAX_BYTES  65536                   // Bytes of messages kept per channel
+# define CHATHISTORY_MAX_LIMIT 100                  // Messages returned by one CHATHISTORY request
+# define SEARCH_PAGE_SIZE   50                      // Hits returned by one SEARCH request
+# define MAX_CHANNEL_MASKS  4096                    // Entries of each +b/+e/+I list of a channel
+# define FLOOD_MAX_MESSAGES 1000                    // Largest message budget of +f
+# define FLOOD_MAX_SECONDS  3600                    // Longest interval of +f
+# define SESSION_GRACE_DEFAULT 120                  // Seconds a dropped session waits for RESUME
+# define SESSION_BUFFER_DEFAULT 262144              // Output bytes kept for a detached session
+# define COMMANDS_PER_TURN_DEFAULT 8                // Lines a client runs per loop turn
+# define SESSION_TOKEN_BYTES 16                     // Random bytes of a RESUME token
+
+// IRCv3 capabilities (bits of Client::_capabilities)
+# define CAP_BATCH          0x01                    // "batch": bulk replies wrapped in BATCH
+# define CAP_MESSAGE_TAGS   0x02                    // "message-tags": client tags are relayed
+# define CAP_NO_IMPLICIT_NAMES 0x04                 // "draft/no-implicit-names": no NAMES after JOIN
+# define CAP_CHATHISTORY    0x08                    // "draft/chathistory": CHATHISTORY playback
+# define CAP_RESUME         0x10                    // "draft/resume-0.5": sessions survive a dropped connection
+
+// Vendor batch types wrapping bulk replies
+# define BATCH_TYPE_NAMES   "ft_irc/names"
+# define BATCH_TYPE_WHO     "ft_irc/who"
+# define BATCH_TYPE_LIST    "ft_irc/list"
+# define BATCH_TYPE_SEARCH  "ft_irc/search"
 
 // Return codes
 # define SUCCESS            0
@@ -75,6 +111,7 @@
 # define RPL_YOURHOST       "002"   // Server information
 # define RPL_CREATED        "003"   // Server creation date
 # define RPL_MYINFO         "004"   // Server technical information
+# define RPL_ISUPPORT       "005"   // Supported features
 
 // Return codes for commands
 # define RPL_ENDOFWHO        "315"   // End of WHO response
@@ -83,15 +120,28 @@
 # define RPL_TOPIC          "332"   // Channel topic
 # define RPL_TOPICWHOTIME   "333"   // Who set the topic and when
 # define RPL_INVITING       "341"   // Invitation confirmation
+# define RPL_INVITELIST     "346"   // Invite exception list entry
+# define RPL_ENDOFINVITELIST "347"  // End of invite exception list
+# define RPL_EXCEPTLIST     "348"   // Ban exception list entry
+# define RPL_ENDOFEXCEPTLIST "349"  // End of ban exception list
 # define RPL_WHOREPLY       "352"   // WHO command response
 # define RPL_NAMREPLY       "353"   // List of users in a channel
 # define RPL_ENDOFNAMES     "366"   // End of user list
+# define RPL_BANLIST        "367"   // Ban list entry
+# define RPL_ENDOFBANLIST   "368"   // End of ban list
 # define RPL_ENDOF
 # define RPL_LISTSTART      "321"   // Start of channel list
 # define RPL_LIST           "322"   // Channel list entry
 # define RPL_LISTEND        "323"   // End of channel list
+# define RPL_YOUREOPER      "381"   // OPER succeeded
+# define RPL_REHASHING      "382"   // REHASH succeeded
+# define RPL_LINKS          "364"   // LINKS entry
+# define RPL_ENDOFLINKS     "365"   // End of LINKS list
+# define RPL_SEARCHRESULT   "780"   // SEARCH hit (server specific)
+# define RPL_ENDOFSEARCH    "781"   // End of SEARCH results (server specific)
 
 // Command errors
+# define ERR_INVALIDCAPCMD  "410"   // Invalid CAP subcommand
 # define ERR_NOSUCHNICK     "401"   // Nickname does not exist
 # define ERR_NOSUCHSERVER   "402"   // Server does not exist
 # define ERR_NOSUCHCHANNEL  "403"   // Channel does not exist
@@ -103,6 +153,7 @@
 # define ERR_NONICKNAMEGIVEN "431"  // No nickname given
 # define ERR_ERRONEUSNICKNAME "432" // Invalid nickname
 # define ERR_NICKNAMEINUSE  "433"   // Nickname already in use
+# define ERR_UNAVAILRESOURCE "437"  // Channel temporarily unavailable
 # define ERR_USERNOTINCHANNEL "441" // User not in channel
 # define ERR_NOTONCHANNEL   "442"   // You are not on that channel
 # define ERR_USERONCHANNEL  "443"   // User already in channel
@@ -114,9 +165,15 @@
 # define ERR_CHANNELISFULL  "471"   // Channel full (limit reached)
 # define ERR_UNKNOWNMODE    "472"   // Unknown mode
 # define ERR_INVITEONLYCHAN "473"   // Invite-only channel
+# define ERR_BANNEDFROMCHAN "474"   // Banned from channel (+b)
 # define ERR_BADCHANNELKEY  "475"   // Bad channel key
+# define ERR_BANLISTFULL    "478"   // Channel list is full
+# define ERR_THROTTLE       "480"   // Joins throttled (+f)
+# define ERR_NOPRIVILEGES   "481"   // Server operator privileges needed
 # define ERR_CHANOPRIVSNEEDED "482" // Operator privileges needed
+# define ERR_NOOPERHOST     "491"   // No O-line for this name
 # define ERR_UMODEUNKNOWNFLAG "501" // Unknown mode flag
+# define ERR_INVALIDMODEPARAM "696" // Invalid mode parameter
 
 /* ========================================================================== */
 /*                          FORWARD DECLARATIONS                              */
@@ -132,9 +189,26 @@ class CommandHandler;
 /* ========================================================================== */
 
 # include "Utils.hpp"
+# include "Config.hpp"
 # include "Parser.hpp"
+# include "Snapshot.hpp"
+# include "WorkerPool.hpp"
+# include "FanoutPool.hpp"
+# include "SpillFile.hpp"
+# include "Handoff.hpp"
+# include "StateStore.hpp"
+# include "ReplyCursor.hpp"
+# include "SpamFilter.hpp"
+# include "RepeatDetector.hpp"
+# include "AdmissionControl.hpp"
+# include "Network.hpp"
 # include "Client.hpp"
+# include "ChannelHistory.hpp"
+# include "MaskList.hpp"
 # include "Channel.hpp"
+# include "ChannelRegistry.hpp"
+# include "ChannelLog.hpp"
+# include "SearchIndex.hpp"
 # include "CommandHandler.hpp"
 # include "Server.hpp"
 
@@ -0,0 +1,83 @@
+#ifndef MASKLIST_HPP
+#define MASKLIST_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ctime>
+
+#define MASK_INDEX_KEY      3       // literal characters used as index key
+
+/*
+** A nick!user@host glob compiled once: the literal text before the first
+** wildcard and after the last one is compared directly, and only the part
+** in between goes through the generic '*'/'?' matcher. Masks and subjects
+** are compared lowercased.
+*/
+class CompiledMask
+{
+private:
+	std::string         _lower;     // whole mask, lowercased
+	std::string         _prefix;    // literal head
+	std::string         _suffix;    // literal tail
+	std::string         _core;      // what remains, starts and ends with a wildcard
+	bool                _literal;   // no wildcard at all
+
+public:
+	CompiledMask(const std::string& mask);
+
+	bool                matches(const std::string& lowerSubject) const;
+	const std::string&  getPrefix() const;
+	const std::string&  getSuffix() const;
+};
+
+/*
+** Channel list of masks (+b, +e, +I). Masks are indexed by the first
+** MASK_INDEX_KEY characters of their literal prefix, or the last ones of
+** their literal suffix when that is longer, so a check only runs the masks
+** that can match the subject's head or tail plus the few masks with no
+** literal part. The entries keep their insertion order for listing.
+*/
+class MaskList
+{
+public:
+	struct Entry
+	{
+	    std::string     mask;
+	    std::string     setter;
+	    time_t          setAt;
+	};
+
+private:
+	typedef std::map<std::string, std::vector<size_t> > Index;
+
+	std::vector<Entry>          _entries;
+	std::vector<CompiledMask>   _compiled;      // same order as _entries
+	Index                       _byPrefix;
+	Index                       _bySuffix;
+	std::vector<size_t>         _unindexed;
+	size_t                      _maxEntries;
+
+	MaskList();
+
+	void                        indexEntry(size_t i);
+	void                        rebuildIndex();
+	bool                        matchBucket(const Index& index, const std::string& key,
+	                                        const std::string& lowerSubject) const;
+
+public:
+	MaskList(size_t maxEntries);
+
+	static std::string          normalize(const std::string& mask);
+
+	int                         find(const std::string& mask) const;
+	bool                        add(const std::string& mask, const std::string& setter, time_t setAt);
+	bool                        remove(const std::string& mask);
+	bool                        matches(const std::string& lowerSubject) const;
+
+	const std::vector<Entry>&   getEntries() const;
+	size_t                      size() const;
+	bool                        isFull() const;
+};
+
+#endif
@@ -0,0 +1,177 @@
+#ifndef NETWORK_HPP
+#define NETWORK_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <ctime>
+
+class Server;
+class Client;
+class Channel;
+
+// Client::_linkState bits
+#define LINK_NONE               0x00    // a user connection
+#define LINK_OUTGOING           0x01    // we connected, our PASS/SERVER is sent
+#define LINK_AUTHENTICATED      0x02    // the peer gave link.password
+#define LINK_ESTABLISHED        0x04    // SERVER exchanged, burst sent
+#define LINK_RELAY              0x08    // the peer is an edge relay (CAPAB RELAY)
+
+#define LINK_BURST_MEMBERS      32      // members per SJOIN line of a burst
+#define LINK_RETRY_DEFAULT      30      // seconds between attempts of link.connect
+
+/*
+** Server-to-server links. Servers form a spanning tree: every server knows
+** every other one and the link it is reached through, so a line is never
+** sent twice over the same link and never comes back.
+**
+** On a new link both sides send a burst (servers, users, channels with
+** their modes, masks and topics), then forward what changes. Users and
+** channel state are replicated on every server; channel messages only go
+** to the links behind which the channel has members, and private messages
+** follow the link towards their target. Remote users are Client objects
+** without a socket, owned here; they are members of channels like local
+** ones, and Server::queueLine() skips them.
+**
+** Collisions are settled by timestamps: when two users claim the same
+** nickname the one who took it first keeps it (both are killed on a tie),
+** and when a channel exists on both sides the older one keeps its modes
+** and operators.
+**
+** An edge relay (relay.upstream) is a leaf holding a replica of the
+** channels its own users are in. It subscribes to a channel (RSUB) on the
+** first local JOIN, which waits for the burst, and unsubscribes (RUNSUB)
+** when the last local member leaves. Its users stay unknown upstream
+** until they first speak or act; lurkers cost the upstream nothing, and a
+** channel message costs it one line per relay. Upstream, a relay link
+** only gets the servers, then what concerns its subscribed channels and
+** the users it was told about.
+*/
+class Network
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct RelayState
+	{
+	    std::set<std::string>   channels;       // subscribed, lowercased
+	    std::set<unsigned long> users;          // introduced to it, by Client::getId()
+	};
+
+	struct PendingJoin
+	{
+	    int                     fd;
+	    unsigned long           id;             // in case the fd was reused
+	    std::string             key;
+	};
+
+	struct RemoteServer
+	{
+	    std::string         name;
+	    std::string         description;
+	    int                 hops;
+	    std::string         uplinkName;     // server that introduced it
+	    Client*             link;           // our link towards it
+	};
+
+	Server&                             _server;
+	std::map<std::string, RemoteServer> _servers;   // by lowercased name
+	std::map<std::string, Client*>      _users;     // remote users by lowercased nick
+	std::vector<Client*>                _links;     // established links
+	std::map<std::string, Client*>      _targets;   // link.connect entry -> its link (NULL: none)
+	time_t                              _nextAttempt;
+
+	std::map<Client*, RelayState>       _relays;        // edge relays linked to us
+	std::string                         _upstream;      // relay.upstream, empty: not an edge
+	std::set<std::string>               _subscribed;    // edge: channels replicated here
+	std::map<std::string, std::vector<PendingJoin> > _pendingJoins; // edge: RSUB sent, burst awaited
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	Network();
+	Network(const Network& other);
+	Network& operator=(const Network& other);
+
+	std::string                 userLine(Client* client) const;
+	void                        sendServerBurst(Client* link);
+	void                        sendChannelBurst(Client* link, Channel* channel);
+	void                        introduceTo(Client* relay, Client* user);
+	void                        sendToRelays(Channel* channel, const std::string& line, Client* except);
+	void                        unsubscribeIdle();
+
+public:
+	Network(Server& server);
+	~Network();
+
+	/* ================================================================== */
+	/*                    LINKS                                           */
+	/* ================================================================== */
+	void                        tick(time_t now);
+	bool                        connect(const std::string& target);
+	void                        linkEstablished(Client* link, const std::string& name,
+	                                            const std::string& description);
+	void                        linkLost(Client* link);
+	void                        sendBurst(Client* link);
+	Client*                     findLink(const std::string& serverName) const;
+	const std::vector<Client*>& getLinks() const;
+
+	/* ================================================================== */
+	/*                    EDGE RELAYS                                     */
+	/* ================================================================== */
+	bool                        isEdge() const;
+	bool                        deferJoin(Client* client, const std::string& channelName,
+	                                      const std::string& key);
+	bool                        acceptsChannel(const std::string& channelName) const;
+	std::vector<std::pair<Client*, std::string> > channelReady(const std::string& channelName);
+	void                        announce(Client* client);
+	void                        addSubscription(Client* relay, const std::string& channelName);
+	void                        removeSubscription(Client* relay, const std::string& channelName);
+	void                        userGone(Client* user);
+
+	/* ================================================================== */
+	/*                    SERVERS                                         */
+	/* ================================================================== */
+	bool                        hasServer(const std::string& name) const;
+	void                        addServer(const std::string& name, const std::string& description,
+	                                      int hops, const std::string& uplinkName, Client* link);
+	void                        removeServer(const std::string& name);
+	std::vector<std::string>    getServerLines() const;
+
+	/* ================================================================== */
+	/*                    REMOTE USERS                                    */
+	/* ================================================================== */
+	Client*                     findUser(const std::string& nickname) const;
+	Client*                     addUser(const std::string& nickname, time_t nickTs,
+	                                    const std::string& username, const std::string& hostname,
+	                                    const std::string& serverName, const std::string& realname,
+	                                    Client* link);
+	void                        removeUser(Client* user, const std::string& reason);
+	void                        renameUser(Client* user, const std::string& nickname, time_t nickTs);
+	const std::map<std::string, Client*>& getUsers() const;
+
+	/* ================================================================== */
+	/*                    PROPAGATION                                     */
+	/* ================================================================== */
+	void                        sendToLinks(const std::string& line, Client* except,
+	                                        bool withRelays = false);
+	void                        sendAboutUser(Client* user, const std::string& line, Client* except);
+	void                        sendChannelChange(Channel* channel, const std::string& line,
+	                                              Client* except);
+	void                        sendToChannelLinks(Channel* channel, const std::string& line,
+	                                               Client* except);
+	void                        forwardJoin(Channel* channel, const std::vector<Client*>& users,
+	                                        const std::string& line, Client* except);
+	void                        propagate(Client* source, const std::string& message,
+	                                      Channel* channel = NULL);
+	void                        propagateToChannel(Channel* channel, Client* source,
+	                                               const std::string& message);
+	void                        routeToUser(Client* source, Client* target, const std::string& message);
+	void                        introduceUser(Client* client);
+	void                        propagateJoin(Channel* channel, Client* client);
+	void                        propagateMode(Channel* channel, Client* source, const std::string& modes);
+};
+
+#endif
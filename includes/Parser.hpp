@@ -13,6 +13,7 @@ std::string                 extractPrefix(const std::string& message);
 std::string                 extractCommand(const std::string& message);
 std::vector<std::string>    extractParams(const std::string& message);
 std::string                 extractTrailing(const std::string& message);
+std::string                 extractClientTags(const std::string& tags);
 
 
 /* ========================================================================== */
@@ -22,25 +23,11 @@ std::vector<std::string>    parseChannelList(const std::string& channelList);
 std::vector<std::string>    parseKeyList(const std::string& keyList);
 std::vector<std::string>    parseTargetList(const std::string& targetList);
 
-/* ========================================================================== */
-/*                              PARSING MODE                                  */
-/* ========================================================================== */
-struct ModeChange
-	{
-		bool        adding;     // true for +, false for -
-		char        mode;       // Mode character (i, t, k, o, l)
-		std::string param;      // Parameter if necessary (for k, o, l)
-	};
-    std::vector<ModeChange> parseModeString(const std::string& modeString,
-        const std::vector<std::string>& params);
-
 /* ========================================================================== */
 /*                          VALIDATION                                        */
 /* ========================================================================== */
 bool                            isValidChannelName(const std::string& name);
 bool                            isValidNickname(const std::string& nickname);
-bool                            isValidMode(char mode);
-bool                            modeNeedsParam(char mode, bool adding);
         
 /* ========================================================================== */
 /*                       PARSING  PREFIX                                      */
@@ -0,0 +1,85 @@
+#ifndef REPEATDETECTOR_HPP
+#define REPEATDETECTOR_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+
+class Config;
+
+#define REPEAT_SOURCE_SLOTS     8       // message hashes remembered per source
+#define REPEAT_GLOBAL_SLOTS     4096    // server-wide table, power of two
+#define REPEAT_GLOBAL_WAYS      8       // slots of one server-wide bucket
+#define REPEAT_MIN_LENGTH       8       // shorter (normalized) messages are ignored
+#define REPEAT_SEEN_WORDS       4       // per-slot filter of the targets seen: 256 bits
+
+// Verdicts of RepeatDetector::check()
+#define REPEAT_PASS             0
+#define REPEAT_DROP             1       // sent to too many targets server-wide
+#define REPEAT_MUTE             2       // the source has just been muted
+#define REPEAT_MUTED            3       // the source is still muted
+
+/*
+** Detects the same line pasted into many channels or to many users.
+** Each message is normalized (case, runs of whitespace) and hashed in one
+** pass with a rolling polynomial hash. Scores are kept per source (a few
+** slots per client) and server-wide (a fixed set-associative table), and
+** halve every half-life, so only bursts count. A score measures fan-out:
+** each slot keeps a small Bloom filter of what it has already counted
+** (targets per source; source x target pairs server-wide), and only a new
+** one raises it, so saying a line again in the same channel does not. A
+** source going over its threshold is muted for a while; a line going over
+** the server-wide threshold is dropped whoever sends it.
+*/
+class RepeatDetector
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Slot
+	{
+	    unsigned long long  hash;       // 0 = empty
+	    double              score;      // distinct targets, decayed
+	    long                lastMs;
+	    unsigned long long  seen[REPEAT_SEEN_WORDS];    // Bloom filter of the keys counted
+	};
+
+	struct Source
+	{
+	    Slot                slots[REPEAT_SOURCE_SLOTS];
+	    long                mutedUntilMs;
+	};
+
+	std::map<unsigned long, Source> _sources;   // by Client::getId()
+	std::vector<Slot>               _global;
+
+	long                            _sourceThreshold;   // 0 = disabled
+	long                            _globalThreshold;   // 0 = disabled
+	long                            _halfLifeMs;
+	long                            _muteMs;
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	RepeatDetector(const RepeatDetector& other);
+	RepeatDetector& operator=(const RepeatDetector& other);
+
+	double                      bump(Slot* slots, size_t count, unsigned long long hash,
+	                                 unsigned long long key, long nowMs) const;
+	double                      decayed(const Slot& slot, long nowMs) const;
+
+public:
+	RepeatDetector();
+	~RepeatDetector();
+
+	void                        configure(const Config& config);
+	int                         check(unsigned long sourceId, const std::string& target,
+	                                  const std::string& text, long nowMs);
+	void                        forget(unsigned long sourceId);
+	long                        getMuteSeconds() const;
+
+	static unsigned long long   hashMessage(const std::string& text, size_t* length);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef REPLYCURSOR_HPP
+#define REPLYCURSOR_HPP
+
+#include <string>
+#include <vector>
+#include "WorkerPool.hpp"
+
+#define REPLY_WINDOW_LINES      64      // lines produced per step
+#define REPLY_LOW_WATERMARK     8192    // refill once the output buffer is below this (bytes)
+
+struct ServerSnapshot;
+class Client;
+
+/*
+** Lazy producer of a long reply (WHO *, LIST, NAMES). Instead of formatting
+** the whole listing at once, a cursor keeps its position in a ServerSnapshot
+** and produces REPLY_WINDOW_LINES lines per step. The next step is only
+** scheduled once the client's output buffer has drained below
+** REPLY_LOW_WATERMARK, so the memory held for a listing is one window, not
+** the whole result. The snapshot never changes, so channels or clients
+** created or destroyed between two steps cannot invalidate the position.
+**
+** Steps run on the worker pool (CursorJob); a cursor is only used by one
+** thread at a time.
+*/
+class ReplyCursor
+{
+private:
+	ReplyCursor();
+	ReplyCursor(const ReplyCursor& other);
+	ReplyCursor& operator=(const ReplyCursor& other);
+
+protected:
+	const ServerSnapshot*       _snapshot;
+	std::string                 _serverName;
+	std::string                 _nick;          // requester, at the time of the request
+	unsigned long               _clientId;
+	int                         _fd;
+	size_t                      _position;      // next entry of the snapshot
+	bool                        _open;          // first window delivered (event loop)
+	std::string                 _batchRef;      // BATCH opened for the reply, if any
+
+public:
+	ReplyCursor(const ServerSnapshot* snapshot, const std::string& serverName, Client* client);
+	virtual ~ReplyCursor();
+
+	// Append up to `maxLines` lines (a single entry may exceed it);
+	// returns true once the reply is complete.
+	virtual bool                fill(std::vector<std::string>& lines, size_t maxLines) = 0;
+	virtual const char*         batchType() const = 0;
+	virtual std::string         batchParams() const;
+
+	unsigned long               getClientId() const;
+	int                         getFd() const;
+	bool                        isOpen() const;
+	void                        open(const std::string& batchRef);
+	const std::string&          getBatchRef() const;
+};
+
+// One step of a cursor on the worker pool.
+class CursorJob : public WorkerJob
+{
+private:
+	ReplyCursor*                _cursor;
+
+public:
+	CursorJob(ReplyCursor* cursor);
+	void                        run(AsyncReply& reply);
+};
+
+#endif
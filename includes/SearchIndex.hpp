@@ -0,0 +1,123 @@
+#ifndef SEARCHINDEX_HPP
+#define SEARCHINDEX_HPP
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#define SEARCH_INDEX_MAGIC      "FTIRCIDX"
+#define SEARCH_INDEX_VERSION    1
+#define SEARCH_TERM_MAX         64      // longer words are truncated
+
+class ChannelLog;
+
+/*
+** Index file "channels-NNNNNN.idx", built once the segment is sealed.
+** A SearchIndexHeader, a term table sorted by hash, then the postings:
+** offsets of the matching records in the segment, ascending. The file is
+** memory-mapped for queries; hash collisions are filtered out by checking
+** the record itself.
+*/
+struct SearchIndexHeader
+{
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    termCount;
+    unsigned long   postingCount;
+    long            minTimeMs;
+    long            maxTimeMs;
+};
+
+struct SearchTermEntry
+{
+    unsigned long   hash;       // FNV-1a of the lowercased word
+    unsigned int    first;      // index of the first posting
+    unsigned int    count;
+};
+
+struct SearchQuery
+{
+    unsigned long               clientId;   // requester, checked again on completion
+    int                         fd;
+    std::vector<std::string>    terms;      // lowercased words, all must match; empty = any text
+    std::string                 channel;    // empty = any channel
+    std::string                 nick;       // empty = anyone
+    long                        afterMs;    // -1 = unbounded
+    long                        beforeMs;   // -1 = unbounded
+    size_t                      offset;     // hits to skip (paging)
+    size_t                      limit;
+};
+
+struct SearchHit
+{
+    long                        timeMs;
+    int                         type;       // LOG_EVENT_*
+    std::string                 channel;
+    std::string                 nick;
+    std::string                 text;
+};
+
+struct SearchResult
+{
+    unsigned long               clientId;
+    int                         fd;
+    size_t                      offset;
+    bool                        more;       // another page is available
+    std::vector<SearchHit>      hits;       // newest first
+};
+
+/*
+** Background full-text search over the channel log segments.
+** One worker thread answers queued queries and, when idle, builds the
+** inverted index of every sealed segment that has none yet. Finished
+** results are queued back and the event loop is woken through notifyFd.
+*/
+class SearchIndex
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	const ChannelLog&           _log;
+	std::string                 _directory;
+	int                         _notifyFd;
+	long                        _indexIntervalMs;
+
+	pthread_t                   _thread;
+	pthread_mutex_t             _mutex;
+	pthread_cond_t              _wakeup;
+	bool                        _running;
+	bool                        _stopping;
+	std::vector<SearchQuery>    _queries;   // guarded by _mutex
+	std::vector<SearchResult>   _results;   // guarded by _mutex
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	SearchIndex();
+	SearchIndex(const SearchIndex& other);
+	SearchIndex& operator=(const SearchIndex& other);
+
+	static void*                workerMain(void* arg);
+	void                        workerLoop();
+	bool                        indexNextSegment();
+	bool                        buildIndex(unsigned long number);
+	void                        runQuery(const SearchQuery& query, SearchResult& result);
+	std::vector<unsigned long>  listSegments() const;
+	std::string                 indexPath(unsigned long number) const;
+
+public:
+	SearchIndex(const ChannelLog& log, int notifyFd, long indexIntervalMs);
+	~SearchIndex();
+
+	bool                        start();
+	void                        stop();
+
+	void                        submit(const SearchQuery& query);
+	void                        takeResults(std::vector<SearchResult>& results);
+
+	static void                 tokenize(const char* text, size_t length, std::vector<std::string>& words);
+	static unsigned long        hashTerm(const std::string& word);
+};
+
+#endif
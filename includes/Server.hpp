@@ -4,11 +4,22 @@
 # include <string>
 # include <vector>
 # include <map>
+# include <deque>
 # include <poll.h>
+# include "ChannelRegistry.hpp"
+# include "Config.hpp"
 
 class Client;
 class Channel;
 class CommandHandler;
+class ChannelLog;
+class SearchIndex;
+class WorkerPool;
+class FanoutPool;
+class StateStore;
+class ReplyCursor;
+class Network;
+struct ServerSnapshot;
 
 class Server
 {
@@ -22,9 +33,36 @@ class Server
         bool                            _running;
 
         std::map<int, Client*>          _clients;   // Map of clients connected (key: fd)
-        std::map<std::string, Channel*>  _channels;  // map of channel (clé: nom du channel)
+        ChannelRegistry                 _channels;  // channels hashed by casefolded name
 
         std::vector<struct pollfd>      _pollFds;   // list the descripteur for poll
+        std::vector<int>                _pollIndex; // fd -> position in _pollFds, -1 if none
+
+        unsigned long                   _fanoutEpoch; // stamp of the current neighbour fan-out
+        unsigned long                   _nextMsgId;   // msgid of the next channel message
+
+        Config                          _config;
+        ChannelLog*                     _channelLog;  // NULL unless log.dir is set
+        SearchIndex*                    _searchIndex; // runs SEARCH, NULL without a log
+        WorkerPool*                     _workerPool;  // runs WHO *, LIST, NAMES
+        FanoutPool*                     _fanoutPool;  // writes the broadcasts of large channels
+        const ServerSnapshot*           _snapshot;    // last snapshot handed to the workers
+        int                             _wakePipe[2]; // background threads wake up poll()
+        SpamFilter                      _spamFilter;  // PRIVMSG/NOTICE patterns, see REHASH
+        RepeatDetector                  _repeatDetector; // same line pasted to many targets
+        AdmissionControl                _admission;   // per-host clone and connect rate limits
+        Network*                        _network;     // server links and remote users
+        StateStore*                     _stateStore;  // NULL unless state.file is set
+        std::map<std::string, std::pair<unsigned long, std::string> > _savedChannels; // lowercased name -> version and state last journaled
+        std::vector<std::string>        _commandLine; // argv, to start the new binary on UPGRADE
+        bool                            _upgradeRequested; // UPGRADE runs at the end of the loop turn
+        std::map<std::string, Client*>  _sessions;    // RESUME token -> client, attached or detached
+        int                             _nextDetachedKey; // _clients key of the next detached session
+        long                            _sessionGrace; // session.grace_seconds, 0 disables sessions
+        size_t                          _sessionBufferMax; // output kept for a detached session
+        time_t                          _nextSessionSweep;
+        std::deque<std::pair<int, unsigned long> > _runQueue; // fd and id of the clients with buffered lines
+        long                            _commandsPerTurn; // lines a client runs before the next one's turn
 
         CommandHandler*                 _cmdHandler;
         /* ================================================================== */
@@ -35,7 +73,7 @@ class Server
         Server& operator=(const Server& other);
 
     public:
-        Server(int port, const std::string& password);
+        Server(int port, const std::string& password, const Config& config);
         ~Server();
 
         /* ========================================================================== */
@@ -43,6 +81,9 @@ class Server
         /* ========================================================================== */
 
         bool                                init();
+        bool                                rehash();
+        void                                setCommandLine(int argc, char** argv);
+        void                                requestUpgrade();
 
         /* ========================================================================== */
         /*                       MAIN LOOP                                            */
@@ -54,8 +95,13 @@ class Server
         /*                       CONNECTION MANAGEMENT                                */
         /* ========================================================================== */
         void                                acceptNewClient();
+        Client*                             addConnection(int fd, const std::string& hostname);
+        void                                applySendq(Client* client);
         void                                disconnectClient(int fd);
         Client*                             getClientByNickname(const std::string& nickname);
+        bool                                sessionsEnabled() const;
+        void                                openSession(Client* client);
+        bool                                resumeSession(Client* fresh, const std::string& token);
         bool                                isNicknameInUse(const std::string& nickname);
 
         /* ========================================================================== */
@@ -69,26 +115,70 @@ class Server
         /*                       COMMUNICATION                                       */
         /* ========================================================================== */
         void                                sendToClient(int fd, const std::string& message);
+        void                                sendToClient(int fd, const std::string& message, int outputClass);
         void                                broadcastToChannel(const std::string& channelName, 
                                                     const std::string& message, int excludeFd);
+        void                                broadcastToChannel(const std::string& channelName,
+                                                    const std::string& message, int excludeFd,
+                                                    const std::string& tags);
+        void                                sendTaggedToClient(Client* client, const std::string& message,
+                                                    const std::string& tags);
+        void                                broadcastMembershipChange(Channel* channel, Client* actor,
+                                                    const std::string& message);
+        void                                broadcastToNeighbours(Client* client, const std::string& message,
+                                                    bool includeSelf);
+        void                                logChannelEvent(int type, Channel* channel, Client* client,
+                                                    const std::string& text);
+        void                                noticeOperators(const std::string& text);
 
         /* ========================================================================== */
         /*                       GETTEURS                                             */
         /* ========================================================================== */
         const   std::string&                getPassword() const;
         const   std::string&                getServerName() const;
+        unsigned long                       nextMsgId();
         std::map<int, Client*>&             getClients();
-        std::map<std::string, Channel*>&    getChannels();
+        ChannelRegistry&                    getChannels();
+        const Config&                       getConfig() const;
+        SearchIndex*                        getSearchIndex();
+        const SpamFilter&                   getSpamFilter() const;
+        RepeatDetector&                     getRepeatDetector();
+        Network&                            getNetwork();
+        WorkerPool*                         getWorkerPool();
+        const ServerSnapshot*               takeSnapshot();
+        void                                queueCursor(Client* client, ReplyCursor* cursor);
 
         /* ========================================================================== */
         /*                       PRIVATE METHODS                                      */
         /* ========================================================================== */
         void                                handleClientData(int fd);
+        void                                scheduleCommands(Client* client);
+        void                                runCommands();
         void                                processCommand(Client* client, const std::string& command);
         void                                flushClientBuffer(int fd);
+        void                                queueLine(Client* client, const std::string& line);
         void                                addToPoll(int fd);
         void                                removeFromPoll(int fd);
+        void                                watchWritable(int fd);
+        void                                flushFanout();
         void                                cleanupDisconnectedClients();
+        bool                                canDetach(Client* client) const;
+        void                                detachSession(Client* client);
+        int                                 nextDetachedKey();
+        void                                endSession(Client* client, const std::string& reason);
+        void                                expireSessions(time_t now);
+        void                                handleWakeup();
+        void                                pumpCursor(Client* client);
+        bool                                openListener();
+        void                                upgrade();
+        void                                restartWriters();
+        std::string                         saveState(std::vector<int>& fds);
+        bool                                resume(int sock);
+        std::string                         channelState(Channel* channel);
+        void                                restoreChannel(const std::string& state);
+        void                                restoreChannelState(const std::string& snapshot,
+                                                    const std::vector<std::string>& records);
+        void                                saveChannelState();
 };
 
 #endif
\ No newline at end of file
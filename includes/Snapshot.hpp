@@ -0,0 +1,69 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <string>
+#include <vector>
+
+/*
+** Read-only copies of the client and channel tables for worker threads.
+**
+** Every change to a client or channel stamps it with a new global state
+** version (touch()). A snapshot is only rebuilt when the global version has
+** moved, and then only the clients/channels whose own version changed get
+** a new copy: the others are shared with the previous snapshot through a
+** reference count. Snapshots are never modified once built, so workers can
+** read them without locking while the event loop keeps running.
+*/
+
+unsigned long   nextStateVersion();
+unsigned long   currentStateVersion();
+
+// Reference counted, shared between the event loop and the workers.
+class SharedSnapshot
+{
+private:
+	mutable int     _refs;
+
+	SharedSnapshot(const SharedSnapshot& other);
+	SharedSnapshot& operator=(const SharedSnapshot& other);
+
+protected:
+	SharedSnapshot();
+	virtual ~SharedSnapshot();
+
+public:
+	void            retain() const;
+	void            release() const;   // deletes the snapshot with the last reference
+};
+
+struct ClientSnapshot : public SharedSnapshot
+{
+	unsigned long               version;
+	unsigned long               id;
+	std::string                 nickname;
+	std::string                 username;
+	std::string                 hostname;
+	std::string                 realname;
+};
+
+struct ChannelSnapshot : public SharedSnapshot
+{
+	unsigned long               version;
+	std::string                 name;
+	std::string                 topic;
+	bool                        auditorium;
+	std::vector<std::string>    memberNames;    // with @/+ prefix, operators first
+	std::vector<unsigned long>  memberIds;      // Client::getId(), same order
+};
+
+struct ServerSnapshot : public SharedSnapshot
+{
+	unsigned long                       version;
+	std::vector<const ClientSnapshot*>  clients;
+	std::vector<const ChannelSnapshot*> channels;   // creation order
+
+	ServerSnapshot();
+	~ServerSnapshot();
+};
+
+#endif
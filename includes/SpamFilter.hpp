@@ -0,0 +1,78 @@
+#ifndef SPAMFILTER_HPP
+#define SPAMFILTER_HPP
+
+#include <string>
+#include <vector>
+
+// Actions, by increasing severity
+#define SPAM_ACTION_NONE        0
+#define SPAM_ACTION_TAG         1   // delivered with the ft_irc/spam tag
+#define SPAM_ACTION_QUARANTINE  2   // withheld and shown to the operators
+#define SPAM_ACTION_BLOCK       3   // dropped, the sender is told
+
+#define SPAM_TAG                "ft_irc/spam"
+
+/*
+** Server-side filter over PRIVMSG/NOTICE text. Patterns are literal or
+** wildcard ('*', '?') and match anywhere in the message, case-insensitively.
+** The longest literal run of every pattern is compiled into one
+** Aho-Corasick automaton (a dense DFA over byte classes), so a message is
+** scanned once whatever the number of patterns; wildcard patterns are only
+** checked in full when their literal part was found.
+**
+** Before the automaton runs, a prefilter looks for the first place where a
+** pattern could start: with SSE2 and at most three distinct start bytes it
+** compares 16 bytes at a time, otherwise it checks the first two bytes of
+** the patterns against a bitmap. Most messages never reach the automaton.
+*/
+class SpamFilter
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Pattern
+	{
+	    std::string         text;       // as written in the file
+	    std::string         mask;       // "*<lowercased text>*"
+	    bool                literal;
+	    int                 action;
+	};
+
+	std::vector<Pattern>            _patterns;
+
+	// Automaton: _next[state * _classCount + _classOf[byte]]
+	unsigned char                   _classOf[256];
+	size_t                          _classCount;
+	std::vector<int>                _next;
+	std::vector<std::vector<int> >  _outputs;   // patterns whose anchor ends in a state
+
+	// Prefilter
+	std::vector<unsigned char>      _bigrams;       // 65536 bits: first two bytes of anchors
+	unsigned char                   _startBytes[3]; // used when _startByteCount <= 3
+	size_t                          _startByteCount;
+
+	mutable std::string             _lowered;       // scratch buffer of scan()
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	SpamFilter(const SpamFilter& other);
+	SpamFilter& operator=(const SpamFilter& other);
+
+	void                        build();
+	size_t                      prefilter(const std::string& text) const;
+
+public:
+	SpamFilter();
+	~SpamFilter();
+
+	bool                        load(const std::string& path);
+	void                        clear();
+
+	int                         scan(const std::string& text, std::string* matched) const;
+	size_t                      size() const;
+	static const char*          actionName(int action);
+};
+
+#endif
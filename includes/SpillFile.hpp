@@ -0,0 +1,48 @@
+#ifndef SPILLFILE_HPP
+#define SPILLFILE_HPP
+
+#include <string>
+#include <sys/types.h>
+
+#define SPILL_MEMORY_DEFAULT    262144      // output bytes a spilling client keeps in RAM
+#define SPILL_MAX_DEFAULT       1073741824  // bytes on disk before the client is dropped anyway
+#define SPILL_WINDOW            65536       // bytes mapped back per refill
+#define SPILL_PUNCH             1048576     // bytes read back before their blocks are freed
+
+/*
+** Overflow of a client's send queue (see Client::appendToOutputBuffer).
+** Output past the memory budget is appended to a file that is unlinked as
+** soon as it exists, so a crash leaves nothing behind, and comes back one
+** window at a time through a read-only mapping as the socket drains. The
+** file is truncated whenever it has been read to the end; a reader that
+** never quite catches up gets the blocks it has read freed (a hole is
+** punched), so the disk used stays bounded by what is pending.
+*/
+class SpillFile
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	int                 _fd;
+	off_t               _written;   // bytes appended
+	off_t               _read;      // bytes handed back
+	off_t               _punched;   // start of the blocks still allocated
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	SpillFile(const SpillFile& other);
+	SpillFile& operator=(const SpillFile& other);
+
+public:
+	SpillFile();
+	~SpillFile();
+
+	bool                open(const std::string& dir);
+	bool                append(const std::string& data);
+	size_t              pending() const;
+	bool                readWindow(std::string& out, size_t max);
+};
+
+#endif
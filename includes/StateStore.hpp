@@ -0,0 +1,104 @@
+#ifndef STATESTORE_HPP
+#define STATESTORE_HPP
+
+#include <string>
+#include <vector>
+#include <ctime>
+#include <pthread.h>
+
+#define STATE_MAGIC             "FTIRCSTA"
+#define STATE_VERSION           1
+#define STATE_INTERVAL_DEFAULT  60      // seconds between two snapshots
+
+// Journal records (first number of the payload)
+#define STATE_RECORD_CHANNEL    1       // a channel's saved state, replacing the previous one
+#define STATE_RECORD_REMOVED    2       // a channel ceased to exist
+
+/*
+** On-disk format. The snapshot file is a StateFileHeader followed by
+** `length` payload bytes; the journal a series of StateRecordHeader, each
+** followed by its payload. Payloads are Serializer encoded. A record
+** belongs to the snapshot generation that was current when it was written;
+** replaying the records of the snapshot's generation and later ones gives
+** back the last saved state.
+*/
+struct StateFileHeader
+{
+    char            magic[8];
+    unsigned int    version;
+    unsigned int    checksum;   // FNV-1a of the payload
+    unsigned long   generation;
+    unsigned long   length;
+};
+
+struct StateRecordHeader
+{
+    unsigned int    length;     // payload bytes
+    unsigned int    checksum;   // FNV-1a of the payload
+    unsigned long   generation;
+};
+
+class Config;
+
+/*
+** Channel state that survives a crash (state.file). Every change is
+** appended to a journal as it happens, a write() into the page cache that
+** outlives the process. Every state.interval seconds the event loop hands
+** a full snapshot to a writer thread, which writes it through a memory
+** mapping to a temporary file, syncs it and renames it over the previous
+** one. The journal is rotated at the same moment (<file>.journal becomes
+** <file>.journal.old) and the old one removed once the snapshot is on
+** disk, so a crash at any point leaves a snapshot and the records needed
+** after it.
+*/
+class StateStore
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	std::string         _path;
+	long                _interval;
+	time_t              _nextSnapshot;
+	unsigned long       _generation;    // of the records being written
+	int                 _journalFd;
+
+	// Writer thread
+	pthread_t           _thread;
+	pthread_mutex_t     _mutex;
+	pthread_cond_t      _wakeup;
+	bool                _running;
+	bool                _stopping;
+	bool                _busy;          // a snapshot is waiting or being written
+	bool                _oldJournal;    // <file>.journal.old still holds needed records
+	std::string         _pending;       // snapshot payload handed to the writer
+	unsigned long       _pendingGeneration;
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	StateStore();
+	StateStore(const StateStore& other);
+	StateStore& operator=(const StateStore& other);
+
+	static void*                writerMain(void* arg);
+	void                        writerLoop();
+	bool                        writeSnapshot(const std::string& payload, unsigned long generation);
+	void                        readJournal(const std::string& path, unsigned long generation,
+	                                        std::vector<std::string>& records);
+	bool                        openJournal();
+
+public:
+	StateStore(const Config& config);
+	~StateStore();
+
+	void                        load(std::string& snapshot, std::vector<std::string>& records);
+	bool                        start();
+	void                        stop();
+
+	void                        record(const std::string& payload);
+	bool                        snapshotDue(time_t now);
+	void                        snapshot(const std::string& payload, time_t now);
+};
+
+#endif
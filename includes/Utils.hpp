@@ -4,6 +4,7 @@
 # include <string>
 # include <vector>
 # include <sstream>
+# include <ctime>
 
 namespace Utils
 {
@@ -19,6 +20,9 @@ namespace Utils
     bool                        startsWith(const std::string& str, const std::string& prefix);
     bool                        endsWith(const std::string& str, const std::string& suffix);
     std::string                 replaceAll(const std::string& str, const std::string& from, const std::string& to);
+    bool                        equalsIgnoreCase(const std::string& a, const std::string& b);
+    unsigned int                hashLower(const std::string& str);
+    bool                        matchMask(const std::string& mask, const std::string& str);
 
 /* ========================================================================== */
 /*                              TYPES CONVERSION                              */
@@ -48,6 +52,10 @@ namespace Utils
     std::string                 getCurrentTimestamp();
     long                        getUnixTimestamp();
     std::string                 timestampToString(long timestamp);
+    long                        getTimeMs();
+    struct timespec             deadlineAfterMs(long delayMs);
+    std::string                 formatIsoTime(long timeMs);
+    long                        parseIsoTime(const std::string& str);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef WORKERPOOL_HPP
+#define WORKERPOOL_HPP
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+#define WORKER_THREADS_DEFAULT  2
+#define WORKER_THREADS_MAX      32
+
+class ReplyCursor;
+
+// Reply lines computed by a worker, delivered by the event loop.
+struct AsyncReply
+{
+    unsigned long               clientId;   // requester, checked again on delivery
+    int                         fd;
+    std::vector<std::string>    lines;      // without CRLF
+    ReplyCursor*                cursor;     // cursor that produced the lines, if any
+    bool                        finished;   // the cursor has nothing more to produce
+};
+
+// A unit of work. It must only read data it owns (e.g. a ServerSnapshot),
+// never the live Server, Client or Channel objects.
+class WorkerJob
+{
+public:
+    virtual ~WorkerJob() {}
+    virtual void                run(AsyncReply& reply) = 0;
+};
+
+/*
+** Fixed pool of worker threads for expensive queries (WHO *, LIST, NAMES).
+** Each worker has its own locked deque: new jobs are dealt round-robin,
+** a worker takes jobs from the front of its own deque and, when it runs
+** dry, steals from the back of another one. Finished replies are queued and
+** the event loop is woken through notifyFd.
+*/
+class WorkerPool
+{
+private:
+	/* ================================================================== */
+	/*                    ATTRIBUTS PRIVÉS                                */
+	/* ================================================================== */
+	struct Worker
+	{
+	    WorkerPool*             pool;
+	    size_t                  index;
+	    pthread_t               thread;
+	    pthread_mutex_t         mutex;
+	    std::deque<WorkerJob*>  jobs;
+	};
+
+	std::vector<Worker*>        _workers;
+	size_t                      _nextWorker;    // round-robin target of submit()
+	int                         _notifyFd;
+
+	pthread_mutex_t             _idleMutex;
+	pthread_cond_t              _idleCond;
+	long                        _pending;       // queued jobs, guarded by _idleMutex
+	bool                        _stopping;
+
+	pthread_mutex_t             _doneMutex;
+	std::vector<AsyncReply>     _done;
+
+	/* ================================================================== */
+	/*                CONSTRUCTORS FORBIDDEN                             */
+	/* ================================================================== */
+	WorkerPool();
+	WorkerPool(const WorkerPool& other);
+	WorkerPool& operator=(const WorkerPool& other);
+
+	static void*                workerMain(void* arg);
+	void                        workerLoop(Worker& worker);
+	WorkerJob*                  takeJob(Worker& worker);
+
+public:
+	WorkerPool(size_t threads, int notifyFd);
+	~WorkerPool();
+
+	bool                        start();
+	void                        stop();
+
+	void                        submit(WorkerJob* job);     // the pool deletes the job
+	void                        takeReplies(std::vector<AsyncReply>& replies);
+	size_t                      size() const;
+};
+
+#endif
@@ -7,16 +7,40 @@
 // Constructor initializing the channel with a name and default values for other attributes.
 Channel::Channel(const std::string& name)
 	: _name(name),
+	  _creationTime(std::time(NULL)),
 	  _topic(""),
 	  _topicSetter(""),
 	  _topicTime(0),
 	  _inviteOnly(false),
 	  _topicRestricted(false),
 	  _key(""),
-	  _userLimit(0)
+	  _userLimit(0),
+	  _moderated(false),
+	  _floodMessages(0),
+	  _floodSeconds(0),
+	  _floodAction(FLOOD_ACTION_DROP),
+	  _floodTokens(0),
+	  _floodRefillMs(0),
+	  _joinLockUntilMs(0),
+	  _operatorCount(0),
+	  _localMemberCount(0),
+	  _auditoriumThreshold(0),
+	  _history(HISTORY_MAX_LINES, HISTORY_MAX_BYTES),
+	  _bans(MAX_CHANNEL_MASKS),
+	  _banExceptions(MAX_CHANNEL_MASKS),
+	  _inviteExceptions(MAX_CHANNEL_MASKS),
+	  _maskVersion(0),
+	  _version(nextStateVersion()),
+	  _snapshot(NULL),
+	  _registry(NULL),
+	  _changeQueued(false)
       {}
 
-Channel::~Channel() {}
+Channel::~Channel()
+{
+	if (_snapshot)
+	    _snapshot->release();
+}
 
 /* ========================================================================== */
 /*                    MEMBERS MANAGEMENT                                     */
@@ -28,26 +52,62 @@ bool Channel::addMember(Client* client)
 	if (isMember(client))
 	    return false;
 
-	_members.insert(client);
-
-	if (_members.size() == 1)
+	size_t oldCount = _members.size();
+	Membership member;
+	member.client = client;
+	member.flags = 0;
+	member.banned = false;
+	member.banCheckVersion = 0;
+	_members.push_back(member);
+
+	if (_members.size() * 2 > _memberIndex.size())
+	    growMemberIndex();
+	else
+	    insertMemberSlot(client, static_cast<int>(_members.size() - 1));
+
+	if (!client->isRemote())
+	    _localMemberCount++;
+	// Operators saved before a restart get their status back (see StateStore)
+	if (!_restoredOperators.empty() && _restoredOperators.erase(Utils::toLower(client->getPrefix())))
+	    addOperator(client);
+	else if (_members.size() == 1 && _restoredOperators.empty())
 	    addOperator(client);
 
+	if (_registry)
+	    _registry->memberCountChanged(this, oldCount);
+	touch();
 	return true;
 }
 
-// Remove a member from the channel.
+// Remove a member from the channel: it is swapped to the end of the array
+// (through the end of the operator block if needed) and popped.
 void Channel::removeMember(Client* client)
 {
-	_members.erase(client);
-	_operators.erase(client);
+	int slot = findMemberSlot(client);
+	if (slot == -1)
+	    return;
+
+	size_t position = _memberIndex[slot];
+	if (_members[position].flags & MEMBER_FLAG_OP)
+	{
+	    swapMembers(position, _operatorCount - 1);
+	    position = --_operatorCount;
+	}
+	swapMembers(position, _members.size() - 1);
 
+	eraseMemberSlot(findMemberSlot(client));
+	_members.pop_back();
+	if (!client->isRemote())
+	    _localMemberCount--;
+	if (_registry)
+	    _registry->memberCountChanged(this, _members.size() + 1);
+	touch();
 }
 
 // Check if a client is a member of the channel.
 bool Channel::isMember(Client* client) const
 {
-	return _members.find(client) != _members.end();
+	return findMemberSlot(client) != -1;
 }
 
 // Check if a member with the given nickname is in the channel.
@@ -59,34 +119,166 @@ bool Channel::hasMember(const std::string& nickname) const
 // Get a member by their nickname. Returns NULL if not found.
 Client* Channel::getMemberByNickname(const std::string &nickname) const
 {
-	std::string lowerNick = Utils::toLower(nickname);
-	for (std::set<Client*>::iterator it = _members.begin();
-	     it != _members.end(); ++it)
+	for (size_t i = 0; i < _members.size(); ++i)
 	{
-	    if (Utils::toLower((*it)->getNickname()) == lowerNick)
-	        return *it;
+	    if (Utils::equalsIgnoreCase(_members[i].client->getNickname(), nickname))
+	        return _members[i].client;
 	}
 	return NULL;
 }
 
-// Get the set of members in the channel.
-const std::set<Client*>& Channel::getMembers() const
+// Get the flat array of members in the channel.
+const std::vector<Membership>& Channel::getMembers() const
 {
 	return _members;
 }
 
+// Position of a member in getMembers(), or std::string::npos if not a member.
+size_t Channel::getMemberPosition(Client* client) const
+{
+	int slot = findMemberSlot(client);
+	if (slot == -1)
+	    return std::string::npos;
+	return _memberIndex[slot];
+}
+
+// Get the flag bits of a member (0 if not a member).
+unsigned char Channel::getMemberFlags(Client* client) const
+{
+	int slot = findMemberSlot(client);
+	if (slot == -1)
+	    return 0;
+	return _members[_memberIndex[slot]].flags;
+}
+
+// Set or clear a flag bit on a member. Does nothing if the client is not a member.
+// Changing the operator bit moves the member across the operator block boundary.
+void Channel::setMemberFlag(Client* client, unsigned char flag, bool enabled)
+{
+	int slot = findMemberSlot(client);
+	if (slot == -1)
+	    return;
+
+	size_t position = _memberIndex[slot];
+	bool wasOperator = (_members[position].flags & MEMBER_FLAG_OP) != 0;
+	touch();
+	if (enabled)
+	    _members[position].flags |= flag;
+	else
+	    _members[position].flags &= ~flag;
+
+	if (!(flag & MEMBER_FLAG_OP) || wasOperator == enabled)
+	    return;
+	if (enabled)
+	    swapMembers(position, _operatorCount++);
+	else
+	    swapMembers(position, --_operatorCount);
+}
+
 // Get the number of members in the channel.
 size_t Channel::getMemberCount() const
 {
 	return _members.size();
 }
 
+// Members connected to this server (not behind a link).
+size_t Channel::getLocalMemberCount() const
+{
+	return _localMemberCount;
+}
+
 // Check if the channel is empty.
 bool Channel::isEmpty() const
 {
 	return _members.empty();
 }
 
+/* ========================================================================== */
+/*                    MEMBER INDEX                                            */
+/* ========================================================================== */
+
+// Hash of a client pointer (low bits are always zero because of alignment).
+static size_t hashClient(Client* client, size_t mask)
+{
+	unsigned long value = reinterpret_cast<unsigned long>(client) >> 4;
+	return static_cast<size_t>(value * 2654435761UL) & mask;
+}
+
+// Probe the back-index for a client. Returns the slot, or -1 if not a member.
+int Channel::findMemberSlot(Client* client) const
+{
+	if (_memberIndex.empty())
+	    return -1;
+
+	size_t mask = _memberIndex.size() - 1;
+	size_t i = hashClient(client, mask);
+	while (_memberIndex[i] != -1)
+	{
+	    if (_members[_memberIndex[i]].client == client)
+	        return static_cast<int>(i);
+	    i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+void Channel::insertMemberSlot(Client* client, int position)
+{
+	size_t mask = _memberIndex.size() - 1;
+	size_t i = hashClient(client, mask);
+	while (_memberIndex[i] != -1)
+	    i = (i + 1) & mask;
+	_memberIndex[i] = position;
+}
+
+// Backward-shift deletion, same scheme as ChannelRegistry.
+void Channel::eraseMemberSlot(size_t slot)
+{
+	size_t mask = _memberIndex.size() - 1;
+	size_t hole = slot;
+	size_t j = slot;
+
+	_memberIndex[hole] = -1;
+	for (;;)
+	{
+	    j = (j + 1) & mask;
+	    if (_memberIndex[j] == -1)
+	        break;
+	    size_t home = hashClient(_members[_memberIndex[j]].client, mask);
+	    bool stays = (hole <= j) ? (hole < home && home <= j)
+	                             : (hole < home || home <= j);
+	    if (!stays)
+	    {
+	        _memberIndex[hole] = _memberIndex[j];
+	        _memberIndex[j] = -1;
+	        hole = j;
+	    }
+	}
+}
+
+// Exchange two members and update their back-index slots.
+void Channel::swapMembers(size_t a, size_t b)
+{
+	if (a == b)
+	    return;
+
+	int slotA = findMemberSlot(_members[a].client);
+	int slotB = findMemberSlot(_members[b].client);
+	std::swap(_members[a], _members[b]);
+	_memberIndex[slotA] = static_cast<int>(b);
+	_memberIndex[slotB] = static_cast<int>(a);
+}
+
+// Double the back-index (keeps the load factor under 1/2) and re-insert every member.
+void Channel::growMemberIndex()
+{
+	size_t size = _memberIndex.empty() ? 8 : _memberIndex.size() * 2;
+	while (_members.size() * 2 > size)
+	    size *= 2;
+	_memberIndex.assign(size, -1);
+	for (size_t i = 0; i < _members.size(); ++i)
+	    insertMemberSlot(_members[i].client, static_cast<int>(i));
+}
+
 /* ========================================================================== */
 /*                    OPERATORS MANAGEMENT                                  */
 /* ========================================================================== */
@@ -96,7 +288,7 @@ bool Channel::addOperator(Client* client)
 {
 	if (isMember(client))
 	{
-		_operators.insert(client);
+		setMemberFlag(client, MEMBER_FLAG_OP, true);
 		return true;
 	}
 	return false;
@@ -105,28 +297,38 @@ bool Channel::addOperator(Client* client)
 // Remove an operator from the channel.
 void Channel::removeOperator(Client* client)
 {
-	_operators.erase(client);
+	setMemberFlag(client, MEMBER_FLAG_OP, false);
 }
 
 // Check if a client is an operator of the channel.
 bool Channel::isOperator(Client* client) const
 {
-	return _operators.find(client) != _operators.end();
+	return (getMemberFlags(client) & MEMBER_FLAG_OP) != 0;
 }
 
 // Check if a nickname belongs to an operator of the channel.
 bool Channel::isOperator(const std::string& nickname) const
 {
-	std::string lowerNick = Utils::toLower(nickname);
-	for (std::set<Client*>::const_iterator it = _operators.begin();
-	     it != _operators.end(); ++it)
+	for (size_t i = 0; i < _operatorCount; ++i)
 	{
-	    if (Utils::toLower((*it)->getNickname()) == lowerNick)
+	    if (Utils::equalsIgnoreCase(_members[i].client->getNickname(), nickname))
 	        return true;
 	}
 	return false;
 }
 
+// Number of operators, which occupy getMembers()[0, getOperatorCount()).
+size_t Channel::getOperatorCount() const
+{
+	return _operatorCount;
+}
+
+// Check if a client is voiced on the channel.
+bool Channel::isVoiced(Client* client) const
+{
+	return (getMemberFlags(client) & MEMBER_FLAG_VOICE) != 0;
+}
+
 /* ========================================================================== */
 /*                    MODES MANAGEMENT                                       */
 /* ========================================================================== */
@@ -134,6 +336,7 @@ bool Channel::isOperator(const std::string& nickname) const
 void Channel::setInviteOnly(bool enabled)
 {
 	_inviteOnly = enabled;
+	touch();
 }
 
 bool Channel::isInviteOnly() const
@@ -144,6 +347,7 @@ bool Channel::isInviteOnly() const
 void Channel::setTopicRestricted(bool enabled)
 {
 	_topicRestricted = enabled;
+	touch();
 }
 
 bool Channel::isTopicRestricted() const
@@ -154,6 +358,7 @@ bool Channel::isTopicRestricted() const
 void Channel::setKey(const std::string& key)
 {
 	_key = key;
+	touch();
 }
 
 const std::string& Channel::getKey() const
@@ -175,6 +380,7 @@ bool Channel::checkKey(const std::string& key) const
 void Channel::setUserLimit(size_t limit)
 {
 	_userLimit = limit;
+	touch();
 }
 
 size_t Channel::getUserLimit() const
@@ -194,6 +400,134 @@ bool Channel::isFull() const
 	return _members.size() >= _userLimit;
 }
 
+void Channel::setAuditoriumThreshold(size_t threshold)
+{
+	_auditoriumThreshold = threshold;
+	touch();
+}
+
+size_t Channel::getAuditoriumThreshold() const
+{
+	return _auditoriumThreshold;
+}
+
+// True when +u is set and the channel is above its member threshold.
+bool Channel::isAuditorium() const
+{
+	return _auditoriumThreshold > 0 && _members.size() > _auditoriumThreshold;
+}
+
+void Channel::setModerated(bool enabled)
+{
+	_moderated = enabled;
+	touch();
+}
+
+bool Channel::isModerated() const
+{
+	return _moderated;
+}
+
+// Parse "<messages>:<seconds>[:<d|m|j>]" and start with a full bucket.
+// Returns false (and changes nothing) if the spec is malformed.
+bool Channel::setFloodLimit(const std::string& spec)
+{
+	std::vector<std::string> parts = Utils::split(spec, ':');
+	if (parts.size() < 2 || parts.size() > 3)
+	    return false;
+	for (size_t i = 0; i < 2; ++i)
+	{
+	    if (!Utils::isNumber(parts[i]) || parts[i].size() > 5)
+	        return false;
+	}
+	int messages = Utils::stringToInt(parts[0]);
+	int seconds = Utils::stringToInt(parts[1]);
+	if (messages <= 0 || seconds <= 0 || messages > FLOOD_MAX_MESSAGES || seconds > FLOOD_MAX_SECONDS)
+	    return false;
+	char action = FLOOD_ACTION_DROP;
+	if (parts.size() == 3)
+	{
+	    if (parts[2].size() != 1)
+	        return false;
+	    action = parts[2][0];
+	    if (action != FLOOD_ACTION_DROP && action != FLOOD_ACTION_MODERATE && action != FLOOD_ACTION_JOINS)
+	        return false;
+	}
+
+	_floodMessages = static_cast<size_t>(messages);
+	_floodSeconds = static_cast<size_t>(seconds);
+	_floodAction = action;
+	_floodTokens = _floodMessages;
+	_floodRefillMs = Utils::getTimeMs();
+	_joinLockUntilMs = 0;
+	touch();
+	return true;
+}
+
+void Channel::clearFloodLimit()
+{
+	_floodMessages = 0;
+	_floodSeconds = 0;
+	_joinLockUntilMs = 0;
+	touch();
+}
+
+bool Channel::hasFloodLimit() const
+{
+	return _floodMessages > 0;
+}
+
+// The +f parameter, in its canonical "messages:seconds:action" form.
+std::string Channel::getFloodLimit() const
+{
+	return Utils::intToString(static_cast<int>(_floodMessages)) + ":"
+	       + Utils::intToString(static_cast<int>(_floodSeconds))
+	       + ":" + std::string(1, _floodAction);
+}
+
+char Channel::getFloodAction() const
+{
+	return _floodAction;
+}
+
+size_t Channel::getFloodSeconds() const
+{
+	return _floodSeconds;
+}
+
+// Take one token for a message sent at `nowMs`. The bucket refills
+// continuously at _floodMessages per _floodSeconds and never holds more
+// than _floodMessages, so no more than that many lines are fanned out per
+// interval, bursts included. Returns false when the bucket is empty.
+bool Channel::consumeMessageToken(long nowMs)
+{
+	if (!hasFloodLimit())
+	    return true;
+
+	long elapsed = nowMs - _floodRefillMs;
+	if (elapsed > 0)
+	{
+	    _floodTokens += elapsed * static_cast<double>(_floodMessages) / (_floodSeconds * 1000.0);
+	    if (_floodTokens > _floodMessages)
+	        _floodTokens = _floodMessages;
+	    _floodRefillMs = nowMs;
+	}
+	if (_floodTokens < 1.0)
+	    return false;
+	_floodTokens -= 1.0;
+	return true;
+}
+
+void Channel::lockJoins(long untilMs)
+{
+	_joinLockUntilMs = untilMs;
+}
+
+bool Channel::areJoinsLocked(long nowMs) const
+{
+	return nowMs < _joinLockUntilMs;
+}
+
 
 std::string Channel::getModeString() const
 {
@@ -207,6 +541,12 @@ std::string Channel::getModeString() const
 	    modes += "k";
 	if (hasUserLimit())
 	    modes += "l";
+	if (_moderated)
+	    modes += "m";
+	if (_auditoriumThreshold > 0)
+	    modes += "u";
+	if (hasFloodLimit())
+	    modes += "f";
 
 	if (modes == "+")
 	    return "";
@@ -222,6 +562,10 @@ std::string Channel::getModeStringWithParams() const
 	    params += " " + _key;
 	if (hasUserLimit())
 	    params += " " + Utils::intToString(_userLimit);
+	if (_auditoriumThreshold > 0)
+	    params += " " + Utils::intToString(_auditoriumThreshold);
+	if (hasFloodLimit())
+	    params += " " + getFloodLimit();
 
 	return modes + params;
 }
@@ -231,12 +575,17 @@ std::string Channel::getModeStringWithParams() const
 /* ========================================================================== */
 
 // Set the topic of the channel along with the setter's nickname and the current timestamp.
-void Channel::setTopic(const std::string& topic, const std::string& setterNick)
+// `setAt` 0 means now.
+void Channel::setTopic(const std::string& topic, const std::string& setterNick, time_t setAt)
 {
+	time_t oldTime = _topicTime;
 
 	_topic = topic;
 	_topicSetter = setterNick;
-	_topicTime = std::time(NULL);  // Timestamp actuel
+	_topicTime = setAt ? setAt : std::time(NULL);  // Timestamp actuel
+	if (_registry && _topicTime != oldTime)
+	    _registry->topicTimeChanged(this, oldTime);
+	touch();
 
 }
 
@@ -271,11 +620,13 @@ time_t Channel::getTopicTime() const
 void Channel::addInvite(const std::string& nickname)
 {
 	_invitedUsers.insert(Utils::toLower(nickname));
+	touch();
 }
 
 void Channel::removeInvite(const std::string& nickname)
 {
-	_invitedUsers.erase(Utils::toLower(nickname));
+	if (_invitedUsers.erase(Utils::toLower(nickname)))
+	    touch();
 }
 
 bool Channel::isInvited(const std::string& nickname) const
@@ -283,6 +634,72 @@ bool Channel::isInvited(const std::string& nickname) const
 	return _invitedUsers.find(Utils::toLower(nickname)) != _invitedUsers.end();
 }
 
+/* ========================================================================== */
+/*                    BAN / EXCEPTION LISTS                                   */
+/* ========================================================================== */
+
+// List of mode 'b', 'e' or 'I', NULL for any other mode.
+MaskList* Channel::getMaskList(char mode)
+{
+	if (mode == 'b')
+	    return &_bans;
+	if (mode == 'e')
+	    return &_banExceptions;
+	if (mode == 'I')
+	    return &_inviteExceptions;
+	return NULL;
+}
+
+// Returns false if the mask is already listed or the list is full.
+bool Channel::addMask(char mode, const std::string& mask, const std::string& setter)
+{
+	MaskList* list = getMaskList(mode);
+	if (!list || !list->add(mask, setter, std::time(NULL)))
+	    return false;
+	_maskVersion = nextStateVersion();
+	touch();
+	return true;
+}
+
+bool Channel::removeMask(char mode, const std::string& mask)
+{
+	MaskList* list = getMaskList(mode);
+	if (!list || !list->remove(mask))
+	    return false;
+	_maskVersion = nextStateVersion();
+	touch();
+	return true;
+}
+
+// Banned and not excepted. For members the result is cached in their
+// Membership and recomputed only after a list change or a change of the
+// client (NICK), both of which move past the cached state version.
+bool Channel::isBanned(Client* client)
+{
+	if (_bans.size() == 0)
+	    return false;
+
+	int slot = findMemberSlot(client);
+	Membership* member = (slot == -1) ? NULL : &_members[_memberIndex[slot]];
+	if (member && member->banCheckVersion >= _maskVersion
+	    && member->banCheckVersion >= client->getVersion())
+	    return member->banned;
+
+	std::string subject = Utils::toLower(client->getPrefix());
+	bool banned = _bans.matches(subject) && !_banExceptions.matches(subject);
+	if (member)
+	{
+	    member->banned = banned;
+	    member->banCheckVersion = currentStateVersion();
+	}
+	return banned;
+}
+
+bool Channel::isInviteExempt(Client* client) const
+{
+	return _inviteExceptions.matches(Utils::toLower(client->getPrefix()));
+}
+
 /* ========================================================================== */
 /*                         GETTERS                                         */
 /* ========================================================================== */
@@ -292,22 +709,213 @@ const std::string& Channel::getName() const
 	return _name;
 }
 
-//Format : "@op1 user1 @op2 user2"
+time_t Channel::getCreationTime() const
+{
+	return _creationTime;
+}
+
+// The creation time is the channel timestamp of server links: the older
+// side of a netjoin keeps its modes (see Network.hpp).
+void Channel::setCreationTime(time_t ts)
+{
+	time_t oldTime = _creationTime;
+
+	_creationTime = ts;
+	if (_registry && ts != oldTime)
+	    _registry->creationTimeChanged(this, oldTime);
+	touch();
+}
+
+//Format : "@op1 user1 +voiced @op2 user2"
 std::string Channel::getNamesList() const
 {
 	std::string list;
 
-	for (std::set<Client*>::const_iterator it = _members.begin();
-	     it != _members.end(); ++it)
+	for (size_t i = 0; i < _members.size(); ++i)
 	{
 	    if (!list.empty())
 	        list += " ";
+	    list += getMemberName(i);
+	}
 
-	    if (isOperator(*it))
-	        list += "@";
+	return list;
+}
+
+// Nickname of the member at `position` with its status prefix ("@nick", "+nick").
+std::string Channel::getMemberName(size_t position) const
+{
+	const Membership& member = _members[position];
+
+	if (member.flags & MEMBER_FLAG_OP)
+	    return "@" + member.client->getNickname();
+	if (member.flags & MEMBER_FLAG_VOICE)
+	    return "+" + member.client->getNickname();
+	return member.client->getNickname();
+}
+
+ChannelHistory& Channel::getHistory()
+{
+	return _history;
+}
+
+/* ========================================================================== */
+/*                         SNAPSHOT                                           */
+/* ========================================================================== */
+
+// Set by ChannelRegistry::insert/remove.
+void Channel::setRegistry(ChannelRegistry* registry)
+{
+	_registry = registry;
+}
+
+// Mark the channel as changed. Also called when a member changes nickname.
+void Channel::touch()
+{
+	_version = nextStateVersion();
+	if (_registry && !_changeQueued)
+	    _registry->channelChanged(this);
+}
+
+unsigned long Channel::getVersion() const
+{
+	return _version;
+}
+
+void Channel::setChangeQueued(bool queued)
+{
+	_changeQueued = queued;
+}
+
+bool Channel::isChangeQueued() const
+{
+	return _changeQueued;
+}
 
-	    list += (*it)->getNickname();
+// Read-only copy for the worker threads, rebuilt only if the channel changed
+// since the last call. The caller owns one reference.
+const ChannelSnapshot* Channel::snapshot()
+{
+	if (!_snapshot || _snapshot->version != _version)
+	{
+	    ChannelSnapshot* copy = new ChannelSnapshot();
+	    copy->version = _version;
+	    copy->name = _name;
+	    copy->topic = _topic;
+	    copy->auditorium = isAuditorium();
+	    copy->memberNames.reserve(_members.size());
+	    copy->memberIds.reserve(_members.size());
+	    for (size_t i = 0; i < _members.size(); ++i)
+	    {
+	        copy->memberNames.push_back(getMemberName(i));
+	        copy->memberIds.push_back(_members[i].client->getId());
+	    }
+	    if (_snapshot)
+	        _snapshot->release();
+	    _snapshot = copy;
 	}
+	_snapshot->retain();
+	return _snapshot;
+}
 
-	return list;
-}
\ No newline at end of file
+/* ========================================================================== */
+/*                         SAVED STATE                                        */
+/* ========================================================================== */
+
+// Everything but the name, the members and the history: what UPGRADE and
+// the state file keep of a channel.
+void Channel::save(Serializer& out) const
+{
+	out.putNumber(_creationTime);
+	out.putString(_topic);
+	out.putString(_topicSetter);
+	out.putNumber(_topicTime);
+	out.putNumber(_inviteOnly);
+	out.putNumber(_topicRestricted);
+	out.putNumber(_moderated);
+	out.putString(_key);
+	out.putNumber(_userLimit);
+	out.putNumber(_auditoriumThreshold);
+	out.putString(hasFloodLimit() ? getFloodLimit() : "");
+
+	out.putNumber(_invitedUsers.size());
+	for (std::set<std::string>::const_iterator it = _invitedUsers.begin(); it != _invitedUsers.end(); ++it)
+	    out.putString(*it);
+
+	const MaskList* lists[3] = { &_bans, &_banExceptions, &_inviteExceptions };
+	for (size_t i = 0; i < 3; ++i)
+	{
+	    const std::vector<MaskList::Entry>& entries = lists[i]->getEntries();
+	    out.putNumber(entries.size());
+	    for (size_t e = 0; e < entries.size(); ++e)
+	    {
+	        out.putString(entries[e].mask);
+	        out.putString(entries[e].setter);
+	        out.putNumber(entries[e].setAt);
+	    }
+	}
+
+	out.putNumber(_restoredOperators.size());
+	for (std::set<std::string>::const_iterator it = _restoredOperators.begin();
+	     it != _restoredOperators.end(); ++it)
+	    out.putString(*it);
+}
+
+void Channel::load(Serializer& in)
+{
+	setCreationTime(in.getNumber());
+	std::string topic = in.getString();
+	std::string setter = in.getString();
+	time_t topicTime = in.getNumber();
+	if (!topic.empty())
+	    setTopic(topic, setter, topicTime);
+	setInviteOnly(in.getNumber() != 0);
+	setTopicRestricted(in.getNumber() != 0);
+	setModerated(in.getNumber() != 0);
+	setKey(in.getString());
+	setUserLimit(in.getNumber());
+	setAuditoriumThreshold(in.getNumber());
+	std::string flood = in.getString();
+	if (!flood.empty())
+	    setFloodLimit(flood);
+
+	size_t count = in.getNumber();
+	for (size_t i = 0; i < count && in.ok(); ++i)
+	    addInvite(in.getString());
+
+	MaskList* lists[3] = { &_bans, &_banExceptions, &_inviteExceptions };
+	for (size_t i = 0; i < 3; ++i)
+	{
+	    count = in.getNumber();
+	    for (size_t e = 0; e < count && in.ok(); ++e)
+	    {
+	        std::string mask = in.getString();
+	        std::string maskSetter = in.getString();
+	        lists[i]->add(mask, maskSetter, in.getNumber());
+	    }
+	}
+	_maskVersion = nextStateVersion();
+
+	count = in.getNumber();
+	for (size_t i = 0; i < count && in.ok(); ++i)
+	    addRestoredOperator(in.getString());
+}
+
+// A nick!user@host that gets operator status when it joins.
+void Channel::addRestoredOperator(const std::string& prefix)
+{
+	_restoredOperators.insert(Utils::toLower(prefix));
+	touch();
+}
+
+// nick!user@host of the local operators, lowercased (the restored ones
+// that have not come back are part of save()).
+std::vector<std::string> Channel::getOperatorMasks() const
+{
+	std::vector<std::string> masks;
+	for (size_t i = 0; i < _operatorCount; ++i)
+	{
+	    if (!_members[i].client->isRemote())
+	        masks.push_back(Utils::toLower(_members[i].client->getPrefix()));
+	}
+	return masks;
+}
@@ -0,0 +1,166 @@
+#include "IRC.hpp"
+
+size_t ChannelHistory::_totalBytes = 0;
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+ChannelHistory::ChannelHistory(size_t maxLines, size_t maxBytes)
+	: _maxLines(maxLines),
+	  _maxBytes(maxBytes),
+	  _writePos(0),
+	  _first(0),
+	  _count(0)
+{}
+
+ChannelHistory::~ChannelHistory()
+{
+	_totalBytes -= memoryUsage();
+}
+
+/* ========================================================================== */
+/*                    APPEND / QUERIES                                        */
+/* ========================================================================== */
+
+// Store a line (without CRLF). The oldest records are evicted when the line
+// limit is reached or when their bytes are about to be overwritten.
+void ChannelHistory::append(const std::string& line, unsigned long msgid, long timeMs)
+{
+	if (line.empty() || line.size() > _maxBytes || _maxLines == 0)
+	    return;
+
+	if (_arena.empty())
+	{
+	    _arena.resize(_maxBytes);
+	    _records.resize(_maxLines);
+	    _totalBytes += memoryUsage();
+	}
+
+	size_t pos = _writePos;
+	if (pos + line.size() > _arena.size())
+	{
+	    // Does not fit before the end of the arena: wrap. The records past
+	    // _writePos are the oldest ones; the tail they sit in is given up.
+	    while (_count > 0 && at(0).offset >= _writePos)
+	        dropOldest();
+	    pos = 0;
+	}
+
+	// Records sit in the arena in append order, so the ones overlapping the
+	// new line are always the oldest ones.
+	while (_count > 0)
+	{
+	    const Record& oldest = at(0);
+	    bool overlaps = oldest.offset < pos + line.size() && pos < oldest.offset + oldest.length;
+	    if (!overlaps && _count < _maxLines)
+	        break;
+	    dropOldest();
+	}
+
+	std::memcpy(&_arena[pos], line.data(), line.size());
+
+	Record& record = _records[(_first + _count) % _maxLines];
+	record.msgid = msgid;
+	record.timeMs = timeMs;
+	record.offset = pos;
+	record.length = line.size();
+	_count++;
+	_writePos = pos + line.size();
+}
+
+// The `limit` most recent messages, oldest first.
+std::vector<ChannelHistory::Entry> ChannelHistory::latest(size_t limit) const
+{
+	std::vector<Entry> result;
+	size_t start = (_count > limit) ? _count - limit : 0;
+	for (size_t i = start; i < _count; ++i)
+	    result.push_back(toEntry(at(i)));
+	return result;
+}
+
+// Up to `limit` messages strictly before a msgid (or a timestamp), oldest first.
+std::vector<ChannelHistory::Entry> ChannelHistory::before(unsigned long msgid, long timeMs,
+                                                          bool byTime, size_t limit) const
+{
+	std::vector<Entry> result;
+	size_t end = lowerBound(msgid, timeMs, byTime);
+	size_t start = (end > limit) ? end - limit : 0;
+	for (size_t i = start; i < end; ++i)
+	    result.push_back(toEntry(at(i)));
+	return result;
+}
+
+// Up to `limit` messages strictly after a msgid (or a timestamp), oldest first.
+std::vector<ChannelHistory::Entry> ChannelHistory::after(unsigned long msgid, long timeMs,
+                                                         bool byTime, size_t limit) const
+{
+	std::vector<Entry> result;
+	size_t start = lowerBound(msgid + 1, timeMs + 1, byTime);
+	for (size_t i = start; i < _count && result.size() < limit; ++i)
+	    result.push_back(toEntry(at(i)));
+	return result;
+}
+
+/* ========================================================================== */
+/*                    PRIVATE METHODS                                         */
+/* ========================================================================== */
+
+// i-th record, 0 being the oldest.
+const ChannelHistory::Record& ChannelHistory::at(size_t i) const
+{
+	return _records[(_first + i) % _maxLines];
+}
+
+void ChannelHistory::dropOldest()
+{
+	_first = (_first + 1) % _maxLines;
+	_count--;
+}
+
+ChannelHistory::Entry ChannelHistory::toEntry(const Record& record) const
+{
+	Entry entry;
+	entry.msgid = record.msgid;
+	entry.timeMs = record.timeMs;
+	entry.line.assign(&_arena[record.offset], record.length);
+	return entry;
+}
+
+// Index of the first record whose msgid (or timestamp) is >= the given one.
+size_t ChannelHistory::lowerBound(unsigned long msgid, long timeMs, bool byTime) const
+{
+	size_t low = 0;
+	size_t high = _count;
+	while (low < high)
+	{
+	    size_t mid = low + (high - low) / 2;
+	    bool less = byTime ? (at(mid).timeMs < timeMs) : (at(mid).msgid < msgid);
+	    if (less)
+	        low = mid + 1;
+	    else
+	        high = mid;
+	}
+	return low;
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+size_t ChannelHistory::size() const
+{
+	return _count;
+}
+
+// Bytes allocated by this history (0 until the first message).
+size_t ChannelHistory::memoryUsage() const
+{
+	return _arena.capacity() + _records.capacity() * sizeof(Record);
+}
+
+// Bytes allocated by the histories of every channel.
+size_t ChannelHistory::totalMemoryUsage()
+{
+	return _totalBytes;
+}
@@ -0,0 +1,378 @@
+#include "IRC.hpp"
+#include <limits>
+
+#define REGISTRY_INITIAL_SLOTS  64
+
+ChannelFilter::ChannelFilter()
+	: minUsers(0),
+	  maxUsers(static_cast<size_t>(-1)),
+	  createdFrom(0),
+	  createdTo(std::numeric_limits<time_t>::max() - 1),
+	  topicFrom(1),
+	  topicTo(std::numeric_limits<time_t>::max() - 1),
+	  bySize(false),
+	  byCreation(false),
+	  byTopic(false)
+{}
+
+bool ChannelFilter::matches(const Channel* channel) const
+{
+	if (bySize && (channel->getMemberCount() < minUsers || channel->getMemberCount() > maxUsers))
+	    return false;
+	if (byCreation && (channel->getCreationTime() < createdFrom || channel->getCreationTime() > createdTo))
+	    return false;
+	if (byTopic && (!channel->hasTopic() || channel->getTopicTime() < topicFrom
+	                || channel->getTopicTime() > topicTo))
+	    return false;
+	return true;
+}
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+ChannelRegistry::ChannelRegistry(size_t maxChannels)
+	: _count(0),
+	  _maxChannels(maxChannels)
+{
+	Slot empty;
+	empty.hash = 0;
+	empty.index = -1;
+	_slots.assign(REGISTRY_INITIAL_SLOTS, empty);
+}
+
+// The registry does not own the channels, see deleteAll().
+ChannelRegistry::~ChannelRegistry() {}
+
+/* ========================================================================== */
+/*                    LOOKUP / INSERTION                                      */
+/* ========================================================================== */
+
+// Find a channel by name, case-insensitively. Returns NULL if not found.
+Channel* ChannelRegistry::find(const std::string& name) const
+{
+	int slot = findSlot(name, Utils::hashLower(name));
+	if (slot == -1)
+	    return NULL;
+	return _entries[_slots[slot].index].channel;
+}
+
+// Insert a channel. Returns false if the server channel limit is reached.
+// The caller must make sure no channel with the same name exists.
+bool ChannelRegistry::insert(Channel* channel)
+{
+	if (isFull())
+	    return false;
+
+	// Keep the load factor under 3/4 (removed entries never occupy a slot)
+	if ((_count + 1) * 4 > _slots.size() * 3)
+	    rebuild(_slots.size() * 2);
+
+	Entry entry;
+	entry.channel = channel;
+	entry.hash = Utils::hashLower(channel->getName());
+	_entries.push_back(entry);
+
+	size_t mask = _slots.size() - 1;
+	size_t i = entry.hash & mask;
+	while (_slots[i].index != -1)
+	    i = (i + 1) & mask;
+	_slots[i].hash = entry.hash;
+	_slots[i].index = static_cast<int>(_entries.size() - 1);
+	_count++;
+
+	_bySize.insert(std::make_pair(channel->getMemberCount(), channel));
+	_byCreation.insert(std::make_pair(channel->getCreationTime(), channel));
+	_byTopic.insert(std::make_pair(channel->getTopicTime(), channel));
+	channel->setRegistry(this);
+	channelChanged(channel);
+	return true;
+}
+
+// Unlink a channel from the registry and return it (the caller deletes it).
+Channel* ChannelRegistry::remove(const std::string& name)
+{
+	int slot = findSlot(name, Utils::hashLower(name));
+	if (slot == -1)
+	    return NULL;
+
+	size_t index = _slots[slot].index;
+	Channel* channel = _entries[index].channel;
+	_entries[index].channel = NULL;
+	eraseSlot(slot);
+	_count--;
+
+	_bySize.erase(std::make_pair(channel->getMemberCount(), channel));
+	_byCreation.erase(std::make_pair(channel->getCreationTime(), channel));
+	_byTopic.erase(std::make_pair(channel->getTopicTime(), channel));
+	channel->setRegistry(NULL);
+	if (channel->isChangeQueued())
+	{
+	    _changed.erase(std::find(_changed.begin(), _changed.end(), channel));
+	    channel->setChangeQueued(false);
+	}
+
+	while (!_entries.empty() && _entries.back().channel == NULL)
+	    _entries.pop_back();
+	// Compact once removed entries outnumber live ones
+	if (_entries.size() > 2 * _count + 16)
+	    rebuild(_slots.size());
+	return channel;
+}
+
+// Delete every channel and empty the registry.
+void ChannelRegistry::deleteAll()
+{
+	for (size_t i = 0; i < _entries.size(); ++i)
+	    delete _entries[i].channel;
+	_entries.clear();
+	_bySize.clear();
+	_byCreation.clear();
+	_byTopic.clear();
+	_changed.clear();
+	_count = 0;
+	rebuild(REGISTRY_INITIAL_SLOTS);
+}
+
+/* ========================================================================== */
+/*                    CHANGED CHANNELS                                        */
+/* ========================================================================== */
+
+// Called by Channel::touch(): remember the channel once until taken, so the
+// state file only looks at the channels that changed.
+void ChannelRegistry::channelChanged(Channel* channel)
+{
+	channel->setChangeQueued(true);
+	_changed.push_back(channel);
+}
+
+// The channels changed since the last call, in the order they first changed.
+void ChannelRegistry::takeChanged(std::vector<Channel*>& out)
+{
+	out.swap(_changed);
+	_changed.clear();
+	for (size_t i = 0; i < out.size(); ++i)
+	    out[i]->setChangeQueued(false);
+}
+
+/* ========================================================================== */
+/*                    SECONDARY INDEXES                                       */
+/* ========================================================================== */
+
+void ChannelRegistry::memberCountChanged(Channel* channel, size_t oldCount)
+{
+	_bySize.erase(std::make_pair(oldCount, channel));
+	_bySize.insert(std::make_pair(channel->getMemberCount(), channel));
+}
+
+void ChannelRegistry::topicTimeChanged(Channel* channel, time_t oldTime)
+{
+	_byTopic.erase(std::make_pair(oldTime, channel));
+	_byTopic.insert(std::make_pair(channel->getTopicTime(), channel));
+}
+
+void ChannelRegistry::creationTimeChanged(Channel* channel, time_t oldTime)
+{
+	_byCreation.erase(std::make_pair(oldTime, channel));
+	_byCreation.insert(std::make_pair(channel->getCreationTime(), channel));
+}
+
+// Channels matching every range of `filter`. The ranges are walked in step
+// and the first one to run out (the smallest) is the one whose channels get
+// checked against the other conditions, so the cost follows the number of
+// candidates rather than the number of channels.
+void ChannelRegistry::select(const ChannelFilter& filter, std::vector<Channel*>& out) const
+{
+	if (!filter.bySize && !filter.byCreation && !filter.byTopic)
+	{
+	    for (iterator it = begin(); it != end(); ++it)
+	        out.push_back(*it);
+	    return;
+	}
+
+	if (filter.minUsers > filter.maxUsers || (filter.byCreation && filter.createdFrom > filter.createdTo)
+	    || (filter.byTopic && filter.topicFrom > filter.topicTo))
+	    return;
+
+	SizeIndex::const_iterator sizeIt = _bySize.lower_bound(std::make_pair(filter.minUsers, (Channel*)NULL));
+	SizeIndex::const_iterator sizeEnd = _bySize.end();
+	if (filter.maxUsers != static_cast<size_t>(-1))
+	    sizeEnd = _bySize.lower_bound(std::make_pair(filter.maxUsers + 1, (Channel*)NULL));
+
+	TimeIndex::const_iterator createdIt = _byCreation.lower_bound(std::make_pair(filter.createdFrom, (Channel*)NULL));
+	TimeIndex::const_iterator createdEnd = _byCreation.lower_bound(std::make_pair(filter.createdTo + 1, (Channel*)NULL));
+
+	TimeIndex::const_iterator topicIt = _byTopic.lower_bound(std::make_pair(filter.topicFrom, (Channel*)NULL));
+	TimeIndex::const_iterator topicEnd = _byTopic.lower_bound(std::make_pair(filter.topicTo + 1, (Channel*)NULL));
+
+	// 0: size, 1: creation, 2: topic
+	int driver = -1;
+	SizeIndex::const_iterator s = sizeIt;
+	TimeIndex::const_iterator c = createdIt;
+	TimeIndex::const_iterator t = topicIt;
+	while (driver == -1)
+	{
+	    if (filter.bySize && (s == sizeEnd || ++s == sizeEnd))
+	        driver = 0;
+	    else if (filter.byCreation && (c == createdEnd || ++c == createdEnd))
+	        driver = 1;
+	    else if (filter.byTopic && (t == topicEnd || ++t == topicEnd))
+	        driver = 2;
+	}
+
+	if (driver == 0)
+	{
+	    for (; sizeIt != sizeEnd; ++sizeIt)
+	        if (filter.matches(sizeIt->second))
+	            out.push_back(sizeIt->second);
+	}
+	else if (driver == 1)
+	{
+	    for (; createdIt != createdEnd; ++createdIt)
+	        if (filter.matches(createdIt->second))
+	            out.push_back(createdIt->second);
+	}
+	else
+	{
+	    for (; topicIt != topicEnd; ++topicIt)
+	        if (filter.matches(topicIt->second))
+	            out.push_back(topicIt->second);
+	}
+}
+
+/* ========================================================================== */
+/*                    PRIVATE METHODS                                         */
+/* ========================================================================== */
+
+// Probe for the slot holding `name`. Returns -1 if absent.
+int ChannelRegistry::findSlot(const std::string& name, unsigned int hash) const
+{
+	size_t mask = _slots.size() - 1;
+	size_t i = hash & mask;
+
+	while (_slots[i].index != -1)
+	{
+	    if (_slots[i].hash == hash &&
+	        Utils::equalsIgnoreCase(_entries[_slots[i].index].channel->getName(), name))
+	        return static_cast<int>(i);
+	    i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+// Backward-shift deletion: pull following probed entries back so that no
+// tombstone is needed and probe chains stay short.
+void ChannelRegistry::eraseSlot(size_t slot)
+{
+	size_t mask = _slots.size() - 1;
+	size_t hole = slot;
+	size_t j = slot;
+
+	_slots[hole].index = -1;
+	for (;;)
+	{
+	    j = (j + 1) & mask;
+	    if (_slots[j].index == -1)
+	        break;
+	    size_t home = _slots[j].hash & mask;
+	    bool stays = (hole <= j) ? (hole < home && home <= j)
+	                             : (hole < home || home <= j);
+	    if (!stays)
+	    {
+	        _slots[hole] = _slots[j];
+	        _slots[j].index = -1;
+	        hole = j;
+	    }
+	}
+}
+
+// Drop removed entries and rehash the live ones into `slotCount` slots.
+void ChannelRegistry::rebuild(size_t slotCount)
+{
+	std::vector<Entry> live;
+	live.reserve(_count);
+	for (size_t i = 0; i < _entries.size(); ++i)
+	{
+	    if (_entries[i].channel)
+	        live.push_back(_entries[i]);
+	}
+	_entries.swap(live);
+
+	Slot empty;
+	empty.hash = 0;
+	empty.index = -1;
+	_slots.assign(slotCount, empty);
+
+	size_t mask = slotCount - 1;
+	for (size_t e = 0; e < _entries.size(); ++e)
+	{
+	    size_t i = _entries[e].hash & mask;
+	    while (_slots[i].index != -1)
+	        i = (i + 1) & mask;
+	    _slots[i].hash = _entries[e].hash;
+	    _slots[i].index = static_cast<int>(e);
+	}
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+size_t ChannelRegistry::size() const
+{
+	return _count;
+}
+
+bool ChannelRegistry::isFull() const
+{
+	return _count >= _maxChannels;
+}
+
+ChannelRegistry::iterator ChannelRegistry::begin() const
+{
+	return iterator(&_entries, 0);
+}
+
+ChannelRegistry::iterator ChannelRegistry::end() const
+{
+	return iterator(&_entries, _entries.size());
+}
+
+/* ========================================================================== */
+/*                    ITERATOR                                                */
+/* ========================================================================== */
+
+ChannelRegistry::iterator::iterator(const std::vector<Entry>* entries, size_t pos)
+	: _entries(entries),
+	  _pos(pos)
+{
+	skipRemoved();
+}
+
+void ChannelRegistry::iterator::skipRemoved()
+{
+	while (_pos < _entries->size() && (*_entries)[_pos].channel == NULL)
+	    _pos++;
+}
+
+Channel* ChannelRegistry::iterator::operator*() const
+{
+	return (*_entries)[_pos].channel;
+}
+
+ChannelRegistry::iterator& ChannelRegistry::iterator::operator++()
+{
+	_pos++;
+	skipRemoved();
+	return *this;
+}
+
+bool ChannelRegistry::iterator::operator==(const iterator& other) const
+{
+	return _pos == other._pos;
+}
+
+bool ChannelRegistry::iterator::operator!=(const iterator& other) const
+{
+	return _pos != other._pos;
+}
@@ -0,0 +1,198 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    COMPILED MASK                                           */
+/* ========================================================================== */
+
+CompiledMask::CompiledMask(const std::string& mask)
+	: _lower(Utils::toLower(mask)),
+	  _literal(false)
+{
+	size_t first = _lower.find_first_of("*?");
+	if (first == std::string::npos)
+	{
+	    _literal = true;
+	    _prefix = _lower;
+	    return;
+	}
+	size_t last = _lower.find_last_of("*?");
+	_prefix = _lower.substr(0, first);
+	_suffix = _lower.substr(last + 1);
+	_core = _lower.substr(first, last + 1 - first);
+}
+
+bool CompiledMask::matches(const std::string& lowerSubject) const
+{
+	if (_literal)
+	    return lowerSubject == _lower;
+	if (lowerSubject.size() < _prefix.size() + _suffix.size())
+	    return false;
+	if (lowerSubject.compare(0, _prefix.size(), _prefix) != 0)
+	    return false;
+	if (lowerSubject.compare(lowerSubject.size() - _suffix.size(), _suffix.size(), _suffix) != 0)
+	    return false;
+	if (_core == "*")
+	    return true;
+	return Utils::matchMask(_core, lowerSubject.substr(_prefix.size(),
+	                        lowerSubject.size() - _prefix.size() - _suffix.size()));
+}
+
+const std::string& CompiledMask::getPrefix() const
+{
+	return _prefix;
+}
+
+const std::string& CompiledMask::getSuffix() const
+{
+	return _suffix;
+}
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR                                             */
+/* ========================================================================== */
+
+MaskList::MaskList(size_t maxEntries)
+	: _maxEntries(maxEntries)
+{}
+
+/* ========================================================================== */
+/*                    LIST MANAGEMENT                                         */
+/* ========================================================================== */
+
+// Complete a partial mask: "nick" -> "nick!*@*", "user@host" -> "*!user@host",
+// "nick!user" -> "nick!user@*".
+std::string MaskList::normalize(const std::string& mask)
+{
+	size_t bang = mask.find('!');
+	size_t at = mask.find('@');
+
+	if (bang == std::string::npos && at == std::string::npos)
+	    return mask + "!*@*";
+	if (bang == std::string::npos)
+	    return "*!" + mask;
+	if (at == std::string::npos)
+	    return mask + "@*";
+	return mask;
+}
+
+// Position of `mask` (case-insensitive), -1 if absent.
+int MaskList::find(const std::string& mask) const
+{
+	for (size_t i = 0; i < _entries.size(); ++i)
+	{
+	    if (Utils::equalsIgnoreCase(_entries[i].mask, mask))
+	        return static_cast<int>(i);
+	}
+	return -1;
+}
+
+// Returns false if the mask is already listed or the list is full.
+bool MaskList::add(const std::string& mask, const std::string& setter, time_t setAt)
+{
+	if (isFull() || find(mask) != -1)
+	    return false;
+
+	Entry entry;
+	entry.mask = mask;
+	entry.setter = setter;
+	entry.setAt = setAt;
+	_entries.push_back(entry);
+	_compiled.push_back(CompiledMask(mask));
+	indexEntry(_entries.size() - 1);
+	return true;
+}
+
+bool MaskList::remove(const std::string& mask)
+{
+	int i = find(mask);
+	if (i == -1)
+	    return false;
+	_entries.erase(_entries.begin() + i);
+	_compiled.erase(_compiled.begin() + i);
+	rebuildIndex();
+	return true;
+}
+
+/* ========================================================================== */
+/*                    MATCHING                                                */
+/* ========================================================================== */
+
+// Does any mask match `lowerSubject` (a lowercased nick!user@host)?
+bool MaskList::matches(const std::string& lowerSubject) const
+{
+	if (_entries.empty())
+	    return false;
+
+	for (size_t len = 1; len <= MASK_INDEX_KEY && len <= lowerSubject.size(); ++len)
+	{
+	    if (matchBucket(_byPrefix, lowerSubject.substr(0, len), lowerSubject)
+	        || matchBucket(_bySuffix, lowerSubject.substr(lowerSubject.size() - len), lowerSubject))
+	        return true;
+	}
+	for (size_t i = 0; i < _unindexed.size(); ++i)
+	{
+	    if (_compiled[_unindexed[i]].matches(lowerSubject))
+	        return true;
+	}
+	return false;
+}
+
+bool MaskList::matchBucket(const Index& index, const std::string& key,
+                           const std::string& lowerSubject) const
+{
+	Index::const_iterator it = index.find(key);
+	if (it == index.end())
+	    return false;
+	for (size_t i = 0; i < it->second.size(); ++i)
+	{
+	    if (_compiled[it->second[i]].matches(lowerSubject))
+	        return true;
+	}
+	return false;
+}
+
+/* ========================================================================== */
+/*                    PRIVATE METHODS                                         */
+/* ========================================================================== */
+
+// Index a mask under its longer literal end.
+void MaskList::indexEntry(size_t i)
+{
+	const std::string& prefix = _compiled[i].getPrefix();
+	const std::string& suffix = _compiled[i].getSuffix();
+
+	if (prefix.empty() && suffix.empty())
+	    _unindexed.push_back(i);
+	else if (prefix.size() >= suffix.size())
+	    _byPrefix[prefix.substr(0, MASK_INDEX_KEY)].push_back(i);
+	else
+	    _bySuffix[suffix.substr(suffix.size() - std::min(suffix.size(), (size_t)MASK_INDEX_KEY))].push_back(i);
+}
+
+void MaskList::rebuildIndex()
+{
+	_byPrefix.clear();
+	_bySuffix.clear();
+	_unindexed.clear();
+	for (size_t i = 0; i < _entries.size(); ++i)
+	    indexEntry(i);
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+const std::vector<MaskList::Entry>& MaskList::getEntries() const
+{
+	return _entries;
+}
+
+size_t MaskList::size() const
+{
+	return _entries.size();
+}
+
+bool MaskList::isFull() const
+{
+	return _entries.size() >= _maxEntries;
+}
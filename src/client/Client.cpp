@@ -6,20 +6,57 @@
 
 Client::Client(int fd, const std::string& hostname)
 	: _fd(fd),
+	  _id(0),
 	  _nickname(""),
 	  _username(""),
 	  _realname(""),
 	  _hostname(hostname),
+	  _address(0),
 	  _passwordProvided(false),
 	  _registered(false),
 	  _shouldDisconnect(false),
-      _markedForDisconnection(false)
+      _markedForDisconnection(false),
+	  _serverOperator(false),
+	  _nickTs(std::time(NULL)),
+	  _quitReason("Connection closed"),
+	  _sessionToken(""),
+	  _detachedAt(0),
+	  _connectionLost(false),
+	  _linkState(LINK_NONE),
+	  _serverName(""),
+	  _uplink(NULL),
+	  _introduced(false),
+	  _capabilities(0),
+	  _capNegotiating(false),
+	  _activeBatch(""),
+	  _batchCounter(0),
+	  _fanoutEpoch(0),
+	  _commandQueued(false),
+	  _outputClass(OUTPUT_INTERACTIVE),
+	  _sendingClass(OUTPUT_INTERACTIVE),
+	  _partialClass(-1),
+	  _sendqMax(0),
+	  _spillDir(""),
+	  _spillMemory(0),
+	  _spillMax(0),
+	  _spill(NULL),
+	  _cursorInFlight(false),
+	  _version(nextStateVersion()),
+	  _snapshot(NULL)
 {
+    static unsigned long nextId = 0;
+    _id = ++nextId;
     std::cout << "Client created (fd: " << _fd << ")" << std::endl;
 }
 
 Client::~Client()
 {
+    // A cursor on the worker pool is deleted when it comes back
+    for (size_t i = _cursorInFlight ? 1 : 0; i < _replyCursors.size(); ++i)
+        delete _replyCursors[i];
+    if (_snapshot)
+        _snapshot->release();
+    delete _spill;
     std::cout << "Client destroyed (fd: " << _fd << ")" << std::endl;
 }
 
@@ -30,6 +67,8 @@ Client::~Client()
 void Client::setNickname(const std::string& nickname)
 {
 	_nickname = nickname;
+	_nickTs = std::time(NULL);
+	touch();
 }
 
 const std::string& Client::getNickname() const
@@ -40,6 +79,7 @@ const std::string& Client::getNickname() const
 void Client::setUsername(const std::string& username)
 {
 	_username = username;
+	touch();
 }
 
 const std::string& Client::getUsername() const
@@ -50,6 +90,7 @@ const std::string& Client::getUsername() const
 void Client::setRealname(const std::string& realname)
 {
 	_realname = realname;
+	touch();
 }
 
 const std::string& Client::getRealname() const
@@ -62,6 +103,16 @@ const std::string& Client::getHostname() const
 	return _hostname;
 }
 
+void Client::setAddress(unsigned int address)
+{
+	_address = address;
+}
+
+unsigned int Client::getAddress() const
+{
+	return _address;
+}
+
 std::string Client::getPrefix() const
 {
     return _nickname + "!" + _username + "@" + _hostname;
@@ -93,6 +144,229 @@ bool Client::isRegistered() const
 void Client::setRegistered(bool value)
 {
 	_registered = value;
+	touch();
+}
+
+void Client::setServerOperator(bool oper)
+{
+	_serverOperator = oper;
+}
+
+bool Client::isServerOperator() const
+{
+	return _serverOperator;
+}
+
+// setNickname() stamps the current time; remote users keep their own.
+void Client::setNickTs(time_t ts)
+{
+	_nickTs = ts;
+}
+
+time_t Client::getNickTs() const
+{
+	return _nickTs;
+}
+
+void Client::setQuitReason(const std::string& reason)
+{
+	_quitReason = reason;
+}
+
+const std::string& Client::getQuitReason() const
+{
+	return _quitReason;
+}
+
+/* ========================================================================== */
+/*                       DETACHABLE SESSION                                   */
+/* ========================================================================== */
+
+void Client::setSessionToken(const std::string& token)
+{
+	_sessionToken = token;
+}
+
+const std::string& Client::getSessionToken() const
+{
+	return _sessionToken;
+}
+
+// The socket failed or was closed by the peer: the session may be kept.
+void Client::markConnectionLost()
+{
+	_connectionLost = true;
+	markForDisconnection();
+}
+
+bool Client::isConnectionLost() const
+{
+	return _connectionLost;
+}
+
+// Leave the socket behind. `key` stands for the fd in the client table
+// until a new connection resumes the session. The complete lines waiting
+// for the old socket wait for the new one (spilled ones are brought back
+// to memory); the rest of a line cut by the last send() is dropped, its
+// start may have reached the peer. Without `keepOutput` nothing is kept.
+void Client::detach(int key, time_t now, bool keepOutput)
+{
+	_fd = key;
+	_detachedAt = now;
+	_connectionLost = false;
+	_shouldDisconnect = false;
+	_markedForDisconnection = false;
+	_inputBuffer.clear();
+	_commandQueued = false;
+	if (keepOutput && _partialClass >= 0)
+	{
+	    std::string& buffer = _partialClass == OUTPUT_CONTROL ? _controlBuffer
+	                        : _partialClass == OUTPUT_BULK ? _bulkBuffer : _outputBuffer;
+	    size_t end = buffer.find('\n');
+	    buffer.erase(0, end == std::string::npos ? buffer.size() : end + 1);
+	}
+	while (keepOutput && _spill && _spill->pending() > 0)
+	{
+	    if (!_spill->readWindow(_outputBuffer, SPILL_WINDOW))
+	        keepOutput = false;
+	}
+	if (!keepOutput)
+	{
+	    _outputBuffer.clear();
+	    _controlBuffer.clear();
+	    _bulkBuffer.clear();
+	}
+	_outputClass = OUTPUT_INTERACTIVE;
+	_sendingClass = OUTPUT_INTERACTIVE;
+	_partialClass = -1;
+	delete _spill;
+	_spill = NULL;
+	_activeBatch.clear();
+	for (size_t i = 0; i < _replyCursors.size(); ++i)
+	    delete _replyCursors[i];
+	_replyCursors.clear();
+}
+
+void Client::attach(int fd)
+{
+	_fd = fd;
+	_detachedAt = 0;
+}
+
+bool Client::isDetached() const
+{
+	return _detachedAt != 0;
+}
+
+time_t Client::getDetachedAt() const
+{
+	return _detachedAt;
+}
+
+/* ========================================================================== */
+/*                       SERVER LINKS                                         */
+/* ========================================================================== */
+
+void Client::setLinkState(int state)
+{
+	_linkState = state;
+}
+
+int Client::getLinkState() const
+{
+	return _linkState;
+}
+
+bool Client::isServerLink() const
+{
+	return (_linkState & LINK_ESTABLISHED) != 0;
+}
+
+void Client::setServerName(const std::string& name)
+{
+	_serverName = name;
+}
+
+const std::string& Client::getServerName() const
+{
+	return _serverName;
+}
+
+void Client::setUplink(Client* link)
+{
+	_uplink = link;
+}
+
+Client* Client::getUplink() const
+{
+	return _uplink;
+}
+
+bool Client::isRemote() const
+{
+	return _uplink != NULL;
+}
+
+void Client::setIntroduced(bool introduced)
+{
+	_introduced = introduced;
+}
+
+bool Client::isIntroduced() const
+{
+	return _introduced;
+}
+
+/* ========================================================================== */
+/*                   CAPABILITIES                                           */
+/* ========================================================================== */
+
+// Enable or disable an IRCv3 capability (CAP_* bit).
+void Client::setCapability(unsigned int cap, bool enabled)
+{
+	if (enabled)
+	    _capabilities |= cap;
+	else
+	    _capabilities &= ~cap;
+}
+
+// Check if the client negotiated a capability.
+bool Client::hasCapability(unsigned int cap) const
+{
+	return (_capabilities & cap) != 0;
+}
+
+unsigned int Client::getCapabilities() const
+{
+	return _capabilities;
+}
+
+// While negotiating (CAP LS/REQ before CAP END) registration is suspended.
+void Client::setCapNegotiating(bool negotiating)
+{
+	_capNegotiating = negotiating;
+}
+
+bool Client::isCapNegotiating() const
+{
+	return _capNegotiating;
+}
+
+// Generate a new batch reference, unique for this connection.
+std::string Client::nextBatchRef()
+{
+	return "b" + Utils::intToString(static_cast<int>(++_batchCounter));
+}
+
+// While a batch is active, replies carry the @batch tag (see Server::sendToClient).
+void Client::setActiveBatch(const std::string& ref)
+{
+	_activeBatch = ref;
+}
+
+const std::string& Client::getActiveBatch() const
+{
+	return _activeBatch;
 }
 
 /* ========================================================================== */
@@ -145,31 +419,235 @@ void Client::clearInputBuffer()
 	_inputBuffer.clear();
 }
 
-// Append data to the client's output buffer.
+void Client::setCommandQueued(bool queued)
+{
+	_commandQueued = queued;
+}
+
+bool Client::isCommandQueued() const
+{
+	return _commandQueued;
+}
+
+// Append data to the client's output buffer. Past the memory budget of a
+// spilling client it goes to the spill file instead, and keeps going there
+// until the file is drained, so the order is kept. Exceeding the send
+// queue marks the client for disconnection; this may run on a fan-out
+// thread, which only touches this client.
 void Client::appendToOutputBuffer(const std::string& message)
 {
-	_outputBuffer += message;
+	bool spilled = _spill && _spill->pending() > 0;
+	if (_spillDir.empty() || _outputBuffer.empty()
+	    || (!spilled && _outputBuffer.size() + message.size() <= _spillMemory))
+	{
+	    if (_sendqMax && _spillDir.empty() && _linkState == LINK_NONE
+	        && _outputBuffer.size() + message.size() > _sendqMax)
+	    {
+	        _quitReason = "Max SendQ exceeded";
+	        markForDisconnection();
+	        return;
+	    }
+	    _outputBuffer += message;
+	    return;
+	}
+
+	if (!_spill)
+	{
+	    _spill = new SpillFile();
+	    if (!_spill->open(_spillDir))
+	    {
+	        std::cerr << "Error: cannot create a spill file in " << _spillDir << std::endl;
+	        delete _spill;
+	        _spill = NULL;
+	        _quitReason = "SendQ spill failed";
+	        markForDisconnection();
+	        return;
+	    }
+	}
+	if (_spill->pending() + message.size() > _spillMax || !_spill->append(message))
+	{
+	    _quitReason = "Max SendQ exceeded";
+	    markForDisconnection();
+	}
 }
 
-// Get the client's output buffer.
+// Get the client's output buffer (OUTPUT_INTERACTIVE).
 std::string& Client::getOutputBuffer()
 {
 	return _outputBuffer;
 }
 
-// Clear a specified number of bytes from the beginning of the output buffer.
+// Queue data in one of the output classes. Control lines are short and
+// bulk replies are produced a window at a time, so only the interactive
+// class spills or counts against the send queue.
+void Client::appendToOutput(int outputClass, const std::string& data)
+{
+	if (outputClass == OUTPUT_CONTROL)
+	    _controlBuffer += data;
+	else if (outputClass == OUTPUT_BULK)
+	    _bulkBuffer += data;
+	else
+	    appendToOutputBuffer(data);
+}
+
+// Class of the lines queued from now on (bulk replies set OUTPUT_BULK
+// while they are produced, then put OUTPUT_INTERACTIVE back).
+void Client::setOutputClass(int outputClass)
+{
+	_outputClass = outputClass;
+}
+
+int Client::getOutputClass() const
+{
+	return _outputClass;
+}
+
+// What to send next: the first non-empty class, control first. A line cut
+// by the previous send() is finished before any other class goes, so
+// lines never interleave; within a class, order is kept.
+bool Client::nextOutput(const char*& data, size_t& size)
+{
+	int outputClass = _partialClass;
+	if (outputClass < 0)
+	{
+	    for (outputClass = 0; outputClass < OUTPUT_CLASSES; ++outputClass)
+	    {
+	        if (getOutputSize(outputClass) > 0)
+	            break;
+	    }
+	    if (outputClass == OUTPUT_CLASSES)
+	        return false;
+	}
+
+	const std::string& buffer = outputClass == OUTPUT_CONTROL ? _controlBuffer
+	                          : outputClass == OUTPUT_BULK ? _bulkBuffer : _outputBuffer;
+	_sendingClass = outputClass;
+	data = buffer.data();
+	size = buffer.size();
+	if (_partialClass >= 0)
+	{
+	    size_t end = buffer.find('\n');
+	    if (end != std::string::npos)
+	        size = end + 1;
+	}
+	return size > 0;
+}
+
+// Drop the first `bytes` of what nextOutput() handed out: they were sent.
 void Client::trimOutputBuffer(size_t bytes)
 {
-	if (bytes >= _outputBuffer.size())
-	    _outputBuffer.clear();
+	std::string& buffer = _sendingClass == OUTPUT_CONTROL ? _controlBuffer
+	                    : _sendingClass == OUTPUT_BULK ? _bulkBuffer : _outputBuffer;
+	if (bytes == 0)
+	    return;
+	if (bytes >= buffer.size())
+	{
+	    buffer.clear();
+	    _partialClass = -1;
+	}
 	else
-	    _outputBuffer.erase(0, bytes);
+	{
+	    _partialClass = (buffer[bytes - 1] == '\n') ? -1 : _sendingClass;
+	    buffer.erase(0, bytes);
+	}
+
+	// The memory part is sent: bring back the next window of the spill
+	if (_outputBuffer.empty() && _spill && _spill->pending() > 0
+	    && !_spill->readWindow(_outputBuffer, SPILL_WINDOW))
+	{
+	    _quitReason = "SendQ spill failed";
+	    markForDisconnection();
+	}
 }
 
-// Check if there is data to send to the client.
+// Check if there is data to send to the client. The spill only holds
+// data while the output buffer does too.
 bool Client::hasDataToSend() const
 {
-	return !_outputBuffer.empty();
+	return !_outputBuffer.empty() || !_controlBuffer.empty() || !_bulkBuffer.empty();
+}
+
+size_t Client::getOutputSize(int outputClass) const
+{
+	if (outputClass == OUTPUT_CONTROL)
+	    return _controlBuffer.size();
+	if (outputClass == OUTPUT_BULK)
+	    return _bulkBuffer.size();
+	return _outputBuffer.size();
+}
+
+// Everything queued, in the order it would be sent (UPGRADE). The spill is
+// not included: UPGRADE waits until it is empty.
+std::string Client::getPendingOutput() const
+{
+	std::string pending;
+	const std::string* buffers[OUTPUT_CLASSES] = { &_controlBuffer, &_outputBuffer, &_bulkBuffer };
+	size_t skip[OUTPUT_CLASSES] = { 0, 0, 0 };
+	if (_partialClass >= 0)
+	{
+	    const std::string& buffer = *buffers[_partialClass];
+	    size_t end = buffer.find('\n');
+	    skip[_partialClass] = (end == std::string::npos) ? buffer.size() : end + 1;
+	    pending.append(buffer, 0, skip[_partialClass]);
+	}
+	for (int i = 0; i < OUTPUT_CLASSES; ++i)
+	    pending.append(*buffers[i], skip[i], std::string::npos);
+	return pending;
+}
+
+// Bytes waiting to be sent, in memory and on disk.
+size_t Client::getSendqSize() const
+{
+	return _outputBuffer.size() + _controlBuffer.size() + _bulkBuffer.size()
+	       + (_spill ? _spill->pending() : 0);
+}
+
+void Client::setSendqMax(size_t max)
+{
+	_sendqMax = max;
+}
+
+// Spill the send queue to a file in `dir` past `memory` bytes, up to `max`
+// bytes on disk.
+void Client::setSpill(const std::string& dir, size_t memory, size_t max)
+{
+	_spillDir = dir;
+	_spillMemory = memory;
+	_spillMax = max;
+}
+
+bool Client::isSpilling() const
+{
+	return _spill && _spill->pending() > 0;
+}
+
+// Queue a lazily produced reply behind the ones already in progress.
+void Client::addReplyCursor(ReplyCursor* cursor)
+{
+	_replyCursors.push_back(cursor);
+}
+
+// Reply being produced, or NULL.
+ReplyCursor* Client::getReplyCursor() const
+{
+	return _replyCursors.empty() ? NULL : _replyCursors.front();
+}
+
+// Drop the finished front cursor.
+void Client::popReplyCursor()
+{
+	delete _replyCursors.front();
+	_replyCursors.pop_front();
+}
+
+void Client::setCursorInFlight(bool inFlight)
+{
+	_cursorInFlight = inFlight;
+}
+
+bool Client::isCursorInFlight() const
+{
+	return _cursorInFlight;
 }
 
 /* ========================================================================== */
@@ -182,10 +660,16 @@ int Client::getFd() const
 	return _fd;
 }
 
+unsigned long Client::getId() const
+{
+	return _id;
+}
+
 // Mark the client for disconnection.
 void Client::markForDisconnection()
 {
 	_shouldDisconnect = true;
+	_markedForDisconnection = true;
 }
 
 // Check if the client is marked for disconnection.
@@ -194,3 +678,37 @@ bool Client::shouldDisconnect() const
 	return _shouldDisconnect;
 }
 
+/* ========================================================================== */
+/*                         SNAPSHOT                                           */
+/* ========================================================================== */
+
+void Client::touch()
+{
+	_version = nextStateVersion();
+}
+
+unsigned long Client::getVersion() const
+{
+	return _version;
+}
+
+// Read-only copy for the worker threads, rebuilt only if the client changed
+// since the last call. The caller owns one reference.
+const ClientSnapshot* Client::snapshot()
+{
+	if (!_snapshot || _snapshot->version != _version)
+	{
+	    ClientSnapshot* copy = new ClientSnapshot();
+	    copy->version = _version;
+	    copy->id = _id;
+	    copy->nickname = _nickname;
+	    copy->username = _username;
+	    copy->hostname = _hostname;
+	    copy->realname = _realname;
+	    if (_snapshot)
+	        _snapshot->release();
+	    _snapshot = copy;
+	}
+	_snapshot->retain();
+	return _snapshot;
+}
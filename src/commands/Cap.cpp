@@ -0,0 +1,121 @@
+#include "IRC.hpp"
+
+// Capabilities offered by the server, in CAP LS order
+static const struct
+{
+    const char*     name;
+    unsigned int    bit;
+} g_capabilities[] = {
+    { "batch",                      CAP_BATCH },
+    { "message-tags",               CAP_MESSAGE_TAGS },
+    { "draft/no-implicit-names",    CAP_NO_IMPLICIT_NAMES },
+    { "draft/chathistory",          CAP_CHATHISTORY },
+    { "draft/resume-0.5",           CAP_RESUME },           // only with session.grace_seconds
+    { "no-implicit-names",          CAP_NO_IMPLICIT_NAMES },    // alias, not advertised
+};
+
+static const size_t g_advertisedCount = 5;
+static const size_t g_capabilityCount = sizeof(g_capabilities) / sizeof(g_capabilities[0]);
+
+// Bit of a capability name, 0 if unknown.
+static unsigned int findCapability(const std::string& name)
+{
+    for (size_t i = 0; i < g_capabilityCount; ++i)
+    {
+        if (name == g_capabilities[i].name)
+            return g_capabilities[i].bit;
+    }
+    return 0;
+}
+
+// CAP LS [302] / LIST / REQ :<caps> / END
+// LS or REQ before registration suspends it until CAP END (see checkRegistration).
+void CommandHandler::handleCap(Client* client, const ParsedCommand& cmd)
+{
+    std::string nick = client->getNickname().empty() ? "*" : client->getNickname();
+    std::string prefix = ":" + _server.getServerName() + " CAP " + nick + " ";
+
+    if (cmd.params.empty())
+    {
+        sendError(client, ERR_NEEDMOREPARAMS, "CAP", "Not enough parameters");
+        return;
+    }
+
+    std::string sub = Utils::toUpper(cmd.params[0]);
+
+    if (sub == "LS")
+    {
+        if (!client->isRegistered())
+            client->setCapNegotiating(true);
+
+        std::string caps;
+        for (size_t i = 0; i < g_advertisedCount; ++i)
+        {
+            if (g_capabilities[i].bit == CAP_RESUME && !_server.sessionsEnabled())
+                continue;
+            if (!caps.empty())
+                caps += " ";
+            caps += g_capabilities[i].name;
+        }
+        _server.sendToClient(client->getFd(), prefix + "LS :" + caps);
+    }
+    else if (sub == "LIST")
+    {
+        std::string caps;
+        for (size_t i = 0; i < g_advertisedCount; ++i)
+        {
+            if (!client->hasCapability(g_capabilities[i].bit))
+                continue;
+            if (!caps.empty())
+                caps += " ";
+            caps += g_capabilities[i].name;
+        }
+        _server.sendToClient(client->getFd(), prefix + "LIST :" + caps);
+    }
+    else if (sub == "REQ")
+    {
+        if (!client->isRegistered())
+            client->setCapNegotiating(true);
+
+        std::string requested = (cmd.params.size() > 1) ? cmd.params[1] : "";
+        std::vector<std::string> names = Utils::split(requested, ' ');
+
+        // The request is applied atomically: one unknown capability NAKs everything
+        unsigned int enable = 0;
+        unsigned int disable = 0;
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            if (names[i].empty())
+                continue;
+            bool removing = (names[i][0] == '-');
+            unsigned int bit = findCapability(removing ? names[i].substr(1) : names[i]);
+            if (bit == CAP_RESUME && !_server.sessionsEnabled())
+                bit = 0;
+            if (!bit)
+            {
+                _server.sendToClient(client->getFd(), prefix + "NAK :" + requested);
+                return;
+            }
+            if (removing)
+                disable |= bit;
+            else
+                enable |= bit;
+        }
+        client->setCapability(disable, false);
+        client->setCapability(enable, true);
+        _server.sendToClient(client->getFd(), prefix + "ACK :" + requested);
+        if ((enable & CAP_RESUME) && client->getSessionToken().empty())
+            _server.openSession(client);
+    }
+    else if (sub == "END")
+    {
+        if (!client->isCapNegotiating())
+            return;
+        client->setCapNegotiating(false);
+        checkRegistration(client);
+    }
+    else
+    {
+        sendError(client, ERR_INVALIDCAPCMD, cmd.params[0], "Invalid CAP command");
+    }
+}
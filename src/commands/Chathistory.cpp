@@ -0,0 +1,102 @@
+#include "IRC.hpp"
+
+// Parse a CHATHISTORY reference: "msgid=<id>" or "timestamp=<time>".
+static bool parseHistoryRef(const std::string& ref, unsigned long& msgid, long& timeMs, bool& byTime)
+{
+    if (Utils::startsWith(ref, "msgid="))
+    {
+        std::string id = ref.substr(6);
+        if (id.empty() || !Utils::isNumber(id))
+            return false;
+        msgid = std::strtoul(id.c_str(), NULL, 10);
+        byTime = false;
+        return true;
+    }
+    if (Utils::startsWith(ref, "timestamp="))
+    {
+        timeMs = Utils::parseIsoTime(ref.substr(10));
+        byTime = true;
+        return timeMs >= 0;
+    }
+    return false;
+}
+
+// CHATHISTORY LATEST <target> <* | msgid=<id> | timestamp=<time>> <limit>
+// CHATHISTORY BEFORE|AFTER <target> <msgid=<id> | timestamp=<time>> <limit>
+// Replays channel messages, oldest first, in a "chathistory" batch.
+void CommandHandler::handleChathistory(Client* client, const ParsedCommand& cmd)
+{
+    if (cmd.params.size() < 4)
+    {
+        sendFail(client, "CHATHISTORY", "NEED_MORE_PARAMS", "", "Missing parameters");
+        return;
+    }
+
+    std::string sub = Utils::toUpper(cmd.params[0]);
+    std::string target = cmd.params[1];
+    std::string ref = cmd.params[2];
+
+    if (sub != "LATEST" && sub != "BEFORE" && sub != "AFTER")
+    {
+        sendFail(client, "CHATHISTORY", "INVALID_PARAMS", sub, "Unknown subcommand");
+        return;
+    }
+
+    Channel* channel = _server.getChannel(target);
+    if (!channel || !channel->isMember(client))
+    {
+        sendFail(client, "CHATHISTORY", "INVALID_TARGET", sub + " " + target, "No such channel");
+        return;
+    }
+
+    int limit = Utils::stringToInt(cmd.params[3]);
+    if (!Utils::isPositiveNumber(cmd.params[3]))
+    {
+        sendFail(client, "CHATHISTORY", "INVALID_PARAMS", sub + " " + cmd.params[3], "Invalid limit");
+        return;
+    }
+    if (limit > CHATHISTORY_MAX_LIMIT)
+        limit = CHATHISTORY_MAX_LIMIT;
+
+    unsigned long msgid = 0;
+    long timeMs = 0;
+    bool byTime = false;
+    bool hasRef = (sub == "LATEST" && ref == "*") ? false : true;
+    if (hasRef && !parseHistoryRef(ref, msgid, timeMs, byTime))
+    {
+        sendFail(client, "CHATHISTORY", "INVALID_PARAMS", sub + " " + ref, "Invalid message reference");
+        return;
+    }
+
+    ChannelHistory& history = channel->getHistory();
+    std::vector<ChannelHistory::Entry> entries;
+    if (sub == "LATEST" && !hasRef)
+        entries = history.latest(limit);
+    else if (sub == "LATEST")
+        entries = history.after(msgid, timeMs, byTime, history.size());
+    else if (sub == "BEFORE")
+        entries = history.before(msgid, timeMs, byTime, limit);
+    else
+        entries = history.after(msgid, timeMs, byTime, limit);
+
+    // LATEST with a reference wants the most recent messages after it
+    if (entries.size() > static_cast<size_t>(limit))
+        entries.erase(entries.begin(), entries.end() - limit);
+
+    client->setOutputClass(OUTPUT_BULK);
+    bool batched = startBatch(client, "chathistory", channel->getName());
+    bool tagged = client->hasCapability(CAP_MESSAGE_TAGS);
+    for (size_t i = 0; i < entries.size(); ++i)
+    {
+        if (tagged)
+            _server.sendToClient(client->getFd(), "@msgid="
+                                 + Utils::timestampToString(static_cast<long>(entries[i].msgid))
+                                 + ";time=" + Utils::formatIsoTime(entries[i].timeMs)
+                                 + " " + entries[i].line);
+        else
+            _server.sendToClient(client->getFd(), entries[i].line);
+    }
+    if (batched)
+        endBatch(client);
+    client->setOutputClass(OUTPUT_INTERACTIVE);
+}
@@ -19,11 +19,19 @@ void CommandHandler::handleCommand(Client* client, const std::string& rawCommand
 	if (cmd.command.empty())
 	    return;
 
+	// Established server links speak the server protocol (ServerLink.cpp)
+	if (client->isServerLink())
+	{
+	    handleLinkMessage(client, cmd);
+	    return;
+	}
+
 	std::string upperCmd = Utils::toUpper(cmd.command);
 
 	if (!client->isRegistered() &&
 	    upperCmd != "PASS" && upperCmd != "NICK" &&
-	    upperCmd != "USER" && upperCmd != "QUIT" && upperCmd != "CAP")
+	    upperCmd != "USER" && upperCmd != "QUIT" && upperCmd != "CAP"
+	    && upperCmd != "RESUME" && upperCmd != "SERVER" && upperCmd != "CAPAB" && upperCmd != "ERROR")
 	{
 	    sendError(client, ERR_NOTREGISTERED, "*", "You have not registered");
 	    return;
@@ -53,10 +61,12 @@ void CommandHandler::handleCommand(Client* client, const std::string& rawCommand
 	    handleMode(client, cmd);
 	else if (upperCmd == "QUIT")
 	    handleQuit(client, cmd);
+	else if (upperCmd == "RESUME")
+	    handleResume(client, cmd);
 	else if (upperCmd == "PING")
 	    handlePing(client, cmd);
     else if (upperCmd == "CAP")
-        return ;
+        handleCap(client, cmd);
     else if (upperCmd == "WHO" || upperCmd == "WHOIS" || upperCmd == "WHOWAS")
         handleWho(client, cmd);
 	else if (upperCmd == "BOT")
@@ -65,6 +75,32 @@ void CommandHandler::handleCommand(Client* client, const std::string& rawCommand
 	    handleNames(client, cmd);
 	else if (upperCmd == "LIST")
 		handleList(client, cmd);
+	else if (upperCmd == "CHATHISTORY")
+	    handleChathistory(client, cmd);
+	else if (upperCmd == "OPER")
+	    handleOper(client, cmd);
+	else if (upperCmd == "SEARCH")
+	    handleSearch(client, cmd);
+	else if (upperCmd == "REHASH")
+	    handleRehash(client, cmd);
+	else if (upperCmd == "UPGRADE")
+	    handleUpgrade(client, cmd);
+	else if (upperCmd == "CONNECT")
+	    handleConnect(client, cmd);
+	else if (upperCmd == "SQUIT")
+	    handleSquit(client, cmd);
+	else if (upperCmd == "LINKS")
+	    handleLinks(client, cmd);
+	else if (upperCmd == "SERVER")
+	    handleServer(client, cmd);
+	else if (upperCmd == "CAPAB" && client->getLinkState() != LINK_NONE)
+	    handleCapab(client, cmd);
+	else if (upperCmd == "ERROR" && client->getLinkState() != LINK_NONE)
+	{
+	    // A server refusing our link
+	    std::cerr << "Link error: " << (cmd.params.empty() ? "" : cmd.params[0]) << std::endl;
+	    client->markForDisconnection();
+	}
 	else
 	    sendError(client, ERR_UNKNOWNCOMMAND, upperCmd, "Unknown command");
 }
@@ -74,6 +110,17 @@ ParsedCommand CommandHandler::parseCommand(const std::string& rawCommand)
 	ParsedCommand cmd;
 	std::string line = rawCommand;
 
+	// IRCv3 message tags: "@key=value;+client-tag ..."
+	if (!line.empty() && line[0] == '@')
+	{
+	    size_t spacePos = line.find(' ');
+	    size_t restPos = line.find_first_not_of(' ', spacePos);
+	    if (restPos == std::string::npos)
+	        return cmd;
+	    cmd.tags = line.substr(1, spacePos - 1);
+	    line = line.substr(restPos);
+	}
+
 	if (!line.empty() && line[0] == ':')
 	{
 	    size_t spacePos = line.find(' ');
@@ -135,6 +182,18 @@ void CommandHandler::sendError(Client* client, const std::string& errorCode,
 	_server.sendToClient(client->getFd(), reply);
 }
 
+// IRCv3 standard reply: FAIL <command> <code> [<context>] :<message>
+void CommandHandler::sendFail(Client* client, const std::string& command, const std::string& code,
+							  const std::string& context, const std::string& message)
+{
+	std::string reply = ":" + _server.getServerName() + " FAIL " + command + " " + code;
+	if (!context.empty())
+	    reply += " " + context;
+	reply += " :" + message;
+
+	_server.sendToClient(client->getFd(), reply);
+}
+
 void CommandHandler::sendReply(Client* client, const std::string& replyCode,
 							   const std::string& params, const std::string& message)
 {
@@ -174,6 +233,64 @@ void CommandHandler::sendWelcome(Client* client)
 
 	// 004 RPL_MYINFO
 	sendReply(client, RPL_MYINFO,
-	          _server.getServerName() + " " + SERVER_VERSION + " o itkol",
+	          _server.getServerName() + " " + SERVER_VERSION + " o beIfiklmotuv",
 	          "");
-}
\ No newline at end of file
+
+	// 005 RPL_ISUPPORT
+	sendReply(client, RPL_ISUPPORT, "CHANMODES=beI,k,flu,imt EXCEPTS INVEX ELIST=CMNTU",
+	          "are supported by this server");
+}
+
+// Open a batch around a bulk reply for clients that negotiated "batch".
+// Lines sent to the client until endBatch() are tagged with @batch=<ref>.
+// Returns false when no batch was opened (no capability, or already inside one).
+bool CommandHandler::startBatch(Client* client, const std::string& type, const std::string& params)
+{
+	if (!client->hasCapability(CAP_BATCH) || !client->getActiveBatch().empty())
+	    return false;
+
+	std::string ref = client->nextBatchRef();
+	std::string line = ":" + _server.getServerName() + " BATCH +" + ref + " " + type;
+	if (!params.empty())
+	    line += " " + params;
+	_server.sendToClient(client->getFd(), line);
+	client->setActiveBatch(ref);
+	return true;
+}
+
+// Close the batch opened by startBatch(), if any.
+void CommandHandler::endBatch(Client* client)
+{
+	std::string ref = client->getActiveBatch();
+	if (ref.empty())
+	    return;
+
+	client->setActiveBatch("");
+	_server.sendToClient(client->getFd(), ":" + _server.getServerName() + " BATCH -" + ref);
+}
+
+// Deliver one window of a lazily produced reply, as bulk output. The batch is
+// opened with the first window and closed with the last; in between it is
+// only active while the window is queued, so unrelated lines are not tagged
+// with it.
+void CommandHandler::sendCursorWindow(Client* client, const AsyncReply& reply)
+{
+	ReplyCursor* cursor = reply.cursor;
+	client->setOutputClass(OUTPUT_BULK);
+	if (!cursor->isOpen())
+	{
+	    bool batched = *cursor->batchType() && startBatch(client, cursor->batchType(),
+	                                                      cursor->batchParams());
+	    cursor->open(batched ? client->getActiveBatch() : "");
+	}
+	else
+	    client->setActiveBatch(cursor->getBatchRef());
+
+	for (size_t i = 0; i < reply.lines.size(); ++i)
+	    _server.sendToClient(client->getFd(), reply.lines[i]);
+
+	if (reply.finished)
+	    endBatch(client);
+	client->setActiveBatch("");
+	client->setOutputClass(OUTPUT_INTERACTIVE);
+}
@@ -0,0 +1,27 @@
+#include "IRC.hpp"
+
+// CONNECT <host> <port>
+// Operators only: open a server link (see Network.hpp). The outcome shows
+// in the server log and in LINKS.
+void CommandHandler::handleConnect(Client* client, const ParsedCommand& cmd)
+{
+	if (!client->isServerOperator())
+	{
+	    sendError(client, ERR_NOPRIVILEGES, "", "Permission Denied- You're not an IRC operator");
+	    return;
+	}
+	if (cmd.params.size() < 2)
+	{
+	    sendError(client, ERR_NEEDMOREPARAMS, "CONNECT", "Not enough parameters");
+	    return;
+	}
+
+	std::string target = cmd.params[0] + ":" + cmd.params[1];
+	if (!_server.getNetwork().connect(target))
+	{
+	    sendFail(client, "CONNECT", "CANNOT_CONNECT", target, "Link failed (is link.password set?)");
+	    return;
+	}
+	_server.sendToClient(client->getFd(), ":" + _server.getServerName() + " NOTICE "
+	                                      + client->getNickname() + " :*** Connecting to " + target);
+}
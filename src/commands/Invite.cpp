@@ -38,6 +38,13 @@ void CommandHandler::handleInvite(Client* client, const ParsedCommand& cmd)
         sendError(client, ERR_USERONCHANNEL, targetNick + " " + channelName, "is already on channel");
         return;
     }
+    // A remote user is invited by its own server, where it will join
+    if (targetClient->isRemote())
+    {
+        _server.getNetwork().routeToUser(client, targetClient, "INVITE " + targetClient->getNickname()
+                                                               + " " + channel->getName());
+        return;
+    }
     channel->addInvite(targetClient->getNickname());
     std::string inviteMsg = ":" + client->getPrefix() + " INVITE " + targetNick + " :" + channelName;
     _server.sendToClient(targetClient->getFd(), inviteMsg);
@@ -44,18 +44,44 @@ void CommandHandler::joinSingleChannel(Client* client, const std::string& channe
          return;
      }
 
-     Channel* channel = _server.getOrCreatChannel(channelName);
-     if (!channel)
+     Channel* channel = _server.getChannel(channelName);
+     if (channel && channel->isMember(client))
+         return;
+
+     if (client->getChannels().size() >= MAX_CHANNELS_PER_USER)
      {
-         sendError(client, ERR_NOSUCHCHANNEL, channelName, "No such channel");
+         sendError(client, ERR_TOOMANYCHANNELS, channelName, "You have joined too many channels");
          return;
      }
 
-     if (channel->isMember(client))
+     // An edge relay checks the JOIN against the replica, once upstream sent it
+     Network& network = _server.getNetwork();
+     if (network.isEdge() && network.getLinks().empty())
+     {
+         sendError(client, ERR_UNAVAILRESOURCE, channelName, "Channel is temporarily unavailable");
+         return;
+     }
+     if (network.deferJoin(client, channelName, key))
          return;
 
+     if (!channel)
+         channel = _server.getOrCreatChannel(channelName);
+     if (!channel)
+     {
+         sendError(client, ERR_UNAVAILRESOURCE, channelName, "Too many channels on this server");
+         return;
+     }
 
-     if (channel->isInviteOnly() && !channel->isInvited(client->getNickname()))
+
+     // An invitation lets a banned client in
+     if (channel->isBanned(client) && !channel->isInvited(client->getNickname()))
+     {
+         sendError(client, ERR_BANNEDFROMCHAN, channelName, "Cannot join channel (+b)");
+         return;
+     }
+
+     if (channel->isInviteOnly() && !channel->isInvited(client->getNickname())
+         && !channel->isInviteExempt(client))
      {
          sendError(client, ERR_INVITEONLYCHAN, channelName, "Cannot join channel (+i)");
          return;
@@ -73,19 +99,37 @@ void CommandHandler::joinSingleChannel(Client* client, const std::string& channe
          return;
      }
 
+     // After a flood with the +f join action, only invited clients get in
+     if (channel->areJoinsLocked(Utils::getTimeMs()) && !channel->isInvited(client->getNickname()))
+     {
+         sendError(client, ERR_THROTTLE, channelName, "Cannot join channel (+f, joins throttled)");
+         return;
+     }
+
      channel->addMember(client);
      client->joinChannel(channelName);
 
      channel->removeInvite(client->getNickname());
 
      std::string joinMsg = ":" + client->getPrefix() + " JOIN " + channel->getName();
-     _server.broadcastToChannel(channelName, joinMsg, -1);  // -1 = pas d'exclusion
+     _server.broadcastMembershipChange(channel, client, joinMsg);
+     network.propagateJoin(channel, client);
 
      if (channel->hasTopic())
      {
          sendReply(client, RPL_TOPIC, channel->getName(), channel->getTopic());
      }
 
-     sendReply(client, RPL_NAMREPLY, "= " + channel->getName(), channel->getNamesList());
-     sendReply(client, RPL_ENDOFNAMES, channel->getName(), "End of /NAMES list");
+     // Clients with draft/no-implicit-names ask for NAMES themselves if they want it
+     if (client->hasCapability(CAP_NO_IMPLICIT_NAMES))
+         return;
+
+     // Auditoriums only send the first members (operators first), see NAMES <channel> <offset>
+     size_t count = channel->isAuditorium() ? AUDITORIUM_NAMES_MAX : channel->getMemberCount();
+     client->setOutputClass(OUTPUT_BULK);
+     bool batched = startBatch(client, BATCH_TYPE_NAMES, channel->getName());
+     sendNamesReply(client, channel, 0, count);
+     if (batched)
+         endBatch(client);
+     client->setOutputClass(OUTPUT_INTERACTIVE);
  }
@@ -42,6 +42,10 @@ void CommandHandler::handleKick(Client* client, const ParsedCommand& cmd)
 	std::string kickMsg = ":" + client->getPrefix() + " KICK " + channelName +
 	                      " " + targetNick + " :" + reason;
 	_server.broadcastToChannel(channelName, kickMsg, -1);
+	_server.getNetwork().announce(client);
+	_server.getNetwork().propagate(client, "KICK " + channel->getName() + " " + target->getNickname()
+	                                       + " :" + reason, channel);
+	_server.logChannelEvent(LOG_EVENT_KICK, channel, client, targetNick + " " + reason);
 
 	channel->removeMember(target);
 	target->leaveChannel(channelName);
@@ -0,0 +1,18 @@
+#include "IRC.hpp"
+
+// LINKS
+// Every server of the network with its distance in hops.
+void CommandHandler::handleLinks(Client* client, const ParsedCommand& cmd)
+{
+	(void)cmd;
+	std::vector<std::string> lines = _server.getNetwork().getServerLines();
+	for (size_t i = 0; i < lines.size(); ++i)
+	{
+	    size_t space = lines[i].find(' ');
+	    size_t hops = lines[i].find(' ', space + 1);
+	    std::string name = lines[i].substr(0, space);
+	    sendReply(client, RPL_LINKS, name + " " + _server.getServerName(),
+	              lines[i].substr(space + 1, hops - space - 1) + " " + lines[i].substr(hops + 1));
+	}
+	sendReply(client, RPL_ENDOFLINKS, "*", "End of LINKS list");
+}
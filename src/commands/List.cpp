@@ -1,42 +1,169 @@
 #include "IRC.hpp"
 
-void CommandHandler::handleList(Client* client, const ParsedCommand& cmd)
+static std::string formatListReply(const std::string& serverName, const std::string& nick,
+                                   const std::string& channelName, size_t memberCount,
+                                   const std::string& topic)
 {
-    std::vector<std::string> targets;
+    return ":" + serverName + " " + RPL_LIST + " " + nick + " " + channelName
+         + " " + Utils::intToString(memberCount) + " :" + topic;
+}
 
-    if (cmd.params.empty())
+static std::string formatListStart(const std::string& serverName, const std::string& nick)
+{
+    return ":" + serverName + " " + RPL_LISTSTART + " " + nick + " Channel :Users  Name";
+}
+
+static std::string formatListEnd(const std::string& serverName, const std::string& nick)
+{
+    return ":" + serverName + " " + RPL_LISTEND + " " + nick + " :End of /LIST";
+}
+
+// LIST without arguments, produced lazily from a server snapshot.
+class ListAllCursor : public ReplyCursor
+{
+public:
+    ListAllCursor(const ServerSnapshot* snapshot, const std::string& serverName, Client* client)
+        : ReplyCursor(snapshot, serverName, client) {}
+
+    bool fill(std::vector<std::string>& lines, size_t maxLines)
     {
-        std::map<std::string, Channel*>& chans = _server.getChannels();
-        for (std::map<std::string, Channel*>::iterator it = chans.begin(); it != chans.end(); ++it)
-            targets.push_back(it->second->getName());
+        const std::vector<const ChannelSnapshot*>& channels = _snapshot->channels;
+        if (_position == 0)
+            lines.push_back(formatListStart(_serverName, _nick));
+        for (; _position < channels.size() && lines.size() < maxLines; ++_position)
+            lines.push_back(formatListReply(_serverName, _nick, channels[_position]->name,
+                                            channels[_position]->memberNames.size(),
+                                            channels[_position]->topic));
+        if (_position < channels.size())
+            return false;
+        lines.push_back(formatListEnd(_serverName, _nick));
+        return true;
     }
+
+    const char* batchType() const { return BATCH_TYPE_LIST; }
+};
+
+// Parse one ELIST condition (">N", "<N", "C>N", "C<N", "T>N", "T<N") into
+// `filter`. Times are in minutes ago. Returns false if `token` is not one.
+static bool parseElistCondition(const std::string& token, ChannelFilter& filter, time_t now)
+{
+    size_t op = (token.size() > 1 && (token[0] == 'C' || token[0] == 'T')) ? 1 : 0;
+    if (token.size() < op + 2 || (token[op] != '<' && token[op] != '>')
+        || !Utils::isNumber(token.substr(op + 1)))
+        return false;
+
+    long value = std::atol(token.c_str() + op + 1);
+    if (value < 0)
+        return false;
+    bool above = (token[op] == '>');
+
+    if (op == 0)
+    {
+        filter.bySize = true;
+        if (above)
+            filter.minUsers = std::max(filter.minUsers, static_cast<size_t>(value) + 1);
+        else if (value == 0)
+        {
+            filter.minUsers = 1;        // "<0" matches nothing
+            filter.maxUsers = 0;
+        }
+        else
+            filter.maxUsers = std::min(filter.maxUsers, static_cast<size_t>(value) - 1);
+        return true;
+    }
+
+    // "more than N minutes ago" bounds the time from above, "less than" from below
+    time_t limit = now - static_cast<time_t>(value) * 60;
+    time_t& from = (token[0] == 'C') ? filter.createdFrom : filter.topicFrom;
+    time_t& to = (token[0] == 'C') ? filter.createdTo : filter.topicTo;
+    if (token[0] == 'C')
+        filter.byCreation = true;
+    else
+        filter.byTopic = true;
+    if (above)
+        to = std::min(to, limit - 1);
     else
+        from = std::max(from, limit + 1);
+    return true;
+}
+
+// LIST [<channels>|<ELIST conditions>]
+// Without arguments every channel is listed, lazily, on the worker pool.
+// Otherwise the comma separated tokens are channel names, masks ("#foo*"),
+// negated masks ("!#foo*") and ELIST conditions; conditions and negated
+// masks apply to every channel, names and masks are alternatives.
+void CommandHandler::handleList(Client* client, const ParsedCommand& cmd)
+{
+    if (cmd.params.empty())
+    {
+        _server.queueCursor(client, new ListAllCursor(_server.takeSnapshot(),
+                                                      _server.getServerName(), client));
+        return;
+    }
+
+    std::vector<std::string> tokens = Utils::split(cmd.params[0], ',');
+    std::vector<std::string> names;
+    std::vector<std::string> masks;
+    std::vector<std::string> excluded;
+    ChannelFilter filter;
+    time_t now = std::time(NULL);
+
+    for (size_t i = 0; i < tokens.size(); ++i)
     {
-        targets = Utils::split(cmd.params[0], ',');
+        if (tokens[i].empty() || parseElistCondition(tokens[i], filter, now))
+            continue;
+        if (tokens[i][0] == '!')
+            excluded.push_back(tokens[i].substr(1));
+        else if (tokens[i].find_first_of("*?") != std::string::npos)
+            masks.push_back(tokens[i]);
+        else
+            names.push_back(tokens[i]);
+    }
+
+    // Candidates: the named channels, or those inside the filter's ranges
+    std::vector<Channel*> candidates;
+    if (!names.empty() && masks.empty())
+    {
+        for (size_t i = 0; i < names.size(); ++i)
+        {
+            Channel* channel = _server.getChannel(names[i]);
+            if (channel && filter.matches(channel))
+                candidates.push_back(channel);
+        }
     }
+    else
+        _server.getChannels().select(filter, candidates);
+
+    client->setOutputClass(OUTPUT_BULK);
+    bool batched = startBatch(client, BATCH_TYPE_LIST, "");
 
     // 321 RPL_LISTSTART (optionnel mais utile)
-    std::string startReply = ":" + _server.getServerName() + " " + RPL_LISTSTART + " "
-                           + client->getNickname() + " Channel :Users  Name";
-    _server.sendToClient(client->getFd(), startReply);
+    _server.sendToClient(client->getFd(), formatListStart(_server.getServerName(), client->getNickname()));
 
-    for (size_t i = 0; i < targets.size(); ++i)
+    for (size_t i = 0; i < candidates.size(); ++i)
     {
-        Channel* channel = _server.getChannel(targets[i]);
-        if (!channel)
+        Channel* channel = candidates[i];
+        const std::string& name = channel->getName();
+
+        bool wanted = masks.empty() && names.empty();
+        for (size_t m = 0; !wanted && m < masks.size(); ++m)
+            wanted = Utils::matchMask(masks[m], name);
+        for (size_t n = 0; !wanted && n < names.size(); ++n)
+            wanted = Utils::equalsIgnoreCase(names[n], name);
+        for (size_t x = 0; wanted && x < excluded.size(); ++x)
+            wanted = !Utils::matchMask(excluded[x], name);
+        if (!wanted)
             continue;
 
-        std::string userCount = Utils::intToString(channel->getMemberCount());
         std::string topic = channel->hasTopic() ? channel->getTopic() : "";
-
-        std::string reply = ":" + _server.getServerName() + " " + RPL_LIST + " "
-                          + client->getNickname() + " " + channel->getName()
-                          + " " + userCount + " :" + topic;
-        _server.sendToClient(client->getFd(), reply);
+        _server.sendToClient(client->getFd(),
+                             formatListReply(_server.getServerName(), client->getNickname(),
+                                             name, channel->getMemberCount(), topic));
     }
 
     // 323 RPL_LISTEND
-    std::string endReply = ":" + _server.getServerName() + " " + RPL_LISTEND + " "
-                         + client->getNickname() + " :End of /LIST";
-    _server.sendToClient(client->getFd(), endReply);
-}
\ No newline at end of file
+    _server.sendToClient(client->getFd(), formatListEnd(_server.getServerName(), client->getNickname()));
+    if (batched)
+        endBatch(client);
+    client->setOutputClass(OUTPUT_INTERACTIVE);
+}
@@ -1,5 +1,31 @@
 #include "IRC.hpp"
 
+// 367/368, 348/349 or 346/347: the entries of one mask list, then its end.
+void CommandHandler::sendMaskList(Client* client, Channel* channel, char mode)
+{
+    const char* entryCode = RPL_BANLIST;
+    const char* endCode = RPL_ENDOFBANLIST;
+    const char* endText = "End of channel ban list";
+    if (mode == 'e')
+    {
+        entryCode = RPL_EXCEPTLIST;
+        endCode = RPL_ENDOFEXCEPTLIST;
+        endText = "End of channel exception list";
+    }
+    else if (mode == 'I')
+    {
+        entryCode = RPL_INVITELIST;
+        endCode = RPL_ENDOFINVITELIST;
+        endText = "End of channel invite list";
+    }
+
+    const std::vector<MaskList::Entry>& entries = channel->getMaskList(mode)->getEntries();
+    for (size_t i = 0; i < entries.size(); ++i)
+        sendReply(client, entryCode, channel->getName() + " " + entries[i].mask + " "
+                  + entries[i].setter + " " + Utils::intToString(entries[i].setAt), "");
+    sendReply(client, endCode, channel->getName(), endText);
+}
+
 void CommandHandler::handleMode(Client* client, const ParsedCommand& cmd)
 {
     if (cmd.params.empty())
@@ -31,6 +57,16 @@ void CommandHandler::handleMode(Client* client, const ParsedCommand& cmd)
         return;
     }
 
+    // Viewing a ban/exception list ("MODE #chan b") needs no privileges
+    std::string listMode = cmd.params[1];
+    if (!listMode.empty() && listMode[0] == '+')
+        listMode.erase(0, 1);
+    if (cmd.params.size() == 2 && listMode.size() == 1 && channel->getMaskList(listMode[0]))
+    {
+        sendMaskList(client, channel, listMode[0]);
+        return;
+    }
+
     if (!channel->isOperator(client))
     {
         sendError(client, ERR_CHANOPRIVSNEEDED, target, "You're not channel operator");
@@ -121,6 +157,102 @@ void::CommandHandler::applyModeChanges(Client* client, Channel* channel,
                 }
                 appliedModes += "o";
                 break;
+            case 'v':
+                if (paramIndex >= modeParams.size())
+                {
+                    sendError(client, ERR_NEEDMOREPARAMS, "MODE", "Not enough parameters for v");
+                    return;
+                }
+                {
+                    Client* targetClient = channel->getMemberByNickname(modeParams[paramIndex]);
+                    if (!targetClient)
+                    {
+                        sendError(client, ERR_USERNOTINCHANNEL, modeParams[paramIndex] + " " + channel->getName(),
+                                  "They aren't on that channel");
+                        return;
+                    }
+                    channel->setMemberFlag(targetClient, MEMBER_FLAG_VOICE, adding);
+                    modeParamsStr += " " + modeParams[paramIndex];
+                    paramIndex++;
+                }
+                appliedModes += "v";
+                break;
+            case 'u':
+                if (adding)
+                {
+                    if (paramIndex >= modeParams.size())
+                    {
+                        sendError(client, ERR_NEEDMOREPARAMS, "MODE", "Not enough parameters for +u");
+                        return;
+                    }
+                    int threshold = Utils::stringToInt(modeParams[paramIndex]);
+                    if (threshold <= 0)
+                    {
+                        paramIndex++;
+                        continue;
+                    }
+                    channel->setAuditoriumThreshold(static_cast<size_t>(threshold));
+                    modeParamsStr += " " + Utils::intToString(threshold);
+                    paramIndex++;
+                }
+                else
+                {
+                    channel->setAuditoriumThreshold(0);
+                }
+                appliedModes += "u";
+                break;
+            case 'm':
+                channel->setModerated(adding);
+                appliedModes += "m";
+                break;
+            case 'f':
+                if (adding)
+                {
+                    if (paramIndex >= modeParams.size())
+                    {
+                        sendError(client, ERR_NEEDMOREPARAMS, "MODE", "Not enough parameters for +f");
+                        return;
+                    }
+                    if (!channel->setFloodLimit(modeParams[paramIndex]))
+                    {
+                        sendError(client, ERR_INVALIDMODEPARAM, channel->getName() + " f " + modeParams[paramIndex],
+                                  "Expected <messages>:<seconds>[:d|m|j]");
+                        paramIndex++;
+                        continue;
+                    }
+                    modeParamsStr += " " + channel->getFloodLimit();
+                    paramIndex++;
+                }
+                else
+                {
+                    channel->clearFloodLimit();
+                }
+                appliedModes += "f";
+                break;
+            case 'b':
+            case 'e':
+            case 'I':
+                if (paramIndex >= modeParams.size())
+                {
+                    sendMaskList(client, channel, modeChar);
+                    continue;
+                }
+                {
+                    std::string mask = MaskList::normalize(modeParams[paramIndex++]);
+                    if (adding && channel->getMaskList(modeChar)->isFull())
+                    {
+                        sendError(client, ERR_BANLISTFULL, channel->getName() + " " + mask,
+                                  "Channel list is full");
+                        continue;
+                    }
+                    bool changed = adding ? channel->addMask(modeChar, mask, client->getPrefix())
+                                          : channel->removeMask(modeChar, mask);
+                    if (!changed)
+                        continue;
+                    modeParamsStr += " " + mask;
+                }
+                appliedModes += modeChar;
+                break;
             case 'l':
                 if (adding)
                 {
@@ -132,10 +264,12 @@ void::CommandHandler::applyModeChanges(Client* client, Channel* channel,
                     int limit = Utils::stringToInt(modeParams[paramIndex]);
                     if (limit <= 0)
                     {
+                        paramIndex++;
                         continue;
                     }
                     channel->setUserLimit(static_cast<size_t>(limit));
-                    appliedModes += " " + Utils::intToString(limit);
+                    modeParamsStr += " " + Utils::intToString(limit);
+                    paramIndex++;
                 }
                 else 
                 {
@@ -154,5 +288,8 @@ void::CommandHandler::applyModeChanges(Client* client, Channel* channel,
         std::string modeMsg = ":" + client->getPrefix() + " MODE " +
                               channel->getName() + " " + appliedModes + modeParamsStr;
         _server.broadcastToChannel(channel->getName(), modeMsg, -1);
+        _server.logChannelEvent(LOG_EVENT_MODE, channel, client, appliedModes + modeParamsStr);
+        _server.getNetwork().announce(client);
+        _server.getNetwork().propagateMode(channel, client, appliedModes + modeParamsStr);
     }
 }
\ No newline at end of file
@@ -1,21 +1,99 @@
 #include "IRC.hpp"
 
-void CommandHandler::handleNames(Client* client, const ParsedCommand& cmd)
+// Format RPL_NAMREPLY lines for names [offset, offset + count), split so that no
+// line carries more than NAMES_LINE_LENGTH bytes of names, then RPL_ENDOFNAMES.
+// `self` (position of the requester, or npos) is always listed. A truncated
+// listing tells the client which offset to ask for next.
+static void formatNamesReply(std::vector<std::string>& lines, const std::string& serverName,
+                             const std::string& nick, const std::string& channelName,
+                             const std::vector<std::string>& names, size_t offset, size_t count,
+                             size_t self)
 {
-    std::vector<std::string> targets;
+    size_t end = names.size();
+    if (offset > end)
+        offset = end;
+    if (count < end - offset)
+        end = offset + count;
 
-    if (cmd.params.empty())
+    std::string target = nick + " = " + channelName;
+    std::string line;
+    for (size_t i = offset; i < end; ++i)
     {
-        std::map<std::string, Channel*>& chans = _server.getChannels();
-        for (std::map<std::string, Channel*>::iterator it = chans.begin();
-             it != chans.end(); ++it)
-            targets.push_back(it->second->getName());
+        if (!line.empty() && line.size() + 1 + names[i].size() > NAMES_LINE_LENGTH)
+        {
+            lines.push_back(Utils::formatServerReply(serverName, RPL_NAMREPLY, target, line));
+            line.clear();
+        }
+        if (!line.empty())
+            line += " ";
+        line += names[i];
     }
+
+    // Always let a member see themselves, even in a truncated listing
+    if (self != std::string::npos && (self < offset || self >= end))
+        line += (line.empty() ? "" : " ") + names[self];
+
+    if (!line.empty())
+        lines.push_back(Utils::formatServerReply(serverName, RPL_NAMREPLY, target, line));
+
+    if (end < names.size())
+        lines.push_back(Utils::formatServerReply(serverName, RPL_ENDOFNAMES, nick + " " + channelName,
+                        "End of /NAMES list (truncated, NAMES " + channelName + " "
+                        + Utils::intToString(end) + " for more)"));
     else
+        lines.push_back(Utils::formatServerReply(serverName, RPL_ENDOFNAMES, nick + " " + channelName,
+                        "End of /NAMES list"));
+}
+
+// NAMES without arguments, produced lazily from a server snapshot, one
+// channel at a time.
+class NamesAllCursor : public ReplyCursor
+{
+public:
+    NamesAllCursor(const ServerSnapshot* snapshot, const std::string& serverName, Client* client)
+        : ReplyCursor(snapshot, serverName, client) {}
+
+    bool fill(std::vector<std::string>& lines, size_t maxLines)
+    {
+        const std::vector<const ChannelSnapshot*>& channels = _snapshot->channels;
+        if (channels.empty())
+        {
+            lines.push_back(Utils::formatServerReply(_serverName, RPL_ENDOFNAMES, _nick + " *",
+                                                     "End of /NAMES list"));
+            return true;
+        }
+
+        for (; _position < channels.size() && lines.size() < maxLines; ++_position)
+        {
+            const ChannelSnapshot* channel = channels[_position];
+            size_t count = channel->auditorium ? NAMES_PAGE_SIZE : channel->memberNames.size();
+            std::vector<unsigned long>::const_iterator self
+                = std::find(channel->memberIds.begin(), channel->memberIds.end(), _clientId);
+            size_t position = self == channel->memberIds.end()
+                ? std::string::npos : static_cast<size_t>(self - channel->memberIds.begin());
+            formatNamesReply(lines, _serverName, _nick, channel->name,
+                             channel->memberNames, 0, count, position);
+        }
+        return _position == channels.size();
+    }
+
+    const char* batchType() const { return _snapshot->channels.empty() ? "" : BATCH_TYPE_NAMES; }
+};
+
+// NAMES [<channels> [<offset>]]
+// With an offset, only NAMES_PAGE_SIZE members starting at that position are
+// listed. Auditoriums (+u) are always paged instead of sending every member.
+// Without arguments every channel is listed, lazily, on the worker pool.
+void CommandHandler::handleNames(Client* client, const ParsedCommand& cmd)
+{
+    if (cmd.params.empty())
     {
-        targets = Utils::split(cmd.params[0], ',');
+        _server.queueCursor(client, new NamesAllCursor(_server.takeSnapshot(),
+                                                       _server.getServerName(), client));
+        return;
     }
 
+    std::vector<std::string> targets = Utils::split(cmd.params[0], ',');
     if (targets.empty())
     {
         std::string endReply = ":" + _server.getServerName() + " " + RPL_ENDOFNAMES
@@ -24,21 +102,39 @@ void CommandHandler::handleNames(Client* client, const ParsedCommand& cmd)
         return;
     }
 
+    bool paged = (cmd.params.size() > 1 && Utils::isNumber(cmd.params[1]) && !cmd.params[1].empty());
+    size_t offset = paged ? static_cast<size_t>(std::atol(cmd.params[1].c_str())) : 0;
+
+    client->setOutputClass(OUTPUT_BULK);
+    bool batched = startBatch(client, BATCH_TYPE_NAMES, "");
     for (size_t i = 0; i < targets.size(); ++i)
     {
         Channel* channel = _server.getChannel(targets[i]);
         if (!channel)
             continue;
 
-        std::string names = channel->getNamesList(); // "@op user1 user2"
-        std::string reply = ":" + _server.getServerName() + " " + RPL_NAMREPLY + " "
-                          + client->getNickname() + " = " + channel->getName()
-                          + " :" + names;
-        _server.sendToClient(client->getFd(), reply);
-
-        std::string endReply = ":" + _server.getServerName() + " " + RPL_ENDOFNAMES
-                             + " " + client->getNickname() + " " + channel->getName()
-                             + " :End of /NAMES list";
-        _server.sendToClient(client->getFd(), endReply);
+        size_t count = channel->getMemberCount();
+        if (paged || channel->isAuditorium())
+            count = NAMES_PAGE_SIZE;
+        sendNamesReply(client, channel, offset, count);
     }
-}
\ No newline at end of file
+    if (batched)
+        endBatch(client);
+    client->setOutputClass(OUTPUT_INTERACTIVE);
+}
+
+// Send the NAMES reply of one channel for members [offset, offset + count).
+void CommandHandler::sendNamesReply(Client* client, Channel* channel, size_t offset, size_t count)
+{
+    const std::vector<Membership>& members = channel->getMembers();
+    std::vector<std::string> names;
+    names.reserve(members.size());
+    for (size_t i = 0; i < members.size(); ++i)
+        names.push_back(channel->getMemberName(i));
+
+    std::vector<std::string> lines;
+    formatNamesReply(lines, _server.getServerName(), client->getNickname(), channel->getName(),
+                     names, offset, count, channel->getMemberPosition(client));
+    for (size_t i = 0; i < lines.size(); ++i)
+        _server.sendToClient(client->getFd(), lines[i]);
+}
@@ -27,19 +27,24 @@ void CommandHandler::handleNick(Client* client, const ParsedCommand& cmd)
 
 	client->setNickname(newNick);
 
+	// Channel snapshots hold member nicknames
+	const std::set<std::string>& channels = client->getChannels();
+	for (std::set<std::string>::const_iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (channel)
+	        channel->touch();
+	}
+
 	if (client->isRegistered())
 	{
 	    std::string oldPrefix = oldNick + "!" + client->getUsername() + "@" + client->getHostname();
 	    std::string message = ":" + oldPrefix + " NICK :" + newNick;
 
-	    _server.sendToClient(client->getFd(), message);
-
-	    const std::set<std::string>& channels = client->getChannels();
-	    for (std::set<std::string>::const_iterator it = channels.begin();
-	         it != channels.end(); ++it)
-	    {
-	        _server.broadcastToChannel(*it, message, client->getFd());
-	    }
+	    _server.broadcastToNeighbours(client, message, true);
+	    if (client->isIntroduced())
+	        _server.getNetwork().sendAboutUser(client, ":" + oldNick + " NICK " + newNick + " "
+	                                           + Utils::timestampToString(client->getNickTs()), NULL);
 	}
 	else
 	{
@@ -55,7 +60,11 @@ void CommandHandler::handleNick(Client* client, const ParsedCommand& cmd)
          return;
      if (client->getUsername().empty())
          return;
+     if (client->isCapNegotiating() || client->isRegistered())
+         return;
 
      client->setRegistered(true);
      sendWelcome(client);
+     _server.getNetwork().introduceUser(client);
+     _server.openSession(client);
  }
\ No newline at end of file
@@ -13,6 +13,7 @@ void CommandHandler::handleNotice(Client* client, const ParsedCommand& cmd)
 	std::string message = cmd.params[1];
 
 	std::string fullMsg = ":" + client->getPrefix() + " NOTICE " + target + " :" + message;
+	std::string tags = parser::extractClientTags(cmd.tags);
 
 	if (target[0] == '#' || target[0] == '&' || target[0] == '+' || target[0] == '!')
 	{
@@ -23,8 +24,22 @@ void CommandHandler::handleNotice(Client* client, const ParsedCommand& cmd)
 	    if (!channel->isMember(client))
 	        return;
 
+	    if (channel->isBanned(client) && channel->getMemberFlags(client) == 0)
+	        return;
+
+	    if (channel->isModerated() && channel->getMemberFlags(client) == 0)
+	        return;
+
+	    if (!filterMessage(client, "NOTICE", target, message, tags)
+	        || !checkChannelFlood(client, channel, "NOTICE"))
+	        return;
+
 	    // Diffuser à tous les membres sauf l'expéditeur
-	    _server.broadcastToChannel(target, fullMsg, client->getFd());
+	    tags = recordChannelMessage(channel, fullMsg, tags);
+	    _server.logChannelEvent(LOG_EVENT_NOTICE, channel, client, message);
+	    _server.broadcastToChannel(target, fullMsg, client->getFd(), tags);
+	    _server.getNetwork().propagateToChannel(channel, client, "NOTICE " + channel->getName()
+	                                                             + " :" + message);
 	}
 	else
 	{
@@ -32,6 +47,12 @@ void CommandHandler::handleNotice(Client* client, const ParsedCommand& cmd)
 	    if (!recipient)
 	        return;
 
-	    _server.sendToClient(recipient->getFd(), fullMsg);
+	    if (!filterMessage(client, "NOTICE", target, message, tags))
+	        return;
+	    if (recipient->isRemote())
+	        _server.getNetwork().routeToUser(client, recipient, "NOTICE " + recipient->getNickname()
+	                                                            + " :" + message);
+	    else
+	        _server.sendTaggedToClient(recipient, fullMsg, tags);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+#include "IRC.hpp"
+
+// OPER <name> <password>
+// Operators are declared in the configuration file as "oper.<name> = <password>".
+void CommandHandler::handleOper(Client* client, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 2)
+	{
+	    sendError(client, ERR_NEEDMOREPARAMS, "OPER", "Not enough parameters");
+	    return;
+	}
+
+	const Config& config = _server.getConfig();
+	std::string key = "oper." + cmd.params[0];
+	if (!config.has(key))
+	{
+	    sendError(client, ERR_NOOPERHOST, "", "No O-lines for your host");
+	    return;
+	}
+	if (config.getString(key, "") != cmd.params[1])
+	{
+	    sendError(client, ERR_PASSWDMISMATCH, "", "Password incorrect");
+	    return;
+	}
+
+	client->setServerOperator(true);
+	sendReply(client, RPL_YOUREOPER, "", "You are now an IRC operator");
+	std::cout << client->getNickname() << " is now an operator (" << cmd.params[0] << ")" << std::endl;
+}
@@ -35,7 +35,8 @@ void CommandHandler::handlePart(Client* client, const ParsedCommand& cmd)
 	    if (!reason.empty())
 	        partMsg += " :" + reason;
 
-	    _server.broadcastToChannel(channelName, partMsg, -1);
+	    _server.broadcastMembershipChange(channel, client, partMsg);
+	    _server.getNetwork().propagate(client, "PART " + channel->getName() + " :" + reason, channel);
 
 	    channel->removeMember(client);
 	    client->leaveChannel(channelName);
@@ -14,11 +14,17 @@ void CommandHandler::handlePass(Client* client, const ParsedCommand& cmd)
 	    return;
 	}
 
+	// A peer server gives link.password before its SERVER line
+	std::string linkPassword = _server.getConfig().getString("link.password", "");
+	bool isLink = !linkPassword.empty() && cmd.params[0] == linkPassword;
+	if (isLink)
+	    client->setLinkState(client->getLinkState() | LINK_AUTHENTICATED);
+
 	if (cmd.params[0] == _server.getPassword())
 	{
 	    client->setPasswordProvided(true);
 	}
-	else
+	else if (!isLink)
 	{
 	    sendError(client, ERR_PASSWDMISMATCH, "", "Password incorrect");
 	    client->markForDisconnection();
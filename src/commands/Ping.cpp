@@ -11,5 +11,6 @@ void CommandHandler::handlePing(Client* client, const ParsedCommand& cmd)
 	if (!token.empty())
 	    pongMsg += " :" + token;
 
-	_server.sendToClient(client->getFd(), pongMsg);
+	// Ahead of any backlog, so keepalives do not time out behind it
+	_server.sendToClient(client->getFd(), pongMsg, OUTPUT_CONTROL);
 }
\ No newline at end of file
@@ -19,6 +19,7 @@ void CommandHandler::handlePrivmsg(Client* client, const ParsedCommand& cmd)
 	std::string message = cmd.params[1];
 
 	std::string fullMsg = ":" + client->getPrefix() + " PRIVMSG " + target + " :" + message;
+	std::string tags = parser::extractClientTags(cmd.tags);
 
 	if (target[0] == '#' || target[0] == '&' || target[0] == '+' || target[0] == '!')
 	{
@@ -35,8 +36,29 @@ void CommandHandler::handlePrivmsg(Client* client, const ParsedCommand& cmd)
 	        return;
 	    }
 
+	    // Banned members stay silent unless they are operator or voiced
+	    if (channel->isBanned(client) && channel->getMemberFlags(client) == 0)
+	    {
+	        sendError(client, ERR_CANNOTSENDTOCHAN, target, "Cannot send to channel (+b)");
+	        return;
+	    }
+
+	    if (channel->isModerated() && channel->getMemberFlags(client) == 0)
+	    {
+	        sendError(client, ERR_CANNOTSENDTOCHAN, target, "Cannot send to channel (+m)");
+	        return;
+	    }
+
+	    if (!filterMessage(client, "PRIVMSG", target, message, tags)
+	        || !checkChannelFlood(client, channel, "PRIVMSG"))
+	        return;
+
 	    // Diffuser à tous les membres sauf l'expéditeur
-	    _server.broadcastToChannel(target, fullMsg, client->getFd());
+	    tags = recordChannelMessage(channel, fullMsg, tags);
+	    _server.logChannelEvent(LOG_EVENT_PRIVMSG, channel, client, message);
+	    _server.broadcastToChannel(target, fullMsg, client->getFd(), tags);
+	    _server.getNetwork().propagateToChannel(channel, client, "PRIVMSG " + channel->getName()
+	                                                             + " :" + message);
 	}
 	else
 	{
@@ -47,6 +69,108 @@ void CommandHandler::handlePrivmsg(Client* client, const ParsedCommand& cmd)
 	        return;
 	    }
 
-	    _server.sendToClient(recipient->getFd(), fullMsg);
+	    if (!filterMessage(client, "PRIVMSG", target, message, tags))
+	        return;
+	    if (recipient->isRemote())
+	        _server.getNetwork().routeToUser(client, recipient, "PRIVMSG " + recipient->getNickname()
+	                                                            + " :" + message);
+	    else
+	        _server.sendTaggedToClient(recipient, fullMsg, tags);
 	}
-}
\ No newline at end of file
+}
+
+// Store a channel message in the channel history and return the tags to
+// deliver with it (msgid and time, followed by the relayed client tags).
+std::string CommandHandler::recordChannelMessage(Channel* channel, const std::string& line,
+                                                 const std::string& clientTags)
+{
+	unsigned long msgid = _server.nextMsgId();
+	long now = Utils::getTimeMs();
+
+	channel->getHistory().append(line, msgid, now);
+
+	std::string tags = "msgid=" + Utils::timestampToString(static_cast<long>(msgid))
+	                 + ";time=" + Utils::formatIsoTime(now);
+	if (!clientTags.empty())
+	    tags += ";" + clientTags;
+	return tags;
+}
+
+// Run the repeat detector and the spam filter over a PRIVMSG/NOTICE text,
+// before any fan-out. Returns true if the message is to be delivered, with
+// the spam tag added to `tags` if the matching pattern asks for it.
+// Messages of muted sources and lines sent to too many targets server-wide
+// are dropped (operators are exempt). Blocked PRIVMSGs are answered with a
+// FAIL; quarantined messages are silently withheld and shown to operators.
+bool CommandHandler::filterMessage(Client* client, const std::string& command,
+                                   const std::string& target, const std::string& text,
+                                   std::string& tags)
+{
+	if (!client->isServerOperator())
+	{
+	    RepeatDetector& detector = _server.getRepeatDetector();
+	    int verdict = detector.check(client->getId(), Utils::toLower(target), text,
+	                                 Utils::getTimeMs());
+	    if (verdict == REPEAT_MUTE)
+	    {
+	        std::string seconds = Utils::intToString(detector.getMuteSeconds());
+	        _server.sendToClient(client->getFd(), ":" + _server.getServerName() + " NOTICE "
+	                             + client->getNickname() + " :*** You are muted for " + seconds
+	                             + " seconds (repeated messages)");
+	        _server.noticeOperators("Muted " + client->getPrefix() + " for " + seconds
+	                                + " seconds (repeated messages)");
+	    }
+	    else if (verdict == REPEAT_DROP && command == "PRIVMSG")
+	        sendFail(client, command, "MESSAGE_BLOCKED", target,
+	                 "Message sent to too many targets on this server");
+	    if (verdict != REPEAT_PASS)
+	        return false;
+	}
+
+	std::string pattern;
+	int action = _server.getSpamFilter().scan(text, &pattern);
+
+	if (action == SPAM_ACTION_TAG)
+	    tags += (tags.empty() ? "" : ";") + std::string(SPAM_TAG);
+	else if (action == SPAM_ACTION_QUARANTINE)
+	    _server.noticeOperators("Quarantined " + command + " from " + client->getPrefix()
+	                            + " to " + target + " (" + pattern + "): " + text);
+	else if (action == SPAM_ACTION_BLOCK && command == "PRIVMSG")
+	    sendFail(client, command, "MESSAGE_BLOCKED", target, "Message blocked by the spam filter");
+
+	return action == SPAM_ACTION_NONE || action == SPAM_ACTION_TAG;
+}
+
+// Take a token from the channel's +f bucket before a message is fanned out.
+// Channel operators are exempt. When the bucket is empty the message is
+// dropped and the channel's flood action applies: +m is set, or joins are
+// refused for one interval. Returns true if the message may be delivered.
+bool CommandHandler::checkChannelFlood(Client* client, Channel* channel, const std::string& command)
+{
+	if (!channel->hasFloodLimit() || channel->isOperator(client))
+	    return true;
+
+	long now = Utils::getTimeMs();
+	if (channel->consumeMessageToken(now))
+	    return true;
+
+	char action = channel->getFloodAction();
+	if (action == FLOOD_ACTION_MODERATE && !channel->isModerated())
+	{
+	    channel->setModerated(true);
+	    _server.broadcastToChannel(channel->getName(), ":" + _server.getServerName() + " MODE "
+	                               + channel->getName() + " +m", -1);
+	    _server.getNetwork().propagateMode(channel, NULL, "+m");
+	    _server.noticeOperators("Flood on " + channel->getName() + ", set +m");
+	}
+	else if (action == FLOOD_ACTION_JOINS && !channel->areJoinsLocked(now))
+	{
+	    channel->lockJoins(now + static_cast<long>(channel->getFloodSeconds()) * 1000);
+	    _server.noticeOperators("Flood on " + channel->getName() + ", joins throttled for "
+	                            + Utils::intToString(static_cast<int>(channel->getFloodSeconds())) + " seconds");
+	}
+
+	if (command == "PRIVMSG")
+	    sendError(client, ERR_CANNOTSENDTOCHAN, channel->getName(), "Cannot send to channel (+f)");
+	return false;
+}
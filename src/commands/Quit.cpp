@@ -8,16 +8,12 @@ void CommandHandler::handleQuit(Client* client, const ParsedCommand& cmd)
 
 	std::string quitMsg = ":" + client->getPrefix() + " QUIT :" + reason;
 
-	const std::set<std::string>& channels = client->getChannels();
-	for (std::set<std::string>::const_iterator it = channels.begin();
-	     it != channels.end(); ++it)
-	{
-	    _server.broadcastToChannel(*it, quitMsg, client->getFd());
-	}
+	_server.broadcastToNeighbours(client, quitMsg, false);
+	client->setQuitReason(reason);      // for the other servers, see Server::disconnectClient
 
 	std::string errorMsg = "ERROR :Closing Link: " + client->getHostname() +
 	                       " (Quit: " + reason + ")";
-	_server.sendToClient(client->getFd(), errorMsg);
+	_server.sendToClient(client->getFd(), errorMsg, OUTPUT_CONTROL);
 
 	client->markForDisconnection();
 }
\ No newline at end of file
@@ -0,0 +1,23 @@
+#include "IRC.hpp"
+
+// REHASH
+// Operators only: reload the configuration file and the spam filter patterns.
+void CommandHandler::handleRehash(Client* client, const ParsedCommand& cmd)
+{
+	(void)cmd;
+	if (!client->isServerOperator())
+	{
+	    sendError(client, ERR_NOPRIVILEGES, "", "Permission Denied- You're not an IRC operator");
+	    return;
+	}
+
+	std::string path = _server.getConfig().getPath();
+	if (!_server.rehash())
+	{
+	    sendFail(client, "REHASH", "CANNOT_RELOAD", path, "Configuration or spam filter file could not be read");
+	    return;
+	}
+	sendReply(client, RPL_REHASHING, path.empty() ? "-" : path, "Rehashing");
+	std::cout << client->getNickname() << " rehashed the server ("
+	          << _server.getSpamFilter().size() << " spam filter patterns)" << std::endl;
+}
@@ -0,0 +1,28 @@
+#include "IRC.hpp"
+
+// RESUME <token>
+// Sent instead of NICK/USER by a draft/resume client reconnecting after its
+// connection dropped: the session it had (nick, channels, modes, what was
+// sent to it meanwhile) moves to this connection, see Server::resumeSession.
+void CommandHandler::handleResume(Client* client, const ParsedCommand& cmd)
+{
+	if (client->isRegistered())
+	{
+	    sendFail(client, "RESUME", "REGISTRATION_IS_COMPLETED", "", "Cannot resume once registered");
+	    return;
+	}
+	if (cmd.params.empty())
+	{
+	    sendError(client, ERR_NEEDMOREPARAMS, "RESUME", "Not enough parameters");
+	    return;
+	}
+	if (!client->hasPasswordProvided())
+	{
+	    sendError(client, ERR_PASSWDMISMATCH, "", "Password required");
+	    return;
+	}
+
+	// On success `client` is gone: its socket belongs to the session
+	if (!_server.resumeSession(client, cmd.params[0]))
+	    sendFail(client, "RESUME", "INVALID_TOKEN", "", "Cannot resume connection, token is invalid");
+}
@@ -0,0 +1,134 @@
+#include "IRC.hpp"
+
+static const char* eventName(int type)
+{
+    switch (type)
+    {
+        case LOG_EVENT_PRIVMSG: return "PRIVMSG";
+        case LOG_EVENT_NOTICE:  return "NOTICE";
+        case LOG_EVENT_TOPIC:   return "TOPIC";
+        case LOG_EVENT_KICK:    return "KICK";
+        case LOG_EVENT_MODE:    return "MODE";
+    }
+    return "*";
+}
+
+// "key=..." with a SEARCH filter key. The words are an empty trailing
+// parameter when only filters are given, and the parser drops those.
+static bool isSearchFilter(const std::string& param)
+{
+    size_t equal = param.find('=');
+    if (equal == std::string::npos)
+        return false;
+    std::string key = Utils::toLower(param.substr(0, equal));
+    return key == "channel" || key == "nick" || key == "after" || key == "before" || key == "offset";
+}
+
+// SEARCH [channel=<chan>] [nick=<nick>] [after=<time>] [before=<time>] [offset=<n>] :[<words>]
+// Operator only. Finds logged channel events containing every word, newest
+// first, SEARCH_PAGE_SIZE at a time. Without words, every event matching
+// the filters is listed; at least one word or one filter is required. The
+// query runs on the search thread; the replies are sent by
+// sendSearchResult() once it is done.
+void CommandHandler::handleSearch(Client* client, const ParsedCommand& cmd)
+{
+    if (!client->isServerOperator())
+    {
+        sendError(client, ERR_NOPRIVILEGES, "", "Permission Denied- You're not an IRC operator");
+        return;
+    }
+
+    SearchIndex* index = _server.getSearchIndex();
+    if (!index)
+    {
+        sendFail(client, "SEARCH", "UNAVAILABLE", "", "Channel logging is disabled");
+        return;
+    }
+
+    if (cmd.params.empty())
+    {
+        sendError(client, ERR_NEEDMOREPARAMS, "SEARCH", "Not enough parameters");
+        return;
+    }
+
+    SearchQuery query;
+    query.clientId = client->getId();
+    query.fd = client->getFd();
+    query.afterMs = -1;
+    query.beforeMs = -1;
+    query.offset = 0;
+    query.limit = SEARCH_PAGE_SIZE;
+
+    size_t filters = cmd.params.size() - 1;
+    if (isSearchFilter(cmd.params.back()))
+        filters = cmd.params.size();
+
+    for (size_t i = 0; i < filters; ++i)
+    {
+        const std::string& param = cmd.params[i];
+        size_t equal = param.find('=');
+        std::string key = Utils::toLower(param.substr(0, equal));
+        std::string value = equal == std::string::npos ? "" : param.substr(equal + 1);
+
+        bool valid = !value.empty();
+        if (valid && key == "channel")
+            query.channel = value;
+        else if (valid && key == "nick")
+            query.nick = value;
+        else if (valid && key == "after")
+            valid = (query.afterMs = Utils::parseIsoTime(value)) >= 0;
+        else if (valid && key == "before")
+            valid = (query.beforeMs = Utils::parseIsoTime(value)) >= 0;
+        else if (valid && key == "offset" && Utils::isNumber(value))
+            query.offset = std::strtoul(value.c_str(), NULL, 10);
+        else
+            valid = false;
+
+        if (!valid)
+        {
+            sendFail(client, "SEARCH", "INVALID_PARAMS", param, "Invalid search filter");
+            return;
+        }
+    }
+
+    if (filters < cmd.params.size())
+    {
+        const std::string& words = cmd.params.back();
+        SearchIndex::tokenize(words.data(), words.size(), query.terms);
+    }
+    if (query.terms.empty() && query.channel.empty() && query.nick.empty()
+        && query.afterMs < 0 && query.beforeMs < 0)
+    {
+        sendFail(client, "SEARCH", "INVALID_PARAMS", "", "Nothing to search for");
+        return;
+    }
+
+    index->submit(query);
+}
+
+// RPL_SEARCHRESULT <channel> <nick> <time> <event> :<text> for each hit, then
+// RPL_ENDOFSEARCH with the offset of the next page when there is one.
+void CommandHandler::sendSearchResult(Client* client, const SearchResult& result)
+{
+    client->setOutputClass(OUTPUT_BULK);
+    bool batched = startBatch(client, BATCH_TYPE_SEARCH, "");
+    for (size_t i = 0; i < result.hits.size(); ++i)
+    {
+        const SearchHit& hit = result.hits[i];
+        sendReply(client, RPL_SEARCHRESULT,
+                  hit.channel + " " + hit.nick + " " + Utils::formatIsoTime(hit.timeMs)
+                  + " " + eventName(hit.type),
+                  hit.text);
+    }
+
+    std::string count = Utils::intToString(static_cast<int>(result.hits.size()));
+    if (result.more)
+        sendReply(client, RPL_ENDOFSEARCH, count + " offset="
+                  + Utils::intToString(static_cast<int>(result.offset + result.hits.size())),
+                  "More results available");
+    else
+        sendReply(client, RPL_ENDOFSEARCH, count, "End of SEARCH");
+    if (batched)
+        endBatch(client);
+    client->setOutputClass(OUTPUT_INTERACTIVE);
+}
@@ -0,0 +1,796 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    HELPERS                                                 */
+/* ========================================================================== */
+
+// The remote user a link line comes from; NULL if unknown or if it is not
+// behind this link (a stale line from before a collision or a split).
+static Client* linkSource(Network& network, Client* link, const std::string& prefix)
+{
+	Client* user = network.findUser(prefix);
+	if (!user || user->getUplink() != link)
+	    return NULL;
+	return user;
+}
+
+// Prefix shown to local clients: nick!user@host for users, else the server name.
+static std::string displayPrefix(Network& network, const std::string& prefix)
+{
+	Client* user = network.findUser(prefix);
+	return user ? user->getPrefix() : prefix;
+}
+
+static std::string joinParams(const std::vector<std::string>& params, size_t first, size_t end)
+{
+	std::string joined;
+	for (size_t i = first; i < end; ++i)
+	    joined += (i == first ? "" : " ") + params[i];
+	return joined;
+}
+
+/* ========================================================================== */
+/*                    HANDSHAKE                                               */
+/* ========================================================================== */
+
+// SERVER <name> <hops> :<description>
+// Sent by a peer after PASS <link.password>. An incoming link gets our own
+// PASS/SERVER in return, then both sides send their burst.
+void CommandHandler::handleServer(Client* client, const ParsedCommand& cmd)
+{
+	if (client->isRegistered())
+	{
+	    sendError(client, ERR_ALREADYREGISTERED, "", "You may not reregister");
+	    return;
+	}
+	if (cmd.params.size() < 3)
+	{
+	    sendError(client, ERR_NEEDMOREPARAMS, "SERVER", "Not enough parameters");
+	    return;
+	}
+
+	Network& network = _server.getNetwork();
+	const std::string& name = cmd.params[0];
+	std::string error;
+	if (!(client->getLinkState() & LINK_AUTHENTICATED))
+	    error = "Bad link password";
+	else if (name.empty() || name.find_first_of("!@*?,") != std::string::npos)
+	    error = "Bad server name";
+	else if (network.hasServer(name))
+	    error = "Server " + name + " already exists";
+	else if (network.isEdge() && !(client->getLinkState() & LINK_OUTGOING))
+	    error = "Edge relays take no links";
+	if (!error.empty())
+	{
+	    _server.sendToClient(client->getFd(), "ERROR :" + error);
+	    client->markForDisconnection();
+	    std::cerr << "Link refused (" << name << "): " << error << std::endl;
+	    return;
+	}
+
+	if (!(client->getLinkState() & LINK_OUTGOING))
+	{
+	    const Config& config = _server.getConfig();
+	    _server.sendToClient(client->getFd(), "PASS " + config.getString("link.password", ""));
+	    _server.sendToClient(client->getFd(), "SERVER " + _server.getServerName() + " 1 :"
+	                                          + config.getString("server.description", SERVER_NAME));
+	}
+	network.linkEstablished(client, name, cmd.params[2]);
+}
+
+// CAPAB :<capabilities>
+// Sent by a peer between PASS and SERVER. RELAY: it is an edge relay.
+void CommandHandler::handleCapab(Client* client, const ParsedCommand& cmd)
+{
+	if (client->isRegistered() || cmd.params.empty())
+	    return;
+	std::vector<std::string> capabilities = Utils::split(cmd.params[0], ' ');
+	for (size_t i = 0; i < capabilities.size(); ++i)
+	{
+	    if (Utils::toUpper(capabilities[i]) == "RELAY")
+	        client->setLinkState(client->getLinkState() | LINK_RELAY);
+	}
+}
+
+/* ========================================================================== */
+/*                    DISPATCH                                                */
+/* ========================================================================== */
+
+// Lines of an established link. Every handler applies the change locally,
+// shows it to the local clients concerned and forwards it to the other
+// links; malformed or stale lines are dropped silently.
+void CommandHandler::handleLinkMessage(Client* link, const ParsedCommand& cmd)
+{
+	std::string command = Utils::toUpper(cmd.command);
+
+	if (command == "PING")
+	    _server.sendToClient(link->getFd(), ":" + _server.getServerName() + " PONG "
+	                                        + _server.getServerName() + " :"
+	                                        + (cmd.params.empty() ? "" : cmd.params[0]), OUTPUT_CONTROL);
+	else if (command == "PONG")
+	    return;
+	else if (command == "ERROR")
+	{
+	    std::cerr << "Link error from " << link->getServerName() << ": "
+	              << (cmd.params.empty() ? "" : cmd.params[0]) << std::endl;
+	    link->markForDisconnection();
+	}
+	else if (command == "SERVER")
+	    linkServer(link, cmd);
+	else if (command == "NICK")
+	    linkNick(link, cmd);
+	else if (command == "QUIT")
+	    linkQuit(link, cmd);
+	else if (command == "KILL")
+	    linkKill(link, cmd);
+	else if (command == "SQUIT")
+	    linkSquit(link, cmd);
+	else if (command == "SJOIN")
+	    linkSjoin(link, cmd);
+	else if (command == "BMASK")
+	    linkBmask(link, cmd);
+	else if (command == "PART")
+	    linkPart(link, cmd);
+	else if (command == "KICK")
+	    linkKick(link, cmd);
+	else if (command == "TMODE")
+	    linkTmode(link, cmd);
+	else if (command == "TOPIC")
+	    linkTopic(link, cmd);
+	else if (command == "PRIVMSG" || command == "NOTICE")
+	    linkMessage(link, cmd);
+	else if (command == "INVITE")
+	    linkInvite(link, cmd);
+	else if (command == "RSUB")
+	    linkRsub(link, cmd);
+	else if (command == "RUNSUB")
+	    linkRunsub(link, cmd);
+}
+
+/* ========================================================================== */
+/*                    SERVERS AND USERS                                       */
+/* ========================================================================== */
+
+// :<uplink> SERVER <name> <hops> :<description>
+void CommandHandler::linkServer(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 3)
+	    return;
+
+	Network& network = _server.getNetwork();
+	const std::string& name = cmd.params[0];
+	if (network.hasServer(name))
+	{
+	    // Known through another path: the tree has a loop, drop this link
+	    _server.sendToClient(link->getFd(), "ERROR :Server " + name + " already exists");
+	    link->markForDisconnection();
+	    return;
+	}
+
+	int hops = Utils::stringToInt(cmd.params[1]);
+	std::string uplink = cmd.prefix.empty() ? link->getServerName() : cmd.prefix;
+	network.addServer(name, cmd.params[2], hops, uplink, link);
+	network.sendToLinks(":" + uplink + " SERVER " + name + " " + Utils::intToString(hops + 1)
+	                    + " :" + cmd.params[2], link, true);
+}
+
+// :<server> NICK <nick> <ts> <user> <host> <server> :<realname>   (new user)
+// :<nick> NICK <newnick> <ts>                                      (nick change)
+// On a collision the nickname stays with whoever took it first; on a tie
+// both users are killed.
+void CommandHandler::linkNick(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	const std::string& me = _server.getServerName();
+
+	if (cmd.params.size() >= 6)
+	{
+	    const std::string& nick = cmd.params[0];
+	    time_t ts = std::atol(cmd.params[1].c_str());
+	    if (!network.hasServer(cmd.params[4]) || !parser::isValidNickname(nick))
+	        return;
+
+	    Client* existing = _server.getClientByNickname(nick);
+	    if (existing)
+	    {
+	        if (existing->getNickTs() <= ts)
+	        {
+	            _server.sendToClient(link->getFd(), ":" + me + " KILL " + nick + " :Nick collision");
+	            if (existing->getNickTs() == ts)
+	                killUser(existing, me, "Nick collision", link);
+	            return;
+	        }
+	        killUser(existing, me, "Nick collision", link);
+	    }
+
+	    Client* user = network.addUser(nick, ts, cmd.params[2], cmd.params[3], cmd.params[4],
+	                                   cmd.params[5], link);
+	    network.sendToLinks(":" + cmd.params[4] + " NICK " + nick + " " + cmd.params[1] + " "
+	                        + user->getUsername() + " " + user->getHostname() + " "
+	                        + cmd.params[4] + " :" + user->getRealname(), link);
+	    return;
+	}
+
+	Client* source = linkSource(network, link, cmd.prefix);
+	if (!source || cmd.params.empty() || !parser::isValidNickname(cmd.params[0]))
+	    return;
+	const std::string& newNick = cmd.params[0];
+	time_t ts = (cmd.params.size() > 1) ? std::atol(cmd.params[1].c_str()) : std::time(NULL);
+
+	Client* existing = _server.getClientByNickname(newNick);
+	if (existing && existing != source)
+	{
+	    if (existing->getNickTs() <= ts)
+	    {
+	        // The renamed user loses: gone on its side by KILL, on ours by QUIT
+	        _server.sendToClient(link->getFd(), ":" + me + " KILL " + newNick + " :Nick collision");
+	        network.sendAboutUser(source, ":" + source->getNickname() + " QUIT :Nick collision", link);
+	        network.removeUser(source, "Nick collision");
+	        if (existing->getNickTs() == ts)
+	            killUser(existing, me, "Nick collision", link);
+	        return;
+	    }
+	    killUser(existing, me, "Nick collision", link);
+	}
+
+	std::string line = ":" + source->getNickname() + " NICK " + newNick + " "
+	                 + Utils::timestampToString(ts);
+	network.sendAboutUser(source, line, link);
+	network.renameUser(source, newNick, ts);
+}
+
+// :<nick> QUIT :<reason>
+void CommandHandler::linkQuit(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	Client* source = linkSource(network, link, cmd.prefix);
+	if (!source)
+	    return;
+
+	std::string reason = cmd.params.empty() ? "" : cmd.params[0];
+	network.sendAboutUser(source, ":" + source->getNickname() + " QUIT :" + reason, link);
+	network.removeUser(source, reason);
+}
+
+// :<source> KILL <nick> :<reason>
+void CommandHandler::linkKill(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.empty())
+	    return;
+	Client* victim = _server.getClientByNickname(cmd.params[0]);
+	if (!victim || victim->getUplink() == link)
+	    return;
+	killUser(victim, cmd.prefix.empty() ? link->getServerName() : cmd.prefix,
+	         cmd.params.size() > 1 ? cmd.params[1] : "Killed", link);
+}
+
+// Remove a user from the whole of our side of the network, `fromLink` excepted.
+// A local victim sees the KILL and is disconnected at the end of the loop;
+// its nickname is released at once.
+void CommandHandler::killUser(Client* victim, const std::string& source, const std::string& reason,
+                              Client* fromLink)
+{
+	Network& network = _server.getNetwork();
+	std::string line = ":" + source + " KILL " + victim->getNickname() + " :" + reason;
+	std::string quitReason = "Killed (" + source + " (" + reason + "))";
+
+	network.sendAboutUser(victim, line, fromLink);
+	if (victim->isRemote())
+	{
+	    network.removeUser(victim, quitReason);
+	    return;
+	}
+
+	_server.broadcastToNeighbours(victim, ":" + victim->getPrefix() + " QUIT :" + quitReason, false);
+	_server.sendToClient(victim->getFd(), line, OUTPUT_CONTROL);
+	_server.sendToClient(victim->getFd(), "ERROR :Closing Link: " + victim->getHostname()
+	                                      + " (" + quitReason + ")", OUTPUT_CONTROL);
+
+	std::set<std::string> channels = victim->getChannels();
+	for (std::set<std::string>::iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (!channel)
+	        continue;
+	    channel->removeMember(victim);
+	    victim->leaveChannel(*it);
+	    if (channel->isEmpty())
+	        _server.removeChannel(*it);
+	}
+	victim->setIntroduced(false);
+	victim->setNickname("");
+	victim->markForDisconnection();
+}
+
+// :<source> SQUIT <server> :<reason>
+void CommandHandler::linkSquit(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.empty())
+	    return;
+
+	Network& network = _server.getNetwork();
+	const std::string& name = cmd.params[0];
+	if (Utils::equalsIgnoreCase(name, link->getServerName())
+	    || Utils::equalsIgnoreCase(name, _server.getServerName()))
+	{
+	    link->markForDisconnection();
+	    return;
+	}
+	if (!network.hasServer(name))
+	    return;
+
+	network.removeServer(name);
+	network.sendToLinks(":" + (cmd.prefix.empty() ? link->getServerName() : cmd.prefix) + " SQUIT "
+	                    + name + " :" + (cmd.params.size() > 1 ? cmd.params[1] : ""), link, true);
+}
+
+/* ========================================================================== */
+/*                    CHANNELS                                                */
+/* ========================================================================== */
+
+// :<server> SJOIN <ts> <channel> <modes> [<params>...] :<[@][+]nick> ...
+// Joins remote users. The channel timestamp decides whose modes hold: an
+// older incoming channel resets ours, a newer one has its modes and
+// operator/voice prefixes ignored, equal timestamps merge.
+void CommandHandler::linkSjoin(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	if (cmd.params.size() < 4 || !parser::isValidChannelName(cmd.params[1])
+	    || !network.acceptsChannel(cmd.params[1]))
+	    return;
+
+	const std::string& me = _server.getServerName();
+	time_t ts = std::atol(cmd.params[0].c_str());
+	size_t last = cmd.params.size() - 1;
+
+	Channel* channel = _server.getChannel(cmd.params[1]);
+	bool theirModes = true;
+	if (!channel)
+	{
+	    channel = _server.getOrCreatChannel(cmd.params[1]);
+	    if (!channel)
+	    {
+	        std::cerr << "Warning: no room for channel " << cmd.params[1] << " from "
+	                  << link->getServerName() << std::endl;
+	        return;
+	    }
+	    channel->setCreationTime(ts);
+	}
+	else if (ts < channel->getCreationTime())
+	{
+	    std::string removed = resetChannelModes(channel);
+	    if (!removed.empty())
+	        _server.broadcastToChannel(channel->getName(), ":" + me + " MODE " + channel->getName()
+	                                   + " " + removed, -1);
+	    channel->setCreationTime(ts);
+	}
+	else if (ts > channel->getCreationTime())
+	    theirModes = false;
+	const std::string& name = channel->getName();
+
+	std::string modes = "+";
+	if (theirModes)
+	{
+	    std::string applied = applyLinkModes(channel, cmd.params, 2, last, me);
+	    if (!applied.empty())
+	        _server.broadcastToChannel(name, ":" + me + " MODE " + name + " " + applied, -1);
+	    modes = joinParams(cmd.params, 2, last);
+	}
+
+	std::vector<std::string> names = Utils::split(cmd.params[last], ' ');
+	std::vector<Client*> joined;
+	std::string accepted;
+	std::string statusModes;
+	std::string statusParams;
+	for (size_t i = 0; i < names.size(); ++i)
+	{
+	    size_t start = names[i].find_first_not_of("@+");
+	    if (start == std::string::npos)
+	        continue;
+	    Client* user = network.findUser(names[i].substr(start));
+	    if (!user || user->getUplink() != link)
+	        continue;
+	    bool op = theirModes && names[i].find('@') < start;
+	    bool voice = theirModes && names[i].find('+') < start;
+
+	    if (channel->addMember(user))
+	    {
+	        user->joinChannel(name);
+	        channel->setMemberFlag(user, MEMBER_FLAG_OP, op);   // the first member was made operator
+	        channel->setMemberFlag(user, MEMBER_FLAG_VOICE, voice);
+	        _server.broadcastMembershipChange(channel, user, ":" + user->getPrefix() + " JOIN " + name);
+	    }
+	    else
+	    {
+	        if (op)
+	            channel->setMemberFlag(user, MEMBER_FLAG_OP, true);
+	        if (voice)
+	            channel->setMemberFlag(user, MEMBER_FLAG_VOICE, true);
+	    }
+	    if (op)
+	    {
+	        statusModes += "o";
+	        statusParams += " " + user->getNickname();
+	    }
+	    if (voice)
+	    {
+	        statusModes += "v";
+	        statusParams += " " + user->getNickname();
+	    }
+	    joined.push_back(user);
+	    accepted += std::string(accepted.empty() ? "" : " ") + (op ? "@" : "") + (voice ? "+" : "")
+	              + user->getNickname();
+	}
+	if (!statusModes.empty())
+	    _server.broadcastToChannel(name, ":" + me + " MODE " + name + " +" + statusModes + statusParams, -1);
+
+	if (accepted.empty())
+	{
+	    if (channel->isEmpty())
+	        _server.removeChannel(name);
+	    return;
+	}
+	network.forwardJoin(channel, joined, ":" + (cmd.prefix.empty() ? link->getServerName() : cmd.prefix)
+	                    + " SJOIN " + Utils::timestampToString(channel->getCreationTime()) + " " + name
+	                    + " " + modes + " :" + accepted, link);
+}
+
+// :<server> BMASK <ts> <channel> <b|e|I> :<mask> ...
+void CommandHandler::linkBmask(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 4 || cmd.params[2].size() != 1)
+	    return;
+	Channel* channel = _server.getChannel(cmd.params[1]);
+	time_t ts = std::atol(cmd.params[0].c_str());
+	char mode = cmd.params[2][0];
+	if (!channel || ts > channel->getCreationTime() || !channel->getMaskList(mode))
+	    return;
+
+	std::string source = cmd.prefix.empty() ? link->getServerName() : cmd.prefix;
+	std::vector<std::string> masks = Utils::split(cmd.params[3], ' ');
+	std::string added;
+	for (size_t i = 0; i < masks.size(); ++i)
+	{
+	    if (!masks[i].empty() && channel->addMask(mode, masks[i], source))
+	        added += " " + masks[i];
+	}
+	if (!added.empty())
+	    _server.getNetwork().sendChannelChange(channel, ":" + source + " BMASK " + cmd.params[0] + " "
+	                                           + channel->getName() + " " + mode + " :" + added.substr(1),
+	                                           link);
+}
+
+// :<nick> PART <channel> :<reason>
+void CommandHandler::linkPart(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	Client* source = linkSource(network, link, cmd.prefix);
+	Channel* channel = cmd.params.empty() ? NULL : _server.getChannel(cmd.params[0]);
+	if (!source || !channel || !channel->isMember(source))
+	    return;
+
+	std::string name = channel->getName();
+	std::string reason = (cmd.params.size() > 1) ? cmd.params[1] : "";
+	std::string partMsg = ":" + source->getPrefix() + " PART " + name;
+	if (!reason.empty())
+	    partMsg += " :" + reason;
+
+	_server.broadcastMembershipChange(channel, source, partMsg);
+	network.sendChannelChange(channel, ":" + source->getNickname() + " PART " + name + " :" + reason, link);
+	channel->removeMember(source);
+	source->leaveChannel(name);
+	if (channel->isEmpty())
+	    _server.removeChannel(name);
+}
+
+// :<source> KICK <channel> <nick> :<reason>
+void CommandHandler::linkKick(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 2)
+	    return;
+	Network& network = _server.getNetwork();
+	Channel* channel = _server.getChannel(cmd.params[0]);
+	Client* target = channel ? channel->getMemberByNickname(cmd.params[1]) : NULL;
+	if (!target)
+	    return;
+
+	std::string name = channel->getName();
+	std::string reason = (cmd.params.size() > 2) ? cmd.params[2] : cmd.prefix;
+	_server.broadcastToChannel(name, ":" + displayPrefix(network, cmd.prefix) + " KICK " + name + " "
+	                           + target->getNickname() + " :" + reason, -1);
+	network.sendChannelChange(channel, ":" + cmd.prefix + " KICK " + name + " " + target->getNickname()
+	                          + " :" + reason, link);
+	channel->removeMember(target);
+	target->leaveChannel(name);
+	if (channel->isEmpty())
+	    _server.removeChannel(name);
+}
+
+// :<source> TMODE <ts> <channel> <modes> [<params>...]
+// Dropped when the channel here is older than the one the change was made on.
+void CommandHandler::linkTmode(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 3)
+	    return;
+	Network& network = _server.getNetwork();
+	Channel* channel = _server.getChannel(cmd.params[1]);
+	time_t ts = std::atol(cmd.params[0].c_str());
+	if (!channel || ts > channel->getCreationTime())
+	    return;
+
+	std::string source = cmd.prefix.empty() ? link->getServerName() : cmd.prefix;
+	std::string applied = applyLinkModes(channel, cmd.params, 2, cmd.params.size(), source);
+	if (applied.empty())
+	    return;
+	_server.broadcastToChannel(channel->getName(), ":" + displayPrefix(network, source) + " MODE "
+	                           + channel->getName() + " " + applied, -1);
+	network.sendChannelChange(channel, ":" + source + " TMODE "
+	                          + Utils::timestampToString(channel->getCreationTime()) + " "
+	                          + channel->getName() + " " + applied, link);
+}
+
+// :<source> TOPIC <channel> <ts> <setter> :<topic>
+// The most recent topic wins.
+void CommandHandler::linkTopic(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.size() < 3)
+	    return;
+	Network& network = _server.getNetwork();
+	Channel* channel = _server.getChannel(cmd.params[0]);
+	time_t ts = std::atol(cmd.params[1].c_str());
+	std::string topic = (cmd.params.size() > 3) ? cmd.params[3] : "";
+	if (!channel || topic == channel->getTopic()
+	    || (channel->hasTopic() && ts < channel->getTopicTime()))
+	    return;
+
+	std::string source = cmd.prefix.empty() ? link->getServerName() : cmd.prefix;
+	channel->setTopic(topic, cmd.params[2], ts);
+	_server.broadcastToChannel(channel->getName(), ":" + displayPrefix(network, source) + " TOPIC "
+	                           + channel->getName() + " :" + topic, -1);
+	network.sendChannelChange(channel, ":" + source + " TOPIC " + channel->getName() + " " + cmd.params[1]
+	                          + " " + cmd.params[2] + " :" + topic, link);
+}
+
+/* ========================================================================== */
+/*                    MESSAGES                                                */
+/* ========================================================================== */
+
+// :<nick> PRIVMSG|NOTICE <target> :<text>
+// The sending server already ran the channel checks and the filters.
+void CommandHandler::linkMessage(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	Client* source = linkSource(network, link, cmd.prefix);
+	if (!source || cmd.params.size() < 2)
+	    return;
+
+	std::string command = Utils::toUpper(cmd.command);
+	const std::string& target = cmd.params[0];
+	const std::string& text = cmd.params[1];
+	std::string message = command + " " + target + " :" + text;
+	std::string line = ":" + source->getPrefix() + " " + message;
+
+	if (target[0] == '#' || target[0] == '&' || target[0] == '+' || target[0] == '!')
+	{
+	    Channel* channel = _server.getChannel(target);
+	    if (!channel)
+	        return;
+	    std::string tags = recordChannelMessage(channel, line, "");
+	    _server.logChannelEvent(command == "PRIVMSG" ? LOG_EVENT_PRIVMSG : LOG_EVENT_NOTICE,
+	                            channel, source, text);
+	    _server.broadcastToChannel(channel->getName(), line, -1, tags);
+	    network.sendToChannelLinks(channel, ":" + source->getNickname() + " " + message, link);
+	    return;
+	}
+
+	Client* recipient = _server.getClientByNickname(target);
+	if (!recipient)
+	    return;
+	if (recipient->isRemote())
+	    network.routeToUser(source, recipient, message);
+	else
+	    _server.sendToClient(recipient->getFd(), line);
+}
+
+// :<nick> INVITE <nick> <channel>
+void CommandHandler::linkInvite(Client* link, const ParsedCommand& cmd)
+{
+	Network& network = _server.getNetwork();
+	Client* source = linkSource(network, link, cmd.prefix);
+	if (!source || cmd.params.size() < 2)
+	    return;
+	Client* target = _server.getClientByNickname(cmd.params[0]);
+	Channel* channel = _server.getChannel(cmd.params[1]);
+	if (!target || !channel)
+	    return;
+
+	if (target->isRemote())
+	{
+	    network.routeToUser(source, target, "INVITE " + target->getNickname() + " " + channel->getName());
+	    return;
+	}
+	channel->addInvite(target->getNickname());
+	_server.sendToClient(target->getFd(), ":" + source->getPrefix() + " INVITE " + target->getNickname()
+	                                      + " :" + channel->getName());
+}
+
+/* ========================================================================== */
+/*                    EDGE RELAYS                                             */
+/* ========================================================================== */
+
+// :<server> RSUB <channel>
+// From a relay: subscribe it to the channel. From upstream, on an edge:
+// the burst of the channel is complete, the JOINs waiting for it go on.
+void CommandHandler::linkRsub(Client* link, const ParsedCommand& cmd)
+{
+	if (cmd.params.empty() || !parser::isValidChannelName(cmd.params[0]))
+	    return;
+	Network& network = _server.getNetwork();
+	if (link->getLinkState() & LINK_RELAY)
+	{
+	    network.addSubscription(link, cmd.params[0]);
+	    return;
+	}
+
+	std::vector<std::pair<Client*, std::string> > ready = network.channelReady(cmd.params[0]);
+	for (size_t i = 0; i < ready.size(); ++i)
+	    joinSingleChannel(ready[i].first, cmd.params[0], ready[i].second);
+}
+
+// :<server> RUNSUB <channel>
+void CommandHandler::linkRunsub(Client* link, const ParsedCommand& cmd)
+{
+	if (!cmd.params.empty() && (link->getLinkState() & LINK_RELAY))
+	    _server.getNetwork().removeSubscription(link, cmd.params[0]);
+}
+
+/* ========================================================================== */
+/*                    MODES                                                   */
+/* ========================================================================== */
+
+// Apply args[first] (modes) with args[first + 1, end) (parameters) without
+// permission checks: the sending server made them. Returns what changed,
+// as "<modes> <params>", empty if nothing did.
+std::string CommandHandler::applyLinkModes(Channel* channel, const std::vector<std::string>& args,
+                                           size_t first, size_t end, const std::string& setter)
+{
+	if (first >= end)
+	    return "";
+
+	const std::string& modes = args[first];
+	size_t index = first + 1;
+	bool adding = true;
+	char sign = 0;
+	std::string applied;
+	std::string params;
+
+	for (size_t i = 0; i < modes.size(); ++i)
+	{
+	    char c = modes[i];
+	    if (c == '+' || c == '-')
+	    {
+	        adding = (c == '+');
+	        continue;
+	    }
+
+	    bool takesParam = std::strchr("ovbeI", c) || (adding && std::strchr("klfu", c));
+	    std::string param;
+	    if (takesParam)
+	    {
+	        if (index >= end)
+	            continue;
+	        param = args[index++];
+	    }
+
+	    bool done = true;
+	    switch (c)
+	    {
+	        case 'i':
+	            channel->setInviteOnly(adding);
+	            break;
+	        case 't':
+	            channel->setTopicRestricted(adding);
+	            break;
+	        case 'm':
+	            channel->setModerated(adding);
+	            break;
+	        case 'k':
+	            channel->setKey(adding ? param : "");
+	            break;
+	        case 'l':
+	        case 'u':
+	        {
+	            int value = adding ? Utils::stringToInt(param) : 0;
+	            done = !adding || value > 0;
+	            if (done && c == 'l')
+	                channel->setUserLimit(static_cast<size_t>(value));
+	            else if (done)
+	                channel->setAuditoriumThreshold(static_cast<size_t>(value));
+	            break;
+	        }
+	        case 'f':
+	            if (adding)
+	                done = channel->setFloodLimit(param);
+	            else
+	                channel->clearFloodLimit();
+	            break;
+	        case 'o':
+	        case 'v':
+	        {
+	            Client* member = channel->getMemberByNickname(param);
+	            done = (member != NULL);
+	            if (done)
+	                channel->setMemberFlag(member, c == 'o' ? MEMBER_FLAG_OP : MEMBER_FLAG_VOICE, adding);
+	            break;
+	        }
+	        case 'b':
+	        case 'e':
+	        case 'I':
+	            done = adding ? channel->addMask(c, param, setter) : channel->removeMask(c, param);
+	            break;
+	        default:
+	            done = false;
+	            break;
+	    }
+	    if (!done)
+	        continue;
+
+	    char wanted = adding ? '+' : '-';
+	    if (wanted != sign)
+	        applied += wanted;
+	    sign = wanted;
+	    applied += c;
+	    if (takesParam)
+	        params += " " + param;
+	}
+	return applied + params;
+}
+
+// A netjoin found an older channel on the other side: drop our modes and
+// our members' operator/voice status. Ban lists are kept (merged).
+// Returns the mode change to show to the local members.
+std::string CommandHandler::resetChannelModes(Channel* channel)
+{
+	std::string removed;
+	std::string params;
+
+	if (channel->isInviteOnly())
+	    removed += "i";
+	if (channel->isTopicRestricted())
+	    removed += "t";
+	if (channel->isModerated())
+	    removed += "m";
+	if (channel->hasKey())
+	    removed += "k";
+	if (channel->hasUserLimit())
+	    removed += "l";
+	if (channel->getAuditoriumThreshold() > 0)
+	    removed += "u";
+	if (channel->hasFloodLimit())
+	    removed += "f";
+	channel->setInviteOnly(false);
+	channel->setTopicRestricted(false);
+	channel->setModerated(false);
+	channel->setKey("");
+	channel->setUserLimit(0);
+	channel->setAuditoriumThreshold(0);
+	channel->clearFloodLimit();
+
+	// Status changes reorder the member array: collect first
+	std::vector<Membership> members = channel->getMembers();
+	for (size_t i = 0; i < members.size(); ++i)
+	{
+	    if (members[i].flags & MEMBER_FLAG_OP)
+	    {
+	        removed += "o";
+	        params += " " + members[i].client->getNickname();
+	    }
+	    if (members[i].flags & MEMBER_FLAG_VOICE)
+	    {
+	        removed += "v";
+	        params += " " + members[i].client->getNickname();
+	    }
+	    channel->setMemberFlag(members[i].client, MEMBER_FLAG_OP | MEMBER_FLAG_VOICE, false);
+	}
+	return removed.empty() ? "" : "-" + removed + params;
+}
@@ -0,0 +1,28 @@
+#include "IRC.hpp"
+
+// SQUIT <server> [:<reason>]
+// Operators only: close the link to a directly connected server; everything
+// behind it splits off.
+void CommandHandler::handleSquit(Client* client, const ParsedCommand& cmd)
+{
+	if (!client->isServerOperator())
+	{
+	    sendError(client, ERR_NOPRIVILEGES, "", "Permission Denied- You're not an IRC operator");
+	    return;
+	}
+	if (cmd.params.empty())
+	{
+	    sendError(client, ERR_NEEDMOREPARAMS, "SQUIT", "Not enough parameters");
+	    return;
+	}
+
+	Client* link = _server.getNetwork().findLink(cmd.params[0]);
+	if (!link)
+	{
+	    sendError(client, ERR_NOSUCHSERVER, cmd.params[0], "No such server");
+	    return;
+	}
+	std::string reason = (cmd.params.size() > 1) ? cmd.params[1] : client->getNickname();
+	_server.sendToClient(link->getFd(), "ERROR :SQUIT by " + client->getNickname() + " (" + reason + ")");
+	link->markForDisconnection();
+}
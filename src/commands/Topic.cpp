@@ -55,5 +55,10 @@ void CommandHandler::handleTopic(Client* client, const ParsedCommand& cmd)
 	        topicMsg += "";  // Topic effacé
         
 	    _server.broadcastToChannel(channelName, topicMsg, -1);
+	    _server.getNetwork().announce(client);
+	    _server.getNetwork().propagate(client, "TOPIC " + channel->getName() + " "
+	                                   + Utils::timestampToString(channel->getTopicTime()) + " "
+	                                   + client->getNickname() + " :" + newTopic, channel);
+	    _server.logChannelEvent(LOG_EVENT_TOPIC, channel, client, newTopic);
     }
 }
\ No newline at end of file
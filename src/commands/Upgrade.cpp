@@ -0,0 +1,18 @@
+#include "IRC.hpp"
+
+// UPGRADE
+// Operators only: restart on the binary this server was started from
+// without dropping a client (see Server::upgrade). The outcome is sent to
+// every operator, by the new process when it worked.
+void CommandHandler::handleUpgrade(Client* client, const ParsedCommand& cmd)
+{
+	(void)cmd;
+	if (!client->isServerOperator())
+	{
+	    sendError(client, ERR_NOPRIVILEGES, "", "Permission Denied- You're not an IRC operator");
+	    return;
+	}
+
+	_server.noticeOperators(client->getNickname() + " is upgrading the server");
+	_server.requestUpgrade();
+}
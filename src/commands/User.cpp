@@ -20,10 +20,6 @@ void CommandHandler::handleUser(Client* client, const ParsedCommand& cmd)
 	client->setUsername(username);
 	client->setRealname(realname);
 
-	//    (need PASS + NICK + USER)
-	if (client->hasPasswordProvided() && !client->getNickname().empty())
-	{
-	    client->setRegistered(true);
-	    sendWelcome(client);
-	}
+	//    (need PASS + NICK + USER, and CAP END if negotiating)
+	checkRegistration(client);
 }
\ No newline at end of file
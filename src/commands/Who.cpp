@@ -1,5 +1,45 @@
 #include "IRC.hpp"
 
+// One RPL_WHOREPLY line.
+static std::string formatWhoReply(const std::string& serverName, const std::string& nick,
+                                  const std::string& channelName, const std::string& username,
+                                  const std::string& hostname, const std::string& targetNick,
+                                  const std::string& flags, const std::string& realname)
+{
+    return Utils::formatServerReply(serverName, RPL_WHOREPLY,
+                                    nick + " " + channelName + " " + username + " " + hostname
+                                    + " " + serverName + " " + targetNick + " " + flags + " :0 ",
+                                    realname);
+}
+
+// WHO *, produced lazily from a server snapshot.
+class WhoAllCursor : public ReplyCursor
+{
+public:
+    WhoAllCursor(const ServerSnapshot* snapshot, const std::string& serverName, Client* client)
+        : ReplyCursor(snapshot, serverName, client) {}
+
+    bool fill(std::vector<std::string>& lines, size_t maxLines)
+    {
+        const std::vector<const ClientSnapshot*>& clients = _snapshot->clients;
+        for (; _position < clients.size() && lines.size() < maxLines; ++_position)
+        {
+            const ClientSnapshot* target = clients[_position];
+            lines.push_back(formatWhoReply(_serverName, _nick, "*", target->username,
+                                           target->hostname, target->nickname, "H",
+                                           target->realname));
+        }
+        if (_position < clients.size())
+            return false;
+        lines.push_back(Utils::formatServerReply(_serverName, RPL_ENDOFWHO, _nick + " *",
+                                                 "End of WHO list"));
+        return true;
+    }
+
+    const char* batchType() const { return BATCH_TYPE_WHO; }
+    std::string batchParams() const { return "*"; }
+};
+
 void CommandHandler::handleWho(Client* client, const ParsedCommand& cmd)
 {
     if (cmd.params.empty())
@@ -11,6 +51,24 @@ void CommandHandler::handleWho(Client* client, const ParsedCommand& cmd)
     std::string target = cmd.params[0];
     bool isChannel = (target[0] == '#' || target[0] == '&' || target[0] == '+' || target[0] == '!');
 
+    // Every client: produced lazily, on the worker pool
+    if (target == "*")
+    {
+        _server.queueCursor(client, new WhoAllCursor(_server.takeSnapshot(),
+                                                     _server.getServerName(), client));
+        return;
+    }
+
+    client->setOutputClass(OUTPUT_BULK);
+    bool batched = startBatch(client, BATCH_TYPE_WHO, target);
+    sendWhoList(client, target, isChannel);
+    if (batched)
+        endBatch(client);
+    client->setOutputClass(OUTPUT_INTERACTIVE);
+}
+
+void CommandHandler::sendWhoList(Client* client, const std::string& target, bool isChannel)
+{
     if (isChannel)
     {
         Channel* channel = _server.getChannel(target);
@@ -26,11 +84,10 @@ void CommandHandler::handleWho(Client* client, const ParsedCommand& cmd)
             return;
         }
 
-        const std::set<Client*>& memberSet = channel->getMembers();
-        std::vector<Client*> members(memberSet.begin(), memberSet.end());
+        const std::vector<Membership>& members = channel->getMembers();
         for (size_t i = 0; i < members.size(); ++i)
         {
-            Client* member = members[i];
+            Client* member = members[i].client;
             sendWhoReply(client, channel, member);
         }
 
@@ -65,13 +122,15 @@ void CommandHandler::sendWhoReply(Client* client, Channel* channel, Client* targ
         channelName = channel->getName();
 
     std::string flags = "H";
-    if (channel && channel->isOperator(targetClient))
+    unsigned char memberFlags = channel ? channel->getMemberFlags(targetClient) : 0;
+    if (memberFlags & MEMBER_FLAG_OP)
         flags += "@";
-    std::string replyParams = channelName + " " + targetClient->getUsername() + " "
-                            + targetClient->getHostname() + " "
-                            + _server.getServerName() + " "
-                            + targetClient->getNickname() + " "
-                            + flags + " :0 ";
+    else if (memberFlags & MEMBER_FLAG_VOICE)
+        flags += "+";
 
-    sendReply(client, RPL_WHOREPLY, replyParams, targetClient->getRealname());
+    _server.sendToClient(client->getFd(),
+                         formatWhoReply(_server.getServerName(), client->getNickname(), channelName,
+                                        targetClient->getUsername(), targetClient->getHostname(),
+                                        targetClient->getNickname(), flags,
+                                        targetClient->getRealname()));
 }
\ No newline at end of file
@@ -0,0 +1,354 @@
+#include "IRC.hpp"
+#include <dirent.h>
+
+// Round a record size up to the next multiple of 8
+#define LOG_ALIGN(n)    (((n) + 7) & ~static_cast<size_t>(7))
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+ChannelLog::ChannelLog(const Config& config)
+	: _ring(NULL),
+	  _head(0),
+	  _tail(0),
+	  _seq(0),
+	  _dropped(0),
+	  _directory(config.getString("log.dir", "logs")),
+	  _policy(config.getString("log.policy", "block") == "drop" ? LOG_POLICY_DROP : LOG_POLICY_BLOCK),
+	  _blockTimeoutMs(config.getLong("log.block_timeout_ms", 2)),
+	  _commitIntervalMs(config.getLong("log.commit_interval_ms", 20)),
+	  _segmentSize(static_cast<size_t>(config.getLong("log.segment_size", 16 * 1024 * 1024))),
+	  _running(false),
+	  _stopping(false),
+	  _segmentFd(-1),
+	  _segmentNumber(0),
+	  _segmentBytes(0),
+	  _segmentFailed(false)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wakeup, NULL);
+}
+
+ChannelLog::~ChannelLog()
+{
+	stop();
+	pthread_cond_destroy(&_wakeup);
+	pthread_mutex_destroy(&_mutex);
+	delete[] _ring;
+}
+
+/* ========================================================================== */
+/*                    START / STOP                                            */
+/* ========================================================================== */
+
+// Create the log directory and start the writer thread. New segments are
+// numbered after the last existing one, older segments are never rewritten.
+// Also called again after stop() when an upgrade fails.
+bool ChannelLog::start()
+{
+	if (mkdir(_directory.c_str(), 0750) == -1 && errno != EEXIST)
+	{
+	    std::cerr << "Error: cannot create log directory " << _directory << std::endl;
+	    return false;
+	}
+
+	DIR* dir = opendir(_directory.c_str());
+	if (!dir)
+	{
+	    std::cerr << "Error: cannot open log directory " << _directory << std::endl;
+	    return false;
+	}
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+	    unsigned long number;
+	    if (std::sscanf(entry->d_name, "channels-%lu.log", &number) == 1 && number > _segmentNumber)
+	        _segmentNumber = number;
+	}
+	closedir(dir);
+	_segmentNumber++;
+
+	if (!openSegment())
+	    return false;
+
+	if (!_ring)
+	    _ring = new Slot[LOG_RING_SIZE];
+	_stopping = false;
+	if (pthread_create(&_thread, NULL, &ChannelLog::writerMain, this) != 0)
+	{
+	    std::cerr << "Error: cannot start the log writer thread" << std::endl;
+	    return false;
+	}
+	_running = true;
+	return true;
+}
+
+// Flush every pending record and join the writer thread.
+void ChannelLog::stop()
+{
+	if (!_running)
+	    return;
+
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+
+	pthread_join(_thread, NULL);
+	_running = false;
+
+	if (_segmentFd != -1)
+	    close(_segmentFd);
+	_segmentFd = -1;
+
+	unsigned long dropped = __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+	if (dropped)
+	    std::cerr << "Channel log: " << dropped << " record(s) dropped" << std::endl;
+}
+
+/* ========================================================================== */
+/*                    PRODUCER (event loop)                                   */
+/* ========================================================================== */
+
+// Copy an event into the ring. Never allocates; only waits (bounded by
+// log.block_timeout_ms) when the ring is full and the policy is "block".
+void ChannelLog::append(int type, const std::string& channel,
+                        const std::string& nick, const std::string& text)
+{
+	if (!_running)
+	    return;
+
+	size_t head = _head;
+	size_t tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+
+	if (head - tail >= LOG_RING_SIZE)
+	{
+	    wakeWriter();
+	    if (_policy == LOG_POLICY_DROP)
+	    {
+	        __atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+	        return;
+	    }
+	    long deadline = Utils::getTimeMs() + _blockTimeoutMs;
+	    while (head - tail >= LOG_RING_SIZE)
+	    {
+	        if (Utils::getTimeMs() >= deadline)
+	        {
+	            __atomic_add_fetch(&_dropped, 1, __ATOMIC_RELAXED);
+	            return;
+	        }
+	        usleep(50);
+	        tail = __atomic_load_n(&_tail, __ATOMIC_ACQUIRE);
+	    }
+	}
+
+	Slot& slot = _ring[head & (LOG_RING_SIZE - 1)];
+	size_t channelLength = std::min(channel.size(), static_cast<size_t>(MAX_CHANNEL_LENGTH));
+	size_t nickLength = std::min(nick.size(), static_cast<size_t>(64));
+	size_t textLength = std::min(text.size(), LOG_RECORD_DATA - channelLength - nickLength);
+
+	slot.timeMs = Utils::getTimeMs();
+	slot.seq = ++_seq;
+	slot.type = static_cast<unsigned char>(type);
+	slot.channelLength = static_cast<unsigned short>(channelLength);
+	slot.nickLength = static_cast<unsigned short>(nickLength);
+	slot.textLength = static_cast<unsigned short>(textLength);
+	std::memcpy(slot.data, channel.data(), channelLength);
+	std::memcpy(slot.data + channelLength, nick.data(), nickLength);
+	std::memcpy(slot.data + channelLength + nickLength, text.data(), textLength);
+
+	__atomic_store_n(&_head, head + 1, __ATOMIC_RELEASE);
+
+	// The writer commits on a timer; only wake it early when half full
+	if (head + 1 - tail == LOG_RING_SIZE / 2)
+	    wakeWriter();
+}
+
+void ChannelLog::wakeWriter()
+{
+	pthread_mutex_lock(&_mutex);
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    CONSUMER (writer thread)                                */
+/* ========================================================================== */
+
+void* ChannelLog::writerMain(void* arg)
+{
+	static_cast<ChannelLog*>(arg)->writerLoop();
+	return NULL;
+}
+
+// Every commit interval (or when woken up), encode everything in the ring,
+// write it with a single write() and fdatasync() once: one commit per batch.
+void ChannelLog::writerLoop()
+{
+	std::string batch;
+
+	for (;;)
+	{
+	    pthread_mutex_lock(&_mutex);
+	    if (!_stopping)
+	    {
+	        struct timespec deadline = Utils::deadlineAfterMs(_commitIntervalMs);
+	        pthread_cond_timedwait(&_wakeup, &_mutex, &deadline);
+	    }
+	    bool stopping = _stopping;
+	    pthread_mutex_unlock(&_mutex);
+
+	    batch.clear();
+	    size_t count = drain(batch);
+	    if (count > 0)
+	    {
+	        if (_segmentFd != -1 && _segmentBytes > sizeof(LogSegmentHeader)
+	            && _segmentBytes + batch.size() > _segmentSize)
+	        {
+	            close(_segmentFd);
+	            _segmentFd = -1;
+	            __atomic_store_n(&_segmentNumber, _segmentNumber + 1, __ATOMIC_RELEASE);
+	        }
+	        // A segment that could not be opened is tried again for each batch
+	        if (_segmentFd == -1)
+	            openSegment();
+
+	        size_t written = 0;
+	        while (_segmentFd != -1 && written < batch.size())
+	        {
+	            ssize_t n = write(_segmentFd, batch.data() + written, batch.size() - written);
+	            if (n == -1 && errno == EINTR)
+	                continue;
+	            if (n <= 0)
+	            {
+	                std::cerr << "Error: channel log write failed" << std::endl;
+	                break;
+	            }
+	            written += n;
+	        }
+	        _segmentBytes += written;
+	        if (_segmentFd != -1)
+	        {
+#ifdef __linux__
+	            fdatasync(_segmentFd);
+#else
+	            fsync(_segmentFd);
+#endif
+	        }
+	        else
+	            __atomic_add_fetch(&_dropped, count, __ATOMIC_RELAXED);
+	    }
+
+	    if (stopping && __atomic_load_n(&_head, __ATOMIC_ACQUIRE) == _tail)
+	        break;
+	}
+}
+
+// Encode every available record into `batch` and release the slots.
+size_t ChannelLog::drain(std::string& batch)
+{
+	size_t tail = _tail;
+	size_t head = __atomic_load_n(&_head, __ATOMIC_ACQUIRE);
+	size_t count = head - tail;
+
+	for (; tail != head; ++tail)
+	{
+	    const Slot& slot = _ring[tail & (LOG_RING_SIZE - 1)];
+	    size_t payload = slot.channelLength + slot.nickLength + slot.textLength;
+	    size_t length = LOG_ALIGN(sizeof(LogRecordHeader) + payload);
+
+	    LogRecordHeader header;
+	    std::memset(&header, 0, sizeof(header));
+	    header.length = static_cast<unsigned int>(length);
+	    header.checksum = checksum(slot.data, payload);
+	    header.timeMs = slot.timeMs;
+	    header.seq = slot.seq;
+	    header.type = slot.type;
+	    header.channelLength = slot.channelLength;
+	    header.nickLength = slot.nickLength;
+	    header.textLength = slot.textLength;
+
+	    batch.append(reinterpret_cast<const char*>(&header), sizeof(header));
+	    batch.append(slot.data, payload);
+	    batch.append(length - sizeof(header) - payload, '\0');
+	}
+
+	__atomic_store_n(&_tail, tail, __ATOMIC_RELEASE);
+	return count;
+}
+
+// Create the segment file _segmentNumber and write its header. A failure
+// is reported once, until a segment opens again.
+bool ChannelLog::openSegment()
+{
+	std::string path = segmentPath(_directory, _segmentNumber);
+
+	// Truncated: a previous attempt may have left part of a header
+	_segmentFd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0640);
+	if (_segmentFd == -1)
+	{
+	    if (!_segmentFailed)
+	        std::cerr << "Error: cannot open log segment " << path << std::endl;
+	    _segmentFailed = true;
+	    return false;
+	}
+
+	LogSegmentHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, LOG_SEGMENT_MAGIC, sizeof(header.magic));
+	header.version = LOG_SEGMENT_VERSION;
+	if (write(_segmentFd, &header, sizeof(header)) != static_cast<ssize_t>(sizeof(header)))
+	{
+	    if (!_segmentFailed)
+	        std::cerr << "Error: cannot write log segment " << path << std::endl;
+	    _segmentFailed = true;
+	    close(_segmentFd);
+	    _segmentFd = -1;
+	    return false;
+	}
+	if (_segmentFailed)
+	    std::cerr << "Channel log: writing to " << path << " again" << std::endl;
+	_segmentFailed = false;
+	_segmentBytes = sizeof(header);
+	return true;
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+const std::string& ChannelLog::getDirectory() const
+{
+	return _directory;
+}
+
+unsigned long ChannelLog::getDroppedCount() const
+{
+	return __atomic_load_n(&_dropped, __ATOMIC_RELAXED);
+}
+
+// Number of the segment being written; lower numbers are complete.
+unsigned long ChannelLog::getCurrentSegment() const
+{
+	return __atomic_load_n(&_segmentNumber, __ATOMIC_ACQUIRE);
+}
+
+std::string ChannelLog::segmentPath(const std::string& directory, unsigned long number)
+{
+	char name[64];
+	std::snprintf(name, sizeof(name), "/channels-%06lu.log", number);
+	return directory + name;
+}
+
+// FNV-1a, used to detect torn or corrupted records when reading segments back.
+unsigned int ChannelLog::checksum(const char* data, size_t length)
+{
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < length; ++i)
+	{
+	    hash ^= static_cast<unsigned char>(data[i]);
+	    hash *= 16777619u;
+	}
+	return hash;
+}
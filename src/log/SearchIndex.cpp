@@ -0,0 +1,506 @@
+#include "IRC.hpp"
+#include <dirent.h>
+#include <sys/mman.h>
+
+/* ========================================================================== */
+/*                    FILE HELPERS                                            */
+/* ========================================================================== */
+
+// Read-only mapping of a whole file
+struct MappedFile
+{
+	const char* data;
+	size_t      size;
+};
+
+static bool mapFile(const std::string& path, MappedFile& file)
+{
+	file.data = NULL;
+	file.size = 0;
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	    return false;
+	struct stat st;
+	if (fstat(fd, &st) == -1 || st.st_size == 0)
+	{
+	    close(fd);
+	    return false;
+	}
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	    return false;
+	file.data = static_cast<const char*>(data);
+	file.size = st.st_size;
+	return true;
+}
+
+static void unmapFile(MappedFile& file)
+{
+	if (file.data)
+	    munmap(const_cast<char*>(file.data), file.size);
+	file.data = NULL;
+}
+
+// Decode the record at `offset`; false past the end or on a torn record.
+static bool readRecord(const MappedFile& segment, size_t offset,
+                       LogRecordHeader& header, const char*& payload)
+{
+	if (offset + sizeof(LogRecordHeader) > segment.size)
+	    return false;
+	std::memcpy(&header, segment.data + offset, sizeof(header));
+	size_t payloadLength = header.channelLength + header.nickLength + header.textLength;
+	if (header.length < sizeof(header) + payloadLength || offset + header.length > segment.size)
+	    return false;
+	payload = segment.data + offset + sizeof(header);
+	return ChannelLog::checksum(payload, payloadLength) == header.checksum;
+}
+
+// Check the filters and that every term really is in the text.
+static bool matchRecord(const SearchQuery& query, const LogRecordHeader& header, const char* payload)
+{
+	if (query.afterMs >= 0 && header.timeMs <= query.afterMs)
+	    return false;
+	if (query.beforeMs >= 0 && header.timeMs >= query.beforeMs)
+	    return false;
+	if (!query.channel.empty()
+	    && !Utils::equalsIgnoreCase(query.channel, std::string(payload, header.channelLength)))
+	    return false;
+	if (!query.nick.empty()
+	    && !Utils::equalsIgnoreCase(query.nick, std::string(payload + header.channelLength, header.nickLength)))
+	    return false;
+	if (query.terms.empty())
+	    return true;
+
+	std::vector<std::string> words;
+	SearchIndex::tokenize(payload + header.channelLength + header.nickLength, header.textLength, words);
+	for (size_t i = 0; i < query.terms.size(); ++i)
+	{
+	    if (std::find(words.begin(), words.end(), query.terms[i]) == words.end())
+	        return false;
+	}
+	return true;
+}
+
+static bool termLess(const SearchTermEntry& entry, unsigned long hash)
+{
+	return entry.hash < hash;
+}
+
+// Offsets of the records holding every term, ascending.
+static void lookupIndex(const MappedFile& index, const std::vector<std::string>& terms,
+                        std::vector<unsigned int>& offsets)
+{
+	const SearchIndexHeader* header = reinterpret_cast<const SearchIndexHeader*>(index.data);
+	const SearchTermEntry* table = reinterpret_cast<const SearchTermEntry*>(index.data + sizeof(*header));
+	const SearchTermEntry* tableEnd = table + header->termCount;
+	const unsigned int* postings = reinterpret_cast<const unsigned int*>(tableEnd);
+
+	offsets.clear();
+	for (size_t i = 0; i < terms.size(); ++i)
+	{
+	    unsigned long hash = SearchIndex::hashTerm(terms[i]);
+	    const SearchTermEntry* entry = std::lower_bound(table, tableEnd, hash, termLess);
+	    if (entry == tableEnd || entry->hash != hash)
+	    {
+	        offsets.clear();
+	        return;
+	    }
+	    const unsigned int* first = postings + entry->first;
+	    const unsigned int* last = first + entry->count;
+	    if (i == 0)
+	    {
+	        offsets.assign(first, last);
+	        continue;
+	    }
+	    std::vector<unsigned int> both;
+	    std::set_intersection(offsets.begin(), offsets.end(), first, last, std::back_inserter(both));
+	    offsets.swap(both);
+	    if (offsets.empty())
+	        break;
+	}
+}
+
+static bool validIndex(const MappedFile& index)
+{
+	if (index.size < sizeof(SearchIndexHeader))
+	    return false;
+	const SearchIndexHeader* header = reinterpret_cast<const SearchIndexHeader*>(index.data);
+	return std::memcmp(header->magic, SEARCH_INDEX_MAGIC, sizeof(header->magic)) == 0
+	    && header->version == SEARCH_INDEX_VERSION
+	    && index.size == sizeof(*header) + header->termCount * sizeof(SearchTermEntry)
+	                     + header->postingCount * sizeof(unsigned int);
+}
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+SearchIndex::SearchIndex(const ChannelLog& log, int notifyFd, long indexIntervalMs)
+	: _log(log),
+	  _directory(log.getDirectory()),
+	  _notifyFd(notifyFd),
+	  _indexIntervalMs(indexIntervalMs),
+	  _running(false),
+	  _stopping(false)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wakeup, NULL);
+}
+
+SearchIndex::~SearchIndex()
+{
+	stop();
+	pthread_cond_destroy(&_wakeup);
+	pthread_mutex_destroy(&_mutex);
+}
+
+bool SearchIndex::start()
+{
+	_stopping = false;
+	if (pthread_create(&_thread, NULL, &SearchIndex::workerMain, this) != 0)
+	{
+	    std::cerr << "Error: cannot start the search thread" << std::endl;
+	    return false;
+	}
+	_running = true;
+	return true;
+}
+
+// Pending queries are abandoned; an index being built is finished first.
+void SearchIndex::stop()
+{
+	if (!_running)
+	    return;
+
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+
+	pthread_join(_thread, NULL);
+	_running = false;
+}
+
+/* ========================================================================== */
+/*                    EVENT LOOP SIDE                                         */
+/* ========================================================================== */
+
+void SearchIndex::submit(const SearchQuery& query)
+{
+	pthread_mutex_lock(&_mutex);
+	_queries.push_back(query);
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+}
+
+// Hand the finished queries to the caller (called when notifyFd is readable).
+void SearchIndex::takeResults(std::vector<SearchResult>& results)
+{
+	pthread_mutex_lock(&_mutex);
+	results.swap(_results);
+	_results.clear();
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    WORKER THREAD                                           */
+/* ========================================================================== */
+
+void* SearchIndex::workerMain(void* arg)
+{
+	static_cast<SearchIndex*>(arg)->workerLoop();
+	return NULL;
+}
+
+// Queries come first; sealed segments are indexed one at a time in between,
+// so a query never waits for more than one index build.
+void SearchIndex::workerLoop()
+{
+	bool pending = true;  // segments may still need an index
+
+	pthread_mutex_lock(&_mutex);
+	while (!_stopping)
+	{
+	    if (_queries.empty() && !pending)
+	    {
+	        struct timespec deadline = Utils::deadlineAfterMs(_indexIntervalMs);
+	        pthread_cond_timedwait(&_wakeup, &_mutex, &deadline);
+	        pending = true;
+	        continue;
+	    }
+
+	    if (!_queries.empty())
+	    {
+	        SearchQuery query = _queries.front();
+	        _queries.erase(_queries.begin());
+	        pthread_mutex_unlock(&_mutex);
+
+	        SearchResult result;
+	        runQuery(query, result);
+
+	        pthread_mutex_lock(&_mutex);
+	        _results.push_back(result);
+	        char byte = 's';
+	        if (write(_notifyFd, &byte, 1) == -1 && errno != EAGAIN)
+	            std::cerr << "Error: cannot wake up the event loop" << std::endl;
+	        continue;
+	    }
+
+	    pthread_mutex_unlock(&_mutex);
+	    pending = indexNextSegment();
+	    pthread_mutex_lock(&_mutex);
+	}
+	pthread_mutex_unlock(&_mutex);
+}
+
+// Build the index of one sealed segment that has none. False when all
+// sealed segments are indexed.
+bool SearchIndex::indexNextSegment()
+{
+	unsigned long current = _log.getCurrentSegment();
+	std::vector<unsigned long> segments = listSegments();
+
+	for (size_t i = 0; i < segments.size(); ++i)
+	{
+	    if (segments[i] >= current || access(indexPath(segments[i]).c_str(), F_OK) == 0)
+	        continue;
+	    if (!buildIndex(segments[i]))
+	        std::cerr << "Error: cannot index log segment " << segments[i] << std::endl;
+	    return true;
+	}
+	return false;
+}
+
+// Tokenize every record of a segment, sort the (term, offset) pairs and
+// write them as a term table plus postings. The file is written under a
+// temporary name and renamed, so readers never see a partial index.
+bool SearchIndex::buildIndex(unsigned long number)
+{
+	MappedFile segment;
+	if (!mapFile(ChannelLog::segmentPath(_directory, number), segment))
+	    return false;
+
+	std::vector<std::pair<unsigned long, unsigned int> > pairs;
+	std::vector<std::string> words;
+	SearchIndexHeader header;
+	std::memset(&header, 0, sizeof(header));
+	std::memcpy(header.magic, SEARCH_INDEX_MAGIC, sizeof(header.magic));
+	header.version = SEARCH_INDEX_VERSION;
+	header.minTimeMs = -1;
+
+	LogRecordHeader record;
+	const char* payload;
+	size_t offset = sizeof(LogSegmentHeader);
+	while (readRecord(segment, offset, record, payload))
+	{
+	    if (header.minTimeMs < 0)
+	        header.minTimeMs = record.timeMs;
+	    header.maxTimeMs = record.timeMs;
+
+	    words.clear();
+	    tokenize(payload + record.channelLength + record.nickLength, record.textLength, words);
+	    for (size_t i = 0; i < words.size(); ++i)
+	        pairs.push_back(std::make_pair(hashTerm(words[i]), static_cast<unsigned int>(offset)));
+	    offset += record.length;
+	}
+	unmapFile(segment);
+
+	std::sort(pairs.begin(), pairs.end());
+	pairs.erase(std::unique(pairs.begin(), pairs.end()), pairs.end());
+
+	std::vector<SearchTermEntry> terms;
+	std::vector<unsigned int> postings;
+	postings.reserve(pairs.size());
+	for (size_t i = 0; i < pairs.size(); ++i)
+	{
+	    if (terms.empty() || terms.back().hash != pairs[i].first)
+	    {
+	        SearchTermEntry entry;
+	        entry.hash = pairs[i].first;
+	        entry.first = static_cast<unsigned int>(postings.size());
+	        entry.count = 0;
+	        terms.push_back(entry);
+	    }
+	    terms.back().count++;
+	    postings.push_back(pairs[i].second);
+	}
+	header.termCount = static_cast<unsigned int>(terms.size());
+	header.postingCount = postings.size();
+
+	std::string body(reinterpret_cast<const char*>(&header), sizeof(header));
+	if (!terms.empty())
+	    body.append(reinterpret_cast<const char*>(&terms[0]), terms.size() * sizeof(SearchTermEntry));
+	if (!postings.empty())
+	    body.append(reinterpret_cast<const char*>(&postings[0]), postings.size() * sizeof(unsigned int));
+
+	std::string path = indexPath(number);
+	std::string tmpPath = path + ".tmp";
+	int fd = open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd == -1)
+	    return false;
+	size_t written = 0;
+	while (written < body.size())
+	{
+	    ssize_t n = write(fd, body.data() + written, body.size() - written);
+	    if (n == -1 && errno == EINTR)
+	        continue;
+	    if (n <= 0)
+	        break;
+	    written += n;
+	}
+	bool ok = written == body.size() && fsync(fd) == 0;
+	close(fd);
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) == -1)
+	{
+	    unlink(tmpPath.c_str());
+	    return false;
+	}
+	return true;
+}
+
+// Newest segments first, newest records first. Sealed segments are skipped
+// when outside the time range, and go through their index when the query
+// has words; the others are scanned record by record against the filters.
+// Stops as soon as one hit past the page is found.
+void SearchIndex::runQuery(const SearchQuery& query, SearchResult& result)
+{
+	result.clientId = query.clientId;
+	result.fd = query.fd;
+	result.offset = query.offset;
+	result.more = false;
+
+	unsigned long current = _log.getCurrentSegment();
+	std::vector<unsigned long> segments = listSegments();
+	size_t matched = 0;
+
+	for (size_t i = segments.size(); i-- > 0 && !result.more; )
+	{
+	    std::vector<unsigned int> offsets;
+	    bool indexed = false;
+
+	    MappedFile index;
+	    if (segments[i] < current && mapFile(indexPath(segments[i]), index))
+	    {
+	        if (validIndex(index))
+	        {
+	            const SearchIndexHeader* header = reinterpret_cast<const SearchIndexHeader*>(index.data);
+	            bool outside = header->minTimeMs < 0
+	                || (query.afterMs >= 0 && header->maxTimeMs <= query.afterMs)
+	                || (query.beforeMs >= 0 && header->minTimeMs >= query.beforeMs);
+	            if (outside)
+	            {
+	                unmapFile(index);
+	                continue;
+	            }
+	            if (!query.terms.empty())
+	            {
+	                lookupIndex(index, query.terms, offsets);
+	                indexed = true;
+	            }
+	        }
+	        unmapFile(index);
+	    }
+	    if (indexed && offsets.empty())
+	        continue;
+
+	    MappedFile segment;
+	    if (!mapFile(ChannelLog::segmentPath(_directory, segments[i]), segment))
+	        continue;
+
+	    LogRecordHeader record;
+	    const char* payload;
+	    if (!indexed)
+	    {
+	        size_t offset = sizeof(LogSegmentHeader);
+	        while (readRecord(segment, offset, record, payload))
+	        {
+	            offsets.push_back(static_cast<unsigned int>(offset));
+	            offset += record.length;
+	        }
+	    }
+
+	    for (size_t j = offsets.size(); j-- > 0; )
+	    {
+	        if (!readRecord(segment, offsets[j], record, payload) || !matchRecord(query, record, payload))
+	            continue;
+	        if (matched++ < query.offset)
+	            continue;
+	        if (result.hits.size() == query.limit)
+	        {
+	            result.more = true;
+	            break;
+	        }
+	        SearchHit hit;
+	        hit.timeMs = record.timeMs;
+	        hit.type = record.type;
+	        hit.channel.assign(payload, record.channelLength);
+	        hit.nick.assign(payload + record.channelLength, record.nickLength);
+	        hit.text.assign(payload + record.channelLength + record.nickLength, record.textLength);
+	        result.hits.push_back(hit);
+	    }
+	    unmapFile(segment);
+	}
+}
+
+// Segment numbers found in the log directory, ascending.
+std::vector<unsigned long> SearchIndex::listSegments() const
+{
+	std::vector<unsigned long> segments;
+	DIR* dir = opendir(_directory.c_str());
+	if (!dir)
+	    return segments;
+
+	struct dirent* entry;
+	while ((entry = readdir(dir)) != NULL)
+	{
+	    unsigned long number;
+	    char suffix[8];
+	    if (std::sscanf(entry->d_name, "channels-%lu.%7s", &number, suffix) == 2
+	        && std::strcmp(suffix, "log") == 0)
+	        segments.push_back(number);
+	}
+	closedir(dir);
+	std::sort(segments.begin(), segments.end());
+	return segments;
+}
+
+std::string SearchIndex::indexPath(unsigned long number) const
+{
+	std::string path = ChannelLog::segmentPath(_directory, number);
+	return path.substr(0, path.size() - 4) + ".idx";
+}
+
+/* ========================================================================== */
+/*                    TOKENIZER                                               */
+/* ========================================================================== */
+
+// Words are runs of letters and digits, lowercased; each word is kept once.
+void SearchIndex::tokenize(const char* text, size_t length, std::vector<std::string>& words)
+{
+	std::string word;
+	for (size_t i = 0; i <= length; ++i)
+	{
+	    if (i < length && std::isalnum(static_cast<unsigned char>(text[i])))
+	    {
+	        if (word.size() < SEARCH_TERM_MAX)
+	            word += static_cast<char>(std::tolower(static_cast<unsigned char>(text[i])));
+	        continue;
+	    }
+	    if (!word.empty() && std::find(words.begin(), words.end(), word) == words.end())
+	        words.push_back(word);
+	    word.clear();
+	}
+}
+
+// 64-bit FNV-1a
+unsigned long SearchIndex::hashTerm(const std::string& word)
+{
+	unsigned long long hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < word.size(); ++i)
+	{
+	    hash ^= static_cast<unsigned char>(word[i]);
+	    hash *= 1099511628211ULL;
+	}
+	return static_cast<unsigned long>(hash);
+}
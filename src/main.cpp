@@ -42,10 +42,10 @@ void setupSignalHandlers()
 bool validateArguments(int argc, char** argv)
 {
 	// Check the number of arguments
-	if (argc != 3)
+	if (argc != 3 && argc != 4)
 	{
 		std::cerr << "Error: Invalid number of arguments" << std::endl;
-		std::cerr << "Usage: " << argv[0] << " <port> <password>" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " <port> <password> [config]" << std::endl;
 		std::cerr << "Example: " << argv[0] << " 6667 mypassword" << std::endl;
 		return false;
 	}
@@ -95,13 +95,17 @@ int main(int argc, char** argv)
 	// 2. Parse the arguments
 	int port = std::atoi(argv[1]);
 	std::string password = argv[2];
+	Config config;
+	if (argc == 4 && !config.load(argv[3]))
+		return 1;
 	
 	// 3. Setup signal handlers
 	setupSignalHandlers();
 	
 	// 4. Create the server
-	Server server(port, password);
+	Server server(port, password, config);
 	g_server = &server;  // For the signal handler
+	server.setCommandLine(argc, argv);  // UPGRADE starts the new binary the same way
 	
 	// 5. Initialize the server
 	if (!server.init())
@@ -0,0 +1,242 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+AdmissionControl::AdmissionControl()
+	: _used(0),
+	  _seed(0),
+	  _clones(0),
+	  _intervalMs(0),
+	  _toleranceMs(0),
+	  _refused(0),
+	  _reportMs(0)
+{
+	Slot empty;
+	empty.address = 0;
+	empty.live = 0;
+	empty.nextMs = 0;
+	_slots.assign(ADMISSION_MIN_SLOTS, empty);
+
+	// A secret seed, so that nobody can pick addresses that collide
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd == -1 || read(fd, &_seed, sizeof(_seed)) != static_cast<ssize_t>(sizeof(_seed)))
+	    _seed = static_cast<unsigned int>(std::time(NULL)) ^ (static_cast<unsigned int>(getpid()) << 16);
+	if (fd != -1)
+	    close(fd);
+}
+
+AdmissionControl::~AdmissionControl() {}
+
+// Limits from the configuration (also called by REHASH). They apply to
+// the connections accepted from then on.
+void AdmissionControl::configure(const Config& config)
+{
+	_clones = std::max(0L, config.getLong("admission.clones", ADMISSION_CLONES_DEFAULT));
+	long connects = std::max(0L, config.getLong("admission.connects", ADMISSION_CONNECTS_DEFAULT));
+	long periodMs = std::max(1L, config.getLong("admission.period", ADMISSION_PERIOD_DEFAULT)) * 1000;
+	_intervalMs = connects > 0 ? std::max(1L, periodMs / connects) : 0;
+	_toleranceMs = connects > 0 ? periodMs - _intervalMs : 0;
+
+	std::vector<std::string> networks;
+	if (config.has("admission.exempt"))
+	    networks = config.getList("admission.exempt");
+	else
+	    networks.push_back(ADMISSION_EXEMPT_DEFAULT);
+
+	_exempt.clear();
+	for (size_t i = 0; i < networks.size(); ++i)
+	{
+	    Range range;
+	    if (parseNetwork(networks[i], range.address, range.mask))
+	        _exempt.push_back(range);
+	    else
+	        std::cerr << "Warning: admission.exempt: invalid network " << networks[i] << std::endl;
+	}
+}
+
+/* ========================================================================== */
+/*                    ADMISSION                                               */
+/* ========================================================================== */
+
+// Count a new connection from `address`, or say why it is refused. Exempt
+// hosts are not counted, and neither are new hosts once the table is full.
+int AdmissionControl::admit(unsigned int address, long nowMs)
+{
+	if ((_clones <= 0 && _intervalMs <= 0) || address == 0 || isExempt(address))
+	    return ADMISSION_OK;
+
+	Slot* slot = find(address);
+	if (slot)
+	{
+	    if (_clones > 0 && slot->live >= static_cast<unsigned long>(_clones))
+	    {
+	        ++_refused;
+	        return ADMISSION_CLONES;
+	    }
+	    if (_intervalMs > 0 && slot->nextMs - nowMs > _toleranceMs)
+	    {
+	        ++_refused;
+	        return ADMISSION_RATE;
+	    }
+	}
+	else if (!(slot = insert(address, nowMs)))
+	    return ADMISSION_OK;
+
+	if (_intervalMs > 0)
+	    slot->nextMs = std::max(slot->nextMs, nowMs) + _intervalMs;
+	++slot->live;
+	return ADMISSION_OK;
+}
+
+// Count a connection that was not accepted here (handed over by UPGRADE).
+void AdmissionControl::track(unsigned int address)
+{
+	if ((_clones <= 0 && _intervalMs <= 0) || address == 0 || isExempt(address))
+	    return;
+	Slot* slot = find(address);
+	if (!slot)
+	    slot = insert(address, Utils::getTimeMs());
+	if (slot)
+	    ++slot->live;
+}
+
+// A connection from `address` is gone.
+void AdmissionControl::release(unsigned int address)
+{
+	if (address == 0)
+	    return;
+	Slot* slot = find(address);
+	if (slot && slot->live > 0)
+	    --slot->live;
+}
+
+// At most once a second, the number of connections refused since the last
+// report, so that a storm does not flood the log too.
+bool AdmissionControl::takeReport(long nowMs, unsigned long& refused)
+{
+	if (_refused == 0 || nowMs - _reportMs < 1000)
+	    return false;
+	refused = _refused;
+	_refused = 0;
+	_reportMs = nowMs;
+	return true;
+}
+
+/* ========================================================================== */
+/*                    TABLE                                                   */
+/* ========================================================================== */
+
+size_t AdmissionControl::slotOf(unsigned int address) const
+{
+	// MurmurHash3 finalizer
+	unsigned int hash = address ^ _seed;
+	hash ^= hash >> 16;
+	hash *= 0x85ebca6bu;
+	hash ^= hash >> 13;
+	hash *= 0xc2b2ae35u;
+	hash ^= hash >> 16;
+	return hash & (_slots.size() - 1);
+}
+
+AdmissionControl::Slot* AdmissionControl::find(unsigned int address)
+{
+	size_t mask = _slots.size() - 1;
+	for (size_t i = slotOf(address); _slots[i].address != 0; i = (i + 1) & mask)
+	{
+	    if (_slots[i].address == address)
+	        return &_slots[i];
+	}
+	return NULL;
+}
+
+// A new slot for `address` (not in the table), NULL if the table is full.
+// The table is kept at most half full.
+AdmissionControl::Slot* AdmissionControl::insert(unsigned int address, long nowMs)
+{
+	if ((_used + 1) * 2 > _slots.size())
+	{
+	    rebuild(nowMs);
+	    if ((_used + 1) * 2 > _slots.size())
+	        return NULL;
+	}
+
+	size_t mask = _slots.size() - 1;
+	size_t i = slotOf(address);
+	while (_slots[i].address != 0)
+	    i = (i + 1) & mask;
+	_slots[i].address = address;
+	_slots[i].live = 0;
+	_slots[i].nextMs = 0;
+	++_used;
+	return &_slots[i];
+}
+
+// Drop the hosts with no connection and a full bucket, and rehash the
+// others into a table at most a quarter full, so the next rebuild is at
+// least as many insertions away as there are hosts left.
+void AdmissionControl::rebuild(long nowMs)
+{
+	std::vector<Slot> kept;
+	for (size_t i = 0; i < _slots.size(); ++i)
+	{
+	    if (_slots[i].address != 0 && (_slots[i].live > 0 || _slots[i].nextMs > nowMs))
+	        kept.push_back(_slots[i]);
+	}
+
+	size_t size = ADMISSION_MIN_SLOTS;
+	while (size < ADMISSION_MAX_SLOTS && (kept.size() + 1) * 4 > size)
+	    size *= 2;
+
+	Slot empty;
+	empty.address = 0;
+	empty.live = 0;
+	empty.nextMs = 0;
+	_slots.assign(size, empty);
+	_used = kept.size();
+
+	size_t mask = size - 1;
+	for (size_t k = 0; k < kept.size(); ++k)
+	{
+	    size_t i = slotOf(kept[k].address);
+	    while (_slots[i].address != 0)
+	        i = (i + 1) & mask;
+	    _slots[i] = kept[k];
+	}
+}
+
+bool AdmissionControl::isExempt(unsigned int address) const
+{
+	for (size_t i = 0; i < _exempt.size(); ++i)
+	{
+	    if ((address & _exempt[i].mask) == _exempt[i].address)
+	        return true;
+	}
+	return false;
+}
+
+// "a.b.c.d/n", or a single address.
+bool AdmissionControl::parseNetwork(const std::string& text, unsigned int& address, unsigned int& mask)
+{
+	std::string host = text;
+	long prefix = 32;
+	size_t slash = text.find('/');
+	if (slash != std::string::npos)
+	{
+	    host = text.substr(0, slash);
+	    std::string bits = text.substr(slash + 1);
+	    if (bits.empty() || bits.size() > 2 || !Utils::isNumber(bits))
+	        return false;
+	    prefix = std::atol(bits.c_str());
+	    if (prefix > 32)
+	        return false;
+	}
+
+	struct in_addr parsed;
+	if (inet_pton(AF_INET, host.c_str(), &parsed) != 1)
+	    return false;
+	mask = prefix == 0 ? 0 : 0xffffffffu << (32 - prefix);
+	address = ntohl(parsed.s_addr) & mask;
+	return true;
+}
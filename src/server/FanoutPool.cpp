@@ -0,0 +1,242 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+FanoutPool::FanoutPool(size_t threads, size_t minMembers)
+	: _minMembers(minMembers),
+	  _generation(0),
+	  _busy(0),
+	  _stopping(false),
+	  _task(FANOUT_TASK_QUEUE),
+	  _members(NULL),
+	  _line(NULL),
+	  _taggedLine(NULL),
+	  _excludeFd(-1),
+	  _clients(NULL),
+	  _hasDirty(false)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_startCond, NULL);
+	pthread_cond_init(&_doneCond, NULL);
+
+	for (size_t i = 0; i <= threads; ++i)
+	{
+	    Sender* sender = new Sender();
+	    sender->pool = this;
+	    sender->index = i;
+	    _senders.push_back(sender);
+	}
+}
+
+FanoutPool::~FanoutPool()
+{
+	stop();
+	for (size_t i = 0; i < _senders.size(); ++i)
+	    delete _senders[i];
+	pthread_cond_destroy(&_doneCond);
+	pthread_cond_destroy(&_startCond);
+	pthread_mutex_destroy(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    START / STOP                                            */
+/* ========================================================================== */
+
+bool FanoutPool::start()
+{
+	for (size_t i = 1; i < _senders.size(); ++i)
+	{
+	    if (pthread_create(&_senders[i]->thread, NULL, &FanoutPool::senderMain, _senders[i]) != 0)
+	    {
+	        std::cerr << "Error: cannot start fan-out thread " << i << std::endl;
+	        for (size_t j = i; j < _senders.size(); ++j)
+	            delete _senders[j];
+	        _senders.resize(i);
+	        stop();
+	        return false;
+	    }
+	}
+	return true;
+}
+
+void FanoutPool::stop()
+{
+	pthread_mutex_lock(&_mutex);
+	if (_stopping)
+	{
+	    pthread_mutex_unlock(&_mutex);
+	    return;
+	}
+	_stopping = true;
+	pthread_cond_broadcast(&_startCond);
+	pthread_mutex_unlock(&_mutex);
+
+	for (size_t i = 1; i < _senders.size(); ++i)
+	    pthread_join(_senders[i]->thread, NULL);
+}
+
+/* ========================================================================== */
+/*                    EVENT LOOP SIDE                                         */
+/* ========================================================================== */
+
+bool FanoutPool::accepts(size_t memberCount) const
+{
+	return _senders.size() > 1 && memberCount >= _minMembers;
+}
+
+// Queue `line` (`taggedLine` for message-tags clients) for every local
+// member but `excludeFd`. Nothing is written yet: see flush().
+void FanoutPool::broadcast(const std::vector<Membership>& members, const std::string& line,
+                           const std::string& taggedLine, int excludeFd)
+{
+	_members = &members;
+	_line = &line;
+	_taggedLine = &taggedLine;
+	_excludeFd = excludeFd;
+	runTask(FANOUT_TASK_QUEUE);
+	_members = NULL;
+	_hasDirty = true;
+}
+
+bool FanoutPool::hasDirty() const
+{
+	return _hasDirty;
+}
+
+// The fds broadcasts gave output to since the last call.
+void FanoutPool::takeDirty(std::vector<int>& fds)
+{
+	for (size_t i = 0; i < _senders.size(); ++i)
+	{
+	    fds.insert(fds.end(), _senders[i]->dirty.begin(), _senders[i]->dirty.end());
+	    _senders[i]->dirty.clear();
+	}
+	_hasDirty = false;
+}
+
+// One send() per client; `blocked` receives the clients whose socket did
+// not take everything, to be watched for POLLOUT.
+void FanoutPool::flush(const std::vector<Client*>& clients, std::vector<Client*>& blocked)
+{
+	_clients = &clients;
+	runTask(FANOUT_TASK_FLUSH);
+	_clients = NULL;
+
+	for (size_t i = 0; i < _senders.size(); ++i)
+	{
+	    blocked.insert(blocked.end(), _senders[i]->blocked.begin(), _senders[i]->blocked.end());
+	    _senders[i]->blocked.clear();
+	}
+}
+
+size_t FanoutPool::size() const
+{
+	return _senders.size() - 1;
+}
+
+// Wake the threads, run the event loop's slice, wait for theirs.
+void FanoutPool::runTask(int task)
+{
+	pthread_mutex_lock(&_mutex);
+	_task = task;
+	_busy = _senders.size() - 1;
+	_generation++;
+	pthread_cond_broadcast(&_startCond);
+	pthread_mutex_unlock(&_mutex);
+
+	if (task == FANOUT_TASK_QUEUE)
+	    queueSlice(*_senders[0]);
+	else
+	    flushSlice(*_senders[0]);
+
+	pthread_mutex_lock(&_mutex);
+	while (_busy > 0)
+	    pthread_cond_wait(&_doneCond, &_mutex);
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    SENDER THREADS                                          */
+/* ========================================================================== */
+
+void* FanoutPool::senderMain(void* arg)
+{
+	Sender* sender = static_cast<Sender*>(arg);
+	sender->pool->senderLoop(*sender);
+	return NULL;
+}
+
+void FanoutPool::senderLoop(Sender& sender)
+{
+	unsigned long seen = 0;
+	for (;;)
+	{
+	    pthread_mutex_lock(&_mutex);
+	    while (_generation == seen && !_stopping)
+	        pthread_cond_wait(&_startCond, &_mutex);
+	    if (_stopping)
+	    {
+	        pthread_mutex_unlock(&_mutex);
+	        return;
+	    }
+	    seen = _generation;
+	    int task = _task;
+	    pthread_mutex_unlock(&_mutex);
+
+	    if (task == FANOUT_TASK_QUEUE)
+	        queueSlice(sender);
+	    else
+	        flushSlice(sender);
+
+	    pthread_mutex_lock(&_mutex);
+	    if (--_busy == 0)
+	        pthread_cond_signal(&_doneCond);
+	    pthread_mutex_unlock(&_mutex);
+	}
+}
+
+void FanoutPool::queueSlice(Sender& sender)
+{
+	size_t count = _members->size();
+	size_t begin = count * sender.index / _senders.size();
+	size_t end = count * (sender.index + 1) / _senders.size();
+
+	for (size_t i = begin; i < end; ++i)
+	{
+	    Client* member = (*_members)[i].client;
+	    // Detached sessions are capped by the event loop (Server::queueLine)
+	    if (member->isRemote() || member->isDetached() || member->getFd() == _excludeFd)
+	        continue;
+
+	    if (!member->hasDataToSend())
+	        sender.dirty.push_back(member->getFd());
+	    member->appendToOutput(member->getOutputClass(),
+	                           member->hasCapability(CAP_MESSAGE_TAGS) ? *_taggedLine : *_line);
+	}
+}
+
+void FanoutPool::flushSlice(Sender& sender)
+{
+	size_t count = _clients->size();
+	size_t begin = count * sender.index / _senders.size();
+	size_t end = count * (sender.index + 1) / _senders.size();
+
+	for (size_t i = begin; i < end; ++i)
+	{
+	    Client* client = (*_clients)[i];
+	    const char* data;
+	    size_t size;
+	    if (!client->nextOutput(data, size))
+	        continue;
+
+	    ssize_t written = send(client->getFd(), data, size, 0);
+	    if (written > 0)
+	        client->trimOutputBuffer(written);
+	    else if (written == -1 && errno != EAGAIN && errno != EWOULDBLOCK)
+	        client->markConnectionLost();
+	    if (client->hasDataToSend())
+	        sender.blocked.push_back(client);
+	}
+}
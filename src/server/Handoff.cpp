@@ -0,0 +1,299 @@
+#include "IRC.hpp"
+
+extern char** environ;
+
+/* ========================================================================== */
+/*                    SERIALIZER                                              */
+/* ========================================================================== */
+
+Serializer::Serializer()
+	: _pos(0),
+	  _ok(true)
+{
+}
+
+Serializer::Serializer(const std::string& data)
+	: _data(data),
+	  _pos(0),
+	  _ok(true)
+{
+}
+
+void Serializer::putNumber(long value)
+{
+	// Zigzag: 0, -1, 1, -2... become 0, 1, 2, 3...
+	unsigned long bits = static_cast<unsigned long>(value) << 1;
+	if (value < 0)
+	    bits = ~bits;
+	while (bits >= 0x80)
+	{
+	    _data += static_cast<char>((bits & 0x7f) | 0x80);
+	    bits >>= 7;
+	}
+	_data += static_cast<char>(bits);
+}
+
+void Serializer::putString(const std::string& value)
+{
+	putNumber(static_cast<long>(value.size()));
+	_data += value;
+}
+
+long Serializer::getNumber()
+{
+	unsigned long bits = 0;
+	for (unsigned int shift = 0; _ok; shift += 7)
+	{
+	    if (_pos >= _data.size() || shift >= 64)
+	    {
+	        _ok = false;
+	        break;
+	    }
+	    unsigned char byte = _data[_pos++];
+	    bits |= static_cast<unsigned long>(byte & 0x7f) << shift;
+	    if (!(byte & 0x80))
+	        return (bits & 1) ? ~static_cast<long>(bits >> 1) : static_cast<long>(bits >> 1);
+	}
+	return 0;
+}
+
+std::string Serializer::getString()
+{
+	long length = getNumber();
+	if (!_ok || length < 0 || static_cast<unsigned long>(length) > _data.size() - _pos)
+	{
+	    _ok = false;
+	    return "";
+	}
+	std::string value = _data.substr(_pos, length);
+	_pos += length;
+	return value;
+}
+
+const std::string& Serializer::getData() const
+{
+	return _data;
+}
+
+bool Serializer::ok() const
+{
+	return _ok;
+}
+
+/* ========================================================================== */
+/*                    OLD PROCESS                                             */
+/* ========================================================================== */
+
+// The program to exec: argv[0] as given, looked up in PATH if it has no '/'.
+static std::string findProgram(const std::string& name)
+{
+	if (name.find('/') != std::string::npos)
+	    return name;
+	const char* path = std::getenv("PATH");
+	std::vector<std::string> dirs = Utils::split(path ? path : "", ':');
+	for (size_t i = 0; i < dirs.size(); ++i)
+	{
+	    std::string candidate = (dirs[i].empty() ? "." : dirs[i]) + "/" + name;
+	    if (access(candidate.c_str(), X_OK) == 0)
+	        return candidate;
+	}
+	return name;
+}
+
+// Start the binary named by `commandLine` with the same arguments and one
+// end of a socket pair; `sock` is our end.
+bool Handoff::spawn(const std::vector<std::string>& commandLine, int& sock, pid_t& pid)
+{
+	if (commandLine.empty())
+	    return false;
+
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, pair) == -1)
+	    return false;
+
+	// Everything the child needs is built before fork(): other threads may
+	// hold allocator locks, and only async-signal-safe calls are allowed there
+	std::string program = findProgram(commandLine[0]);
+	std::vector<char*> argv;
+	for (size_t i = 0; i < commandLine.size(); ++i)
+	    argv.push_back(const_cast<char*>(commandLine[i].c_str()));
+	argv.push_back(NULL);
+
+	std::string prefix = std::string(HANDOFF_ENV) + "=";
+	std::string handoffVar = prefix + Utils::intToString(pair[1]);
+	std::vector<char*> envp;
+	for (char** env = environ; *env; ++env)
+	{
+	    if (std::strncmp(*env, prefix.c_str(), prefix.size()) != 0)
+	        envp.push_back(*env);
+	}
+	envp.push_back(const_cast<char*>(handoffVar.c_str()));
+	envp.push_back(NULL);
+
+	long maxFd = sysconf(_SC_OPEN_MAX);
+	if (maxFd < 0)
+	    maxFd = 1024;
+
+	pid = fork();
+	if (pid == -1)
+	{
+	    close(pair[0]);
+	    close(pair[1]);
+	    return false;
+	}
+	if (pid == 0)
+	{
+	    // Only the handoff socket goes through exec: a stray copy of a
+	    // client socket would keep it open after the new server closes it
+	    for (int fd = 3; fd < maxFd; ++fd)
+	    {
+	        if (fd != pair[1])
+	            close(fd);
+	    }
+	    execve(program.c_str(), &argv[0], &envp[0]);
+	    _exit(127);
+	}
+
+	close(pair[1]);
+	sock = pair[0];
+	return true;
+}
+
+static bool sendMessage(int sock, char type, const char* data, size_t size,
+                        const int* fds, size_t fdCount)
+{
+	std::string payload(1, type);
+	payload.append(data, size);
+
+	struct iovec iov;
+	iov.iov_base = const_cast<char*>(payload.data());
+	iov.iov_len = payload.size();
+
+	union
+	{
+	    char            buffer[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MSG)];
+	    struct cmsghdr  align;
+	} control;
+
+	struct msghdr msg;
+	std::memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	if (fdCount > 0)
+	{
+	    msg.msg_control = control.buffer;
+	    msg.msg_controllen = CMSG_SPACE(sizeof(int) * fdCount);
+	    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+	    cmsg->cmsg_level = SOL_SOCKET;
+	    cmsg->cmsg_type = SCM_RIGHTS;
+	    cmsg->cmsg_len = CMSG_LEN(sizeof(int) * fdCount);
+	    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * fdCount);
+	}
+
+	ssize_t sent;
+	do
+	    sent = sendmsg(sock, &msg, 0);
+	while (sent == -1 && errno == EINTR);
+	return sent == static_cast<ssize_t>(payload.size());
+}
+
+// Descriptors first ('F' messages, in order), then the state ('D'), then 'E'.
+bool Handoff::send(int sock, const std::vector<int>& fds, const std::string& state)
+{
+	for (size_t i = 0; i < fds.size(); i += HANDOFF_FDS_PER_MSG)
+	{
+	    size_t count = std::min(fds.size() - i, static_cast<size_t>(HANDOFF_FDS_PER_MSG));
+	    if (!sendMessage(sock, 'F', "", 0, &fds[i], count))
+	        return false;
+	}
+	for (size_t i = 0; i < state.size(); i += HANDOFF_CHUNK)
+	{
+	    size_t size = std::min(state.size() - i, static_cast<size_t>(HANDOFF_CHUNK));
+	    if (!sendMessage(sock, 'D', state.data() + i, size, NULL, 0))
+	        return false;
+	}
+	return sendMessage(sock, 'E', "", 0, NULL, 0);
+}
+
+// Wait for the new process to say it took over.
+bool Handoff::waitReady(int sock, int timeoutMs)
+{
+	struct pollfd pfd;
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	int result;
+	do
+	    result = poll(&pfd, 1, timeoutMs);
+	while (result == -1 && errno == EINTR);
+	if (result <= 0)
+	    return false;
+
+	char answer = 0;
+	return recv(sock, &answer, 1, 0) == 1 && answer == 'K';
+}
+
+/* ========================================================================== */
+/*                    NEW PROCESS                                             */
+/* ========================================================================== */
+
+bool Handoff::receive(int sock, std::vector<int>& fds, std::string& state)
+{
+	std::vector<char> buffer(HANDOFF_CHUNK + 1);
+	for (;;)
+	{
+	    union
+	    {
+	        char            buffer[CMSG_SPACE(sizeof(int) * HANDOFF_FDS_PER_MSG)];
+	        struct cmsghdr  align;
+	    } control;
+
+	    struct iovec iov;
+	    iov.iov_base = &buffer[0];
+	    iov.iov_len = buffer.size();
+
+	    struct msghdr msg;
+	    std::memset(&msg, 0, sizeof(msg));
+	    msg.msg_iov = &iov;
+	    msg.msg_iovlen = 1;
+	    msg.msg_control = control.buffer;
+	    msg.msg_controllen = sizeof(control.buffer);
+
+	    ssize_t received = recvmsg(sock, &msg, 0);
+	    if (received == -1 && errno == EINTR)
+	        continue;
+	    if (received <= 0 || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)))
+	        return false;
+
+	    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	    {
+	        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+	            continue;
+	        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+	        const unsigned char* data = CMSG_DATA(cmsg);
+	        for (size_t i = 0; i < count; ++i)
+	        {
+	            int fd;
+	            std::memcpy(&fd, data + i * sizeof(int), sizeof(int));
+	            fds.push_back(fd);
+	        }
+	    }
+
+	    if (buffer[0] == 'D')
+	        state.append(&buffer[1], received - 1);
+	    else if (buffer[0] == 'E')
+	        return true;
+	    else if (buffer[0] != 'F')
+	        return false;
+	}
+}
+
+// Tell the old process it can exit.
+void Handoff::ready(int sock)
+{
+	char answer = 'K';
+	if (write(sock, &answer, 1) != 1)
+	    std::cerr << "Warning: could not confirm the upgrade" << std::endl;
+	close(sock);
+}
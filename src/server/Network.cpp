@@ -0,0 +1,777 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+Network::Network(Server& server)
+	: _server(server),
+	  _nextAttempt(0),
+	  _upstream(server.getConfig().getString("relay.upstream", ""))
+{
+	// An edge relay only links to its upstream
+	if (isEdge())
+	{
+	    _targets[_upstream] = NULL;
+	    return;
+	}
+	std::vector<std::string> targets = _server.getConfig().getList("link.connect");
+	for (size_t i = 0; i < targets.size(); ++i)
+	    _targets[targets[i]] = NULL;
+}
+
+// Remote users are owned here; the channels holding them are gone by now.
+Network::~Network()
+{
+	for (std::map<std::string, Client*>::iterator it = _users.begin(); it != _users.end(); ++it)
+	    delete it->second;
+}
+
+/* ========================================================================== */
+/*                    LINKS                                                   */
+/* ========================================================================== */
+
+// Called once per loop: try the link.connect entries that have no link,
+// at most every link.retry_seconds.
+void Network::tick(time_t now)
+{
+	if (!_subscribed.empty())
+	    unsubscribeIdle();
+	if (_targets.empty() || now < _nextAttempt)
+	    return;
+	_nextAttempt = now + _server.getConfig().getLong("link.retry_seconds", LINK_RETRY_DEFAULT);
+
+	for (std::map<std::string, Client*>::iterator it = _targets.begin(); it != _targets.end(); ++it)
+	{
+	    if (!it->second)
+	        connect(it->first);
+	}
+}
+
+// Open a link to "host:port". The connection is non-blocking: PASS and
+// SERVER are queued at once and sent when poll() reports the socket
+// writable; a refused connection shows up as POLLERR/POLLHUP.
+bool Network::connect(const std::string& target)
+{
+	std::string password = _server.getConfig().getString("link.password", "");
+	size_t colon = target.rfind(':');
+	if (password.empty() || colon == std::string::npos)
+	    return false;
+
+	std::string host = target.substr(0, colon);
+	std::string port = target.substr(colon + 1);
+	struct addrinfo hints;
+	struct addrinfo* result = NULL;
+	std::memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &result) != 0 || !result)
+	{
+	    std::cerr << "Error: cannot resolve link " << target << std::endl;
+	    return false;
+	}
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd == -1 || fcntl(fd, F_SETFL, O_NONBLOCK) == -1
+	    || (::connect(fd, result->ai_addr, result->ai_addrlen) == -1 && errno != EINPROGRESS))
+	{
+	    std::cerr << "Error: cannot connect to link " << target << std::endl;
+	    if (fd != -1)
+	        close(fd);
+	    freeaddrinfo(result);
+	    return false;
+	}
+	freeaddrinfo(result);
+
+	Client* link = _server.addConnection(fd, host);
+	if (!link)
+	    return false;
+	link->setLinkState(LINK_OUTGOING);
+	if (_targets.count(target))
+	    _targets[target] = link;
+
+	const Config& config = _server.getConfig();
+	_server.sendToClient(fd, "PASS " + password);
+	if (isEdge())
+	    _server.sendToClient(fd, "CAPAB :RELAY");
+	_server.sendToClient(fd, "SERVER " + _server.getServerName() + " 1 :"
+	                         + config.getString("server.description", SERVER_NAME));
+	std::cout << "Linking to " << target << " (fd: " << fd << ")" << std::endl;
+	return true;
+}
+
+// Both SERVER lines are exchanged: remember the peer, tell the other links
+// and send it our state. A relay only gets the servers; an edge sends no
+// burst but asks again for the channels its users are in.
+void Network::linkEstablished(Client* link, const std::string& name, const std::string& description)
+{
+	link->setLinkState(link->getLinkState() | LINK_ESTABLISHED);
+	link->setServerName(name);
+	_links.push_back(link);
+
+	addServer(name, description, 1, _server.getServerName(), link);
+	sendToLinks(":" + _server.getServerName() + " SERVER " + name + " 2 :" + description, link, true);
+	if (link->getLinkState() & LINK_RELAY)
+	{
+	    _relays[link] = RelayState();
+	    sendServerBurst(link);
+	}
+	else if (isEdge())
+	{
+	    std::map<int, Client*>& clients = _server.getClients();
+	    for (std::map<int, Client*>::iterator it = clients.begin(); it != clients.end(); ++it)
+	        it->second->setIntroduced(false);
+
+	    ChannelRegistry& channels = _server.getChannels();
+	    for (ChannelRegistry::iterator it = channels.begin(); it != channels.end(); ++it)
+	    {
+	        _pendingJoins[Utils::toLower((*it)->getName())];
+	        _server.sendToClient(link->getFd(), ":" + _server.getServerName() + " RSUB "
+	                                            + (*it)->getName());
+	    }
+	}
+	else
+	    sendBurst(link);
+	std::cout << "Link established with " << name << std::endl;
+}
+
+// The connection of a link closed (or never opened): everything behind it
+// splits off, and the other links are told.
+void Network::linkLost(Client* link)
+{
+	for (std::map<std::string, Client*>::iterator it = _targets.begin(); it != _targets.end(); ++it)
+	{
+	    if (it->second == link)
+	        it->second = NULL;
+	}
+
+	std::vector<Client*>::iterator pos = std::find(_links.begin(), _links.end(), link);
+	if (pos == _links.end())
+	    return;
+	_links.erase(pos);
+	_relays.erase(link);
+
+	// An edge without its upstream has nothing to replicate from
+	if (isEdge())
+	{
+	    std::map<int, Client*>& clients = _server.getClients();
+	    for (std::map<std::string, std::vector<PendingJoin> >::iterator it = _pendingJoins.begin();
+	         it != _pendingJoins.end(); ++it)
+	    {
+	        for (size_t i = 0; i < it->second.size(); ++i)
+	        {
+	            std::map<int, Client*>::iterator client = clients.find(it->second[i].fd);
+	            if (client != clients.end() && client->second->getId() == it->second[i].id)
+	                _server.sendToClient(client->first, ":" + _server.getServerName() + " "
+	                                     + ERR_UNAVAILRESOURCE + " " + client->second->getNickname()
+	                                     + " " + it->first + " :Channel is temporarily unavailable");
+	        }
+	    }
+	    _pendingJoins.clear();
+	    _subscribed.clear();
+	}
+
+	std::string name = link->getServerName();
+	removeServer(name);
+	sendToLinks(":" + _server.getServerName() + " SQUIT " + name + " :Link closed", NULL, true);
+	std::cout << "Link with " << name << " closed" << std::endl;
+}
+
+// State of this side of the network, for a new link: servers nearest
+// first, then users, then channels.
+void Network::sendBurst(Client* link)
+{
+	int fd = link->getFd();
+
+	sendServerBurst(link);
+
+	std::map<int, Client*>& clients = _server.getClients();
+	for (std::map<int, Client*>::iterator it = clients.begin(); it != clients.end(); ++it)
+	{
+	    if (it->second->isIntroduced())
+	        _server.sendToClient(fd, userLine(it->second));
+	}
+	for (std::map<std::string, Client*>::iterator it = _users.begin(); it != _users.end(); ++it)
+	{
+	    if (it->second->getUplink() != link)
+	        _server.sendToClient(fd, userLine(it->second));
+	}
+
+	ChannelRegistry& channels = _server.getChannels();
+	for (ChannelRegistry::iterator it = channels.begin(); it != channels.end(); ++it)
+	    sendChannelBurst(link, *it);
+}
+
+// The servers known here, nearest first.
+void Network::sendServerBurst(Client* link)
+{
+	for (int hops = 1; hops <= static_cast<int>(_servers.size()); ++hops)
+	{
+	    for (std::map<std::string, RemoteServer>::const_iterator it = _servers.begin();
+	         it != _servers.end(); ++it)
+	    {
+	        if (it->second.hops == hops && it->second.link != link)
+	            _server.sendToClient(link->getFd(), ":" + it->second.uplinkName + " SERVER "
+	                                 + it->second.name + " " + Utils::intToString(hops + 1)
+	                                 + " :" + it->second.description);
+	    }
+	}
+}
+
+// SJOIN lines (the first one with the modes), BMASK lines, TOPIC.
+void Network::sendChannelBurst(Client* link, Channel* channel)
+{
+	int fd = link->getFd();
+	std::string head = ":" + _server.getServerName() + " SJOIN "
+	                 + Utils::timestampToString(channel->getCreationTime()) + " " + channel->getName() + " ";
+	std::string modes = channel->getModeStringWithParams();
+	if (modes.empty())
+	    modes = "+";
+
+	const std::vector<Membership>& members = channel->getMembers();
+	std::string names;
+	size_t count = 0;
+	for (size_t i = 0; i < members.size(); ++i)
+	{
+	    if (members[i].client->getUplink() == link)
+	        continue;
+	    if (!names.empty())
+	        names += " ";
+	    if (members[i].flags & MEMBER_FLAG_OP)
+	        names += "@";
+	    if (members[i].flags & MEMBER_FLAG_VOICE)
+	        names += "+";
+	    names += members[i].client->getNickname();
+	    if (++count == LINK_BURST_MEMBERS)
+	    {
+	        _server.sendToClient(fd, head + modes + " :" + names);
+	        modes = "+";
+	        names.clear();
+	        count = 0;
+	    }
+	}
+	if (!names.empty())
+	    _server.sendToClient(fd, head + modes + " :" + names);
+
+	const char lists[] = "beI";
+	for (size_t l = 0; l < 3; ++l)
+	{
+	    const std::vector<MaskList::Entry>& entries = channel->getMaskList(lists[l])->getEntries();
+	    for (size_t i = 0; i < entries.size(); ++i)
+	        _server.sendToClient(fd, ":" + _server.getServerName() + " BMASK "
+	                                 + Utils::timestampToString(channel->getCreationTime()) + " "
+	                                 + channel->getName() + " " + lists[l] + " :" + entries[i].mask);
+	}
+
+	if (channel->hasTopic())
+	    _server.sendToClient(fd, ":" + _server.getServerName() + " TOPIC " + channel->getName() + " "
+	                             + Utils::timestampToString(channel->getTopicTime()) + " "
+	                             + channel->getTopicSetter() + " :" + channel->getTopic());
+}
+
+Client* Network::findLink(const std::string& serverName) const
+{
+	std::map<std::string, RemoteServer>::const_iterator it = _servers.find(Utils::toLower(serverName));
+	if (it == _servers.end() || it->second.hops != 1)
+	    return NULL;
+	return it->second.link;
+}
+
+const std::vector<Client*>& Network::getLinks() const
+{
+	return _links;
+}
+
+/* ========================================================================== */
+/*                    EDGE RELAYS                                             */
+/* ========================================================================== */
+
+bool Network::isEdge() const
+{
+	return !_upstream.empty();
+}
+
+// Edge: a JOIN to a channel not replicated here yet waits for its burst
+// (see channelReady()). Returns false when the JOIN can go on now.
+bool Network::deferJoin(Client* client, const std::string& channelName, const std::string& key)
+{
+	std::string name = Utils::toLower(channelName);
+	if (!isEdge() || _subscribed.count(name))
+	    return false;
+
+	std::map<std::string, std::vector<PendingJoin> >::iterator it = _pendingJoins.find(name);
+	if (it == _pendingJoins.end())
+	{
+	    it = _pendingJoins.insert(std::make_pair(name, std::vector<PendingJoin>())).first;
+	    sendToLinks(":" + _server.getServerName() + " RSUB " + channelName, NULL);
+	}
+	PendingJoin pending;
+	pending.fd = client->getFd();
+	pending.id = client->getId();
+	pending.key = key;
+	it->second.push_back(pending);
+	return true;
+}
+
+// Edge: channel lines from upstream are only taken for the channels
+// replicated here or being subscribed to.
+bool Network::acceptsChannel(const std::string& channelName) const
+{
+	std::string name = Utils::toLower(channelName);
+	return !isEdge() || _subscribed.count(name) || _pendingJoins.count(name);
+}
+
+// Edge: upstream sent RSUB back, the burst of the channel is complete.
+// Returns the clients whose JOIN waited for it, with their keys.
+std::vector<std::pair<Client*, std::string> > Network::channelReady(const std::string& channelName)
+{
+	std::vector<std::pair<Client*, std::string> > ready;
+	std::map<std::string, std::vector<PendingJoin> >::iterator it
+	    = _pendingJoins.find(Utils::toLower(channelName));
+	if (it == _pendingJoins.end())
+	    return ready;
+
+	_subscribed.insert(it->first);
+	std::map<int, Client*>& clients = _server.getClients();
+	for (size_t i = 0; i < it->second.size(); ++i)
+	{
+	    std::map<int, Client*>::iterator client = clients.find(it->second[i].fd);
+	    if (client != clients.end() && client->second->getId() == it->second[i].id)
+	        ready.push_back(std::make_pair(client->second, it->second[i].key));
+	}
+	_pendingJoins.erase(it);
+	return ready;
+}
+
+// Edge: make a lurker known upstream, with its channels, before the first
+// line it sends there.
+void Network::announce(Client* client)
+{
+	if (!isEdge() || client->isRemote() || client->isIntroduced() || _links.empty())
+	    return;
+
+	client->setIntroduced(true);
+	sendToLinks(userLine(client), NULL);
+	const std::set<std::string>& channels = client->getChannels();
+	for (std::set<std::string>::const_iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (channel)
+	        propagateJoin(channel, client);
+	}
+}
+
+// Upstream side of RSUB: the relay gets the members it does not know yet,
+// the channel burst, and RSUB back to mark its end.
+void Network::addSubscription(Client* relay, const std::string& channelName)
+{
+	std::map<Client*, RelayState>::iterator it = _relays.find(relay);
+	if (it == _relays.end())
+	    return;
+
+	it->second.channels.insert(Utils::toLower(channelName));
+	Channel* channel = _server.getChannel(channelName);
+	if (channel)
+	{
+	    const std::vector<Membership>& members = channel->getMembers();
+	    for (size_t i = 0; i < members.size(); ++i)
+	        introduceTo(relay, members[i].client);
+	    sendChannelBurst(relay, channel);
+	}
+	_server.sendToClient(relay->getFd(), ":" + _server.getServerName() + " RSUB "
+	                                     + (channel ? channel->getName() : channelName));
+}
+
+// RUNSUB: the users the relay only knew through this channel are forgotten
+// with it, as the relay drops them too.
+void Network::removeSubscription(Client* relay, const std::string& channelName)
+{
+	std::map<Client*, RelayState>::iterator it = _relays.find(relay);
+	if (it == _relays.end())
+	    return;
+
+	RelayState& state = it->second;
+	state.channels.erase(Utils::toLower(channelName));
+	Channel* channel = _server.getChannel(channelName);
+	if (!channel)
+	    return;
+
+	const std::vector<Membership>& members = channel->getMembers();
+	for (size_t i = 0; i < members.size(); ++i)
+	{
+	    Client* user = members[i].client;
+	    if (user->getUplink() == relay)
+	        continue;
+	    const std::set<std::string>& channels = user->getChannels();
+	    bool elsewhere = false;
+	    for (std::set<std::string>::const_iterator c = channels.begin(); c != channels.end() && !elsewhere; ++c)
+	        elsewhere = state.channels.count(*c) != 0;
+	    if (!elsewhere)
+	        state.users.erase(user->getId());
+	}
+}
+
+// A user left the network: the relays stop tracking it.
+void Network::userGone(Client* user)
+{
+	for (std::map<Client*, RelayState>::iterator it = _relays.begin(); it != _relays.end(); ++it)
+	    it->second.users.erase(user->getId());
+}
+
+/* ========================================================================== */
+/*                    SERVERS                                                 */
+/* ========================================================================== */
+
+bool Network::hasServer(const std::string& name) const
+{
+	return Utils::equalsIgnoreCase(name, _server.getServerName())
+	       || _servers.count(Utils::toLower(name)) != 0;
+}
+
+void Network::addServer(const std::string& name, const std::string& description,
+                        int hops, const std::string& uplinkName, Client* link)
+{
+	RemoteServer server;
+	server.name = name;
+	server.description = description;
+	server.hops = hops;
+	server.uplinkName = uplinkName;
+	server.link = link;
+	_servers[Utils::toLower(name)] = server;
+}
+
+// Netsplit: forget `name`, the servers introduced through it and their
+// users. Local members see the users quit with "<uplink> <server>".
+void Network::removeServer(const std::string& name)
+{
+	std::map<std::string, RemoteServer>::iterator root = _servers.find(Utils::toLower(name));
+	if (root == _servers.end())
+	    return;
+
+	std::set<std::string> gone;
+	gone.insert(root->first);
+	std::string reason = root->second.uplinkName + " " + root->second.name;
+	for (bool grown = true; grown; )
+	{
+	    grown = false;
+	    for (std::map<std::string, RemoteServer>::iterator it = _servers.begin(); it != _servers.end(); ++it)
+	    {
+	        if (!gone.count(it->first) && gone.count(Utils::toLower(it->second.uplinkName)))
+	        {
+	            gone.insert(it->first);
+	            grown = true;
+	        }
+	    }
+	}
+
+	std::vector<Client*> users;
+	for (std::map<std::string, Client*>::iterator it = _users.begin(); it != _users.end(); ++it)
+	{
+	    if (gone.count(Utils::toLower(it->second->getServerName())))
+	        users.push_back(it->second);
+	}
+	for (size_t i = 0; i < users.size(); ++i)
+	    removeUser(users[i], reason);
+	for (std::set<std::string>::iterator it = gone.begin(); it != gone.end(); ++it)
+	    _servers.erase(*it);
+	std::cout << "Netsplit: " << reason << " (" << gone.size() << " servers, "
+	          << users.size() << " users)" << std::endl;
+}
+
+// "<server> <hops> <description>" for every known server, this one first (LINKS).
+std::vector<std::string> Network::getServerLines() const
+{
+	std::vector<std::string> lines;
+	lines.push_back(_server.getServerName() + " 0 "
+	                + _server.getConfig().getString("server.description", SERVER_NAME));
+	for (std::map<std::string, RemoteServer>::const_iterator it = _servers.begin(); it != _servers.end(); ++it)
+	    lines.push_back(it->second.name + " " + Utils::intToString(it->second.hops) + " "
+	                    + it->second.description);
+	return lines;
+}
+
+/* ========================================================================== */
+/*                    REMOTE USERS                                            */
+/* ========================================================================== */
+
+Client* Network::findUser(const std::string& nickname) const
+{
+	std::map<std::string, Client*>::const_iterator it = _users.find(Utils::toLower(nickname));
+	return it == _users.end() ? NULL : it->second;
+}
+
+Client* Network::addUser(const std::string& nickname, time_t nickTs,
+                         const std::string& username, const std::string& hostname,
+                         const std::string& serverName, const std::string& realname,
+                         Client* link)
+{
+	Client* user = new Client(-1, hostname);
+	user->setNickname(nickname);
+	user->setNickTs(nickTs);
+	user->setUsername(username);
+	user->setRealname(realname);
+	user->setServerName(serverName);
+	user->setUplink(link);
+	user->setRegistered(true);
+	_users[Utils::toLower(nickname)] = user;
+	nextStateVersion();     // the client table changed
+	return user;
+}
+
+// Quit a remote user locally: neighbours are told, channels forget it.
+void Network::removeUser(Client* user, const std::string& reason)
+{
+	_server.broadcastToNeighbours(user, ":" + user->getPrefix() + " QUIT :" + reason, false);
+
+	std::set<std::string> channels = user->getChannels();
+	for (std::set<std::string>::iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (!channel)
+	        continue;
+	    channel->removeMember(user);
+	    if (channel->isEmpty())
+	        _server.removeChannel(*it);
+	}
+
+	_users.erase(Utils::toLower(user->getNickname()));
+	userGone(user);
+	nextStateVersion();
+	delete user;
+}
+
+void Network::renameUser(Client* user, const std::string& nickname, time_t nickTs)
+{
+	std::string message = ":" + user->getPrefix() + " NICK :" + nickname;
+
+	_users.erase(Utils::toLower(user->getNickname()));
+	user->setNickname(nickname);
+	user->setNickTs(nickTs);
+	_users[Utils::toLower(nickname)] = user;
+
+	const std::set<std::string>& channels = user->getChannels();
+	for (std::set<std::string>::const_iterator it = channels.begin(); it != channels.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (channel)
+	        channel->touch();
+	}
+	_server.broadcastToNeighbours(user, message, false);
+}
+
+const std::map<std::string, Client*>& Network::getUsers() const
+{
+	return _users;
+}
+
+/* ========================================================================== */
+/*                    PROPAGATION                                             */
+/* ========================================================================== */
+
+// Every link but `except`; relays only get the lines about servers
+// (`withRelays`), the rest reaches them through the senders below.
+void Network::sendToLinks(const std::string& line, Client* except, bool withRelays)
+{
+	for (size_t i = 0; i < _links.size(); ++i)
+	{
+	    if (_links[i] != except && (withRelays || !_relays.count(_links[i])))
+	        _server.sendToClient(_links[i]->getFd(), line);
+	}
+}
+
+// NICK, QUIT or KILL of `user`: the servers, and the relays that know it.
+void Network::sendAboutUser(Client* user, const std::string& line, Client* except)
+{
+	sendToLinks(line, except);
+	for (std::map<Client*, RelayState>::iterator it = _relays.begin(); it != _relays.end(); ++it)
+	{
+	    if (it->first != except
+	        && (it->first == user->getUplink() || it->second.users.count(user->getId())))
+	        _server.sendToClient(it->first->getFd(), line);
+	}
+}
+
+// A change to a channel: the servers, and the relays subscribed to it.
+void Network::sendChannelChange(Channel* channel, const std::string& line, Client* except)
+{
+	sendToLinks(line, except);
+	sendToRelays(channel, line, except);
+}
+
+// Only the links behind which the channel has members, and the relays
+// subscribed to it.
+void Network::sendToChannelLinks(Channel* channel, const std::string& line, Client* except)
+{
+	if (_links.empty())
+	    return;
+
+	std::vector<Client*> targets;
+	const std::vector<Membership>& members = channel->getMembers();
+	for (size_t i = 0; i < members.size() && targets.size() < _links.size(); ++i)
+	{
+	    Client* uplink = members[i].client->getUplink();
+	    if (uplink && uplink != except && !_relays.count(uplink)
+	        && std::find(targets.begin(), targets.end(), uplink) == targets.end())
+	        targets.push_back(uplink);
+	}
+	for (size_t i = 0; i < targets.size(); ++i)
+	    _server.sendToClient(targets[i]->getFd(), line);
+	sendToRelays(channel, line, except);
+}
+
+// SJOIN of `users`: relays are told who they are first.
+void Network::forwardJoin(Channel* channel, const std::vector<Client*>& users,
+                          const std::string& line, Client* except)
+{
+	sendToLinks(line, except);
+	if (_relays.empty())
+	    return;
+
+	std::string name = Utils::toLower(channel->getName());
+	for (std::map<Client*, RelayState>::iterator it = _relays.begin(); it != _relays.end(); ++it)
+	{
+	    if (it->first == except || !it->second.channels.count(name))
+	        continue;
+	    for (size_t i = 0; i < users.size(); ++i)
+	        introduceTo(it->first, users[i]);
+	    _server.sendToClient(it->first->getFd(), line);
+	}
+}
+
+// Send ":<source> <message>" to every link but the one `source` came from
+// (NULL source: this server). `channel` is the channel the change is about,
+// if any, for the relays.
+void Network::propagate(Client* source, const std::string& message, Channel* channel)
+{
+	if (_links.empty())
+	    return;
+	// An edge's lurkers are not known upstream: what they do stays here
+	if (source && !source->isRemote() && !source->isIntroduced())
+	    return;
+
+	std::string line = ":" + (source ? source->getNickname() : _server.getServerName()) + " " + message;
+	Client* except = source ? source->getUplink() : NULL;
+	if (channel)
+	    sendChannelChange(channel, line, except);
+	else if (source)
+	    sendAboutUser(source, line, except);
+	else
+	    sendToLinks(line, except);
+}
+
+void Network::propagateToChannel(Channel* channel, Client* source, const std::string& message)
+{
+	if (_links.empty())
+	    return;
+	announce(source);
+	sendToChannelLinks(channel, ":" + source->getNickname() + " " + message, source->getUplink());
+}
+
+// PRIVMSG/NOTICE/INVITE to a remote user: one line over the link towards it.
+void Network::routeToUser(Client* source, Client* target, const std::string& message)
+{
+	if (target->getUplink() && target->getUplink() != source->getUplink())
+	{
+	    announce(source);
+	    _server.sendToClient(target->getUplink()->getFd(), ":" + source->getNickname() + " " + message);
+	}
+}
+
+// A local user finished registering. On an edge it waits until it speaks.
+void Network::introduceUser(Client* client)
+{
+	if (isEdge())
+	    return;
+	client->setIntroduced(true);
+	if (!_links.empty())
+	    sendToLinks(userLine(client), NULL);
+}
+
+void Network::propagateJoin(Channel* channel, Client* client)
+{
+	if (_links.empty() || (!client->isRemote() && !client->isIntroduced()))
+	    return;
+
+	unsigned char flags = channel->getMemberFlags(client);
+	std::string name = std::string((flags & MEMBER_FLAG_OP) ? "@" : "")
+	                 + ((flags & MEMBER_FLAG_VOICE) ? "+" : "") + client->getNickname();
+	forwardJoin(channel, std::vector<Client*>(1, client),
+	            ":" + _server.getServerName() + " SJOIN "
+	            + Utils::timestampToString(channel->getCreationTime()) + " " + channel->getName()
+	            + " + :" + name, client->getUplink());
+}
+
+// TMODE carries the channel timestamp: a side that lost a netjoin drops
+// the mode changes still in flight from the other.
+void Network::propagateMode(Channel* channel, Client* source, const std::string& modes)
+{
+	propagate(source, "TMODE " + Utils::timestampToString(channel->getCreationTime()) + " "
+	                  + channel->getName() + " " + modes, channel);
+}
+
+/* ========================================================================== */
+/*                    PRIVATE METHODS                                         */
+/* ========================================================================== */
+
+// Tell a relay about `user` once.
+void Network::introduceTo(Client* relay, Client* user)
+{
+	if (user->getUplink() == relay || !_relays[relay].users.insert(user->getId()).second)
+	    return;
+	_server.sendToClient(relay->getFd(), userLine(user));
+}
+
+// The relays subscribed to `channel`.
+void Network::sendToRelays(Channel* channel, const std::string& line, Client* except)
+{
+	if (_relays.empty())
+	    return;
+	std::string name = Utils::toLower(channel->getName());
+	for (std::map<Client*, RelayState>::iterator it = _relays.begin(); it != _relays.end(); ++it)
+	{
+	    if (it->first != except && it->second.channels.count(name))
+	        _server.sendToClient(it->first->getFd(), line);
+	}
+}
+
+// Edge: the replicas no local user is in any more are dropped, with the
+// remote users only seen there, and upstream is told (RUNSUB).
+void Network::unsubscribeIdle()
+{
+	std::vector<std::string> idle;
+	for (std::set<std::string>::iterator it = _subscribed.begin(); it != _subscribed.end(); ++it)
+	{
+	    Channel* channel = _server.getChannel(*it);
+	    if (!channel || channel->getLocalMemberCount() == 0)
+	        idle.push_back(*it);
+	}
+
+	for (size_t i = 0; i < idle.size(); ++i)
+	{
+	    _subscribed.erase(idle[i]);
+	    sendToLinks(":" + _server.getServerName() + " RUNSUB " + idle[i], NULL);
+	    Channel* channel = _server.getChannel(idle[i]);
+	    if (!channel)
+	        continue;
+
+	    std::vector<Membership> members = channel->getMembers();
+	    for (size_t m = 0; m < members.size(); ++m)
+	    {
+	        Client* user = members[m].client;
+	        channel->removeMember(user);
+	        user->leaveChannel(idle[i]);
+	        if (user->getChannels().empty())
+	            removeUser(user, "");
+	    }
+	    _server.removeChannel(idle[i]);
+	}
+}
+
+// ":<server> NICK <nick> <ts> <user> <host> <server> :<realname>"
+std::string Network::userLine(Client* client) const
+{
+	std::string server = client->isRemote() ? client->getServerName() : _server.getServerName();
+	return ":" + server + " NICK " + client->getNickname() + " "
+	       + Utils::timestampToString(client->getNickTs()) + " " + client->getUsername() + " "
+	       + client->getHostname() + " " + server + " :" + client->getRealname();
+}
@@ -0,0 +1,178 @@
+#include "IRC.hpp"
+#include <cmath>
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+RepeatDetector::RepeatDetector()
+	: _sourceThreshold(0),
+	  _globalThreshold(0),
+	  _halfLifeMs(10000),
+	  _muteMs(60000)
+{
+	Slot empty;
+	std::memset(&empty, 0, sizeof(empty));
+	_global.assign(REPEAT_GLOBAL_SLOTS, empty);
+}
+
+RepeatDetector::~RepeatDetector() {}
+
+// Thresholds from the configuration (also called by REHASH).
+void RepeatDetector::configure(const Config& config)
+{
+	_sourceThreshold = config.getLong("repeat.source_threshold", 5);
+	_globalThreshold = config.getLong("repeat.global_threshold", 0);
+	_halfLifeMs = std::max(1L, config.getLong("repeat.half_life_ms", 10000));
+	_muteMs = std::max(0L, config.getLong("repeat.mute_seconds", 60)) * 1000;
+}
+
+/* ========================================================================== */
+/*                    DETECTION                                               */
+/* ========================================================================== */
+
+// Count `text` sent by `sourceId` to `target` (casefolded) and say what to
+// do with it. Only a target the line has not yet gone to raises the scores.
+int RepeatDetector::check(unsigned long sourceId, const std::string& target,
+                          const std::string& text, long nowMs)
+{
+	if (_sourceThreshold <= 0 && _globalThreshold <= 0)
+	    return REPEAT_PASS;
+
+	std::map<unsigned long, Source>::iterator it = _sources.find(sourceId);
+	if (it != _sources.end() && it->second.mutedUntilMs > nowMs)
+	    return REPEAT_MUTED;
+
+	size_t length;
+	unsigned long long hash = hashMessage(text, &length);
+	if (length < REPEAT_MIN_LENGTH)
+	    return REPEAT_PASS;
+	unsigned long long targetHash = hashMessage(target, &length);
+
+	if (_sourceThreshold > 0)
+	{
+	    if (it == _sources.end())
+	    {
+	        Source source;
+	        std::memset(&source, 0, sizeof(source));
+	        it = _sources.insert(std::make_pair(sourceId, source)).first;
+	    }
+	    if (bump(it->second.slots, REPEAT_SOURCE_SLOTS, hash, targetHash, nowMs) > _sourceThreshold)
+	    {
+	        it->second.mutedUntilMs = nowMs + _muteMs;
+	        return REPEAT_MUTE;
+	    }
+	}
+
+	if (_globalThreshold > 0)
+	{
+	    size_t bucket = (hash % (REPEAT_GLOBAL_SLOTS / REPEAT_GLOBAL_WAYS)) * REPEAT_GLOBAL_WAYS;
+	    unsigned long long pair = targetHash * 1099511628211ULL ^ sourceId;
+	    if (bump(&_global[bucket], REPEAT_GLOBAL_WAYS, hash, pair, nowMs) > _globalThreshold)
+	        return REPEAT_DROP;
+	}
+	return REPEAT_PASS;
+}
+
+// Drop what is known about a source (client gone).
+void RepeatDetector::forget(unsigned long sourceId)
+{
+	_sources.erase(sourceId);
+}
+
+long RepeatDetector::getMuteSeconds() const
+{
+	return _muteMs / 1000;
+}
+
+// Hash of the text lowercased, trimmed, with whitespace runs folded into one
+// space, computed while walking it (h = h * B + c). `length` receives the
+// length of that normalized text. Never returns 0 (empty slot marker).
+unsigned long long RepeatDetector::hashMessage(const std::string& text, size_t* length)
+{
+	unsigned long long hash = 0;
+	size_t count = 0;
+	bool pendingSpace = false;
+
+	for (size_t i = 0; i < text.size(); ++i)
+	{
+	    unsigned char c = static_cast<unsigned char>(text[i]);
+	    if (std::isspace(c))
+	    {
+	        pendingSpace = (count > 0);
+	        continue;
+	    }
+	    if (pendingSpace)
+	    {
+	        hash = hash * 1099511628211ULL + ' ';
+	        count++;
+	        pendingSpace = false;
+	    }
+	    hash = hash * 1099511628211ULL + static_cast<unsigned char>(std::tolower(c));
+	    count++;
+	}
+	*length = count;
+	return hash ? hash : 1;
+}
+
+/* ========================================================================== */
+/*                    PRIVATE METHODS                                         */
+/* ========================================================================== */
+
+// Score of a slot at `nowMs`: halved every half-life since its last hit.
+double RepeatDetector::decayed(const Slot& slot, long nowMs) const
+{
+	if (slot.hash == 0)
+	    return 0;
+	return slot.score * std::pow(0.5, static_cast<double>(nowMs - slot.lastMs) / _halfLifeMs);
+}
+
+// Count `key` for `hash` in a group of slots and return the new score: +1
+// unless the slot's filter says the key was already counted. An unknown hash
+// takes the slot with the lowest decayed score. The filter starts over with
+// the slot, and once the score has decayed below one half (quiet for a
+// half-life), so a key counts again in the next burst.
+double RepeatDetector::bump(Slot* slots, size_t count, unsigned long long hash,
+                            unsigned long long key, long nowMs) const
+{
+	Slot* target = NULL;
+	double lowest = 0;
+	for (size_t i = 0; i < count; ++i)
+	{
+	    if (slots[i].hash == hash)
+	    {
+	        target = &slots[i];
+	        break;
+	    }
+	    double score = decayed(slots[i], nowMs);
+	    if (!target || score < lowest)
+	    {
+	        target = &slots[i];
+	        lowest = score;
+	    }
+	}
+
+	double score = (target->hash == hash) ? decayed(*target, nowMs) : 0;
+	if (score < 0.5)
+	{
+	    score = 0;
+	    std::memset(target->seen, 0, sizeof(target->seen));
+	}
+
+	// Two bits of the 256, from the two halves of the mixed key
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	unsigned int first = static_cast<unsigned int>(key) % (REPEAT_SEEN_WORDS * 64);
+	unsigned int second = static_cast<unsigned int>(key >> 32) % (REPEAT_SEEN_WORDS * 64);
+	unsigned long long firstBit = 1ULL << (first % 64);
+	unsigned long long secondBit = 1ULL << (second % 64);
+	bool known = (target->seen[first / 64] & firstBit) && (target->seen[second / 64] & secondBit);
+	target->seen[first / 64] |= firstBit;
+	target->seen[second / 64] |= secondBit;
+
+	target->hash = hash;
+	target->score = known ? score : score + 1;
+	target->lastMs = nowMs;
+	return target->score;
+}
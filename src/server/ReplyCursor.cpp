@@ -0,0 +1,68 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    REPLY CURSOR                                            */
+/* ========================================================================== */
+
+// Takes over the caller's reference to the snapshot.
+ReplyCursor::ReplyCursor(const ServerSnapshot* snapshot, const std::string& serverName, Client* client)
+	: _snapshot(snapshot),
+	  _serverName(serverName),
+	  _nick(client->getNickname()),
+	  _clientId(client->getId()),
+	  _fd(client->getFd()),
+	  _position(0),
+	  _open(false)
+{}
+
+ReplyCursor::~ReplyCursor()
+{
+	_snapshot->release();
+}
+
+std::string ReplyCursor::batchParams() const
+{
+	return "";
+}
+
+unsigned long ReplyCursor::getClientId() const
+{
+	return _clientId;
+}
+
+int ReplyCursor::getFd() const
+{
+	return _fd;
+}
+
+bool ReplyCursor::isOpen() const
+{
+	return _open;
+}
+
+// Called with the first window; `batchRef` is empty when no batch is used.
+void ReplyCursor::open(const std::string& batchRef)
+{
+	_open = true;
+	_batchRef = batchRef;
+}
+
+const std::string& ReplyCursor::getBatchRef() const
+{
+	return _batchRef;
+}
+
+/* ========================================================================== */
+/*                    CURSOR JOB                                              */
+/* ========================================================================== */
+
+CursorJob::CursorJob(ReplyCursor* cursor) : _cursor(cursor) {}
+
+// The cursor goes back to the event loop with the window it produced.
+void CursorJob::run(AsyncReply& reply)
+{
+	reply.clientId = _cursor->getClientId();
+	reply.fd = _cursor->getFd();
+	reply.finished = _cursor->fill(reply.lines, REPLY_WINDOW_LINES);
+	reply.cursor = _cursor;
+}
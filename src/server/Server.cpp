@@ -4,17 +4,38 @@
 /*                       CONSTRUCTOR                                          */
 /* ========================================================================== */
 
-Server::Server(int port, const std::string& password)
+Server::Server(int port, const std::string& password, const Config& config)
 	: _port(port),
 	  _password(password),
-	  _serverName(SERVER_NAME),
+	  _serverName(config.getString("server.name", SERVER_NAME)),
 	  _serverSocket(-1),
 	  _running(false),
+	  _channels(MAX_CHANNELS),
+	  _fanoutEpoch(0),
+	  _nextMsgId(0),
+	  _config(config),
+	  _channelLog(NULL),
+	  _searchIndex(NULL),
+	  _workerPool(NULL),
+	  _fanoutPool(NULL),
+	  _snapshot(NULL),
+	  _network(NULL),
+	  _stateStore(NULL),
+	  _upgradeRequested(false),
+	  _nextDetachedKey(-2),
+	  _sessionGrace(SESSION_GRACE_DEFAULT),
+	  _sessionBufferMax(SESSION_BUFFER_DEFAULT),
+	  _nextSessionSweep(0),
+	  _commandsPerTurn(COMMANDS_PER_TURN_DEFAULT),
 	  _cmdHandler(NULL)
 {
 	   _creationDate = std::time(NULL);
 
 	   _cmdHandler = new CommandHandler(*this);
+	   _network = new Network(*this);
+
+	   _wakePipe[0] = -1;
+	   _wakePipe[1] = -1;
 
 	   _pollFds.reserve(MAX_CLIENTS + 1);  // +1 for socket server
 }
@@ -25,21 +46,30 @@ Server::~Server()
 	   for (std::map<int, Client*>::iterator it = _clients.begin();
 	        it != _clients.end(); ++it)
 	   {
-	       close(it->first);      // close the socket
+	       if (it->first >= 0)
+	           close(it->first);  // close the socket, detached sessions have none
 	       delete it->second;     // delete client object
 	   }
 	   _clients.clear();
 
-	   for (std::map<std::string, Channel*>::iterator it = _channels.begin();
-	        it != _channels.end(); ++it)
-	   {
-	       delete it->second;
-	   }
-	   _channels.clear();
+	   _channels.deleteAll();
+	   delete _network;        // remote users
 
 	   if (_serverSocket != -1)
 	       close(_serverSocket);
 
+	   delete _workerPool;
+	   delete _fanoutPool;
+	   if (_snapshot)
+	       _snapshot->release();
+	   delete _searchIndex;
+	   delete _channelLog;     // flushes pending records
+	   delete _stateStore;     // finishes the snapshot being written
+	   if (_wakePipe[0] != -1)
+	   {
+	       close(_wakePipe[0]);
+	       close(_wakePipe[1]);
+	   }
 	   delete _cmdHandler;
 }
 
@@ -56,7 +86,7 @@ Server::~Server()
 ** 5. Set to listen mode (listen())
 ** 6. Add to poll()
 */
-bool Server::init()
+bool Server::openListener()
 {
 	_serverSocket = socket(AF_INET, SOCK_STREAM, 0);
 	if (_serverSocket == -1)
@@ -101,29 +131,529 @@ bool Server::init()
 	}
 
 	addToPoll(_serverSocket);
+	return true;
+}
+
+bool Server::init()
+{
+	// After UPGRADE the listening socket comes with the old process's state
+	const char* handoff = std::getenv(HANDOFF_ENV);
+	int handoffSock = handoff ? std::atoi(handoff) : -1;
+	if (handoff)
+	    unsetenv(HANDOFF_ENV);
+	else if (!openListener())
+	    return false;
+
+	// Worker threads report back through a pipe watched by poll()
+	if (pipe(_wakePipe) == -1
+	    || fcntl(_wakePipe[0], F_SETFL, O_NONBLOCK) == -1
+	    || fcntl(_wakePipe[1], F_SETFL, O_NONBLOCK) == -1)
+	{
+	    std::cerr << "Error: pipe() failed" << std::endl;
+	    return false;
+	}
+	addToPoll(_wakePipe[0]);
+
+	long threads = _config.getLong("workers.threads", WORKER_THREADS_DEFAULT);
+	threads = std::max(1L, std::min(threads, static_cast<long>(WORKER_THREADS_MAX)));
+	_workerPool = new WorkerPool(threads, _wakePipe[1]);
+	if (!_workerPool->start())
+	    return false;
+
+	// Sender threads for the broadcasts of large channels (0 disables them)
+	long senders = _config.getLong("fanout.threads", FANOUT_THREADS_DEFAULT);
+	senders = std::max(0L, std::min(senders, static_cast<long>(FANOUT_THREADS_MAX)));
+	long minMembers = std::max(1L, _config.getLong("fanout.min_members", FANOUT_MIN_MEMBERS_DEFAULT));
+	_fanoutPool = new FanoutPool(senders, minMembers);
+	if (!_fanoutPool->start())
+	    return false;
+
+	// Channel event log, only when a directory is configured
+	if (_config.has("log.dir"))
+	{
+	    _channelLog = new ChannelLog(_config);
+	    if (!_channelLog->start())
+	    {
+	        delete _channelLog;
+	        _channelLog = NULL;
+	        return false;
+	    }
+
+	    _searchIndex = new SearchIndex(*_channelLog, _wakePipe[1],
+	                                   _config.getLong("search.index_interval_ms", 1000));
+	    if (!_searchIndex->start())
+	        return false;
+	}
+
+	// Sessions of clients with draft/resume outlive their connection
+	_sessionGrace = std::max(0L, _config.getLong("session.grace_seconds", SESSION_GRACE_DEFAULT));
+	_sessionBufferMax = std::max(0L, _config.getLong("session.buffer_max", SESSION_BUFFER_DEFAULT));
+	_commandsPerTurn = std::max(1L, _config.getLong("commands.per_turn", COMMANDS_PER_TURN_DEFAULT));
+
+	_repeatDetector.configure(_config);
+	_admission.configure(_config);
+	if (_config.has("spamfilter.file") && !_spamFilter.load(_config.getString("spamfilter.file", "")))
+	    return false;
+
+	// Channel state saved by the last run, unless UPGRADE hands it over.
+	// Edge relays only hold replicas of their upstream's channels.
+	if (_config.has("state.file") && !_network->isEdge())
+	{
+	    _stateStore = new StateStore(_config);
+	    std::string snapshot;
+	    std::vector<std::string> records;
+	    _stateStore->load(snapshot, records);
+	    if (handoffSock == -1)
+	        restoreChannelState(snapshot, records);
+	    if (!_stateStore->start())
+	        return false;
+	}
+
+	if (handoffSock != -1 && !resume(handoffSock))
+	    return false;
+
+	_network->tick(std::time(NULL));
+	return true;
+}
+
+// REHASH: read the configuration file and the spam filter patterns again,
+// and apply the repeat detector thresholds.
+// Other settings (log, workers) only take effect at the next start.
+bool Server::rehash()
+{
+	if (!_config.reload())
+	    return false;
+	_repeatDetector.configure(_config);
+	_admission.configure(_config);
+	if (!_config.has("spamfilter.file"))
+	{
+	    _spamFilter.clear();
+	    return true;
+	}
+	return _spamFilter.load(_config.getString("spamfilter.file", ""));
+}
+
+/* ========================================================================== */
+/*                       LIVE UPGRADE                                         */
+/* ========================================================================== */
+
+void Server::setCommandLine(int argc, char** argv)
+{
+	_commandLine.assign(argv, argv + argc);
+}
+
+// UPGRADE runs at the end of the loop turn, once the command that asked
+// for it and the pending fan-out writes are done.
+void Server::requestUpgrade()
+{
+	_upgradeRequested = true;
+}
+
+// Start the binary we were started from (a new build if it was replaced)
+// and hand it the listening socket, the clients and the channels. On
+// success this process stops without touching a socket again; otherwise
+// it carries on as if nothing happened.
+void Server::upgrade()
+{
+	_upgradeRequested = false;
+
+	if (!_network->getLinks().empty() || _network->isEdge())
+	{
+	    noticeOperators("Upgrade refused: server links cannot be handed over, SQUIT them first");
+	    return;
+	}
+	for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+	    if (it->second->getReplyCursor())
+	    {
+	        noticeOperators("Upgrade refused: long replies are in progress, try again");
+	        return;
+	    }
+	    if (it->second->isSpilling())
+	    {
+	        noticeOperators("Upgrade refused: send queues are spilled to disk, try again");
+	        return;
+	    }
+	}
+
+	// The new process takes over the state file and the channel log too:
+	// the current segment is flushed here and sealed, the new process
+	// starts the next one
+	if (_stateStore)
+	    _stateStore->stop();
+	if (_searchIndex)
+	    _searchIndex->stop();
+	if (_channelLog)
+	    _channelLog->stop();
+
+	std::vector<int> fds;
+	std::string state = saveState(fds);
+
+	int sock = -1;
+	pid_t pid = -1;
+	if (!Handoff::spawn(_commandLine, sock, pid))
+	{
+	    restartWriters();
+	    noticeOperators("Upgrade failed: cannot start a new process");
+	    return;
+	}
+	bool done = Handoff::send(sock, fds, state) && Handoff::waitReady(sock, HANDOFF_TIMEOUT_MS);
+	close(sock);
+	if (!done)
+	{
+	    kill(pid, SIGKILL);
+	    waitpid(pid, NULL, 0);
+	    restartWriters();
+	    noticeOperators("Upgrade failed: the new binary did not take over");
+	    return;
+	}
+
+	std::cout << "Upgrade: " << fds.size() - 1 << " clients handed over to process "
+	          << pid << std::endl;
+	_running = false;
+}
+
+// The upgrade failed: this process keeps the state file and the channel
+// log (on a new segment).
+void Server::restartWriters()
+{
+	if (_stateStore)
+	    _stateStore->start();
+	if (_channelLog && !_channelLog->start())
+	    std::cerr << "Error: the channel log could not be restarted" << std::endl;
+	if (_searchIndex)
+	    _searchIndex->start();
+}
+
+// Everything UPGRADE hands over. The descriptors go to `fds`, the listening
+// socket first, then the clients in the order of the state.
+std::string Server::saveState(std::vector<int>& fds)
+{
+	Serializer out;
+	out.putNumber(HANDOFF_VERSION);
+	out.putNumber(_creationDate);
+	out.putNumber(_nextMsgId);
+	fds.push_back(_serverSocket);
+
+	// Half-open links and clients on their way out are left behind
+	std::map<Client*, long> positions;
+	std::vector<Client*> clients;
+	for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+	    if (it->second->getLinkState() == LINK_NONE && !it->second->isMarkedForDisconnection())
+	        clients.push_back(it->second);
+	}
+
+	out.putNumber(clients.size());
+	for (size_t i = 0; i < clients.size(); ++i)
+	{
+	    Client* client = clients[i];
+	    positions[client] = i;
+	    if (!client->isDetached())
+	        fds.push_back(client->getFd());
+	    out.putString(client->getHostname());
+	    out.putNumber(client->getDetachedAt());
+	    out.putString(client->getSessionToken());
+	    out.putString(client->getNickname());
+	    out.putString(client->getUsername());
+	    out.putString(client->getRealname());
+	    out.putNumber(client->hasPasswordProvided());
+	    out.putNumber(client->isRegistered());
+	    out.putNumber(client->isServerOperator());
+	    out.putNumber(client->isCapNegotiating());
+	    out.putNumber(client->getCapabilities());
+	    out.putNumber(client->getNickTs());
+	    out.putString(client->getInputBuffer());
+	    out.putString(client->getPendingOutput());
+	}
+
+	out.putNumber(_channels.size());
+	for (ChannelRegistry::iterator it = _channels.begin(); it != _channels.end(); ++it)
+	{
+	    Channel* channel = *it;
+	    out.putString(channel->getName());
+	    channel->save(out);
+
+	    const std::vector<Membership>& members = channel->getMembers();
+	    std::vector<std::pair<long, unsigned char> > kept;
+	    for (size_t i = 0; i < members.size(); ++i)
+	    {
+	        std::map<Client*, long>::iterator pos = positions.find(members[i].client);
+	        if (pos != positions.end())
+	            kept.push_back(std::make_pair(pos->second, members[i].flags));
+	    }
+	    out.putNumber(kept.size());
+	    for (size_t i = 0; i < kept.size(); ++i)
+	    {
+	        out.putNumber(kept[i].first);
+	        out.putNumber(kept[i].second);
+	    }
+
+	    std::vector<ChannelHistory::Entry> history = channel->getHistory().latest(HISTORY_MAX_LINES);
+	    out.putNumber(history.size());
+	    for (size_t i = 0; i < history.size(); ++i)
+	    {
+	        out.putNumber(history[i].msgid);
+	        out.putNumber(history[i].timeMs);
+	        out.putString(history[i].line);
+	    }
+	}
+	return out.getData();
+}
+
+// The new binary's side of UPGRADE, at the end of init(): rebuild what
+// saveState() wrote, then let the old process go.
+bool Server::resume(int sock)
+{
+	std::vector<int> fds;
+	std::string data;
+	if (!Handoff::receive(sock, fds, data) || fds.empty())
+	{
+	    std::cerr << "Error: upgrade state could not be received" << std::endl;
+	    close(sock);
+	    return false;
+	}
+
+	Serializer in(data);
+	if (in.getNumber() != HANDOFF_VERSION)
+	{
+	    std::cerr << "Error: upgrade state has another version" << std::endl;
+	    close(sock);
+	    return false;
+	}
+	_serverSocket = fds[0];
+	addToPoll(_serverSocket);
+	_creationDate = in.getNumber();
+	_nextMsgId = in.getNumber();
+
+	std::vector<Client*> clients;
+	size_t clientCount = in.getNumber();
+	size_t nextFd = 1;
+	for (size_t i = 0; i < clientCount && in.ok(); ++i)
+	{
+	    std::string hostname = in.getString();
+	    time_t detachedAt = in.getNumber();
+	    std::string token = in.getString();
+	    Client* client;
+	    if (detachedAt)
+	    {
+	        // A detached session, waiting for RESUME without a socket
+	        int key = nextDetachedKey();
+	        client = new Client(key, hostname);
+	        client->detach(key, detachedAt, true);
+	        _clients[key] = client;
+	    }
+	    else if (nextFd < fds.size())
+	    {
+	        client = addConnection(fds[nextFd++], hostname);
+	        // Still counted against its host's clone limit
+	        struct sockaddr_in peer;
+	        socklen_t peerLen = sizeof(peer);
+	        if (getpeername(client->getFd(), (struct sockaddr*)&peer, &peerLen) == 0
+	            && peer.sin_family == AF_INET)
+	        {
+	            client->setAddress(ntohl(peer.sin_addr.s_addr));
+	            _admission.track(client->getAddress());
+	        }
+	    }
+	    else
+	        break;
+	    clients.push_back(client);
+	    if (!token.empty())
+	    {
+	        client->setSessionToken(token);
+	        _sessions[token] = client;
+	    }
+	    client->setNickname(in.getString());
+	    client->setUsername(in.getString());
+	    client->setRealname(in.getString());
+	    client->setPasswordProvided(in.getNumber() != 0);
+	    client->setRegistered(in.getNumber() != 0);
+	    client->setServerOperator(in.getNumber() != 0);
+	    client->setCapNegotiating(in.getNumber() != 0);
+	    unsigned int capabilities = in.getNumber();
+	    for (unsigned int cap = 1; cap != 0; cap <<= 1)
+	    {
+	        if (capabilities & cap)
+	            client->setCapability(cap, true);
+	    }
+	    client->setNickTs(in.getNumber());
+	    client->appendToInputBuffer(in.getString());
+	    scheduleCommands(client);
+	    client->appendToOutputBuffer(in.getString());
+	    if (client->hasDataToSend())
+	        watchWritable(client->getFd());
+	}
+
+	size_t channelCount = in.getNumber();
+	for (size_t i = 0; i < channelCount && in.ok(); ++i)
+	{
+	    Channel* channel = getOrCreatChannel(in.getString());
+	    if (!channel)
+	        break;
+	    channel->load(in);
+
+	    size_t memberCount = in.getNumber();
+	    for (size_t m = 0; m < memberCount && in.ok(); ++m)
+	    {
+	        size_t position = in.getNumber();
+	        unsigned char flags = in.getNumber();
+	        if (position >= clients.size())
+	            continue;
+	        channel->addMember(clients[position]);
+	        clients[position]->joinChannel(channel->getName());
+	        channel->setMemberFlag(clients[position], MEMBER_FLAG_OP, (flags & MEMBER_FLAG_OP) != 0);
+	        channel->setMemberFlag(clients[position], MEMBER_FLAG_VOICE, (flags & MEMBER_FLAG_VOICE) != 0);
+	    }
+
+	    size_t historyCount = in.getNumber();
+	    for (size_t h = 0; h < historyCount && in.ok(); ++h)
+	    {
+	        unsigned long msgid = in.getNumber();
+	        long timeMs = in.getNumber();
+	        channel->getHistory().append(in.getString(), msgid, timeMs);
+	    }
+	}
 
+	// The old process keeps running until told, so a failure here loses nothing
+	if (!in.ok() || clients.size() != clientCount)
+	{
+	    std::cerr << "Error: upgrade state is corrupted" << std::endl;
+	    close(sock);
+	    return false;
+	}
+
+	Handoff::ready(sock);
+	std::cout << "Upgrade: took over " << clients.size() << " clients and "
+	          << _channels.size() << " channels" << std::endl;
+	noticeOperators("Upgrade complete, running the new binary");
 	return true;
 }
 
+/* ========================================================================== */
+/*                       SAVED CHANNEL STATE                                  */
+/* ========================================================================== */
+
+// What the state file keeps of a channel: its name, Channel::save() and
+// who its operators are.
+std::string Server::channelState(Channel* channel)
+{
+	Serializer out;
+	out.putString(channel->getName());
+	channel->save(out);
+	std::vector<std::string> operators = channel->getOperatorMasks();
+	out.putNumber(operators.size());
+	for (size_t i = 0; i < operators.size(); ++i)
+	    out.putString(operators[i]);
+	return out.getData();
+}
+
+// Recreate a channel from channelState(), without members. A later record
+// of the same channel replaces the earlier one.
+void Server::restoreChannel(const std::string& state)
+{
+	Serializer in(state);
+	std::string name = in.getString();
+	if (!in.ok() || !parser::isValidChannelName(name))
+	    return;
+
+	removeChannel(name);
+	Channel* channel = getOrCreatChannel(name);
+	if (!channel)
+	    return;
+	channel->load(in);
+	size_t count = in.getNumber();
+	for (size_t i = 0; i < count && in.ok(); ++i)
+	    channel->addRestoredOperator(in.getString());
+	if (!in.ok())
+	{
+	    std::cerr << "Warning: saved state of " << name << " is damaged" << std::endl;
+	    removeChannel(name);
+	}
+}
+
+// At startup: the channels of the last snapshot, then the journal over them.
+void Server::restoreChannelState(const std::string& snapshot, const std::vector<std::string>& records)
+{
+	Serializer in(snapshot);
+	size_t count = snapshot.empty() ? 0 : in.getNumber();
+	for (size_t i = 0; i < count && in.ok(); ++i)
+	    restoreChannel(in.getString());
+
+	for (size_t i = 0; i < records.size(); ++i)
+	{
+	    Serializer record(records[i]);
+	    long type = record.getNumber();
+	    std::string data = record.getString();
+	    if (type == STATE_RECORD_CHANNEL)
+	        restoreChannel(data);
+	    else if (type == STATE_RECORD_REMOVED)
+	        removeChannel(data);
+	}
+	if (_channels.size() > 0)
+	    std::cout << "Restored " << _channels.size() << " channels from "
+	              << _config.getString("state.file", "") << std::endl;
+}
+
+// At the end of each loop turn: journal the channels whose saved state
+// changed, and every state.interval hand a full snapshot to the writer.
+// Only the channels touched since the last turn are looked at.
+void Server::saveChannelState()
+{
+	std::vector<Channel*> changed;
+	_channels.takeChanged(changed);
+	for (size_t i = 0; i < changed.size(); ++i)
+	{
+	    Channel* channel = changed[i];
+	    std::pair<unsigned long, std::string>& saved = _savedChannels[Utils::toLower(channel->getName())];
+	    if (saved.first == channel->getVersion())
+	        continue;
+	    saved.first = channel->getVersion();
+
+	    // Joins, parts and messages move the version too; most change nothing here
+	    std::string state = channelState(channel);
+	    if (state == saved.second)
+	        continue;
+	    saved.second = state;
+
+	    Serializer record;
+	    record.putNumber(STATE_RECORD_CHANNEL);
+	    record.putString(state);
+	    _stateStore->record(record.getData());
+	}
+
+	time_t now = std::time(NULL);
+	if (!_stateStore->snapshotDue(now))
+	    return;
+	Serializer snapshot;
+	snapshot.putNumber(_savedChannels.size());
+	for (std::map<std::string, std::pair<unsigned long, std::string> >::iterator it = _savedChannels.begin();
+	     it != _savedChannels.end(); ++it)
+	    snapshot.putString(it->second.second);
+	_stateStore->snapshot(snapshot.getData(), now);
+}
+
 /* ========================================================================== */
 /*                       MAIN LOOP                                            */
 /* ========================================================================== */
 
-// 1. Call poll() with a timeout (e.g., 1000ms)
+// 1. Call poll() with a timeout (e.g., 1000ms), none while commands wait
 // 2. Loop through all monitored fds
 // 3. If it's the server socket, accept new connection
 // 4. If it's a client
 //    a. Check POLLERR/POLLHUP/POLLNVAL -> mark for removal
-//    b. If POLLIN (data to read) -> read and process commands
+//    b. If POLLIN (data to read) -> read and queue its commands
 //    c. If POLLOUT (ready to write) -> send pending data
-// 5. Clean up clients marked for disconnection
+// 5. Run a few commands of every queued client, round-robin
+// 6. Clean up clients marked for disconnection
 void Server::run()
 {
 	_running = true;
 	while (_running)
 	{
 	    
-	    int pollResult = poll(&_pollFds[0], _pollFds.size(), 1000);
+	    int timeout = _runQueue.empty() ? 1000 : 0;
+	    int pollResult = poll(&_pollFds[0], _pollFds.size(), timeout);
 
 	    if (pollResult == -1)
 	    {
@@ -133,7 +663,9 @@ void Server::run()
 	        break;
 	    }
 
-	    if (pollResult == 0)
+	    _network->tick(std::time(NULL));
+	    expireSessions(std::time(NULL));
+	    if (pollResult == 0 && _runQueue.empty())
 	        continue;
 
 	    for (size_t i = 0; i < _pollFds.size(); ++i)
@@ -147,14 +679,22 @@ void Server::run()
 	            if (_pollFds[i].revents & POLLIN)
 	                acceptNewClient();
 	        }
+	        else if (_pollFds[i].fd == _wakePipe[0])
+	        {
+	            if (_pollFds[i].revents & POLLIN)
+	                handleWakeup();
+	        }
 	        else
 	        {
 	            int clientFd = _pollFds[i].fd;
 
-	            // Error or deconnexion
+	            // Error or deconnexion, handled with the other disconnections
+	            // at the end of the turn: the session may be kept
 	            if (_pollFds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
 	            {
-	                disconnectClient(clientFd);
+	                std::map<int, Client*>::iterator it = _clients.find(clientFd);
+	                if (it != _clients.end())
+	                    it->second->markConnectionLost();
 	                continue;
 	            }
 	            // Data to read 
@@ -166,7 +706,13 @@ void Server::run()
 	                flushClientBuffer(clientFd);
 	        }
 	    }
+	    runCommands();
         cleanupDisconnectedClients();
+	    flushFanout();
+	    if (_stateStore)
+	        saveChannelState();
+	    if (_upgradeRequested)
+	        upgrade();
 	}
 }
 
@@ -179,34 +725,89 @@ void Server::stop()
 /*                       CONNECTION MANAGEMENT                                */
 /* ========================================================================== */
 
-//accept new client if it's possble
-void Server::acceptNewClient()
+// A connection over the per-host limits: one ERROR line if the socket
+// takes it right away, and close. Nothing is allocated for it.
+static void refuseConnection(int fd, const struct in_addr& address, int verdict)
 {
-	struct sockaddr_in clientAddr;
-	socklen_t addrLen = sizeof(clientAddr);
-	int clientFd = accept(_serverSocket, (struct sockaddr*)&clientAddr, &addrLen);
+	std::string line = std::string("ERROR :Closing Link: ") + inet_ntoa(address)
+	                 + (verdict == ADMISSION_CLONES ? " (Too many host connections)"
+	                                                : " (Reconnecting too fast)") + CRLF;
+	send(fd, line.data(), line.size(), 0);
+	close(fd);
+}
 
-	if (clientFd == -1)
+// Accept the waiting connections, up to a batch per poll() turn so that a
+// storm is drained quickly. Each one is checked against the per-host
+// limits before a Client exists for it.
+void Server::acceptNewClient()
+{
+	long nowMs = Utils::getTimeMs();
+	for (int n = 0; n < ADMISSION_ACCEPT_BATCH; ++n)
 	{
-	    std::cerr << "Error: accept() failed" << std::endl;
-	    return;
-	}
+	    struct sockaddr_in clientAddr;
+	    socklen_t addrLen = sizeof(clientAddr);
+	    int clientFd = accept4(_serverSocket, (struct sockaddr*)&clientAddr, &addrLen,
+	                           SOCK_NONBLOCK | SOCK_CLOEXEC);
+	    if (clientFd == -1)
+	    {
+	        if (errno == EINTR || errno == ECONNABORTED)
+	            continue;
+	        if (errno != EAGAIN && errno != EWOULDBLOCK)
+	            std::cerr << "Error: accept() failed" << std::endl;
+	        break;
+	    }
 
-	if (fcntl(clientFd, F_SETFL, O_NONBLOCK) == -1)
-	{
-	    std::cerr << "Error: fcntl() failed for new client" << std::endl;
-	    close(clientFd);
-	    return;
+	    unsigned int address = ntohl(clientAddr.sin_addr.s_addr);
+	    int verdict = _admission.admit(address, nowMs);
+	    if (verdict != ADMISSION_OK)
+	    {
+	        refuseConnection(clientFd, clientAddr.sin_addr, verdict);
+	        continue;
+	    }
+
+	    std::string hostname = inet_ntoa(clientAddr.sin_addr);
+	    addConnection(clientFd, hostname)->setAddress(address);
+
+	    std::cout << "New client connected: " << hostname << " (fd: " << clientFd << ")" << std::endl;
 	}
 
-	std::string hostname = inet_ntoa(clientAddr.sin_addr);
+	unsigned long refused;
+	if (_admission.takeReport(nowMs, refused))
+	    std::cout << "Refused " << refused << " connection(s) over the per-host limits" << std::endl;
+}
 
-	Client* client = new Client(clientFd, hostname);
-	_clients[clientFd] = client;
+// Track a connected socket (accepted, or an outgoing server link).
+Client* Server::addConnection(int fd, const std::string& hostname)
+{
+	Client* client = new Client(fd, hostname);
+	_clients[fd] = client;
+	applySendq(client);
 
-	addToPoll(clientFd);
+	addToPoll(fd);
+	return client;
+}
+
+// Send queue limits of a connection. Hosts matching spill.hosts (logging
+// bots, bouncers) spill what they cannot take yet to spill.dir instead of
+// losing it; the others are dropped past sendq.max. Server links have no
+// limit.
+void Server::applySendq(Client* client)
+{
+	client->setSendqMax(std::max(0L, _config.getLong("sendq.max", 0)));
+	if (!_config.has("spill.dir"))
+	    return;
 
-	std::cout << "New client connected: " << hostname << " (fd: " << clientFd << ")" << std::endl;
+	std::vector<std::string> hosts = _config.getList("spill.hosts");
+	for (size_t i = 0; i < hosts.size(); ++i)
+	{
+	    if (Utils::matchMask(hosts[i], client->getHostname()))
+	    {
+	        client->setSpill(_config.getString("spill.dir", ""),
+	                         std::max(1L, _config.getLong("spill.memory", SPILL_MEMORY_DEFAULT)),
+	                         std::max(0L, _config.getLong("spill.max", SPILL_MAX_DEFAULT)));
+	        return;
+	    }
+	}
 }
 
 // DisconnectClient
@@ -219,6 +820,13 @@ void Server::disconnectClient(int fd)
 
 	Client* client = it->second;
 
+	// The other servers learn about the quit, or the split behind a link
+	if (client->getLinkState() != LINK_NONE)
+	    _network->linkLost(client);
+	else if (client->isIntroduced())
+	    _network->propagate(client, "QUIT :" + client->getQuitReason());
+	_network->userGone(client);
+
 	const std::set<std::string>& channels = client->getChannels();
 	for (std::set<std::string>::const_iterator chanIt = channels.begin();
 	     chanIt != channels.end(); ++chanIt)
@@ -233,16 +841,24 @@ void Server::disconnectClient(int fd)
 	    }
 	}
 
+	if (!client->getSessionToken().empty())
+	    _sessions.erase(client->getSessionToken());
+
 	removeFromPoll(fd);
 
-	close(fd);
+	if (!client->isDetached())
+	    close(fd);
 
+	_admission.release(client->getAddress());
+	_repeatDetector.forget(client->getId());
 	delete client;
 	_clients.erase(it);
+	nextStateVersion();     // the client table changed
 
 	std::cout << "Client disconnected (fd: " << fd << ")" << std::endl;
 }
 
+// Local users first, then the users of the other servers.
 Client* Server::getClientByNickname(const std::string& nickname)
 {
 	std::string lowerNick = Utils::toLower(nickname);
@@ -252,7 +868,7 @@ Client* Server::getClientByNickname(const std::string& nickname)
 	    if (Utils::toLower(it->second->getNickname()) == lowerNick)
 	        return it->second;
 	}
-	return NULL;
+	return _network->findUser(nickname);
 }
 
 // Verify if the nickname is already used
@@ -261,45 +877,209 @@ bool Server::isNicknameInUse(const std::string& nickname)
 	return (getClientByNickname(nickname) != NULL);
 }
 
+/* ========================================================================== */
+/*                       DETACHABLE SESSIONS                                  */
+/* ========================================================================== */
+
+// Hex of SESSION_TOKEN_BYTES random bytes, empty if none could be read.
+static std::string randomToken()
+{
+	unsigned char bytes[SESSION_TOKEN_BYTES];
+	int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	    return "";
+	ssize_t got = read(fd, bytes, sizeof(bytes));
+	close(fd);
+	if (got != static_cast<ssize_t>(sizeof(bytes)))
+	    return "";
+
+	static const char digits[] = "0123456789abcdef";
+	std::string token;
+	for (size_t i = 0; i < sizeof(bytes); ++i)
+	{
+	    token += digits[bytes[i] >> 4];
+	    token += digits[bytes[i] & 0x0f];
+	}
+	return token;
+}
+
+bool Server::sessionsEnabled() const
+{
+	return _sessionGrace > 0;
+}
+
+// Give a registered draft/resume client the token a later connection will
+// present to take its session over (RESUME TOKEN <token>). A new token
+// replaces the previous one.
+void Server::openSession(Client* client)
+{
+	if (!sessionsEnabled() || !client->isRegistered() || !client->hasCapability(CAP_RESUME))
+	    return;
+	std::string token = randomToken();
+	if (token.empty())
+	    return;
+
+	if (!client->getSessionToken().empty())
+	    _sessions.erase(client->getSessionToken());
+	client->setSessionToken(token);
+	_sessions[token] = client;
+	sendToClient(client->getFd(), ":" + _serverName + " RESUME TOKEN " + token);
+}
+
+// Whether a client whose connection died is kept for RESUME. A reply on
+// the worker pool cannot follow it to another socket.
+bool Server::canDetach(Client* client) const
+{
+	return sessionsEnabled() && client->isRegistered() && !client->getSessionToken().empty()
+	    && client->hasCapability(CAP_RESUME) && !client->isCursorInFlight();
+}
+
+// The user stays in its channels, known to the other servers, while the
+// socket goes. Until it is resumed the client is filed under a negative
+// key of the client table: everything that looks clients up still finds
+// it, and what is sent to it piles up in its output buffer.
+void Server::detachSession(Client* client)
+{
+	int fd = client->getFd();
+	removeFromPoll(fd);
+	close(fd);
+	_clients.erase(fd);
+	_admission.release(client->getAddress());
+	client->setAddress(0);
+
+	// What was queued for the old socket is replayed on RESUME, within
+	// the session buffer
+	bool overflow = client->getSendqSize() > _sessionBufferMax;
+	int key = nextDetachedKey();
+	client->detach(key, std::time(NULL), !overflow);
+	_clients[key] = client;
+	nextStateVersion();     // the client table changed
+	if (overflow)
+	{
+	    client->setQuitReason("Session buffer exceeded");
+	    client->markForDisconnection();
+	}
+
+	std::cout << "Session detached: " << client->getNickname() << " (fd: " << fd << ")" << std::endl;
+}
+
+// Keys of detached sessions count down from -2 (-1 means "no fd" to
+// broadcastToChannel).
+int Server::nextDetachedKey()
+{
+	int key;
+	do
+	{
+	    key = _nextDetachedKey;
+	    _nextDetachedKey = (key > -0x40000000) ? key - 1 : -2;
+	}
+	while (_clients.count(key));
+	return key;
+}
+
+// A detached session that will not come back: its neighbours see it quit.
+void Server::endSession(Client* client, const std::string& reason)
+{
+	broadcastToNeighbours(client, ":" + client->getPrefix() + " QUIT :" + reason, false);
+	client->setQuitReason(reason);
+	disconnectClient(client->getFd());
+}
+
+// Once a second, end the sessions detached for session.grace_seconds.
+void Server::expireSessions(time_t now)
+{
+	if (now < _nextSessionSweep)
+	    return;
+	_nextSessionSweep = now + 1;
+
+	std::vector<Client*> expired;
+	for (std::map<std::string, Client*>::iterator it = _sessions.begin(); it != _sessions.end(); ++it)
+	{
+	    Client* client = it->second;
+	    if (client->isDetached() && now - client->getDetachedAt() >= _sessionGrace)
+	        expired.push_back(client);
+	}
+	for (size_t i = 0; i < expired.size(); ++i)
+	    endSession(expired[i], "Session expired");
+}
+
+// RESUME <token> from a connection that has not registered. The session
+// takes its socket and the rest of its input, gets what was sent to it
+// since the drop and a new token; `fresh` is deleted. The old connection
+// may still look alive (the drop was not noticed yet): it is the one given
+// up.
+bool Server::resumeSession(Client* fresh, const std::string& token)
+{
+	std::map<std::string, Client*>::iterator it = _sessions.find(token);
+	if (it == _sessions.end())
+	    return false;
+	Client* session = it->second;
+	if (session->isMarkedForDisconnection() && !session->isConnectionLost())
+	    return false;       // quitting, or killed
+	if (!session->isDetached())
+	{
+	    if (session->isCursorInFlight())
+	        return false;
+	    detachSession(session);
+	}
+
+	int fd = fresh->getFd();
+	_clients.erase(session->getFd());
+	session->attach(fd);
+	_clients[fd] = session;
+	session->getInputBuffer() = fresh->getInputBuffer();
+	session->setAddress(fresh->getAddress());
+	session->setCapability(session->getCapabilities(), false);
+	session->setCapability(fresh->getCapabilities(), true);
+	session->setCapNegotiating(false);
+	_repeatDetector.forget(fresh->getId());
+	delete fresh;
+	nextStateVersion();
+
+	// What it missed is already queued: the answer is a control line, sent
+	// first, the new token comes behind
+	sendToClient(fd, ":" + _serverName + " RESUME SUCCESS " + session->getNickname(), OUTPUT_CONTROL);
+	openSession(session);
+
+	std::cout << "Session resumed: " << session->getNickname() << " (fd: " << fd << ")" << std::endl;
+	return true;
+}
+
 /* ========================================================================== */
 /*                       CHANNEL MANAGEMENT                                    */
 /* ========================================================================== */
 
+// Returns NULL when the channel does not exist and MAX_CHANNELS is reached.
 Channel* Server::getOrCreatChannel(const std::string& name)
 {
+	Channel* channel = _channels.find(name);
+	if (channel)
+	    return channel;
 
-	std::string lowerName = Utils::toLower(name);
-	std::map<std::string, Channel*>::iterator it = _channels.find(lowerName);
-
-	if (it != _channels.end())
-	    return it->second;
+	if (_channels.isFull())
+	    return NULL;
 
 	// if doesn't exit, creat channel
-	Channel* channel = new Channel(name);
-	_channels[lowerName] = channel;
+	channel = new Channel(name);
+	_channels.insert(channel);
 	return channel;
 }
 
 Channel* Server::getChannel(const std::string& name)
 {
-    std::string lowerName = Utils::toLower(name);
-    std::map<std::string, Channel*>::iterator it = _channels.find(lowerName);
-
-    if (it != _channels.end())
-        return it->second;
-    return NULL;
+    return _channels.find(name);
 }
 
 Channel* Server::removeChannel(const std::string& name)
 {
-    std::string lowerName = Utils::toLower(name);
-    std::map<std::string, Channel*>::iterator it = _channels.find(lowerName);
-
-    if (it != _channels.end())
-    {
-        delete it->second;
-        _channels.erase(it);
-    }
+	if (_stateStore && _savedChannels.erase(Utils::toLower(name)))
+	{
+	    Serializer record;
+	    record.putNumber(STATE_RECORD_REMOVED);
+	    record.putString(name);
+	    _stateStore->record(record.getData());
+	}
+    delete _channels.remove(name);
     return NULL;
 }
 
@@ -311,33 +1091,155 @@ Channel* Server::removeChannel(const std::string& name)
 void Server::sendToClient(int fd, const std::string& message)
 {
 	std::map<int, Client*>::iterator it = _clients.find(fd);
-	if (it != _clients.end())
-    {
-	    it->second->appendToOutputBuffer(message + CRLF);
+	if (it == _clients.end())
+	    return;
 
-	    for (size_t i = 0; i < _pollFds.size(); ++i)
-	    {
-	        if (_pollFds[i].fd == fd)
-	        {
-	            _pollFds[i].events |= POLLOUT;
-	            break;
-	        }
-	    }
-	}
+	// Replies sent inside an open batch carry its reference
+	const std::string& batch = it->second->getActiveBatch();
+	if (batch.empty())
+	    queueLine(it->second, message + CRLF);
+	else if (!message.empty() && message[0] == '@')
+	    queueLine(it->second, "@batch=" + batch + ";" + message.substr(1) + CRLF);
+	else
+	    queueLine(it->second, "@batch=" + batch + " " + message + CRLF);
+}
+
+// Same, in the output class `outputClass` whatever the client is queueing.
+void Server::sendToClient(int fd, const std::string& message, int outputClass)
+{
+	std::map<int, Client*>::iterator it = _clients.find(fd);
+	if (it == _clients.end())
+	    return;
+
+	int previous = it->second->getOutputClass();
+	it->second->setOutputClass(outputClass);
+	sendToClient(fd, message);
+	it->second->setOutputClass(previous);
 }
 
 void Server::broadcastToChannel(const std::string& channelName, const std::string& message, int excludeFd)
+{
+	broadcastToChannel(channelName, message, excludeFd, "");
+}
+
+// Same as above; members that negotiated message-tags also receive `tags`.
+void Server::broadcastToChannel(const std::string& channelName, const std::string& message,
+                                int excludeFd, const std::string& tags)
 {
 	Channel* channel = getChannel(channelName);
 	if (!channel)
 	    return;
 
-	const std::set<Client*>& members = channel->getMembers();
-	for (std::set<Client*>::const_iterator it = members.begin();
-	     it != members.end(); ++it)
+	std::string line = message + CRLF;
+	std::string taggedLine = tags.empty() ? line : "@" + tags + " " + line;
+	const std::vector<Membership>& members = channel->getMembers();
+
+	// Large channels are written by the fan-out threads, one slice each
+	if (_fanoutPool && _fanoutPool->accepts(members.size()))
+	{
+	    _fanoutPool->broadcast(members, line, taggedLine, excludeFd);
+	    // Detached sessions (negative keys, first in _clients) are skipped
+	    // by the threads: their buffer has a cap
+	    if (_clients.empty() || _clients.begin()->first >= 0)
+	        return;
+	    for (size_t i = 0; i < members.size(); ++i)
+	    {
+	        Client* member = members[i].client;
+	        if (member->isDetached())
+	            queueLine(member, member->hasCapability(CAP_MESSAGE_TAGS) ? taggedLine : line);
+	    }
+	    return;
+	}
+
+	for (size_t i = 0; i < members.size(); ++i)
 	{
-	    if ((*it)->getFd() != excludeFd)
-	        sendToClient((*it)->getFd(), message);
+	    Client* member = members[i].client;
+	    if (member->getFd() == excludeFd)
+	        continue;
+	    if (member->hasCapability(CAP_MESSAGE_TAGS))
+	        queueLine(member, taggedLine);
+	    else
+	        queueLine(member, line);
+	}
+}
+
+// Send a message carrying `tags` if the client negotiated message-tags.
+void Server::sendTaggedToClient(Client* client, const std::string& message, const std::string& tags)
+{
+	if (tags.empty() || !client->hasCapability(CAP_MESSAGE_TAGS))
+	    sendToClient(client->getFd(), message);
+	else
+	    sendToClient(client->getFd(), "@" + tags + " " + message);
+}
+
+// Broadcast a JOIN/PART of `actor`. In an auditorium (+u above its threshold)
+// a non-operator's membership change only reaches the operators and the actor.
+void Server::broadcastMembershipChange(Channel* channel, Client* actor, const std::string& message)
+{
+	if (!channel->isAuditorium() || channel->isOperator(actor))
+	{
+	    broadcastToChannel(channel->getName(), message, -1);
+	    return;
+	}
+
+	std::string line = message + CRLF;
+	const std::vector<Membership>& members = channel->getMembers();
+	for (size_t i = 0; i < channel->getOperatorCount(); ++i)
+	    queueLine(members[i].client, line);
+	queueLine(actor, line);
+}
+
+// Send a message once to every client sharing at least one channel with `client`
+// (QUIT, NICK). Recipients are stamped with a fresh epoch instead of being
+// collected in a temporary set, so a peer met in several channels is skipped.
+// Auditorium channels only contribute their operators, as for JOIN/PART.
+void Server::broadcastToNeighbours(Client* client, const std::string& message, bool includeSelf)
+{
+	unsigned long epoch = ++_fanoutEpoch;
+	std::string line = message + CRLF;
+
+	client->setFanoutEpoch(epoch);
+	if (includeSelf)
+	    queueLine(client, line);
+
+	const std::set<std::string>& channels = client->getChannels();
+	for (std::set<std::string>::const_iterator chanIt = channels.begin();
+	     chanIt != channels.end(); ++chanIt)
+	{
+	    Channel* channel = getChannel(*chanIt);
+	    if (!channel)
+	        continue;
+
+	    const std::vector<Membership>& members = channel->getMembers();
+	    size_t count = members.size();
+	    if (channel->isAuditorium() && !channel->isOperator(client))
+	        count = channel->getOperatorCount();
+	    for (size_t i = 0; i < count; ++i)
+	    {
+	        Client* member = members[i].client;
+	        if (member->getFanoutEpoch() == epoch)
+	            continue;
+	        member->setFanoutEpoch(epoch);
+	        queueLine(member, line);
+	    }
+	}
+}
+
+// Hand a channel event to the log writer (no-op when logging is disabled).
+void Server::logChannelEvent(int type, Channel* channel, Client* client, const std::string& text)
+{
+	if (_channelLog)
+	    _channelLog->append(type, channel->getName(), client->getNickname(), text);
+}
+
+// Server NOTICE to every connected IRC operator.
+void Server::noticeOperators(const std::string& text)
+{
+	for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+	{
+	    if (it->second->isServerOperator())
+	        sendToClient(it->first, ":" + _serverName + " NOTICE " + it->second->getNickname()
+	                                + " :*** " + text);
 	}
 }
 
@@ -355,16 +1257,83 @@ const std::string& Server::getServerName() const
     return _serverName;
 }
 
+// Message ids only grow, CHATHISTORY relies on it to order messages.
+unsigned long Server::nextMsgId()
+{
+    return ++_nextMsgId;
+}
+
 std::map<int, Client*>& Server::getClients()
 {
     return _clients;
 }
 
-std::map<std::string, Channel*>& Server::getChannels()
+ChannelRegistry& Server::getChannels()
 {
     return _channels;
 }
 
+const Config& Server::getConfig() const
+{
+    return _config;
+}
+
+SearchIndex* Server::getSearchIndex()
+{
+    return _searchIndex;
+}
+
+const SpamFilter& Server::getSpamFilter() const
+{
+    return _spamFilter;
+}
+
+RepeatDetector& Server::getRepeatDetector()
+{
+    return _repeatDetector;
+}
+
+Network& Server::getNetwork()
+{
+    return *_network;
+}
+
+WorkerPool* Server::getWorkerPool()
+{
+    return _workerPool;
+}
+
+// Consistent read-only view of the users and channels for a worker job:
+// registered clients only, no server links. Reused as is while nothing
+// changed; otherwise rebuilt, sharing the copies of the clients and
+// channels that did not change. The caller owns one reference.
+const ServerSnapshot* Server::takeSnapshot()
+{
+    if (!_snapshot || _snapshot->version != currentStateVersion())
+    {
+        ServerSnapshot* snapshot = new ServerSnapshot();
+        snapshot->version = currentStateVersion();
+        snapshot->clients.reserve(_clients.size());
+        for (std::map<int, Client*>::iterator it = _clients.begin(); it != _clients.end(); ++it)
+        {
+            if (it->second->isRegistered() && !it->second->isServerLink())
+                snapshot->clients.push_back(it->second->snapshot());
+        }
+        const std::map<std::string, Client*>& remote = _network->getUsers();
+        for (std::map<std::string, Client*>::const_iterator it = remote.begin(); it != remote.end(); ++it)
+            snapshot->clients.push_back(it->second->snapshot());
+        snapshot->channels.reserve(_channels.size());
+        for (ChannelRegistry::iterator it = _channels.begin(); it != _channels.end(); ++it)
+            snapshot->channels.push_back((*it)->snapshot());
+
+        if (_snapshot)
+            _snapshot->release();
+        _snapshot = snapshot;
+    }
+    _snapshot->retain();
+    return _snapshot;
+}
+
 /* ========================================================================== */
 /*                       PRIVATE METHODS                                      */
 /* ========================================================================== */
@@ -376,29 +1345,77 @@ void Server::handleClientData(int fd)
 	    return;
 	Client* client = it->second;
 
+	// Lines from the last read still wait their turn: leave the rest in
+	// the socket, the peer slows down once its window fills
+	if (client->isCommandQueued())
+	    return;
+
     char buffer[BUFFER_SIZE];
 	std::memset(buffer, 0, BUFFER_SIZE);
 	ssize_t bytesRead = recv(fd, buffer, BUFFER_SIZE - 1, 0);
 
 	if (bytesRead <= 0) // 0 = diconnect , -1 = error
 	{
-	    client->markForDisconnection();
+	    client->markConnectionLost();
 	    return;
 	}
 
     client->appendToInputBuffer(std::string(buffer, bytesRead));
+	scheduleCommands(client);
+}
 
-    std::string& inputBuffer = client->getInputBuffer();
-	size_t pos;
-	while ((pos = inputBuffer.find(CRLF)) != std::string::npos)
+// Put `client` at the back of the run queue if it has a complete line.
+void Server::scheduleCommands(Client* client)
+{
+	if (client->isCommandQueued() || client->isMarkedForDisconnection())
+	    return;
+	if (client->getInputBuffer().find(CRLF) == std::string::npos)
+	    return;
+	client->setCommandQueued(true);
+	_runQueue.push_back(std::make_pair(client->getFd(), client->getId()));
+}
+
+// One round over the clients queued at the start of the turn: each runs
+// up to commands.per_turn lines, then goes back to the end of the queue
+// if it has more, so a client pasting thousands of lines cannot hold up
+// the others' PING or PRIVMSG.
+void Server::runCommands()
+{
+	size_t count = _runQueue.size();
+	for (size_t n = 0; n < count; ++n)
 	{
-	    // Extract command
-	    std::string command = inputBuffer.substr(0, pos);
-	    inputBuffer.erase(0, pos + 2);  // +2 for \r\n
+	    int fd = _runQueue.front().first;
+	    unsigned long id = _runQueue.front().second;
+	    _runQueue.pop_front();
+
+	    // Gone since, or the fd now belongs to someone else
+	    std::map<int, Client*>::iterator it = _clients.find(fd);
+	    if (it == _clients.end() || it->second->getId() != id || !it->second->isCommandQueued())
+	        continue;
+	    Client* client = it->second;
+	    client->setCommandQueued(false);
 
-	    // Ignore empty lines 
-	    if (!command.empty())
-	        processCommand(client, command);
+	    size_t pos;
+	    for (long done = 0; done < _commandsPerTurn && !client->isMarkedForDisconnection()
+	         && (pos = client->getInputBuffer().find(CRLF)) != std::string::npos; ++done)
+	    {
+	        // Extract command
+	        std::string& inputBuffer = client->getInputBuffer();
+	        std::string command = inputBuffer.substr(0, pos);
+	        inputBuffer.erase(0, pos + 2);  // +2 for \r\n
+
+	        // Ignore empty lines
+	        if (!command.empty())
+	            processCommand(client, command);
+
+	        // RESUME hands the socket and the rest of the input to another client
+	        it = _clients.find(fd);
+	        if (it == _clients.end())
+	            break;
+	        client = it->second;
+	    }
+	    if (it != _clients.end())
+	        scheduleCommands(client);
 	}
 }
 
@@ -415,30 +1432,87 @@ void Server::flushClientBuffer(int fd)
     if (it == _clients.end())
         return ;
     Client* client = it->second;
-    std::string& outputBuffer = client->getOutputBuffer();
-    if (outputBuffer.empty())
+    if (client->isDetached())
+        return ;
+
+    // Output classes in priority order, until the socket is full
+    const char* data;
+    size_t size;
+    while (client->nextOutput(data, size))
     {
-        for (size_t i = 0; i < _pollFds.size(); ++i)
+        ssize_t bytesSent = send(fd, data, size, 0);
+        if (bytesSent == -1)
         {
-            if (_pollFds[i].fd == fd)
-            {
-                _pollFds[i].events &= ~POLLOUT;
-                break;
-            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                client->markConnectionLost();
+            return ;
         }
-        return ;
+        client->trimOutputBuffer(bytesSent);
+        if (static_cast<size_t>(bytesSent) < size)
+            break ;
     }
 
-	ssize_t bytesSent = send(fd, outputBuffer.c_str(), outputBuffer.size(), 0);
+    if (!client->hasDataToSend() && fd < static_cast<int>(_pollIndex.size()) && _pollIndex[fd] != -1)
+        _pollFds[_pollIndex[fd]].events &= ~POLLOUT;
+    pumpCursor(client);
+}
 
-    if (bytesSent == -1)
+// Append an already CRLF-terminated line to a client's output buffer (the
+// class it is queueing to, see Client::setOutputClass) and
+// ask poll() to report when its socket is writable. Remote users have no
+// socket: what reaches them goes through Network. Detached sessions keep
+// their output for the next connection, up to session.buffer_max.
+void Server::queueLine(Client* client, const std::string& line)
+{
+	if (client->isRemote())
+	    return;
+	if (client->isDetached())
 	{
-	    if (errno != EAGAIN && errno != EWOULDBLOCK)
+	    if (client->isMarkedForDisconnection())
+	        return;
+	    if (client->getSendqSize() + line.size() > _sessionBufferMax)
+	    {
+	        client->setQuitReason("Session buffer exceeded");
 	        client->markForDisconnection();
+	        return;
+	    }
+	}
+	client->appendToOutput(client->getOutputClass(), line);
+	watchWritable(client->getFd());
+}
+
+// Write what the broadcasts of large channels queued during this loop
+// turn, on the fan-out threads. What a socket does not take waits for
+// POLLOUT as usual.
+void Server::flushFanout()
+{
+	if (!_fanoutPool || !_fanoutPool->hasDirty())
 	    return;
+
+	std::vector<int> fds;
+	_fanoutPool->takeDirty(fds);
+	std::vector<Client*> clients;
+	clients.reserve(fds.size());
+	for (size_t i = 0; i < fds.size(); ++i)
+	{
+	    std::map<int, Client*>::iterator it = _clients.find(fds[i]);
+	    if (it != _clients.end() && !it->second->isDetached())
+	        clients.push_back(it->second);
 	}
 
-	client->trimOutputBuffer(bytesSent);
+	std::vector<Client*> blocked;
+	_fanoutPool->flush(clients, blocked);
+	for (size_t i = 0; i < blocked.size(); ++i)
+	    watchWritable(blocked[i]->getFd());
+	for (size_t i = 0; i < clients.size(); ++i)
+	    pumpCursor(clients[i]);
+}
+
+// Ask poll() to report when `fd` is writable.
+void Server::watchWritable(int fd)
+{
+	if (fd >= 0 && fd < static_cast<int>(_pollIndex.size()) && _pollIndex[fd] != -1)
+	    _pollFds[_pollIndex[fd]].events |= POLLOUT;
 }
 
 void Server::addToPoll(int fd)
@@ -448,20 +1522,22 @@ void Server::addToPoll(int fd)
 	pfd.events = POLLIN;
 	pfd.revents = 0;
 	_pollFds.push_back(pfd);
+	if (fd >= static_cast<int>(_pollIndex.size()))
+	    _pollIndex.resize(fd + 1, -1);
+	_pollIndex[fd] = static_cast<int>(_pollFds.size() - 1);
 }
 
-//Remove fd from poll
+// Remove fd from poll: the last entry takes its place.
 void Server::removeFromPoll(int fd)
 {
-	for (std::vector<pollfd>::iterator it = _pollFds.begin();
-	     it != _pollFds.end(); ++it)
-	{
-	    if (it->fd == fd)
-	    {
-	        _pollFds.erase(it);
-	        break;
-	    }
-	}
+	if (fd < 0 || fd >= static_cast<int>(_pollIndex.size()) || _pollIndex[fd] == -1)
+	    return;
+
+	size_t position = _pollIndex[fd];
+	_pollFds[position] = _pollFds.back();
+	_pollIndex[_pollFds[position].fd] = static_cast<int>(position);
+	_pollFds.pop_back();
+	_pollIndex[fd] = -1;
 }
 
 void Server::cleanupDisconnectedClients()
@@ -480,7 +1556,81 @@ void Server::cleanupDisconnectedClients()
     for (std::vector<int>::iterator it = fdsToRemove.begin();
          it != fdsToRemove.end(); ++it)
     {
+        std::map<int, Client*>::iterator found = _clients.find(*it);
+        if (found == _clients.end())
+            continue;
+        Client* client = found->second;
+        if (client->isDetached())
+        {
+            endSession(client, client->getQuitReason());
+            continue;
+        }
+        if (client->isConnectionLost() && canDetach(client))
+        {
+            detachSession(client);
+            continue;
+        }
+        // Last chance for a final ERROR/KILL line to leave
+        flushClientBuffer(*it);
         disconnectClient(*it);
     }
 }
 
+// Deliver what the worker pool and the search thread finished. Requesters
+// are matched by id as well as fd, in case they left and their fd was
+// reused meanwhile.
+void Server::handleWakeup()
+{
+	char drain[64];
+	while (read(_wakePipe[0], drain, sizeof(drain)) > 0)
+	    ;
+
+	std::vector<AsyncReply> replies;
+	_workerPool->takeReplies(replies);
+	for (size_t i = 0; i < replies.size(); ++i)
+	{
+	    std::map<int, Client*>::iterator it = _clients.find(replies[i].fd);
+	    if (it == _clients.end() || it->second->getId() != replies[i].clientId)
+	    {
+	        delete replies[i].cursor;
+	        continue;
+	    }
+	    Client* client = it->second;
+	    client->setCursorInFlight(false);
+	    _cmdHandler->sendCursorWindow(client, replies[i]);
+	    if (replies[i].finished)
+	        client->popReplyCursor();
+	    pumpCursor(client);
+	}
+
+	if (!_searchIndex)
+	    return;
+	std::vector<SearchResult> results;
+	_searchIndex->takeResults(results);
+	for (size_t i = 0; i < results.size(); ++i)
+	{
+	    std::map<int, Client*>::iterator it = _clients.find(results[i].fd);
+	    if (it == _clients.end() || it->second->getId() != results[i].clientId)
+	        continue;
+	    _cmdHandler->sendSearchResult(it->second, results[i]);
+	}
+}
+
+// Start a lazily produced reply; it waits behind the client's previous ones.
+void Server::queueCursor(Client* client, ReplyCursor* cursor)
+{
+	client->addReplyCursor(cursor);
+	pumpCursor(client);
+}
+
+// Schedule the next window of the client's current reply, once its output
+// bulk output has drained below REPLY_LOW_WATERMARK.
+void Server::pumpCursor(Client* client)
+{
+	ReplyCursor* cursor = client->getReplyCursor();
+	if (!cursor || client->isCursorInFlight()
+	    || client->getOutputSize(OUTPUT_BULK) >= REPLY_LOW_WATERMARK)
+	    return;
+	client->setCursorInFlight(true);
+	_workerPool->submit(new CursorJob(cursor));
+}
@@ -0,0 +1,51 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    STATE VERSION                                           */
+/* ========================================================================== */
+
+// Only touched by the event loop thread.
+static unsigned long g_stateVersion = 0;
+
+unsigned long nextStateVersion()
+{
+	return ++g_stateVersion;
+}
+
+unsigned long currentStateVersion()
+{
+	return g_stateVersion;
+}
+
+/* ========================================================================== */
+/*                    REFERENCE COUNT                                         */
+/* ========================================================================== */
+
+SharedSnapshot::SharedSnapshot() : _refs(1) {}
+
+SharedSnapshot::~SharedSnapshot() {}
+
+void SharedSnapshot::retain() const
+{
+	__atomic_add_fetch(&_refs, 1, __ATOMIC_RELAXED);
+}
+
+void SharedSnapshot::release() const
+{
+	if (__atomic_sub_fetch(&_refs, 1, __ATOMIC_ACQ_REL) == 0)
+	    delete this;
+}
+
+/* ========================================================================== */
+/*                    SERVER SNAPSHOT                                         */
+/* ========================================================================== */
+
+ServerSnapshot::ServerSnapshot() : version(0) {}
+
+ServerSnapshot::~ServerSnapshot()
+{
+	for (size_t i = 0; i < clients.size(); ++i)
+	    clients[i]->release();
+	for (size_t i = 0; i < channels.size(); ++i)
+	    channels[i]->release();
+}
@@ -0,0 +1,328 @@
+#include "IRC.hpp"
+#ifdef __SSE2__
+# include <emmintrin.h>
+#endif
+
+/* ========================================================================== */
+/*                    HELPERS                                                 */
+/* ========================================================================== */
+
+// ASCII lowercase copy of `in` into `out`, 16 bytes at a time with SSE2.
+static void lowerAscii(const std::string& in, std::string& out)
+{
+	size_t n = in.size();
+	size_t i = 0;
+	out.resize(n);
+
+#ifdef __SSE2__
+	const __m128i beforeA = _mm_set1_epi8('A' - 1);
+	const __m128i afterZ = _mm_set1_epi8('Z' + 1);
+	const __m128i caseBit = _mm_set1_epi8(0x20);
+	for (; i + 16 <= n; i += 16)
+	{
+	    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in.data() + i));
+	    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, beforeA), _mm_cmplt_epi8(v, afterZ));
+	    v = _mm_or_si128(v, _mm_and_si128(upper, caseBit));
+	    _mm_storeu_si128(reinterpret_cast<__m128i*>(&out[i]), v);
+	}
+#endif
+	for (; i < n; ++i)
+	{
+	    char c = in[i];
+	    out[i] = (c >= 'A' && c <= 'Z') ? static_cast<char>(c + 32) : c;
+	}
+}
+
+// Longest run of `pattern` without wildcards: the part searched by the automaton.
+static std::string anchorOf(const std::string& pattern)
+{
+	std::string best;
+	size_t pos = 0;
+	while (pos < pattern.size())
+	{
+	    size_t end = pattern.find_first_of("*?", pos);
+	    if (end == std::string::npos)
+	        end = pattern.size();
+	    if (end - pos > best.size())
+	        best = pattern.substr(pos, end - pos);
+	    pos = end + 1;
+	}
+	return best;
+}
+
+static int parseAction(const std::string& name)
+{
+	if (name == "tag")
+	    return SPAM_ACTION_TAG;
+	if (name == "quarantine")
+	    return SPAM_ACTION_QUARANTINE;
+	if (name == "block")
+	    return SPAM_ACTION_BLOCK;
+	return SPAM_ACTION_NONE;
+}
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+SpamFilter::SpamFilter()
+	: _classCount(1),
+	  _startByteCount(0)
+{
+	build();
+}
+
+SpamFilter::~SpamFilter() {}
+
+/* ========================================================================== */
+/*                    LOADING                                                 */
+/* ========================================================================== */
+
+// Read "<block|tag|quarantine> <pattern>" lines, '#' starts a comment line.
+// Returns false (and keeps the current patterns) if the file cannot be read.
+bool SpamFilter::load(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+	    std::cerr << "Error: cannot open spam filter file " << path << std::endl;
+	    return false;
+	}
+
+	std::vector<Pattern> patterns;
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(file, line))
+	{
+	    lineNumber++;
+	    line = Utils::trim(line);
+	    if (line.empty() || line[0] == '#')
+	        continue;
+
+	    size_t space = line.find_first_of(" \t");
+	    int action = parseAction(line.substr(0, space));
+	    std::string text = (space == std::string::npos) ? "" : Utils::trim(line.substr(space));
+	    std::string lowered;
+	    lowerAscii(text, lowered);
+	    if (action == SPAM_ACTION_NONE || anchorOf(lowered).empty())
+	    {
+	        std::cerr << "Warning: " << path << ":" << lineNumber
+	                  << ": expected <block|tag|quarantine> <pattern with a literal part>" << std::endl;
+	        continue;
+	    }
+
+	    Pattern pattern;
+	    pattern.text = text;
+	    pattern.mask = "*" + lowered + "*";
+	    pattern.literal = (lowered.find_first_of("*?") == std::string::npos);
+	    pattern.action = action;
+	    patterns.push_back(pattern);
+	}
+
+	_patterns.swap(patterns);
+	build();
+	return true;
+}
+
+void SpamFilter::clear()
+{
+	_patterns.clear();
+	build();
+}
+
+/* ========================================================================== */
+/*                    AUTOMATON                                               */
+/* ========================================================================== */
+
+// Compile the anchors of _patterns into the automaton and the prefilter tables.
+void SpamFilter::build()
+{
+	std::vector<std::string> anchors;
+	for (size_t i = 0; i < _patterns.size(); ++i)
+	    anchors.push_back(anchorOf(_patterns[i].mask));
+
+	// Bytes that appear in no anchor share class 0, which always leads to the root
+	std::memset(_classOf, 0, sizeof(_classOf));
+	_classCount = 1;
+	for (size_t i = 0; i < anchors.size(); ++i)
+	    for (size_t j = 0; j < anchors[i].size(); ++j)
+	    {
+	        unsigned char c = static_cast<unsigned char>(anchors[i][j]);
+	        if (!_classOf[c])
+	            _classOf[c] = static_cast<unsigned char>(_classCount++);
+	    }
+
+	// Trie of the anchors (-1: no edge yet)
+	size_t classes = _classCount;
+	_next.assign(classes, -1);
+	_outputs.assign(1, std::vector<int>());
+	for (size_t i = 0; i < anchors.size(); ++i)
+	{
+	    int state = 0;
+	    for (size_t j = 0; j < anchors[i].size(); ++j)
+	    {
+	        size_t edge = state * classes + _classOf[static_cast<unsigned char>(anchors[i][j])];
+	        if (_next[edge] == -1)
+	        {
+	            _next[edge] = static_cast<int>(_outputs.size());
+	            _next.resize(_next.size() + classes, -1);
+	            _outputs.push_back(std::vector<int>());
+	        }
+	        state = _next[edge];
+	    }
+	    _outputs[state].push_back(static_cast<int>(i));
+	}
+
+	// Failure links in breadth-first order, turning the trie into a DFA
+	std::vector<int> fail(_outputs.size(), 0);
+	std::deque<int> queue;
+	for (size_t a = 0; a < classes; ++a)
+	{
+	    if (_next[a] == -1)
+	        _next[a] = 0;
+	    else
+	        queue.push_back(_next[a]);
+	}
+	while (!queue.empty())
+	{
+	    int u = queue.front();
+	    queue.pop_front();
+	    for (size_t a = 0; a < classes; ++a)
+	    {
+	        int v = _next[u * classes + a];
+	        int viaFail = _next[fail[u] * classes + a];
+	        if (v == -1)
+	        {
+	            _next[u * classes + a] = viaFail;
+	            continue;
+	        }
+	        fail[v] = viaFail;
+	        _outputs[v].insert(_outputs[v].end(), _outputs[viaFail].begin(), _outputs[viaFail].end());
+	        queue.push_back(v);
+	    }
+	}
+
+	// Prefilter: first two bytes of every anchor, and the set of first bytes
+	_bigrams.assign(65536 / 8, 0);
+	_startByteCount = 0;
+	std::vector<bool> seen(256, false);
+	for (size_t i = 0; i < anchors.size(); ++i)
+	{
+	    unsigned char first = static_cast<unsigned char>(anchors[i][0]);
+	    if (anchors[i].size() == 1)
+	    {
+	        for (size_t second = 0; second < 256; ++second)
+	            _bigrams[((first << 8) | second) >> 3] |= 1 << (second & 7);
+	    }
+	    else
+	    {
+	        size_t bigram = (first << 8) | static_cast<unsigned char>(anchors[i][1]);
+	        _bigrams[bigram >> 3] |= 1 << (bigram & 7);
+	    }
+	    if (!seen[first])
+	    {
+	        seen[first] = true;
+	        if (_startByteCount < 3)
+	            _startBytes[_startByteCount] = first;
+	        _startByteCount++;
+	    }
+	}
+}
+
+// Offset of the first position where an anchor may start, text.size() if none.
+size_t SpamFilter::prefilter(const std::string& text) const
+{
+	const unsigned char* s = reinterpret_cast<const unsigned char*>(text.data());
+	size_t n = text.size();
+	size_t i = 0;
+
+#ifdef __SSE2__
+	if (_startByteCount <= 3)
+	{
+	    const __m128i b0 = _mm_set1_epi8(static_cast<char>(_startBytes[0]));
+	    const __m128i b1 = _mm_set1_epi8(static_cast<char>(_startBytes[_startByteCount > 1 ? 1 : 0]));
+	    const __m128i b2 = _mm_set1_epi8(static_cast<char>(_startBytes[_startByteCount > 2 ? 2 : 0]));
+	    for (; i + 16 <= n; i += 16)
+	    {
+	        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+	        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, b0), _mm_cmpeq_epi8(v, b1)),
+	                                   _mm_cmpeq_epi8(v, b2));
+	        int bits = _mm_movemask_epi8(hit);
+	        if (bits)
+	            return i + __builtin_ctz(bits);
+	    }
+	    for (; i < n; ++i)
+	    {
+	        for (size_t b = 0; b < _startByteCount; ++b)
+	            if (s[i] == _startBytes[b])
+	                return i;
+	    }
+	    return n;
+	}
+#endif
+	for (; i < n; ++i)
+	{
+	    size_t bigram = (s[i] << 8) | (i + 1 < n ? s[i + 1] : 0);
+	    if (_bigrams[bigram >> 3] & (1 << (bigram & 7)))
+	        return i;
+	}
+	return n;
+}
+
+/* ========================================================================== */
+/*                    SCANNING                                                */
+/* ========================================================================== */
+
+// Strongest action of the patterns found in `text` (SPAM_ACTION_NONE if
+// none). `matched`, if given, receives the pattern that decided it.
+int SpamFilter::scan(const std::string& text, std::string* matched) const
+{
+	if (_patterns.empty())
+	    return SPAM_ACTION_NONE;
+
+	lowerAscii(text, _lowered);
+	const unsigned char* s = reinterpret_cast<const unsigned char*>(_lowered.data());
+	size_t n = _lowered.size();
+
+	int best = SPAM_ACTION_NONE;
+	int state = 0;
+	for (size_t i = prefilter(_lowered); i < n; ++i)
+	{
+	    state = _next[state * _classCount + _classOf[s[i]]];
+	    const std::vector<int>& found = _outputs[state];
+	    for (size_t k = 0; k < found.size(); ++k)
+	    {
+	        const Pattern& pattern = _patterns[found[k]];
+	        if (pattern.action <= best)
+	            continue;
+	        if (!pattern.literal && !Utils::matchMask(pattern.mask, _lowered))
+	            continue;
+	        best = pattern.action;
+	        if (matched)
+	            *matched = pattern.text;
+	        if (best == SPAM_ACTION_BLOCK)
+	            return best;
+	    }
+	}
+	return best;
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+size_t SpamFilter::size() const
+{
+	return _patterns.size();
+}
+
+const char* SpamFilter::actionName(int action)
+{
+	if (action == SPAM_ACTION_TAG)
+	    return "tag";
+	if (action == SPAM_ACTION_QUARANTINE)
+	    return "quarantine";
+	if (action == SPAM_ACTION_BLOCK)
+	    return "block";
+	return "none";
+}
@@ -0,0 +1,101 @@
+#include "IRC.hpp"
+#include <sys/mman.h>
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+SpillFile::SpillFile()
+	: _fd(-1),
+	  _written(0),
+	  _read(0),
+	  _punched(0)
+{
+}
+
+SpillFile::~SpillFile()
+{
+	if (_fd != -1)
+	    close(_fd);
+}
+
+/* ========================================================================== */
+/*                    SPILL                                                   */
+/* ========================================================================== */
+
+// Create the file in `dir`; only the descriptor keeps it.
+bool SpillFile::open(const std::string& dir)
+{
+	std::string path = dir + "/ircserv-spill-XXXXXX";
+	std::vector<char> name(path.begin(), path.end());
+	name.push_back('\0');
+
+	_fd = mkstemp(&name[0]);
+	if (_fd == -1)
+	    return false;
+	unlink(&name[0]);
+	fcntl(_fd, F_SETFD, FD_CLOEXEC);
+	return true;
+}
+
+bool SpillFile::append(const std::string& data)
+{
+	size_t done = 0;
+	while (done < data.size())
+	{
+	    ssize_t written = pwrite(_fd, data.data() + done, data.size() - done, _written);
+	    if (written == -1 && errno == EINTR)
+	        continue;
+	    if (written <= 0)
+	        return false;
+	    done += written;
+	    _written += written;
+	}
+	return true;
+}
+
+// Bytes appended and not read back yet.
+size_t SpillFile::pending() const
+{
+	return _written - _read;
+}
+
+// Move up to `max` of the oldest pending bytes to `out`.
+bool SpillFile::readWindow(std::string& out, size_t max)
+{
+	size_t length = std::min(pending(), max);
+	if (length == 0)
+	    return true;
+
+	// Mappings start on a page boundary
+	static const off_t pageSize = sysconf(_SC_PAGESIZE);
+	off_t base = _read - _read % pageSize;
+	size_t skip = _read - base;
+	void* map = mmap(NULL, skip + length, PROT_READ, MAP_PRIVATE, _fd, base);
+	if (map == MAP_FAILED)
+	    return false;
+	out.append(static_cast<const char*>(map) + skip, length);
+	munmap(map, skip + length);
+
+	_read += length;
+	if (_read == _written)
+	{
+	    // Read to the end: start over instead of growing forever
+	    if (ftruncate(_fd, 0) == 0)
+	    {
+	        _read = 0;
+	        _written = 0;
+	        _punched = 0;
+	    }
+	}
+#ifdef FALLOC_FL_PUNCH_HOLE
+	else if (_read - _punched >= SPILL_PUNCH)
+	{
+	    // Free the whole pages already read; the offsets do not change
+	    off_t end = _read - _read % pageSize;
+	    if (fallocate(_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, _punched, end - _punched) == 0)
+	        _punched = end;
+	}
+#endif
+	return true;
+}
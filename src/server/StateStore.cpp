@@ -0,0 +1,308 @@
+#include "IRC.hpp"
+#include <sys/mman.h>
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+StateStore::StateStore(const Config& config)
+	: _path(config.getString("state.file", "ircserv.state")),
+	  _interval(std::max(1L, config.getLong("state.interval", STATE_INTERVAL_DEFAULT))),
+	  _nextSnapshot(0),
+	  _generation(0),
+	  _journalFd(-1),
+	  _running(false),
+	  _stopping(false),
+	  _busy(false),
+	  _oldJournal(false),
+	  _pendingGeneration(0)
+{
+	pthread_mutex_init(&_mutex, NULL);
+	pthread_cond_init(&_wakeup, NULL);
+}
+
+StateStore::~StateStore()
+{
+	stop();
+	pthread_cond_destroy(&_wakeup);
+	pthread_mutex_destroy(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    LOAD                                                    */
+/* ========================================================================== */
+
+// The last snapshot (empty if there is none or it is damaged) and the
+// journal records to replay over it, oldest first.
+void StateStore::load(std::string& snapshot, std::vector<std::string>& records)
+{
+	unsigned long generation = 0;
+	int fd = open(_path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd != -1)
+	{
+	    struct stat st;
+	    void* data = MAP_FAILED;
+	    if (fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(StateFileHeader))
+	        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	    close(fd);
+	    if (data != MAP_FAILED)
+	    {
+	        StateFileHeader header;
+	        std::memcpy(&header, data, sizeof(header));
+	        const char* payload = static_cast<const char*>(data) + sizeof(header);
+	        if (std::memcmp(header.magic, STATE_MAGIC, sizeof(header.magic)) == 0
+	            && header.version == STATE_VERSION
+	            && header.length == st.st_size - sizeof(header)
+	            && ChannelLog::checksum(payload, header.length) == header.checksum)
+	        {
+	            snapshot.assign(payload, header.length);
+	            generation = header.generation;
+	        }
+	        else
+	            std::cerr << "Warning: ignoring damaged state file " << _path << std::endl;
+	        munmap(data, st.st_size);
+	    }
+	}
+
+	_generation = generation;
+	std::string oldJournal = _path + ".journal.old";
+	_oldJournal = access(oldJournal.c_str(), F_OK) == 0;
+	readJournal(oldJournal, generation, records);
+	readJournal(_path + ".journal", generation, records);
+}
+
+// Append the records of `generation` and later ones. A record torn by a
+// crash ends the journal; it is cut there so new records stay readable.
+void StateStore::readJournal(const std::string& path, unsigned long generation,
+                             std::vector<std::string>& records)
+{
+	int fd = open(path.c_str(), O_RDWR | O_CLOEXEC);
+	if (fd == -1)
+	    return;
+	struct stat st;
+	void* data = MAP_FAILED;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED)
+	{
+	    close(fd);
+	    return;
+	}
+
+	const char* bytes = static_cast<const char*>(data);
+	size_t size = st.st_size;
+	size_t offset = 0;
+	while (offset + sizeof(StateRecordHeader) <= size)
+	{
+	    StateRecordHeader header;
+	    std::memcpy(&header, bytes + offset, sizeof(header));
+	    const char* payload = bytes + offset + sizeof(header);
+	    if (header.length > size - offset - sizeof(header)
+	        || ChannelLog::checksum(payload, header.length) != header.checksum)
+	        break;
+	    if (header.generation >= generation)
+	        records.push_back(std::string(payload, header.length));
+	    _generation = std::max(_generation, static_cast<unsigned long>(header.generation));
+	    offset += sizeof(header) + header.length;
+	}
+	munmap(data, size);
+
+	if (offset < size)
+	{
+	    std::cerr << "Warning: " << path << " ends with a torn record, cut at "
+	              << offset << " bytes" << std::endl;
+	    if (ftruncate(fd, offset) == -1)
+	        std::cerr << "Warning: cannot cut " << path << std::endl;
+	}
+	close(fd);
+}
+
+/* ========================================================================== */
+/*                    START / STOP                                            */
+/* ========================================================================== */
+
+bool StateStore::start()
+{
+	if (!openJournal())
+	    return false;
+	_stopping = false;
+	if (pthread_create(&_thread, NULL, &StateStore::writerMain, this) != 0)
+	{
+	    std::cerr << "Error: cannot start the state writer thread" << std::endl;
+	    return false;
+	}
+	_running = true;
+	return true;
+}
+
+// Finish the snapshot in progress, if any, and join the writer thread.
+void StateStore::stop()
+{
+	if (!_running)
+	    return;
+
+	pthread_mutex_lock(&_mutex);
+	_stopping = true;
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+
+	pthread_join(_thread, NULL);
+	_running = false;
+
+	if (_journalFd != -1)
+	    close(_journalFd);
+	_journalFd = -1;
+}
+
+bool StateStore::openJournal()
+{
+	std::string path = _path + ".journal";
+	_journalFd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+	if (_journalFd == -1)
+	{
+	    std::cerr << "Error: cannot open " << path << std::endl;
+	    return false;
+	}
+	return true;
+}
+
+/* ========================================================================== */
+/*                    EVENT LOOP SIDE                                         */
+/* ========================================================================== */
+
+// One write() per record, so a crash can only tear the last one.
+void StateStore::record(const std::string& payload)
+{
+	if (_journalFd == -1)
+	    return;
+
+	StateRecordHeader header;
+	header.length = payload.size();
+	header.checksum = ChannelLog::checksum(payload.data(), payload.size());
+	header.generation = _generation;
+
+	std::string bytes(reinterpret_cast<const char*>(&header), sizeof(header));
+	bytes += payload;
+	if (write(_journalFd, bytes.data(), bytes.size()) != static_cast<ssize_t>(bytes.size()))
+	    std::cerr << "Warning: state journal write failed" << std::endl;
+}
+
+bool StateStore::snapshotDue(time_t now)
+{
+	if (!_running || now < _nextSnapshot)
+	    return false;
+	pthread_mutex_lock(&_mutex);
+	bool busy = _busy;
+	pthread_mutex_unlock(&_mutex);
+	return !busy;
+}
+
+// Start a new generation and hand `payload`, the whole state as of now, to
+// the writer thread. Called only while the writer is idle. The journal so
+// far is kept until the snapshot is on disk; if an older one is still
+// needed, records keep going to the same file, where the generation tells
+// them apart.
+void StateStore::snapshot(const std::string& payload, time_t now)
+{
+	_nextSnapshot = now + _interval;
+	_generation++;
+
+	if (!_oldJournal)
+	{
+	    std::string path = _path + ".journal";
+	    close(_journalFd);
+	    _journalFd = -1;
+	    if (rename(path.c_str(), (path + ".old").c_str()) == 0)
+	        _oldJournal = true;
+	    openJournal();
+	}
+
+	pthread_mutex_lock(&_mutex);
+	_pending = payload;
+	_pendingGeneration = _generation;
+	_busy = true;
+	pthread_cond_signal(&_wakeup);
+	pthread_mutex_unlock(&_mutex);
+}
+
+/* ========================================================================== */
+/*                    WRITER THREAD                                           */
+/* ========================================================================== */
+
+void* StateStore::writerMain(void* arg)
+{
+	static_cast<StateStore*>(arg)->writerLoop();
+	return NULL;
+}
+
+void StateStore::writerLoop()
+{
+	for (;;)
+	{
+	    pthread_mutex_lock(&_mutex);
+	    while (!_stopping && _pending.empty())
+	        pthread_cond_wait(&_wakeup, &_mutex);
+	    if (_pending.empty())
+	    {
+	        pthread_mutex_unlock(&_mutex);
+	        return;
+	    }
+	    std::string payload;
+	    payload.swap(_pending);
+	    unsigned long generation = _pendingGeneration;
+	    pthread_mutex_unlock(&_mutex);
+
+	    bool written = writeSnapshot(payload, generation);
+
+	    pthread_mutex_lock(&_mutex);
+	    if (written && _oldJournal)
+	    {
+	        unlink((_path + ".journal.old").c_str());
+	        _oldJournal = false;
+	    }
+	    _busy = false;
+	    pthread_mutex_unlock(&_mutex);
+	}
+}
+
+// Write through a mapping of a temporary file, then rename it over the
+// previous snapshot: a reader sees either the old file or the new one.
+bool StateStore::writeSnapshot(const std::string& payload, unsigned long generation)
+{
+	StateFileHeader header;
+	std::memcpy(header.magic, STATE_MAGIC, sizeof(header.magic));
+	header.version = STATE_VERSION;
+	header.checksum = ChannelLog::checksum(payload.data(), payload.size());
+	header.generation = generation;
+	header.length = payload.size();
+
+	std::string tmp = _path + ".tmp";
+	size_t size = sizeof(header) + payload.size();
+	int fd = open(tmp.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd == -1)
+	{
+	    std::cerr << "Warning: cannot write " << tmp << std::endl;
+	    return false;
+	}
+	void* data = MAP_FAILED;
+	if (ftruncate(fd, size) == 0)
+	    data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+	{
+	    std::cerr << "Warning: cannot map " << tmp << std::endl;
+	    return false;
+	}
+
+	std::memcpy(data, &header, sizeof(header));
+	std::memcpy(static_cast<char*>(data) + sizeof(header), payload.data(), payload.size());
+	bool synced = msync(data, size, MS_SYNC) == 0;
+	munmap(data, size);
+
+	if (!synced || rename(tmp.c_str(), _path.c_str()) == -1)
+	{
+	    std::cerr << "Warning: cannot replace " << _path << std::endl;
+	    return false;
+	}
+	return true;
+}
@@ -0,0 +1,195 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+WorkerPool::WorkerPool(size_t threads, int notifyFd)
+	: _nextWorker(0),
+	  _notifyFd(notifyFd),
+	  _pending(0),
+	  _stopping(false)
+{
+	pthread_mutex_init(&_idleMutex, NULL);
+	pthread_cond_init(&_idleCond, NULL);
+	pthread_mutex_init(&_doneMutex, NULL);
+
+	for (size_t i = 0; i < threads; ++i)
+	{
+	    Worker* worker = new Worker();
+	    worker->pool = this;
+	    worker->index = i;
+	    pthread_mutex_init(&worker->mutex, NULL);
+	    _workers.push_back(worker);
+	}
+}
+
+WorkerPool::~WorkerPool()
+{
+	stop();
+	for (size_t i = 0; i < _workers.size(); ++i)
+	{
+	    for (size_t j = 0; j < _workers[i]->jobs.size(); ++j)
+	        delete _workers[i]->jobs[j];
+	    pthread_mutex_destroy(&_workers[i]->mutex);
+	    delete _workers[i];
+	}
+	pthread_mutex_destroy(&_doneMutex);
+	pthread_cond_destroy(&_idleCond);
+	pthread_mutex_destroy(&_idleMutex);
+}
+
+/* ========================================================================== */
+/*                    START / STOP                                            */
+/* ========================================================================== */
+
+bool WorkerPool::start()
+{
+	for (size_t i = 0; i < _workers.size(); ++i)
+	{
+	    if (pthread_create(&_workers[i]->thread, NULL, &WorkerPool::workerMain, _workers[i]) != 0)
+	    {
+	        std::cerr << "Error: cannot start worker thread " << i << std::endl;
+	        for (size_t j = i; j < _workers.size(); ++j)
+	        {
+	            pthread_mutex_destroy(&_workers[j]->mutex);
+	            delete _workers[j];
+	        }
+	        _workers.resize(i);
+	        stop();
+	        return false;
+	    }
+	}
+	return true;
+}
+
+// Jobs still queued are dropped; running ones are finished first.
+void WorkerPool::stop()
+{
+	pthread_mutex_lock(&_idleMutex);
+	if (_stopping)
+	{
+	    pthread_mutex_unlock(&_idleMutex);
+	    return;
+	}
+	_stopping = true;
+	pthread_cond_broadcast(&_idleCond);
+	pthread_mutex_unlock(&_idleMutex);
+
+	for (size_t i = 0; i < _workers.size(); ++i)
+	    pthread_join(_workers[i]->thread, NULL);
+}
+
+/* ========================================================================== */
+/*                    EVENT LOOP SIDE                                         */
+/* ========================================================================== */
+
+void WorkerPool::submit(WorkerJob* job)
+{
+	Worker* worker = _workers[_nextWorker];
+	_nextWorker = (_nextWorker + 1) % _workers.size();
+
+	pthread_mutex_lock(&worker->mutex);
+	worker->jobs.push_back(job);
+	pthread_mutex_unlock(&worker->mutex);
+
+	pthread_mutex_lock(&_idleMutex);
+	_pending++;
+	pthread_cond_signal(&_idleCond);
+	pthread_mutex_unlock(&_idleMutex);
+}
+
+// Hand the finished replies to the caller (called when notifyFd is readable).
+void WorkerPool::takeReplies(std::vector<AsyncReply>& replies)
+{
+	pthread_mutex_lock(&_doneMutex);
+	replies.swap(_done);
+	_done.clear();
+	pthread_mutex_unlock(&_doneMutex);
+}
+
+size_t WorkerPool::size() const
+{
+	return _workers.size();
+}
+
+/* ========================================================================== */
+/*                    WORKER THREADS                                          */
+/* ========================================================================== */
+
+void* WorkerPool::workerMain(void* arg)
+{
+	Worker* worker = static_cast<Worker*>(arg);
+	worker->pool->workerLoop(*worker);
+	return NULL;
+}
+
+void WorkerPool::workerLoop(Worker& worker)
+{
+	for (;;)
+	{
+	    WorkerJob* job = takeJob(worker);
+	    if (!job)
+	    {
+	        pthread_mutex_lock(&_idleMutex);
+	        while (_pending <= 0 && !_stopping)
+	            pthread_cond_wait(&_idleCond, &_idleMutex);
+	        bool stopping = _stopping;
+	        pthread_mutex_unlock(&_idleMutex);
+	        if (stopping)
+	            return;
+	        continue;
+	    }
+
+	    pthread_mutex_lock(&_idleMutex);
+	    _pending--;
+	    pthread_mutex_unlock(&_idleMutex);
+
+	    AsyncReply reply;
+	    reply.clientId = 0;
+	    reply.fd = -1;
+	    reply.cursor = NULL;
+	    reply.finished = true;
+	    job->run(reply);
+	    delete job;
+
+	    pthread_mutex_lock(&_doneMutex);
+	    std::vector<std::string> lines;
+	    lines.swap(reply.lines);            // move the window instead of copying it
+	    _done.push_back(reply);
+	    _done.back().lines.swap(lines);
+	    pthread_mutex_unlock(&_doneMutex);
+
+	    char byte = 'w';
+	    if (write(_notifyFd, &byte, 1) == -1 && errno != EAGAIN)
+	        std::cerr << "Error: cannot wake up the event loop" << std::endl;
+	}
+}
+
+// Oldest job of our own deque (requests are served in order), else steal
+// from the other end of another worker's deque.
+WorkerJob* WorkerPool::takeJob(Worker& worker)
+{
+	WorkerJob* job = NULL;
+
+	pthread_mutex_lock(&worker.mutex);
+	if (!worker.jobs.empty())
+	{
+	    job = worker.jobs.front();
+	    worker.jobs.pop_front();
+	}
+	pthread_mutex_unlock(&worker.mutex);
+
+	for (size_t i = 1; !job && i < _workers.size(); ++i)
+	{
+	    Worker* victim = _workers[(worker.index + i) % _workers.size()];
+	    pthread_mutex_lock(&victim->mutex);
+	    if (!victim->jobs.empty())
+	    {
+	        job = victim->jobs.back();
+	        victim->jobs.pop_back();
+	    }
+	    pthread_mutex_unlock(&victim->mutex);
+	}
+	return job;
+}
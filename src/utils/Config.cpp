@@ -0,0 +1,123 @@
+#include "IRC.hpp"
+
+/* ========================================================================== */
+/*                    CONSTRUCTOR / DESTRUCTOR                              */
+/* ========================================================================== */
+
+Config::Config() {}
+
+Config::~Config() {}
+
+/* ========================================================================== */
+/*                    LOADING                                                 */
+/* ========================================================================== */
+
+// Load "key = value" lines from a file. Returns false (and keeps the previous
+// values) if the file cannot be read or a line is malformed.
+bool Config::load(const std::string& path)
+{
+	std::ifstream file(path.c_str());
+	if (!file)
+	{
+	    std::cerr << "Error: cannot open config file " << path << std::endl;
+	    return false;
+	}
+
+	std::map<std::string, std::string> values;
+	std::string line;
+	size_t lineNumber = 0;
+	while (std::getline(file, line))
+	{
+	    lineNumber++;
+	    size_t comment = line.find('#');
+	    if (comment != std::string::npos)
+	        line.erase(comment);
+	    line = Utils::trim(line);
+	    if (line.empty())
+	        continue;
+
+	    size_t equal = line.find('=');
+	    if (equal == std::string::npos)
+	    {
+	        std::cerr << "Error: " << path << ":" << lineNumber << ": expected key = value" << std::endl;
+	        return false;
+	    }
+	    values[Utils::trim(line.substr(0, equal))] = Utils::trim(line.substr(equal + 1));
+	}
+
+	_values.swap(values);
+	_path = path;
+	return true;
+}
+
+// Read the same file again (REHASH).
+bool Config::reload()
+{
+	if (_path.empty())
+	    return true;
+	return load(_path);
+}
+
+/* ========================================================================== */
+/*                         GETTERS                                            */
+/* ========================================================================== */
+
+bool Config::has(const std::string& key) const
+{
+	return _values.find(key) != _values.end();
+}
+
+std::string Config::getString(const std::string& key, const std::string& defaultValue) const
+{
+	std::map<std::string, std::string>::const_iterator it = _values.find(key);
+	if (it == _values.end())
+	    return defaultValue;
+	return it->second;
+}
+
+long Config::getLong(const std::string& key, long defaultValue) const
+{
+	std::map<std::string, std::string>::const_iterator it = _values.find(key);
+	if (it == _values.end() || it->second.empty() || !Utils::isNumber(it->second))
+	    return defaultValue;
+	return std::atol(it->second.c_str());
+}
+
+// "yes", "true", "on" and "1" are true; anything else is false.
+bool Config::getBool(const std::string& key, bool defaultValue) const
+{
+	std::map<std::string, std::string>::const_iterator it = _values.find(key);
+	if (it == _values.end())
+	    return defaultValue;
+	std::string value = Utils::toLower(it->second);
+	return value == "yes" || value == "true" || value == "on" || value == "1";
+}
+
+// Comma-separated value, items trimmed, empty items skipped.
+std::vector<std::string> Config::getList(const std::string& key) const
+{
+	std::vector<std::string> items;
+	std::vector<std::string> parts = Utils::split(getString(key, ""), ',');
+	for (size_t i = 0; i < parts.size(); ++i)
+	{
+	    std::string item = Utils::trim(parts[i]);
+	    if (!item.empty())
+	        items.push_back(item);
+	}
+	return items;
+}
+
+// Every key starting with `prefix` (e.g. "oper.").
+std::vector<std::string> Config::getKeysWithPrefix(const std::string& prefix) const
+{
+	std::vector<std::string> keys;
+	for (std::map<std::string, std::string>::const_iterator it = _values.lower_bound(prefix);
+	     it != _values.end() && Utils::startsWith(it->first, prefix); ++it)
+	    keys.push_back(it->first);
+	return keys;
+}
+
+const std::string& Config::getPath() const
+{
+	return _path;
+}
@@ -82,6 +82,24 @@ std::string extractTrailing(const std::string& message)
     return "";
 }
 
+// Keeps only the client-only tags ("+name[=value]") of a raw tag string, which are
+// the ones relayed to recipients that negotiated message-tags.
+std::string extractClientTags(const std::string& tags)
+{
+	std::vector<std::string> parts = Utils::split(tags, ';');
+	std::string result;
+
+	for (size_t i = 0; i < parts.size(); ++i)
+	{
+	    if (parts[i].size() < 2 || parts[i][0] != '+')
+	        continue;
+	    if (!result.empty())
+	        result += ";";
+	    result += parts[i];
+	}
+	return result;
+}
+
 /* ========================================================================== */
 /*                    PARSING LISTS                                      */
 /* ========================================================================== */
@@ -110,48 +128,6 @@ std::vector<std::string> parseTargetList(const std::string& targetList)
 	return Utils::split(targetList, ',');
 }
 
-/* ========================================================================== */
-/*                              PARSING MODE                                  */
-/* ========================================================================== */
-
-// Parses a mode string and its parameters into a vector of ModeChange structures.
-std::vector<ModeChange> parseModeString(const std::string& modeString,
-										const std::vector<std::string>& params)
-{
-	std::vector<ModeChange> changes;
-	bool adding = true;
-	size_t paramIndex = 0;
-
-	for (size_t i = 0; i < modeString.length(); ++i)
-	{
-	    char c = modeString[i];
-
-	    if (c == '+')
-	    {
-	        adding = true;
-	        continue;
-	    }
-	    if (c == '-')
-	    {
-	        adding = false;
-	        continue;
-	    }
-
-	    ModeChange change;
-	    change.adding = adding;
-	    change.mode = c;
-	    change.param = "";
-
-	    if (modeNeedsParam(c, adding) && paramIndex < params.size())
-	    {
-	        change.param = params[paramIndex++];
-	    }
-
-	    changes.push_back(change);
-	}
-	return changes;
-}
-
 /* ========================================================================== */
 /*                    VALIDATION                                              */
 /* ========================================================================== */
@@ -202,29 +178,6 @@ bool isValidNickname(const std::string& nickname)
 	return true;
 }
 
-// Validates if a mode character is recognized.
-bool isValidMode(char mode)
-{
-	return (mode == 'i' || mode == 't' || mode == 'k' ||
-	        mode == 'o' || mode == 'l');
-}
-
-// Choose if a mode change requires a parameter.
-bool modeNeedsParam(char mode, bool adding)
-{
-	switch (mode)
-	{
-	    case 'k':  // Key always needs a param for +
-	        return adding;
-	    case 'o':  // Operator always needs a param
-	        return true;
-	    case 'l':  // Limit only for +
-	        return adding;
-	    default:
-	        return false;
-	}
-}
-
 /* ========================================================================== */
 /*                       PREFIX PARSING                                      */
 /* ========================================================================== */
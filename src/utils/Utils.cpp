@@ -94,6 +94,63 @@ std::string replaceAll(const std::string& str, const std::string& from, const st
 	return result;
 }
 
+//equalsIgnoreCase: Compares two strings case-insensitively without building lowered copies.
+bool equalsIgnoreCase(const std::string& a, const std::string& b)
+{
+	if (a.length() != b.length())
+	    return false;
+	for (size_t i = 0; i < a.length(); ++i)
+	{
+	    if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+	        return false;
+	}
+	return true;
+}
+
+//hashLower: FNV-1a hash of the lowercased string, computed in place (equal for names that only differ by case).
+unsigned int hashLower(const std::string& str)
+{
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < str.length(); ++i)
+	{
+	    hash ^= static_cast<unsigned int>(std::tolower(static_cast<unsigned char>(str[i])));
+	    hash *= 16777619u;
+	}
+	return hash;
+}
+
+//matchMask: Case-insensitive glob match, '*' for any sequence and '?' for one character.
+bool matchMask(const std::string& mask, const std::string& str)
+{
+	size_t m = 0, s = 0;
+	size_t star = std::string::npos, resume = 0;
+
+	while (s < str.length())
+	{
+	    if (m < mask.length() && (mask[m] == '?' ||
+	        std::tolower(static_cast<unsigned char>(mask[m])) == std::tolower(static_cast<unsigned char>(str[s]))))
+	    {
+	        m++;
+	        s++;
+	    }
+	    else if (m < mask.length() && mask[m] == '*')
+	    {
+	        star = m++;
+	        resume = s;
+	    }
+	    else if (star != std::string::npos)
+	    {
+	        m = star + 1;
+	        s = ++resume;
+	    }
+	    else
+	        return false;
+	}
+	while (m < mask.length() && mask[m] == '*')
+	    m++;
+	return m == mask.length();
+}
+
 /* ========================================================================== */
 /*                              TYPES CONVERSION                              */
 /* ========================================================================== */
@@ -179,5 +236,52 @@ std::string timestampToString(long timestamp)
 	ss << timestamp;
 	return ss.str();
 }
+
+// getTimeMs: Returns the current Unix time in milliseconds.
+long getTimeMs()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return static_cast<long>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+// deadlineAfterMs: Absolute time `delayMs` from now, for pthread_cond_timedwait().
+struct timespec deadlineAfterMs(long delayMs)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	long usec = tv.tv_usec + (delayMs % 1000) * 1000;
+	struct timespec deadline;
+	deadline.tv_sec = tv.tv_sec + delayMs / 1000 + usec / 1000000;
+	deadline.tv_nsec = (usec % 1000000) * 1000;
+	return deadline;
 }
 
+// formatIsoTime: Formats a millisecond timestamp as used by the IRCv3 time tag (2024-01-31T12:00:00.000Z).
+std::string formatIsoTime(long timeMs)
+{
+	time_t seconds = static_cast<time_t>(timeMs / 1000);
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+
+	char buffer[32];
+	size_t len = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+	std::snprintf(buffer + len, sizeof(buffer) - len, ".%03ldZ", timeMs % 1000);
+	return std::string(buffer);
+}
+
+// parseIsoTime: Parses a time tag value back to milliseconds. Returns -1 if malformed.
+long parseIsoTime(const std::string& str)
+{
+	struct tm tm;
+	int millis = 0;
+	std::memset(&tm, 0, sizeof(tm));
+
+	if (std::sscanf(str.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d.%3dZ", &tm.tm_year, &tm.tm_mon,
+	                &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &millis) < 6)
+	    return -1;
+	tm.tm_year -= 1900;
+	tm.tm_mon -= 1;
+	return static_cast<long>(timegm(&tm)) * 1000 + millis;
+}
+}
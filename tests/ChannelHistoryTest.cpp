@@ -0,0 +1,76 @@
+#include "IRC.hpp"
+
+/*
+** ChannelHistory checks: make test
+*/
+
+static int g_failures = 0;
+
+static void check(bool condition, const std::string& what)
+{
+	if (!condition)
+	{
+	    std::cerr << "FAIL: " << what << std::endl;
+	    ++g_failures;
+	}
+}
+
+// Every entry still returned holds the line appended with its msgid, and
+// msgids only grow.
+static void checkIntegrity(const ChannelHistory& history, const std::vector<std::string>& lines,
+                           const std::string& name)
+{
+	std::vector<ChannelHistory::Entry> entries = history.latest(history.size());
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+	    check(entries[i].msgid < lines.size() && entries[i].line == lines[entries[i].msgid],
+	          name + ": msgid " + Utils::intToString(entries[i].msgid) + " holds another line");
+	    if (i > 0)
+	        check(entries[i - 1].msgid < entries[i].msgid, name + ": msgids out of order");
+	}
+}
+
+// The arena wraps while newer records sit at its start and an older one at
+// its tail.
+static void testWrapWithMixedSizes()
+{
+	ChannelHistory history(100, 1000);
+	std::vector<std::string> lines;
+	lines.push_back(std::string(850, 'A'));
+	for (int i = 0; i < 9; ++i)
+	    lines.push_back(std::string(100, static_cast<char>('a' + i)));
+	lines.push_back(std::string(40, 'x'));
+	lines.push_back(std::string(200, 'L'));
+
+	for (size_t msgid = 0; msgid < lines.size(); ++msgid)
+	{
+	    history.append(lines[msgid], msgid, 1000 + msgid);
+	    checkIntegrity(history, lines, "mixed sizes after msgid " + Utils::intToString(msgid));
+	}
+	std::vector<ChannelHistory::Entry> last = history.latest(1);
+	check(!last.empty() && last[0].msgid == lines.size() - 1, "mixed sizes: last line missing");
+}
+
+// Many wraps with line sizes that do not divide the arena.
+static void testManyWraps()
+{
+	ChannelHistory history(50, 997);
+	std::vector<std::string> lines;
+	for (size_t msgid = 0; msgid < 2000; ++msgid)
+	{
+	    size_t size = 1 + (msgid * 37) % 300;
+	    lines.push_back(std::string(size, static_cast<char>('a' + msgid % 26)));
+	    history.append(lines[msgid], msgid, msgid);
+	    checkIntegrity(history, lines, "many wraps");
+	    check(history.size() > 0, "many wraps: history empty");
+	}
+}
+
+int main()
+{
+	testWrapWithMixedSizes();
+	testManyWraps();
+	if (g_failures == 0)
+	    std::cout << "ChannelHistory: all tests passed" << std::endl;
+	return g_failures == 0 ? 0 : 1;
+}